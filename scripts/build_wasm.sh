@@ -68,6 +68,7 @@ EMFLAGS=(
     -s EXPORTED_FUNCTIONS='[
         "_decoder_init_video",
         "_decoder_send_video_packet",
+        "_decoder_enable_slice_input",
         "_decoder_receive_video_frame",
         "_decoder_flush_video",
         "_decoder_init_audio",
@@ -81,6 +82,9 @@ EMFLAGS=(
         "_decoder_free",
         "_frame_protocol_init",
         "_frame_protocol_parse",
+        "_frame_protocol_next",
+        "_frame_protocol_reset_timeline",
+        "_frame_protocol_set_sequenced",
         "_frame_protocol_destroy",
         "_frame_protocol_alloc_result",
         "_frame_protocol_free_result"
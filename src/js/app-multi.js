@@ -35,6 +35,9 @@ function addStream() {
                     canvas: canvas,
                     wasmPath: '/dist/decoder.js',
                     audioContext: audioContext,
+                    maxFramerate: gridLayout.getTileMaxFramerate(),
+                    preferFmp4: document.getElementById('decodeModeSelect').value === 'mse',
+                    multiplex: document.getElementById('multiplexCheckbox').checked,
                 });
 
                 stream.setOnStatusChange((status) => {
@@ -63,6 +66,20 @@ function addStream() {
                 console.log(`Stream ${streamId} disconnected`);
             }
         },
+        onRateChange: (rate) => {
+            const stream = streamManager.getStream(streamId);
+            if (stream) {
+                stream.setPlaybackRate(rate);
+                console.log(`Stream ${streamId} playback rate ${rate}x`);
+            }
+        },
+        onSeek: (positionMs) => {
+            const stream = streamManager.getStream(streamId);
+            if (stream) {
+                stream.seek(positionMs);
+                console.log(`Stream ${streamId} seek to ${positionMs} ms`);
+            }
+        },
         onRemove: () => {
             const stream = streamManager.getStream(streamId);
             if (stream) {
@@ -98,6 +98,17 @@ export class AVSync {
         }, delayMs);
     }
 
+    /**
+     * Drop a frame waiting for its render time (e.g. after a seek).
+     */
+    reset(): void {
+        if (this.delayTimer !== null) {
+            clearTimeout(this.delayTimer);
+            this.delayTimer = null;
+        }
+        this.pendingFrame = null;
+    }
+
     destroy(): void {
         if (this.delayTimer !== null) {
             clearTimeout(this.delayTimer);
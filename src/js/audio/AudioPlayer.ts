@@ -66,6 +66,15 @@ export class AudioPlayer {
         this.nextPlayTime += frame.nbSamples / frame.sampleRate;
     }
 
+    /**
+     * Restart the clock at the next frame (e.g. after a seek).
+     */
+    reset(): void {
+        this.basePts = -1;
+        this.baseTime = 0;
+        this.nextPlayTime = this.audioCtx ? this.audioCtx.currentTime : 0;
+    }
+
     destroy(): void {
         if (this.audioCtx && !this.externalAudioCtx) {
             this.audioCtx.close();
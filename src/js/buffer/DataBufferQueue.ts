@@ -29,6 +29,7 @@ export class DataBufferQueue {
   private queue: DataPacket[] = [];
   private currentBytes: number = 0;
   private stats: QueueStats;
+  private onDrop: ((packet: DataPacket) => void) | null = null;
 
   constructor(config: QueueConfig = {}) {
     this.maxSize = config.maxSize || 100;
@@ -56,6 +57,9 @@ export class DataBufferQueue {
         this.currentBytes -= droppedSize;
         this.stats.totalOverflows++;
         this.stats.totalBytesDropped += droppedSize;
+        if (this.onDrop) {
+          this.onDrop(dropped);
+        }
       }
     }
 
@@ -91,8 +95,20 @@ export class DataBufferQueue {
   }
 
   clear(): void {
+    const dropped = this.queue;
     this.queue = [];
     this.currentBytes = 0;
+    if (this.onDrop) {
+      dropped.forEach(this.onDrop);
+    }
+  }
+
+  /**
+   * Called for every packet that leaves the queue without being dequeued
+   * (overflow or clear)
+   */
+  setDropCallback(callback: ((packet: DataPacket) => void) | null): void {
+    this.onDrop = callback;
   }
 
   size(): number {
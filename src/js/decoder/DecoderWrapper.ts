@@ -72,6 +72,22 @@ export class DecoderWrapper {
                 throw new Error(`Failed to initialize decoder, error code: ${result}`);
             }
 
+            if (config.sliceInput) {
+                const sliceResult = this.module.ccall('decoder_enable_slice_input', 'number', [], []);
+                if (sliceResult !== 0) {
+                    throw new Error(`Failed to enable slice input, error code: ${sliceResult}`);
+                }
+            }
+
+            // Memory growth is permanent: a block allocated and freed here
+            // leaves the heap at its final size
+            if (config.heapReserveBytes) {
+                const reservePtr = this.module.ccall('decoder_malloc', 'number', ['number'], [config.heapReserveBytes]);
+                if (reservePtr) {
+                    this.module.ccall('decoder_free', null, ['number'], [reservePtr]);
+                }
+            }
+
             this.initialized = true;
             this.lastFrameTime = performance.now();
         } catch (error) {
@@ -84,7 +100,7 @@ export class DecoderWrapper {
         return module.default || module.createDecoderModule;
     }
 
-    async decode(data: Uint8Array, pts: number = 0): Promise<VideoFrame | null> {
+    async decode(data: Uint8Array, pts: number = 0, dts: number = pts): Promise<VideoFrame | null> {
         if (!this.initialized || !this.module) {
             throw new Error('Decoder not initialized');
         }
@@ -96,6 +112,10 @@ export class DecoderWrapper {
         if (pts < 0) {
             throw new Error(`PTS value ${pts} must be non-negative`);
         }
+        // DTS may be negative: B-frame streams start decoding before PTS 0
+        if (!Number.isSafeInteger(dts)) {
+            throw new Error(`DTS value ${dts} is not a safe integer`);
+        }
 
         const startTime = performance.now();
 
@@ -110,8 +130,8 @@ export class DecoderWrapper {
             const sendResult = this.module.ccall(
                 'decoder_send_video_packet',
                 'number',
-                ['number', 'number', 'bigint'],
-                [dataPtr, data.length, BigInt(pts)]
+                ['number', 'number', 'bigint', 'bigint'],
+                [dataPtr, data.length, BigInt(pts), BigInt(dts)]
             );
 
             if (sendResult < 0) {
@@ -165,8 +185,8 @@ export class DecoderWrapper {
         // 读取低 32 位（无符号）
         const low = this.module.getValue(ptr, 'i32') >>> 0;
 
-        // 读取高 32 位（有符号转无符号）
-        const high = this.module.getValue(ptr + 4, 'i32') >>> 0;
+        // 读取高 32 位（有符号，DTS 可能为负）
+        const high = this.module.getValue(ptr + 4, 'i32');
 
         // 组合：low + high * 2^32
         const value = low + high * 4294967296;
@@ -280,7 +300,7 @@ export class DecoderWrapper {
         return frames;
     }
 
-    initProtocol(): void {
+    initProtocol(sequenced: boolean = false): void {
         if (!this.module) {
             throw new Error('Module not initialized');
         }
@@ -289,6 +309,7 @@ export class DecoderWrapper {
         if (result < 0) {
             throw new Error(`Failed to initialize frame protocol, error: ${result}`);
         }
+        this.module.ccall('frame_protocol_set_sequenced', null, ['number'], [sequenced ? 1 : 0]);
 
         this.parsedFramePtr = this.module.ccall('frame_protocol_alloc_result', 'number', [], []);
         if (!this.parsedFramePtr) {
@@ -298,6 +319,12 @@ export class DecoderWrapper {
         this.protocolInitialized = true;
     }
 
+    resetProtocolTimeline(): void {
+        if (this.module && this.protocolInitialized) {
+            this.module.ccall('frame_protocol_reset_timeline', null, [], []);
+        }
+    }
+
     parseFrame(data: Uint8Array): ParsedFrameInfo | null {
         if (!this.module || !this.protocolInitialized || !this.parsedFramePtr) {
             throw new Error('Protocol not initialized');
@@ -318,50 +345,71 @@ export class DecoderWrapper {
                 [dataPtr, data.length, this.parsedFramePtr]
             );
 
-            if (status === FrameParseStatus.FRAGMENT_PENDING) {
-                return {
-                    status,
-                    msgType: 0,
-                    codec: 0,
-                    frameType: 0,
-                    timestamp: 0,
-                    absTime: 0,
-                    payload: new Uint8Array(0),
-                };
-            }
+            return this.readParsedFrame(status);
+        } finally {
+            this.module.ccall('decoder_free', null, ['number'], [dataPtr]);
+        }
+    }
 
-            if (status === FrameParseStatus.ERROR || status === FrameParseStatus.SKIP) {
-                return {
-                    status,
-                    msgType: 0,
-                    codec: 0,
-                    frameType: 0,
-                    timestamp: 0,
-                    absTime: 0,
-                    payload: new Uint8Array(0),
-                };
-            }
+    /**
+     * Next frame of the audio batch that parseFrame returned BATCH_MORE for
+     */
+    nextFrame(): ParsedFrameInfo {
+        if (!this.module || !this.protocolInitialized || !this.parsedFramePtr) {
+            throw new Error('Protocol not initialized');
+        }
 
-            // FRAME_COMPLETE: read ParsedFrame fields from WASM memory
-            const ptr = this.parsedFramePtr;
-            const msgType = this.module.HEAPU8[ptr];
-            const codec = this.module.HEAPU8[ptr + 1];
-            const frameType = this.module.HEAPU8[ptr + 2];
-            const timestamp = this.readInt64AsNumber(ptr + 8);
-            const absTime = this.readInt64AsNumber(ptr + 16);
-            const payloadPtr = this.module.getValue(ptr + 24, 'i32');
-            const payloadSize = this.module.getValue(ptr + 28, 'i32') >>> 0;
-
-            let payload = new Uint8Array(0);
-            if (payloadPtr && payloadSize > 0) {
-                payload = new Uint8Array(payloadSize);
-                payload.set(this.module.HEAPU8.subarray(payloadPtr, payloadPtr + payloadSize));
-            }
+        const status: FrameParseStatus = this.module.ccall(
+            'frame_protocol_next',
+            'number',
+            ['number'],
+            [this.parsedFramePtr]
+        );
+        return this.readParsedFrame(status);
+    }
 
-            return { status, msgType, codec, frameType, timestamp, absTime, payload };
-        } finally {
-            this.module.ccall('decoder_free', null, ['number'], [dataPtr]);
+    private readParsedFrame(status: FrameParseStatus): ParsedFrameInfo {
+        if (!this.module) {
+            throw new Error('Module not initialized');
         }
+
+        if (
+            status !== FrameParseStatus.COMPLETE &&
+            status !== FrameParseStatus.BATCH_MORE &&
+            status !== FrameParseStatus.SLICE
+        ) {
+            return {
+                status,
+                msgType: 0,
+                codec: 0,
+                frameType: 0,
+                timestamp: 0,
+                dts: 0,
+                absTime: 0,
+                seqNumber: 0,
+                payload: new Uint8Array(0),
+            };
+        }
+
+        // Read ParsedFrame fields from WASM memory
+        const ptr = this.parsedFramePtr;
+        const msgType = this.module.HEAPU8[ptr];
+        const codec = this.module.HEAPU8[ptr + 1];
+        const frameType = this.module.HEAPU8[ptr + 2];
+        const timestamp = this.readInt64AsNumber(ptr + 8);
+        const absTime = this.readInt64AsNumber(ptr + 16);
+        const payloadPtr = this.module.getValue(ptr + 24, 'i32');
+        const payloadSize = this.module.getValue(ptr + 28, 'i32') >>> 0;
+        const dts = this.readInt64AsNumber(ptr + 40);
+        const seqNumber = this.module.getValue(ptr + 48, 'i32') >>> 0;
+
+        let payload = new Uint8Array(0);
+        if (payloadPtr && payloadSize > 0) {
+            payload = new Uint8Array(payloadSize);
+            payload.set(this.module.HEAPU8.subarray(payloadPtr, payloadPtr + payloadSize));
+        }
+
+        return { status, msgType, codec, frameType, timestamp, dts, absTime, seqNumber, payload };
     }
 
     async initAudio(codecType: AudioCodecType, sampleRate: number, channels: number): Promise<void> {
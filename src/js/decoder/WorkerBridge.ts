@@ -4,13 +4,16 @@ import type {
     DecoderConfig,
     VideoFrame,
     DecoderStats,
+    LatencySample,
     WorkerRequest,
     WorkerResponse,
 } from './types.js';
 
 type FrameCallback = (frame: VideoFrame) => void;
 type AudioFrameCallback = (frame: AudioFrame) => void;
+type SegmentCallback = (data: Uint8Array, frameType: number) => void;
 type StatsCallback = (stats: DecoderStats) => void;
+type LatencyCallback = (sample: LatencySample) => void;
 type ErrorCallback = (error: string) => void;
 
 export class WorkerBridge {
@@ -18,7 +21,9 @@ export class WorkerBridge {
     private initPromise: Promise<void> | null = null;
     private frameCallback: FrameCallback | null = null;
     private audioFrameCallback: AudioFrameCallback | null = null;
+    private segmentCallback: SegmentCallback | null = null;
     private statsCallback: StatsCallback | null = null;
+    private latencyCallback: LatencyCallback | null = null;
     private errorCallback: ErrorCallback | null = null;
 
     constructor(workerPath: string) {
@@ -119,6 +124,21 @@ export class WorkerBridge {
         this.worker.postMessage(request);
     }
 
+    /**
+     * Tell the protocol parser that queued messages were dropped, so it
+     * waits for the next absolute timestamp (protocol version 2)
+     */
+    async resetTimeline(): Promise<void> {
+        if (!this.worker || !this.initPromise) {
+            return;
+        }
+
+        await this.initPromise;
+
+        const request: WorkerRequest = { type: 'resetTimeline' };
+        this.worker.postMessage(request);
+    }
+
     destroy(): void {
         if (this.worker) {
             const request: WorkerRequest = { type: 'destroy' };
@@ -135,7 +155,9 @@ export class WorkerBridge {
         this.initPromise = null;
         this.frameCallback = null;
         this.audioFrameCallback = null;
+        this.segmentCallback = null;
         this.statsCallback = null;
+        this.latencyCallback = null;
         this.errorCallback = null;
     }
 
@@ -147,10 +169,18 @@ export class WorkerBridge {
         this.audioFrameCallback = callback;
     }
 
+    onSegment(callback: SegmentCallback): void {
+        this.segmentCallback = callback;
+    }
+
     onStats(callback: StatsCallback): void {
         this.statsCallback = callback;
     }
 
+    onLatency(callback: LatencyCallback): void {
+        this.latencyCallback = callback;
+    }
+
     onError(callback: ErrorCallback): void {
         this.errorCallback = callback;
     }
@@ -171,12 +201,24 @@ export class WorkerBridge {
                 }
                 break;
 
+            case 'segment':
+                if (this.segmentCallback) {
+                    this.segmentCallback(response.data, response.frameType);
+                }
+                break;
+
             case 'stats':
                 if (this.statsCallback) {
                     this.statsCallback(response.stats);
                 }
                 break;
 
+            case 'latency':
+                if (this.latencyCallback) {
+                    this.latencyCallback(response.sample);
+                }
+                break;
+
             case 'error':
                 if (this.errorCallback) {
                     this.errorCallback(response.error);
@@ -4,6 +4,15 @@ export type AudioCodecType = 'g711a' | 'g711u' | 'g726' | 'aac';
 export interface DecoderConfig {
     codecType: CodecType;
     wasmPath?: string;
+    // Return reassembled video payloads (fMP4 segments) instead of decoding them
+    videoPassthrough?: boolean;
+    // Decode NAL-aligned fragments as they arrive (H.264 only)
+    sliceInput?: boolean;
+    // The server sends latency probes (seq_number in compact absolute headers)
+    latencyProbes?: boolean;
+    // WASM heap to reserve at init, from the source summary; the heap then
+    // grows once instead of in steps on the first large frames
+    heapReserveBytes?: number;
 }
 
 export interface AudioDecoderConfig {
@@ -45,6 +54,10 @@ export enum FrameParseStatus {
     FRAGMENT_PENDING = 1,
     ERROR = -1,
     SKIP = 2,
+    // Frame of an audio batch; more follow through nextFrame()
+    BATCH_MORE = 3,
+    // Leading NAL units of a fragmented frame; the rest follows
+    SLICE = 4,
 }
 
 export interface ParsedFrameInfo {
@@ -53,10 +66,21 @@ export interface ParsedFrameInfo {
     codec: number;
     frameType: number;
     timestamp: number;
+    dts: number;
     absTime: number;
+    // Latency probe sequence number, 0 if the frame is not a probe
+    seqNumber: number;
     payload: Uint8Array;
 }
 
+/** Client times of one latency probe frame, in local UTC ms */
+export interface LatencySample {
+    seqNumber: number;
+    receivedAt: number;
+    // 0 when the frame is not decoded here (fMP4 passthrough)
+    decodedAt: number;
+}
+
 export interface DecoderStats {
     totalFrames: number;
     droppedFrames: number;
@@ -69,12 +93,15 @@ export type WorkerRequest =
     | { type: 'initAudio'; config: AudioDecoderConfig }
     | { type: 'decode'; data: Uint8Array; pts?: number }
     | { type: 'flush' }
+    | { type: 'resetTimeline' }
     | { type: 'destroy' };
 
 export type WorkerResponse =
     | { type: 'ready' }
     | { type: 'frame'; frame: VideoFrame }
     | { type: 'audioFrame'; frame: AudioFrame }
+    | { type: 'segment'; data: Uint8Array; frameType: number }
+    | { type: 'latency'; sample: LatencySample }
     | { type: 'error'; error: string }
     | { type: 'destroyed' }
     | { type: 'stats'; stats: DecoderStats };
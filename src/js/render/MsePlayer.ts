@@ -0,0 +1,123 @@
+// Buffered media behind the playhead that is kept for small rewinds
+const KEEP_BEHIND_SECONDS = 5;
+// Playhead further behind the newest frame than this jumps forward
+const MAX_LATENCY_SECONDS = 1.0;
+
+/**
+ * Plays fMP4 segments through Media Source Extensions in a <video> element
+ * that takes the stream canvas's place. The browser decodes and presents
+ * the frames, so the WASM decoder and the WebGL renderer are not used.
+ */
+export class MsePlayer {
+    private canvas: HTMLCanvasElement;
+    private video: HTMLVideoElement;
+    private mediaSource: MediaSource;
+    private sourceBuffer: SourceBuffer | null = null;
+    private pending: Uint8Array[] = [];
+    private resumeAt: number | null = null;
+
+    static isSupported(codec: string): boolean {
+        return typeof MediaSource !== 'undefined' && MediaSource.isTypeSupported(`video/mp4; codecs="${codec}"`);
+    }
+
+    constructor(canvas: HTMLCanvasElement, codec: string) {
+        this.canvas = canvas;
+        this.video = document.createElement('video');
+        this.video.className = canvas.className;
+        this.video.muted = true; // audio is played by AudioPlayer
+        this.video.autoplay = true;
+        this.video.playsInline = true;
+        if (canvas.parentElement) {
+            canvas.parentElement.insertBefore(this.video, canvas);
+        }
+        canvas.style.display = 'none';
+
+        this.mediaSource = new MediaSource();
+        this.video.src = URL.createObjectURL(this.mediaSource);
+        this.mediaSource.addEventListener(
+            'sourceopen',
+            () => {
+                URL.revokeObjectURL(this.video.src);
+                this.sourceBuffer = this.mediaSource.addSourceBuffer(`video/mp4; codecs="${codec}"`);
+                // Segments are placed back to back, so timestamp jumps from
+                // seeks and loops do not leave gaps in the buffer
+                this.sourceBuffer.mode = 'sequence';
+                this.sourceBuffer.addEventListener('updateend', () => this.appendPending());
+                this.appendPending();
+            },
+            { once: true }
+        );
+    }
+
+    appendSegment(data: Uint8Array): void {
+        this.pending.push(data);
+        this.appendPending();
+    }
+
+    /**
+     * The server resumed at a new position: play from the first segment
+     * appended after this point.
+     */
+    handleDiscontinuity(): void {
+        const buffered = this.video.buffered;
+        this.resumeAt = buffered.length > 0 ? buffered.end(buffered.length - 1) : null;
+    }
+
+    destroy(): void {
+        this.pending = [];
+        this.sourceBuffer = null;
+        if (this.mediaSource.readyState === 'open') {
+            this.mediaSource.endOfStream();
+        }
+        this.video.removeAttribute('src');
+        this.video.load();
+        this.video.remove();
+        this.canvas.style.display = '';
+    }
+
+    private appendPending(): void {
+        const sourceBuffer = this.sourceBuffer;
+        if (!sourceBuffer || sourceBuffer.updating) {
+            return;
+        }
+
+        this.followLiveEdge();
+
+        const currentTime = this.video.currentTime;
+        const buffered = sourceBuffer.buffered;
+        if (buffered.length > 0 && buffered.start(0) < currentTime - 2 * KEEP_BEHIND_SECONDS) {
+            sourceBuffer.remove(0, currentTime - KEEP_BEHIND_SECONDS);
+            return;
+        }
+
+        const segment = this.pending.shift();
+        if (segment) {
+            sourceBuffer.appendBuffer(segment);
+        }
+    }
+
+    private followLiveEdge(): void {
+        const buffered = this.video.buffered;
+        if (buffered.length === 0) {
+            return;
+        }
+        const end = buffered.end(buffered.length - 1);
+
+        if (this.resumeAt !== null) {
+            if (end > this.resumeAt) {
+                this.video.currentTime = this.resumeAt;
+                this.resumeAt = null;
+            }
+            return;
+        }
+
+        if (end - this.video.currentTime > MAX_LATENCY_SECONDS) {
+            this.video.currentTime = end - 0.1;
+        }
+        if (this.video.paused) {
+            this.video.play().catch(() => {
+                // Autoplay of muted video is allowed; ignore transient errors
+            });
+        }
+    }
+}
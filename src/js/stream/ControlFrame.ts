@@ -0,0 +1,126 @@
+// Control message types (protocol ext header ctrl_type)
+export enum ControlType {
+    FLOW_CONTROL = 3,
+    ERROR_NOTIFY = 4,
+    PLAYBACK_RATE = 6,
+    SEEK = 7,
+    DISCONTINUITY = 8,
+    SUBSCRIBE = 9,
+    UNSUBSCRIBE = 10,
+    LATENCY_REPORT = 11,
+    CLOCK_SYNC = 12,
+}
+
+export const PROTOCOL_MAGIC = 0xeb01;
+const PROTOCOL_VERSION = 1;
+const MSG_TYPE_VIDEO = 0x01;
+const MSG_TYPE_CONTROL = 0x05;
+const CONTROL_EXT_SIZE = 2;
+export const FIXED_HEADER_SIZE = 20;
+// Fixed header byte naming the multiplexed stream a message belongs to
+export const STREAM_ID_OFFSET = 18;
+// Protocol version 2 (compact headers): the version is the high nibble of
+// the first byte and the stream ID is the third byte
+export const COMPACT_VERSION = 2;
+export const COMPACT_STREAM_ID_OFFSET = 2;
+
+/** Stream ID of a protocol message of either version */
+export function readStreamId(data: ArrayBuffer): number | null {
+    const bytes = new Uint8Array(data);
+    if (bytes.length > COMPACT_STREAM_ID_OFFSET && bytes[0] >> 4 === COMPACT_VERSION) {
+        return bytes[COMPACT_STREAM_ID_OFFSET];
+    }
+    return bytes.length >= FIXED_HEADER_SIZE ? bytes[STREAM_ID_OFFSET] : null;
+}
+
+export function encodeControlFrame(type: ControlType, payload: Uint8Array, streamId: number = 0): ArrayBuffer {
+    const frame = new Uint8Array(FIXED_HEADER_SIZE + CONTROL_EXT_SIZE + payload.length);
+    const view = new DataView(frame.buffer);
+    view.setUint16(0, PROTOCOL_MAGIC);
+    view.setUint8(2, PROTOCOL_VERSION);
+    view.setUint8(3, MSG_TYPE_CONTROL);
+    view.setUint8(13, CONTROL_EXT_SIZE);
+    view.setUint32(14, payload.length);
+    view.setUint8(STREAM_ID_OFFSET, streamId);
+    view.setUint8(FIXED_HEADER_SIZE, type);
+    frame.set(payload, FIXED_HEADER_SIZE + CONTROL_EXT_SIZE);
+    return frame.buffer;
+}
+
+const FLAG_FRAGMENT = 0x01;
+export const FLAG_HAS_COMMON = 0x08;
+
+export function parseControlFrame(data: ArrayBuffer): { type: ControlType; payload: DataView } | null {
+    if (data.byteLength < FIXED_HEADER_SIZE) {
+        return null;
+    }
+    const view = new DataView(data);
+    const flags = view.getUint8(4);
+    if (view.getUint16(0) !== PROTOCOL_MAGIC || view.getUint8(3) !== MSG_TYPE_CONTROL || flags & FLAG_FRAGMENT) {
+        return null;
+    }
+    const extLength = view.getUint8(13);
+    const payloadLength = view.getUint32(14);
+    const commonLength = flags & FLAG_HAS_COMMON ? view.getUint8(FIXED_HEADER_SIZE) : 0;
+    if (commonLength >= extLength || FIXED_HEADER_SIZE + extLength + payloadLength > data.byteLength) {
+        return null;
+    }
+    return {
+        type: view.getUint8(FIXED_HEADER_SIZE + commonLength) as ControlType,
+        payload: new DataView(data, FIXED_HEADER_SIZE + extLength, payloadLength),
+    };
+}
+
+/** Reason text of an ERROR_NOTIFY message, null for any other message */
+export function readErrorNotify(data: string | ArrayBuffer): string | null {
+    if (!(data instanceof ArrayBuffer)) {
+        return null;
+    }
+    const control = parseControlFrame(data);
+    if (!control || control.type !== ControlType.ERROR_NOTIFY) {
+        return null;
+    }
+    const payload = control.payload;
+    return new TextDecoder().decode(new Uint8Array(payload.buffer, payload.byteOffset, payload.byteLength));
+}
+
+/**
+ * Whether a video message of either version is the last (or only) message
+ * of its frame; null for any other message
+ */
+export function readVideoFrameEnd(data: ArrayBuffer): boolean | null {
+    const bytes = new Uint8Array(data);
+    if (bytes.length > COMPACT_STREAM_ID_OFFSET && bytes[0] >> 4 === COMPACT_VERSION) {
+        if ((bytes[0] & 0x0f) !== MSG_TYPE_VIDEO) {
+            return null;
+        }
+        if (!(bytes[1] & FLAG_FRAGMENT)) {
+            return true;
+        }
+        // frame_id (2B) follows the stream ID, then the index and total varints
+        const [index, next] = readVarint(bytes, COMPACT_STREAM_ID_OFFSET + 3);
+        const [total] = readVarint(bytes, next);
+        return index + 1 === total;
+    }
+    const view = new DataView(data);
+    if (bytes.length < FIXED_HEADER_SIZE || view.getUint16(0) !== PROTOCOL_MAGIC || bytes[3] !== MSG_TYPE_VIDEO) {
+        return null;
+    }
+    if (!(bytes[4] & FLAG_FRAGMENT) || bytes.length < FIXED_HEADER_SIZE + 6) {
+        return true;
+    }
+    return view.getUint16(FIXED_HEADER_SIZE + 2) + 1 === view.getUint16(FIXED_HEADER_SIZE + 4);
+}
+
+// LEB128 varint at pos: its value and the position after it
+export function readVarint(bytes: Uint8Array, pos: number): [number, number] {
+    let value = 0;
+    for (let shift = 0; pos < bytes.length && shift < 35; shift += 7) {
+        const byte = bytes[pos++];
+        value += (byte & 0x7f) * 2 ** shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return [value, pos];
+}
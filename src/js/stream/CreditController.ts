@@ -0,0 +1,85 @@
+import { ControlType, readVideoFrameEnd } from './ControlFrame.js';
+
+export type CreditMode = 'frames' | 'bytes';
+
+// Consumed credit is returned once this share of the window has built up,
+// or after GRANT_DELAY_MS, whichever comes first
+const GRANT_FRACTION = 0.25;
+const GRANT_DELAY_MS = 50;
+
+/**
+ * Client side of credit flow control. The server sends video only while it
+ * holds credit; the window granted in the media-answer bounds the video in
+ * flight and queued here. Credit is returned with FLOW_CONTROL messages as
+ * video leaves the receive queue, decoded or dropped, so a slow decoder
+ * makes the server drop frames up to a keyframe instead of sending video
+ * that would be discarded here.
+ */
+export class CreditController {
+    private mode: CreditMode;
+    private windowSize: number;
+    private send: (type: ControlType, payload: Uint8Array) => void;
+    private pending: number = 0;
+    private grantTimer: number | null = null;
+
+    constructor(mode: CreditMode, windowSize: number, send: (type: ControlType, payload: Uint8Array) => void) {
+        this.mode = mode;
+        this.windowSize = windowSize;
+        this.send = send;
+    }
+
+    getMode(): CreditMode {
+        return this.mode;
+    }
+
+    getWindow(): number {
+        return this.windowSize;
+    }
+
+    /**
+     * A received message left the queue. Frames count once, on their last
+     * fragment; bytes count every video message.
+     */
+    release(data: ArrayBuffer | Blob): void {
+        if (!(data instanceof ArrayBuffer)) {
+            return;
+        }
+        const frameEnd = readVideoFrameEnd(data);
+        if (frameEnd === null) {
+            return;
+        }
+        if (this.mode === 'bytes') {
+            this.pending += data.byteLength;
+        } else if (frameEnd) {
+            this.pending += 1;
+        }
+
+        if (this.pending >= Math.max(1, this.windowSize * GRANT_FRACTION)) {
+            this.grant();
+        } else if (this.pending > 0 && this.grantTimer === null) {
+            this.grantTimer = window.setTimeout(() => this.grant(), GRANT_DELAY_MS);
+        }
+    }
+
+    destroy(): void {
+        if (this.grantTimer !== null) {
+            clearTimeout(this.grantTimer);
+            this.grantTimer = null;
+        }
+        this.pending = 0;
+    }
+
+    private grant(): void {
+        if (this.grantTimer !== null) {
+            clearTimeout(this.grantTimer);
+            this.grantTimer = null;
+        }
+        if (this.pending === 0) {
+            return;
+        }
+        const payload = new Uint8Array(4);
+        new DataView(payload.buffer).setUint32(0, this.pending);
+        this.pending = 0;
+        this.send(ControlType.FLOW_CONTROL, payload);
+    }
+}
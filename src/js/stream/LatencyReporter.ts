@@ -0,0 +1,93 @@
+import { ControlType } from './ControlFrame.js';
+import type { LatencySample } from '../decoder/types.js';
+
+// seq_number(4B) + received(8B) + decoded(8B)
+const REPORT_ENTRY_SIZE = 20;
+// Samples waiting for the next report; older ones are dropped past this
+const MAX_PENDING_SAMPLES = 64;
+// Clock sync round trips kept; the shortest one gives the offset
+const CLOCK_SAMPLE_COUNT = 5;
+
+interface ClockSample {
+    rttMs: number;
+    offsetMs: number;
+}
+
+/**
+ * Reports when latency probes were received and decoded, on the server's
+ * clock. The offset to the server clock comes from CLOCK_SYNC round trips:
+ * the server's time is taken to be halfway through the round trip, so the
+ * shortest recent round trip bounds the error best.
+ */
+export class LatencyReporter {
+    private send: (type: ControlType, payload: Uint8Array) => void;
+    private pending: LatencySample[] = [];
+    private clockSamples: ClockSample[] = [];
+
+    constructor(send: (type: ControlType, payload: Uint8Array) => void) {
+        this.send = send;
+    }
+
+    addSample(sample: LatencySample): void {
+        if (this.pending.length >= MAX_PENDING_SAMPLES) {
+            this.pending.shift();
+        }
+        this.pending.push(sample);
+    }
+
+    requestClockSync(): void {
+        const payload = new Uint8Array(8);
+        new DataView(payload.buffer).setBigInt64(0, BigInt(Date.now()));
+        this.send(ControlType.CLOCK_SYNC, payload);
+    }
+
+    /**
+     * Server reply: the time we sent (8B), then the server's UTC time (8B)
+     */
+    handleClockSync(payload: DataView): void {
+        if (payload.byteLength < 16) {
+            return;
+        }
+        const sentAt = Number(payload.getBigInt64(0));
+        const serverTime = Number(payload.getBigInt64(8));
+        const now = Date.now();
+        this.clockSamples.push({ rttMs: now - sentAt, offsetMs: serverTime - (sentAt + now) / 2 });
+        if (this.clockSamples.length > CLOCK_SAMPLE_COUNT) {
+            this.clockSamples.shift();
+        }
+    }
+
+    /**
+     * Send pending samples as one LATENCY_REPORT; held back until the clock
+     * offset is known
+     */
+    flush(): void {
+        const offset = this.getClockOffset();
+        if (offset === null || this.pending.length === 0) {
+            return;
+        }
+
+        const payload = new Uint8Array(this.pending.length * REPORT_ENTRY_SIZE);
+        const view = new DataView(payload.buffer);
+        this.pending.forEach((sample, i) => {
+            const base = i * REPORT_ENTRY_SIZE;
+            view.setUint32(base, sample.seqNumber);
+            view.setBigInt64(base + 4, BigInt(Math.round(sample.receivedAt + offset)));
+            // 0 stays 0: the frame was not decoded here
+            const decodedAt = sample.decodedAt !== 0 ? Math.round(sample.decodedAt + offset) : 0;
+            view.setBigInt64(base + 12, BigInt(decodedAt));
+        });
+        this.pending = [];
+        this.send(ControlType.LATENCY_REPORT, payload);
+    }
+
+    getClockOffset(): number | null {
+        let best: ClockSample | null = null;
+        for (const sample of this.clockSamples) {
+            if (best === null || sample.rttMs < best.rttMs) {
+                best = sample;
+            }
+        }
+        return best !== null ? best.offsetMs : null;
+    }
+}
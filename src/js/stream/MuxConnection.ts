@@ -0,0 +1,155 @@
+import { ControlType, encodeControlFrame, readStreamId } from './ControlFrame.js';
+import type { StreamChannel } from './StreamChannel.js';
+
+// Server path of the multiplexing endpoint; streams are added with SUBSCRIBE
+const MUX_PATH = '/mux';
+const MAX_STREAM_ID = 255;
+
+/** One stream carried by a MuxConnection */
+class MuxChannel implements StreamChannel {
+    readonly streamId: number;
+    onmessage: ((data: string | ArrayBuffer) => void) | null = null;
+    onclose: (() => void) | null = null;
+    private connection: MuxConnection;
+
+    constructor(connection: MuxConnection, streamId: number) {
+        this.connection = connection;
+        this.streamId = streamId;
+    }
+
+    send(data: string | ArrayBuffer): void {
+        this.connection.send(data);
+    }
+
+    close(): void {
+        this.connection.unsubscribe(this.streamId);
+    }
+}
+
+/**
+ * A WebSocket shared by every stream to one server. Each stream is
+ * subscribed under its own stream ID; binary messages are routed by their
+ * stream_id byte and text messages by payload.streamId.
+ * The socket is opened with the first stream and closed with the last.
+ */
+export class MuxConnection {
+    private static connections: Map<string, MuxConnection> = new Map();
+
+    private url: string;
+    private ws: WebSocket | null = null;
+    private opening: Promise<void> | null = null;
+    private channels: Map<number, MuxChannel> = new Map();
+    private nextStreamId: number = 1;
+
+    /**
+     * Subscribe to the source at wsUrl's path over the shared connection to
+     * wsUrl's host; the media-offer arrives on the returned channel.
+     */
+    static async openChannel(wsUrl: string): Promise<StreamChannel> {
+        const url = new URL(wsUrl);
+        const muxUrl = `${url.protocol}//${url.host}${MUX_PATH}`;
+        let connection = MuxConnection.connections.get(muxUrl);
+        if (!connection) {
+            connection = new MuxConnection(muxUrl);
+            MuxConnection.connections.set(muxUrl, connection);
+        }
+        return connection.subscribe(url.pathname || '/');
+    }
+
+    private constructor(url: string) {
+        this.url = url;
+    }
+
+    send(data: string | ArrayBuffer): void {
+        if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+            this.ws.send(data);
+        }
+    }
+
+    unsubscribe(streamId: number): void {
+        if (!this.channels.delete(streamId)) {
+            return;
+        }
+        this.send(encodeControlFrame(ControlType.UNSUBSCRIBE, new Uint8Array(0), streamId));
+        if (this.channels.size === 0) {
+            this.close();
+        }
+    }
+
+    private async subscribe(path: string): Promise<StreamChannel> {
+        await this.open();
+        const streamId = this.allocateStreamId();
+        const channel = new MuxChannel(this, streamId);
+        this.channels.set(streamId, channel);
+        this.send(encodeControlFrame(ControlType.SUBSCRIBE, new TextEncoder().encode(path), streamId));
+        return channel;
+    }
+
+    private open(): Promise<void> {
+        if (!this.opening) {
+            this.opening = new Promise((resolve, reject) => {
+                const ws = new WebSocket(this.url);
+                ws.binaryType = 'arraybuffer';
+                ws.onopen = () => resolve();
+                ws.onerror = () => reject(new Error('WebSocket error'));
+                ws.onmessage = (event) => this.route(event.data);
+                ws.onclose = () => this.handleClose();
+                this.ws = ws;
+            });
+        }
+        return this.opening;
+    }
+
+    private allocateStreamId(): number {
+        for (let i = 0; i < MAX_STREAM_ID; i++) {
+            const streamId = this.nextStreamId;
+            this.nextStreamId = (this.nextStreamId % MAX_STREAM_ID) + 1;
+            if (!this.channels.has(streamId)) {
+                return streamId;
+            }
+        }
+        throw new Error('No free stream ID');
+    }
+
+    private route(data: string | ArrayBuffer): void {
+        let streamId: number | null = null;
+        if (typeof data === 'string') {
+            try {
+                streamId = JSON.parse(data).payload?.streamId ?? 0;
+            } catch {
+                return;
+            }
+        } else {
+            streamId = readStreamId(data);
+        }
+        if (streamId === null) {
+            return;
+        }
+
+        const channel = this.channels.get(streamId);
+        if (channel && channel.onmessage) {
+            channel.onmessage(data);
+        }
+    }
+
+    private close(): void {
+        MuxConnection.connections.delete(this.url);
+        if (this.ws) {
+            this.ws.onclose = null;
+            this.ws.close();
+            this.ws = null;
+        }
+    }
+
+    private handleClose(): void {
+        MuxConnection.connections.delete(this.url);
+        this.ws = null;
+        const channels = Array.from(this.channels.values());
+        this.channels.clear();
+        for (const channel of channels) {
+            if (channel.onclose) {
+                channel.onclose();
+            }
+        }
+    }
+}
@@ -0,0 +1,125 @@
+import { FIXED_HEADER_SIZE, FLAG_HAS_COMMON, PROTOCOL_MAGIC, readVarint } from './ControlFrame.js';
+
+const MSG_TYPE_METADATA = 0x04;
+const META_TYPE_SOURCE_SUMMARY = 5;
+const SUMMARY_VERSION = 1;
+// meta_type(1B) + format(1B) + assoc_stream(1B) + reserved(1B)
+const METADATA_EXT_SIZE = 4;
+// Frame-size bucket i counts frames below FRAME_SIZE_BUCKET_BASE << i
+// bytes; the last bucket counts the rest
+export const FRAME_SIZE_BUCKET_BASE = 1024;
+
+export interface RenditionSummary {
+    width: number;
+    height: number;
+    bitrateBps: number;
+    peakBitrateBps: number;
+    maxFrameBytes: number;
+    frameSizeBuckets: number[];
+}
+
+/** Source summary sent ahead of the media-offer */
+export interface SourceSummary {
+    codec: number;
+    profileIdc: number;
+    levelIdc: number;
+    frameRate: number;
+    gopFrames: number;
+    durationMs: number;
+    keyframeTimesMs: number[];
+    renditions: RenditionSummary[];
+}
+
+/**
+ * Summary of a SOURCE_SUMMARY metadata message, null for any other
+ * message or a summary version this client does not know
+ */
+export function parseSourceSummary(data: ArrayBuffer): SourceSummary | null {
+    if (data.byteLength < FIXED_HEADER_SIZE) {
+        return null;
+    }
+    const view = new DataView(data);
+    const flags = view.getUint8(4);
+    if (view.getUint16(0) !== PROTOCOL_MAGIC || view.getUint8(3) !== MSG_TYPE_METADATA) {
+        return null;
+    }
+    const extLength = view.getUint8(13);
+    const payloadLength = view.getUint32(14);
+    const commonLength = flags & FLAG_HAS_COMMON ? view.getUint8(FIXED_HEADER_SIZE) : 0;
+    if (
+        commonLength + METADATA_EXT_SIZE > extLength ||
+        FIXED_HEADER_SIZE + extLength + payloadLength > data.byteLength ||
+        view.getUint8(FIXED_HEADER_SIZE + commonLength) !== META_TYPE_SOURCE_SUMMARY
+    ) {
+        return null;
+    }
+
+    const bytes = new Uint8Array(data, FIXED_HEADER_SIZE + extLength, payloadLength);
+    if (bytes.length < 5 || bytes[0] !== SUMMARY_VERSION) {
+        return null;
+    }
+    let pos = 4;
+    const next = (): number => {
+        const [value, after] = readVarint(bytes, pos);
+        pos = after;
+        return value;
+    };
+
+    const summary: SourceSummary = {
+        codec: bytes[1],
+        profileIdc: bytes[2],
+        levelIdc: bytes[3],
+        frameRate: next() / 1000,
+        gopFrames: next(),
+        durationMs: next(),
+        keyframeTimesMs: [],
+        renditions: [],
+    };
+    const keyframeCount = next();
+    let timeMs = 0;
+    for (let i = 0; i < keyframeCount && pos < bytes.length; i++) {
+        timeMs += next();
+        summary.keyframeTimesMs.push(timeMs);
+    }
+
+    const renditionCount = pos < bytes.length ? bytes[pos++] : 0;
+    for (let i = 0; i < renditionCount && pos < bytes.length; i++) {
+        const rendition: RenditionSummary = {
+            width: next(),
+            height: next(),
+            bitrateBps: next(),
+            peakBitrateBps: next(),
+            maxFrameBytes: next(),
+            frameSizeBuckets: [],
+        };
+        const bucketCount = pos < bytes.length ? bytes[pos++] : 0;
+        for (let j = 0; j < bucketCount; j++) {
+            rendition.frameSizeBuckets.push(next());
+        }
+        summary.renditions.push(rendition);
+    }
+    return summary;
+}
+
+// Decoded pictures the decoder may hold at once (references plus output)
+const DECODER_PICTURE_COUNT = 8;
+// Largest compressed frames buffered between the parser and the decoder
+const DECODER_INPUT_FRAMES = 4;
+
+/**
+ * WASM heap the decoder needs for the summary's largest rendition: I420
+ * pictures plus input buffers. 0 when the summary has no picture size.
+ */
+export function estimateDecoderHeapBytes(summary: SourceSummary): number {
+    let bytes = 0;
+    for (const rendition of summary.renditions) {
+        const pictureBytes = rendition.width * rendition.height * 1.5;
+        if (pictureBytes > 0) {
+            bytes = Math.max(
+                bytes,
+                pictureBytes * DECODER_PICTURE_COUNT + rendition.maxFrameBytes * DECODER_INPUT_FRAMES
+            );
+        }
+    }
+    return Math.ceil(bytes);
+}
@@ -0,0 +1,56 @@
+/**
+ * Messages of one stream: text (negotiation) and binary (protocol
+ * messages). A stream has its own WebSocket, or shares one with other
+ * streams to the same server (see MuxConnection).
+ */
+export interface StreamChannel {
+    // Stream ID stamped on sent control frames and media-answers; 0 for a
+    // stream with its own WebSocket
+    readonly streamId: number;
+    onmessage: ((data: string | ArrayBuffer) => void) | null;
+    onclose: (() => void) | null;
+    send(data: string | ArrayBuffer): void;
+    close(): void;
+}
+
+/** A stream on its own WebSocket; the request path selects the source */
+export class SocketChannel implements StreamChannel {
+    readonly streamId = 0;
+    onmessage: ((data: string | ArrayBuffer) => void) | null = null;
+    onclose: (() => void) | null = null;
+    private ws: WebSocket;
+
+    static open(url: string): Promise<SocketChannel> {
+        return new Promise((resolve, reject) => {
+            const ws = new WebSocket(url);
+            ws.binaryType = 'arraybuffer';
+            ws.onopen = () => resolve(new SocketChannel(ws));
+            ws.onerror = () => reject(new Error('WebSocket error'));
+        });
+    }
+
+    private constructor(ws: WebSocket) {
+        this.ws = ws;
+        ws.onmessage = (event) => {
+            if (this.onmessage) {
+                this.onmessage(event.data);
+            }
+        };
+        ws.onclose = () => {
+            if (this.onclose) {
+                this.onclose();
+            }
+        };
+    }
+
+    send(data: string | ArrayBuffer): void {
+        if (this.ws.readyState === WebSocket.OPEN) {
+            this.ws.send(data);
+        }
+    }
+
+    close(): void {
+        this.ws.onclose = null;
+        this.ws.close();
+    }
+}
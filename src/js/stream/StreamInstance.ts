@@ -2,8 +2,39 @@ import { AudioPlayer } from '../audio/AudioPlayer.js';
 import { AVSync } from '../audio/AVSync.js';
 import { DataBufferQueue } from '../buffer/DataBufferQueue.js';
 import { WorkerBridge } from '../decoder/WorkerBridge.js';
+import { MsePlayer } from '../render/MsePlayer.js';
 import { WebGLRenderer } from '../render/WebGLRenderer.js';
-import type { AudioCodecType, AudioFrame, CodecType, VideoFrame, DecoderStats } from '../decoder/types.js';
+import {
+    COMPACT_VERSION,
+    ControlType,
+    encodeControlFrame,
+    parseControlFrame,
+    readErrorNotify,
+} from './ControlFrame.js';
+import { CreditController } from './CreditController.js';
+import type { CreditMode } from './CreditController.js';
+import { LatencyReporter } from './LatencyReporter.js';
+import { MuxConnection } from './MuxConnection.js';
+import { estimateDecoderHeapBytes, parseSourceSummary } from './SourceSummary.js';
+import type { SourceSummary } from './SourceSummary.js';
+import { SocketChannel } from './StreamChannel.js';
+import type { StreamChannel } from './StreamChannel.js';
+import type {
+    AudioCodecType,
+    AudioFrame,
+    CodecType,
+    VideoFrame,
+    DecoderStats,
+    LatencySample,
+} from '../decoder/types.js';
+
+// Latency probe timings are reported this often
+const LATENCY_REPORT_INTERVAL_MS = 1000;
+// The clock offset to the server is refreshed every this many reports
+const CLOCK_SYNC_EVERY_REPORTS = 10;
+// Flow control windows when the config names a mode but no window
+const DEFAULT_CREDIT_FRAMES = 15;
+const DEFAULT_CREDIT_BYTES = 4 * 1024 * 1024;
 
 export interface StreamConfig {
     id: string;
@@ -11,6 +42,25 @@ export interface StreamConfig {
     canvas: HTMLCanvasElement;
     wasmPath?: string;
     audioContext?: AudioContext;
+    // Thinning requested in the media-answer; the server forwards only the
+    // temporal layers that fit
+    maxFramerate?: number;
+    temporalLayer?: number;
+    // Receive video as fMP4 and play it through MSE when the server offers
+    // it and the browser supports the codec
+    preferFmp4?: boolean;
+    // Share one WebSocket with the other multiplexed streams to the same
+    // server instead of opening one per stream
+    multiplex?: boolean;
+    // Largest media payload per message; the server otherwise sizes
+    // fragments to the connection's TLS records and congestion window
+    maxFragmentSize?: number;
+    // Credit flow control: the server sends no more video than creditWindow
+    // frames or bytes ahead of what has left the receive queue, and drops
+    // frames up to a keyframe instead. A bytes window must exceed the
+    // largest keyframe.
+    flowControl?: CreditMode;
+    creditWindow?: number;
     bufferConfig?: {
         maxSize?: number;
         maxBytes?: number;
@@ -24,8 +74,11 @@ export interface StreamStats {
     dataRate: number;
     decoderStats: DecoderStats | null;
     bufferStats: ReturnType<DataBufferQueue['getStats']> | null;
+    seekLatencyMs: number | null; // seek request to first rendered frame
 }
 
+export { ControlType };
+
 export type StreamStatus = 'disconnected' | 'connecting' | 'connected' | 'error';
 
 export class StreamInstance {
@@ -33,8 +86,15 @@ export class StreamInstance {
     private wsUrl: string;
     private canvas: HTMLCanvasElement;
     private wasmPath: string;
-
-    private ws: WebSocket | null = null;
+    private maxFramerate?: number;
+    private temporalLayer?: number;
+    private preferFmp4: boolean;
+    private multiplex: boolean;
+    private maxFragmentSize?: number;
+    private flowControl?: CreditMode;
+    private creditWindow: number;
+
+    private channel: StreamChannel | null = null;
     private queue: DataBufferQueue;
     private processing: boolean = false;
     private decoder: WorkerBridge | null = null;
@@ -49,13 +109,20 @@ export class StreamInstance {
         dataRate: 0,
         decoderStats: null,
         bufferStats: null,
+        seekLatencyMs: null,
     };
+    private seekStartTime: number | null = null;
 
     private lastUpdateTime: number = 0;
     private lastBytesReceived: number = 0;
 
     private audioContext: AudioContext | null = null;
     private renderer: WebGLRenderer | null = null;
+    private msePlayer: MsePlayer | null = null;
+    private latencyReporter: LatencyReporter | null = null;
+    private latencyTimer: number | null = null;
+    private credit: CreditController | null = null;
+    private sourceSummary: SourceSummary | null = null;
 
     private onStatusChange?: (status: StreamStatus) => void;
     private onStatsUpdate?: (stats: StreamStats) => void;
@@ -67,6 +134,14 @@ export class StreamInstance {
         this.canvas = config.canvas;
         this.wasmPath = config.wasmPath || '/dist/decoder.js';
         this.audioContext = config.audioContext || null;
+        this.maxFramerate = config.maxFramerate;
+        this.temporalLayer = config.temporalLayer;
+        this.preferFmp4 = config.preferFmp4 === true;
+        this.multiplex = config.multiplex === true;
+        this.maxFragmentSize = config.maxFragmentSize;
+        this.flowControl = config.flowControl;
+        this.creditWindow =
+            config.creditWindow || (config.flowControl === 'bytes' ? DEFAULT_CREDIT_BYTES : DEFAULT_CREDIT_FRAMES);
 
         this.queue = new DataBufferQueue(
             config.bufferConfig || {
@@ -74,17 +149,18 @@ export class StreamInstance {
                 maxBytes: 10 * 1024 * 1024,
             }
         );
+        this.queue.setDropCallback((packet) => this.releaseCredit(packet.data));
     }
 
     async connect(): Promise<void> {
-        if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+        if (this.channel) {
             throw new Error(`Stream ${this.id} already connected`);
         }
 
         this.updateStatus('connecting');
 
         try {
-            await this.connectWebSocket();
+            await this.connectChannel();
         } catch (error) {
             this.updateStatus('error');
             this.handleError(`Connection failed: ${error}`);
@@ -94,10 +170,16 @@ export class StreamInstance {
 
     disconnect(): void {
         this.processing = false;
+        this.stopLatencyReports();
+        if (this.credit) {
+            this.credit.destroy();
+            this.credit = null;
+        }
+        this.sourceSummary = null;
 
-        if (this.ws) {
-            this.ws.close();
-            this.ws = null;
+        if (this.channel) {
+            this.channel.close();
+            this.channel = null;
         }
 
         if (this.avSync) {
@@ -115,6 +197,11 @@ export class StreamInstance {
             this.renderer = null;
         }
 
+        if (this.msePlayer) {
+            this.msePlayer.destroy();
+            this.msePlayer = null;
+        }
+
         if (this.decoder) {
             this.decoder.destroy();
             this.decoder = null;
@@ -125,6 +212,42 @@ export class StreamInstance {
         this.updateStatus('disconnected');
     }
 
+    /**
+     * Ask the server for a playback rate (1 = normal). Above 2x the server
+     * sends keyframes only; timestamps stay on a 1x timeline either way.
+     */
+    setPlaybackRate(rate: number): void {
+        const payload = new Uint8Array(4);
+        new DataView(payload.buffer).setUint32(0, Math.round(rate * 1000));
+        this.sendControl(ControlType.PLAYBACK_RATE, payload);
+    }
+
+    /**
+     * Seek to a position in ms from the start of the source. The server
+     * resumes at the keyframe at or before it and sends a discontinuity
+     * marker first.
+     */
+    seek(positionMs: number): void {
+        if (!this.channel) {
+            return;
+        }
+        const payload = new Uint8Array(8);
+        new DataView(payload.buffer).setBigInt64(0, BigInt(Math.max(0, Math.round(positionMs))));
+        this.seekStartTime = performance.now();
+        this.sendControl(ControlType.SEEK, payload);
+    }
+
+    private sendControl(type: ControlType, payload: Uint8Array): void {
+        if (this.channel) {
+            this.channel.send(encodeControlFrame(type, payload, this.channel.streamId));
+        }
+    }
+
+    /** Summary the server sent ahead of the media-offer, if any */
+    getSourceSummary(): SourceSummary | null {
+        return this.sourceSummary;
+    }
+
     getStatus(): StreamStatus {
         return this.status;
     }
@@ -146,10 +269,28 @@ export class StreamInstance {
         this.onError = callback;
     }
 
-    private async initDecoder(codecType: CodecType): Promise<void> {
+    private async initDecoder(
+        codecType: CodecType,
+        fmp4Codec: string | null,
+        sliceInput: boolean
+    ): Promise<void> {
         const workerPath = '/dist/js/worker/decode-worker.js';
         this.decoder = new WorkerBridge(workerPath);
 
+        // fMP4: the worker only reassembles video, MSE decodes and presents
+        // it on the video element's own clock
+        if (fmp4Codec) {
+            const msePlayer = new MsePlayer(this.canvas, fmp4Codec);
+            this.msePlayer = msePlayer;
+            this.decoder.onSegment((data: Uint8Array) => {
+                if (this.seekStartTime !== null) {
+                    this.stats.seekLatencyMs = performance.now() - this.seekStartTime;
+                    this.seekStartTime = null;
+                }
+                msePlayer.appendSegment(data);
+            });
+        }
+
         // Set up audio player and AV sync
         this.audioPlayer = new AudioPlayer(this.audioContext);
         this.avSync = new AVSync(this.audioPlayer);
@@ -176,45 +317,113 @@ export class StreamInstance {
             this.notifyStatsUpdate();
         });
 
+        this.decoder.onLatency((sample: LatencySample) => {
+            if (this.latencyReporter) {
+                this.latencyReporter.addSample(sample);
+            }
+        });
+
         this.decoder.onError((error: string) => {
             this.handleError(`Decoder error: ${error}`);
         });
 
+        // Reserve the WASM heap the source needs up front; MSE decodes fMP4
+        const heapReserveBytes =
+            this.sourceSummary && fmp4Codec === null ? estimateDecoderHeapBytes(this.sourceSummary) : 0;
+
         await this.decoder.init({
             codecType,
             wasmPath: this.wasmPath,
+            videoPassthrough: fmp4Codec !== null,
+            sliceInput,
+            latencyProbes: true,
+            heapReserveBytes,
         });
     }
 
-    private async connectWebSocket(): Promise<void> {
-        return new Promise((resolve, reject) => {
-            this.ws = new WebSocket(this.wsUrl);
-            this.ws.binaryType = 'arraybuffer';
+    // Probe timings go out once a second; the first report waits for the
+    // answer to the first clock sync
+    private startLatencyReports(): void {
+        this.stopLatencyReports();
+        const reporter = new LatencyReporter((type, payload) => this.sendControl(type, payload));
+        this.latencyReporter = reporter;
+        reporter.requestClockSync();
+
+        let reports = 0;
+        this.latencyTimer = window.setInterval(() => {
+            reporter.flush();
+            if (++reports % CLOCK_SYNC_EVERY_REPORTS === 0) {
+                reporter.requestClockSync();
+            }
+        }, LATENCY_REPORT_INTERVAL_MS);
+    }
+
+    private stopLatencyReports(): void {
+        if (this.latencyTimer !== null) {
+            clearInterval(this.latencyTimer);
+            this.latencyTimer = null;
+        }
+        this.latencyReporter = null;
+    }
+
+    private async connectChannel(): Promise<void> {
+        const channel = this.multiplex
+            ? await MuxConnection.openChannel(this.wsUrl)
+            : await SocketChannel.open(this.wsUrl);
+        this.channel = channel;
 
+        // Wait for media-offer before reporting connected
+        return new Promise((resolve, reject) => {
             let negotiated = false;
 
-            this.ws.onopen = () => {
-                // Wait for media-offer before reporting connected
-            };
+            channel.onmessage = async (data) => {
+                // A multiplexed subscription the server refused
+                const serverError = negotiated ? null : readErrorNotify(data);
+                if (serverError !== null) {
+                    channel.close();
+                    this.channel = null;
+                    reject(new Error(serverError));
+                    return;
+                }
 
-            this.ws.onmessage = async (event) => {
-                if (!negotiated && typeof event.data === 'string') {
+                if (!negotiated && typeof data === 'string') {
                     let msg: any;
                     try {
-                        msg = JSON.parse(event.data);
+                        msg = JSON.parse(data);
                     } catch {
                         return;
                     }
 
                     if (msg.type === 'media-offer') {
-                        const streams: Array<{ type: string; codec: string; sampleRate?: number; channels?: number }> =
-                            msg.payload?.streams || [];
+                        const streams: Array<{
+                            type: string;
+                            codec: string;
+                            sampleRate?: number;
+                            channels?: number;
+                            containers?: string[];
+                            fmp4Codec?: string;
+                        }> = msg.payload?.streams || [];
                         const videoStream = streams.find((s) => s.type === 'video');
                         const audioStream = streams.find((s) => s.type === 'audio');
                         const codecType = (videoStream?.codec as CodecType) || 'h264';
 
+                        let fmp4Codec: string | null = null;
+                        if (
+                            this.preferFmp4 &&
+                            videoStream &&
+                            videoStream.fmp4Codec &&
+                            (videoStream.containers || []).includes('fmp4') &&
+                            MsePlayer.isSupported(videoStream.fmp4Codec)
+                        ) {
+                            fmp4Codec = videoStream.fmp4Codec;
+                        }
+
+                        // Large H.264 frames are decoded slice by slice as
+                        // their fragments arrive
+                        const sliceInput = fmp4Codec === null && codecType === 'h264';
+
                         try {
-                            await this.initDecoder(codecType);
+                            await this.initDecoder(codecType, fmp4Codec, sliceInput);
 
                             // Initialize audio decoder if audio stream is present
                             if (audioStream && this.decoder) {
@@ -234,66 +443,163 @@ export class StreamInstance {
                                 }
                             }
 
-                            this.ws!.send(JSON.stringify({ type: 'media-answer', payload: { accepted: true } }));
+                            const answer: Record<string, unknown> = { accepted: true };
+                            if (channel.streamId !== 0) {
+                                answer.streamId = channel.streamId;
+                            }
+                            if (this.maxFramerate !== undefined) {
+                                answer.maxFramerate = this.maxFramerate;
+                            }
+                            if (this.temporalLayer !== undefined) {
+                                answer.temporalLayer = this.temporalLayer;
+                            }
+                            if (fmp4Codec) {
+                                answer.container = 'fmp4';
+                            }
+                            // Compact headers: the parser takes the codec
+                            // parameters from this offer instead
+                            const protocols: number[] = msg.payload?.protocols || [1];
+                            if (protocols.includes(COMPACT_VERSION)) {
+                                answer.protocol = COMPACT_VERSION;
+                            }
+                            // The parser splits AUDIO_BATCH messages into frames
+                            answer.audioBatch = true;
+                            if (sliceInput) {
+                                answer.nalFragments = true;
+                            }
+                            if (this.maxFragmentSize !== undefined) {
+                                answer.maxFragmentSize = this.maxFragmentSize;
+                            }
+                            answer.latencyProbes = true;
+                            if (this.flowControl) {
+                                this.credit = new CreditController(
+                                    this.flowControl,
+                                    this.creditWindow,
+                                    (type, payload) => this.sendControl(type, payload)
+                                );
+                                answer.flowControl = this.flowControl;
+                                answer.credit = this.creditWindow;
+                            }
+                            channel.send(JSON.stringify({ type: 'media-answer', payload: answer }));
                             negotiated = true;
                             this.stats.connectionStartTime = Date.now();
                             this.stats.bytesReceived = 0;
                             this.stats.messagesReceived = 0;
                             this.lastUpdateTime = Date.now();
                             this.lastBytesReceived = 0;
+                            this.startLatencyReports();
                             this.updateStatus('connected');
                             resolve();
                         } catch (error) {
-                            this.ws!.send(
-                                JSON.stringify({
-                                    type: 'media-answer',
-                                    payload: { accepted: false, reason: String(error) },
-                                })
-                            );
+                            const rejection: Record<string, unknown> = { accepted: false, reason: String(error) };
+                            if (channel.streamId !== 0) {
+                                rejection.streamId = channel.streamId;
+                            }
+                            channel.send(JSON.stringify({ type: 'media-answer', payload: rejection }));
                             reject(new Error(`Decoder init failed: ${error}`));
                         }
                     }
                 } else {
-                    this.handleWebSocketMessage(event);
+                    this.handleChannelMessage(data);
                 }
             };
 
-            this.ws.onerror = () => {
-                reject(new Error('WebSocket error'));
-            };
-
-            this.ws.onclose = () => {
+            channel.onclose = () => {
                 this.updateStatus('disconnected');
                 this.processing = false;
+                reject(new Error('Connection closed'));
             };
         });
     }
 
-    private handleWebSocketMessage(event: MessageEvent): void {
+    private handleChannelMessage(data: string | ArrayBuffer): void {
         this.stats.messagesReceived++;
 
-        if (event.data instanceof ArrayBuffer) {
-            const dataSize = event.data.byteLength;
-            this.stats.bytesReceived += dataSize;
-            this.queue.enqueue(event.data);
-            this.processQueue();
+        if (data instanceof ArrayBuffer && this.handleControlMessage(data)) {
+            return;
+        }
 
-            this.updateDataRate();
-        } else if (event.data instanceof Blob) {
-            const dataSize = event.data.size;
+        const summary = data instanceof ArrayBuffer ? parseSourceSummary(data) : null;
+        if (summary) {
+            this.applySourceSummary(summary);
+            return;
+        }
+
+        if (data instanceof ArrayBuffer) {
+            const dataSize = data.byteLength;
             this.stats.bytesReceived += dataSize;
-            this.queue.enqueue(event.data);
+            const overflows = this.queue.getStats().totalOverflows;
+            this.queue.enqueue(data);
+            if (this.queue.getStats().totalOverflows !== overflows) {
+                this.resetTimeline();
+            }
             this.processQueue();
 
             this.updateDataRate();
         } else {
-            const dataSize = new Blob([event.data]).size;
+            const dataSize = new Blob([data]).size;
             this.stats.bytesReceived += dataSize;
         }
 
         this.notifyStatsUpdate();
     }
 
+    private handleControlMessage(data: ArrayBuffer): boolean {
+        const control = parseControlFrame(data);
+        if (!control) {
+            return false;
+        }
+
+        if (control.type === ControlType.DISCONTINUITY) {
+            // Everything queued before the marker belongs to the old position
+            this.queue.clear();
+            this.resetTimeline();
+            if (this.avSync) {
+                this.avSync.reset();
+            }
+            if (this.audioPlayer) {
+                this.audioPlayer.reset();
+            }
+            if (this.msePlayer) {
+                this.msePlayer.handleDiscontinuity();
+            }
+        } else if (control.type === ControlType.ERROR_NOTIFY) {
+            this.handleError(`Server error: ${readErrorNotify(data)}`);
+        } else if (control.type === ControlType.CLOCK_SYNC) {
+            if (this.latencyReporter) {
+                this.latencyReporter.handleClockSync(control.payload);
+            }
+        }
+        return true;
+    }
+
+    // The summary arrives before the media-offer: size the canvas for the
+    // top rendition now rather than on the first decoded frame
+    private applySourceSummary(summary: SourceSummary): void {
+        this.sourceSummary = summary;
+        const top = summary.renditions[0];
+        if (top && top.width > 0 && top.height > 0 && !this.msePlayer) {
+            this.canvas.width = top.width;
+            this.canvas.height = top.height;
+        }
+    }
+
+    private releaseCredit(data: ArrayBuffer | Blob): void {
+        if (this.credit) {
+            this.credit.release(data);
+        }
+    }
+
+    // Queued messages were dropped: compact header timestamps are deltas,
+    // so the parser waits for the next absolute one
+    private resetTimeline(): void {
+        if (this.decoder) {
+            this.decoder.resetTimeline().catch(() => {
+                // Worker already gone
+            });
+        }
+    }
+
     private updateDataRate(): void {
         const currentTime = Date.now();
         const timeDiff = (currentTime - this.lastUpdateTime) / 1000;
@@ -328,6 +634,8 @@ export class StreamInstance {
                 } catch (error) {
                     this.handleError(`Decode error: ${error}`);
                 }
+                // Credit comes back once the worker is done with the message
+                this.releaseCredit(packet.data);
             }
         } finally {
             this.processing = false;
@@ -335,6 +643,11 @@ export class StreamInstance {
     }
 
     private renderFrame(frame: VideoFrame): void {
+        if (this.seekStartTime !== null) {
+            this.stats.seekLatencyMs = performance.now() - this.seekStartTime;
+            this.seekStartTime = null;
+        }
+
         // Lazy init WebGL renderer on first frame
         if (this.renderer === undefined || this.renderer === null) {
             try {
@@ -25,6 +25,19 @@ export class GridLayout {
         return this.gridMode;
     }
 
+    // Frame rate worth decoding per tile in dense layouts, where a tile is
+    // too small for full motion to matter
+    getTileMaxFramerate(): number | undefined {
+        switch (this.gridMode) {
+            case '3x3':
+                return 15;
+            case '4x4':
+                return 10;
+            default:
+                return undefined;
+        }
+    }
+
     addCard(card: StreamCard): void {
         if (this.cards.has(card.id)) {
             throw new Error(`Card with id ${card.id} already exists`);
@@ -4,6 +4,8 @@ export interface StreamCardConfig {
     id: string;
     onConnect?: (wsUrl: string) => void;
     onDisconnect?: () => void;
+    onRateChange?: (rate: number) => void;
+    onSeek?: (positionMs: number) => void;
     onRemove?: () => void;
 }
 
@@ -63,6 +65,21 @@ export class StreamCard {
             <button class="disconnect-btn flex-1 px-3 py-1 text-xs bg-red-500 text-white rounded hover:bg-red-600">
               Disconnect
             </button>
+            <select class="rate-select px-1 py-1 text-xs border rounded" title="Playback rate">
+              <option value="0.5">0.5x</option>
+              <option value="1" selected>1x</option>
+              <option value="2">2x</option>
+              <option value="4">4x</option>
+              <option value="8">8x</option>
+              <option value="16">16x</option>
+            </select>
+          </div>
+          <div class="flex gap-2 mt-2">
+            <input type="number" class="seek-position flex-1 px-2 py-1 text-xs border rounded"
+                   min="0" step="1" placeholder="Position (s)">
+            <button class="seek-btn px-3 py-1 text-xs bg-blue-500 text-white rounded hover:bg-blue-600">
+              Seek
+            </button>
           </div>
         </div>
 
@@ -92,6 +109,10 @@ export class StreamCard {
               <span>FPS:</span>
               <span class="stat-fps font-mono">0</span>
             </div>
+            <div class="stat-row flex justify-between">
+              <span>Seek Latency:</span>
+              <span class="stat-seek font-mono">N/A</span>
+            </div>
             <div class="stat-row flex justify-between">
               <span>Resolution:</span>
               <span class="stat-resolution font-mono">N/A</span>
@@ -109,6 +130,8 @@ export class StreamCard {
         const connectBtn = card.querySelector('.connect-btn') as HTMLButtonElement;
         const disconnectBtn = card.querySelector('.disconnect-btn') as HTMLButtonElement;
         const removeBtn = card.querySelector('.remove-btn') as HTMLButtonElement;
+        const rateSelect = card.querySelector('.rate-select') as HTMLSelectElement;
+        const seekBtn = card.querySelector('.seek-btn') as HTMLButtonElement;
         const statsHeader = card.querySelector('.stats-header') as HTMLElement;
 
         connectBtn.addEventListener('click', () => {
@@ -124,6 +147,19 @@ export class StreamCard {
             }
         });
 
+        rateSelect.addEventListener('change', () => {
+            if (this.config.onRateChange) {
+                this.config.onRateChange(Number(rateSelect.value));
+            }
+        });
+
+        seekBtn.addEventListener('click', () => {
+            const seconds = Number((card.querySelector('.seek-position') as HTMLInputElement).value);
+            if (this.config.onSeek && Number.isFinite(seconds)) {
+                this.config.onSeek(seconds * 1000);
+            }
+        });
+
         removeBtn.addEventListener('click', () => {
             if (this.config.onRemove) {
                 this.config.onRemove();
@@ -184,6 +220,7 @@ export class StreamCard {
         const bytesEl = this.container.querySelector('.stat-bytes') as HTMLElement;
         const bufferEl = this.container.querySelector('.stat-buffer') as HTMLElement;
         const fpsEl = this.container.querySelector('.stat-fps') as HTMLElement;
+        const seekEl = this.container.querySelector('.stat-seek') as HTMLElement;
 
         dataRateEl.textContent = `${stats.dataRate.toFixed(2)} KB/s`;
         messagesEl.textContent = stats.messagesReceived.toString();
@@ -193,6 +230,10 @@ export class StreamCard {
             bufferEl.textContent = `${stats.bufferStats.currentSize}/${stats.bufferStats.maxSize}`;
         }
 
+        if (stats.seekLatencyMs !== null) {
+            seekEl.textContent = `${stats.seekLatencyMs.toFixed(0)} ms`;
+        }
+
         if (stats.decoderStats) {
             fpsEl.textContent = stats.decoderStats.currentFPS.toFixed(1);
             this.fpsOverlay.textContent = `${stats.decoderStats.currentFPS.toFixed(1)} FPS`;
@@ -0,0 +1,120 @@
+#include "abr_controller.h"
+
+#include <algorithm>
+
+namespace server {
+
+static const double DRAIN_EWMA_ALPHA = 0.25;
+static const size_t QUEUE_LOW_BYTES = 16 * 1024;
+static const size_t QUEUE_HIGH_MIN_BYTES = 64 * 1024;
+static const int64_t QUEUE_HIGH_MS = 500;          // queue worth this much media is congested
+static const double DOWN_SWITCH_HEADROOM = 0.8;    // pick a rendition below 80% of drain
+static const int64_t UP_HOLD_MIN_MS = 8000;
+static const int64_t UP_HOLD_MAX_MS = 64000;
+static const int64_t FAILED_PROBE_MS = 15000;      // down within this after an up = failed probe
+static const size_t MAX_HISTORY = 64;
+
+AbrController::AbrController()
+    : target_(0),
+      hasSample_(false),
+      startMs_(0),
+      lastSampleMs_(0),
+      lastBytesSent_(0),
+      lastQueueBytes_(0),
+      drainBps_(0.0),
+      lowQueueSinceMs_(-1),
+      lastUpSwitchMs_(-1),
+      upHoldMs_(UP_HOLD_MIN_MS),
+      switchesUp_(0),
+      switchesDown_(0) {
+}
+
+void AbrController::Reset(const std::vector<uint32_t>& bitratesBps) {
+    *this = AbrController();
+    bitratesBps_ = bitratesBps;
+}
+
+void AbrController::OnSample(int64_t nowMs, uint64_t bytesSent, size_t queueBytes) {
+    if (bitratesBps_.size() < 2) {
+        return;
+    }
+
+    if (!hasSample_) {
+        hasSample_ = true;
+        startMs_ = nowMs;
+        lastSampleMs_ = nowMs;
+        lastBytesSent_ = bytesSent;
+        lastQueueBytes_ = queueBytes;
+        return;
+    }
+
+    int64_t elapsedMs = nowMs - lastSampleMs_;
+    if (elapsedMs <= 0) {
+        return;
+    }
+
+    // Bytes that left the queue = bytes added - growth of the queue
+    int64_t added = static_cast<int64_t>(bytesSent - lastBytesSent_);
+    int64_t growth = static_cast<int64_t>(queueBytes) - static_cast<int64_t>(lastQueueBytes_);
+    int64_t drained = std::max<int64_t>(added - growth, 0);
+    double sampleBps = drained * 8000.0 / elapsedMs;
+    drainBps_ = (drainBps_ == 0.0) ? sampleBps
+                                    : drainBps_ + DRAIN_EWMA_ALPHA * (sampleBps - drainBps_);
+
+    bool isGrowing = queueBytes >= lastQueueBytes_;
+    lastSampleMs_ = nowMs;
+    lastBytesSent_ = bytesSent;
+    lastQueueBytes_ = queueBytes;
+
+    int32_t lowest = static_cast<int32_t>(bitratesBps_.size()) - 1;
+    size_t mediaBytes = static_cast<size_t>(bitratesBps_[target_] / 8.0 * QUEUE_HIGH_MS / 1000.0);
+    size_t highBytes = std::max(QUEUE_HIGH_MIN_BYTES, mediaBytes);
+
+    if (queueBytes > highBytes && (isGrowing || queueBytes > 2 * highBytes)) {
+        lowQueueSinceMs_ = -1;
+        if (target_ == lowest) {
+            return;
+        }
+        int32_t next = target_ + 1;
+        while (next < lowest && bitratesBps_[next] > drainBps_ * DOWN_SWITCH_HEADROOM) {
+            next++;
+        }
+        if (lastUpSwitchMs_ >= 0 && nowMs - lastUpSwitchMs_ < FAILED_PROBE_MS) {
+            upHoldMs_ = std::min(upHoldMs_ * 2, UP_HOLD_MAX_MS);
+        }
+        switchesDown_++;
+        SwitchTo(nowMs, next, queueBytes);
+        return;
+    }
+
+    if (queueBytes > QUEUE_LOW_BYTES || target_ == 0) {
+        lowQueueSinceMs_ = -1;
+        return;
+    }
+    if (lowQueueSinceMs_ < 0) {
+        lowQueueSinceMs_ = nowMs;
+    }
+    if (nowMs - lowQueueSinceMs_ >= upHoldMs_) {
+        lowQueueSinceMs_ = -1;
+        lastUpSwitchMs_ = nowMs;
+        switchesUp_++;
+        SwitchTo(nowMs, target_ - 1, queueBytes);
+    }
+}
+
+void AbrController::SwitchTo(int64_t nowMs, int32_t rendition, size_t queueBytes) {
+    AbrSwitch decision;
+    decision.timeMs = nowMs - startMs_;
+    decision.from = target_;
+    decision.to = rendition;
+    decision.drainKbps = static_cast<uint32_t>(drainBps_ / 1000.0);
+    decision.queueBytes = static_cast<uint32_t>(queueBytes);
+
+    if (history_.size() == MAX_HISTORY) {
+        history_.pop_front();
+    }
+    history_.push_back(decision);
+    target_ = rendition;
+}
+
+}  // namespace server
@@ -0,0 +1,87 @@
+#ifndef ABR_CONTROLLER_H
+#define ABR_CONTROLLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace server {
+
+/**
+ * @brief One rendition switch decision
+ */
+struct AbrSwitch {
+    int64_t timeMs;       // connection time of the decision
+    int32_t from;         // rendition index before
+    int32_t to;           // rendition index after
+    uint32_t drainKbps;   // smoothed drain rate at the decision
+    uint32_t queueBytes;  // socket send queue depth at the decision
+};
+
+/**
+ * @brief Per-connection adaptive bitrate controller
+ *
+ * Fed with periodic samples of the bytes handed to the socket and the
+ * socket send queue depth. The drain rate is what actually left the queue
+ * between samples. A growing queue means the link cannot keep up and
+ * steps down to a rendition the drain rate can carry; an empty queue held
+ * for a while probes one step up. The hold before probing doubles when a
+ * probe fails quickly, so an unstable link does not oscillate.
+ *
+ * The controller only picks a target; the caller applies it at the next
+ * IDR boundary.
+ */
+class AbrController {
+public:
+    AbrController();
+
+    /**
+     * @brief Set the ladder and start at the highest rendition
+     * @param bitratesBps rendition bitrates, index 0 highest
+     */
+    void Reset(const std::vector<uint32_t>& bitratesBps);
+
+    /**
+     * @brief Feed one sample
+     * @param nowMs monotonic time in ms
+     * @param bytesSent total bytes written to the socket so far
+     * @param queueBytes bytes currently queued in the socket
+     */
+    void OnSample(int64_t nowMs, uint64_t bytesSent, size_t queueBytes);
+
+    /**
+     * @brief Get the rendition the connection should switch to
+     */
+    int32_t GetTarget() const { return target_; }
+
+    /**
+     * @brief Get the switch decisions (most recent last, bounded)
+     */
+    const std::deque<AbrSwitch>& GetHistory() const { return history_; }
+
+    uint32_t GetSwitchesUp() const { return switchesUp_; }
+    uint32_t GetSwitchesDown() const { return switchesDown_; }
+
+private:
+    void SwitchTo(int64_t nowMs, int32_t rendition, size_t queueBytes);
+
+    std::vector<uint32_t> bitratesBps_;
+    int32_t target_;
+    bool hasSample_;
+    int64_t startMs_;
+    int64_t lastSampleMs_;
+    uint64_t lastBytesSent_;
+    size_t lastQueueBytes_;
+    double drainBps_;          // EWMA of the drain rate
+    int64_t lowQueueSinceMs_;  // -1 while the queue is not low
+    int64_t lastUpSwitchMs_;
+    int64_t upHoldMs_;
+    uint32_t switchesUp_;
+    uint32_t switchesDown_;
+    std::deque<AbrSwitch> history_;
+};
+
+}  // namespace server
+
+#endif  // ABR_CONTROLLER_H
@@ -0,0 +1,136 @@
+// Remux cost microbenchmark: Annex-B protocol framing versus fMP4 remux
+// (moof/mdat per frame) plus framing, per access unit and per stream.
+//
+// Usage: fmp4_mux_bench [frame_count] [avg_frame_bytes] [gop] [fps]
+//   frame_count      access units to remux (default: 20000)
+//   avg_frame_bytes  average slice payload size in bytes (default: 8192)
+//   gop              keyframe interval in frames (default: 50)
+//   fps              stream frame rate for the per-stream figure (default: 25)
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "fmp4_muxer.h"
+#include "frame_protocol.h"
+
+using namespace server;
+
+static const size_t DEFAULT_FRAME_COUNT = 20000;
+static const size_t DEFAULT_AVG_FRAME_BYTES = 8192;
+static const size_t DEFAULT_GOP = 50;
+static const double DEFAULT_FPS = 25.0;
+
+// 1280x720 High profile SPS and a PPS, as sent ahead of every keyframe
+static const uint8_t PARAMETER_SETS[] = {
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1F, 0xAC, 0xD9, 0x40, 0x50,
+    0x05, 0xBB, 0x01, 0x10, 0x00, 0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03,
+    0x03, 0x20, 0xF1, 0x83, 0x19, 0x60,
+    0x00, 0x00, 0x00, 0x01, 0x68, 0xEB, 0xE3, 0xCB, 0x22, 0xC0,
+};
+
+static double SecondsSince(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Annex-B access unit: parameter sets on keyframes, then one slice whose
+// payload never forms a start code
+static std::vector<uint8_t> MakeAccessUnit(std::mt19937& rng, size_t payloadBytes,
+                                           bool isKeyframe) {
+    std::vector<uint8_t> au;
+    if (isKeyframe) {
+        au.assign(PARAMETER_SETS, PARAMETER_SETS + sizeof(PARAMETER_SETS));
+    }
+    const uint8_t sliceHeader[] = {0x00, 0x00, 0x00, 0x01,
+                                   static_cast<uint8_t>(isKeyframe ? 0x65 : 0x41)};
+    au.insert(au.end(), sliceHeader, sliceHeader + sizeof(sliceHeader));
+    std::uniform_int_distribution<uint32_t> byteDist(1, 255);
+    for (size_t i = 0; i < payloadBytes; ++i) {
+        au.push_back(static_cast<uint8_t>(byteDist(rng)));
+    }
+    return au;
+}
+
+int main(int argc, char* argv[]) {
+    size_t frameCount = (argc > 1) ? static_cast<size_t>(std::atol(argv[1])) : DEFAULT_FRAME_COUNT;
+    size_t avgBytes = (argc > 2) ? static_cast<size_t>(std::atol(argv[2])) : DEFAULT_AVG_FRAME_BYTES;
+    size_t gop = (argc > 3) ? static_cast<size_t>(std::atol(argv[3])) : DEFAULT_GOP;
+    double fps = (argc > 4) ? std::atof(argv[4]) : DEFAULT_FPS;
+    if (frameCount == 0 || avgBytes < 2 || gop == 0 || fps <= 0.0) {
+        std::fprintf(stderr, "Usage: %s [frame_count] [avg_frame_bytes] [gop] [fps]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> sizeDist(1, avgBytes * 2 - 1);
+    std::vector<std::vector<uint8_t>> accessUnits;
+    size_t totalBytes = 0;
+    for (size_t i = 0; i < frameCount; ++i) {
+        bool isKeyframe = (i % gop == 0);
+        // Keyframes are several times larger than the frames between them
+        size_t payload = isKeyframe ? sizeDist(rng) * 4 : sizeDist(rng);
+        accessUnits.push_back(MakeAccessUnit(rng, payload, isKeyframe));
+        totalBytes += accessUnits.back().size();
+    }
+    double intervalMs = 1000.0 / fps;
+
+    std::printf("%zu access units, %.1f MiB, GOP %zu\n", frameCount,
+                totalBytes / (1024.0 * 1024.0), gop);
+
+    size_t annexbBytes = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frameCount; ++i) {
+        const std::vector<uint8_t>& au = accessUnits[i];
+        int64_t timeMs = static_cast<int64_t>(i * intervalMs);
+        auto frames = FrameProtocol::EncodeVideoFrame(
+            au.data(), au.size(), VideoCodec::H264,
+            (i % gop == 0) ? VideoFrameType::IDR : VideoFrameType::P_FRAME,
+            timeMs, timeMs, timeMs, static_cast<uint16_t>(i));
+        for (const auto& frame : frames) {
+            annexbBytes += frame.size();
+        }
+    }
+    double annexbSeconds = SecondsSince(begin);
+
+    Fmp4Muxer muxer;
+    muxer.Reset(false, intervalMs);
+    std::vector<uint8_t> initSegment;
+    std::vector<uint8_t> mediaSegment;
+    size_t fmp4Bytes = 0;
+    begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frameCount; ++i) {
+        const std::vector<uint8_t>& au = accessUnits[i];
+        int64_t timeMs = static_cast<int64_t>(i * intervalMs);
+        bool isKeyframe = (i % gop == 0);
+        if (!muxer.WriteAccessUnit(au.data(), au.size(), timeMs, timeMs, isKeyframe,
+                                   initSegment, mediaSegment)) {
+            continue;
+        }
+        if (!initSegment.empty()) {
+            fmp4Bytes += initSegment.size();
+        }
+        auto frames = FrameProtocol::EncodeVideoFrame(
+            mediaSegment.data(), mediaSegment.size(), VideoCodec::H264,
+            isKeyframe ? VideoFrameType::IDR : VideoFrameType::P_FRAME,
+            timeMs, timeMs, timeMs, static_cast<uint16_t>(i));
+        for (const auto& frame : frames) {
+            fmp4Bytes += frame.size();
+        }
+    }
+    double fmp4Seconds = SecondsSince(begin);
+
+    // CPU share of one core that a single stream at the given fps costs
+    double annexbUsPerFrame = annexbSeconds * 1e6 / frameCount;
+    double fmp4UsPerFrame = fmp4Seconds * 1e6 / frameCount;
+    std::printf("  %-16s %12s %12s %14s\n", "mode", "us/frame", "MiB/s", "core %/stream");
+    std::printf("  %-16s %12.2f %12.1f %14.4f\n", "annexb", annexbUsPerFrame,
+                totalBytes / annexbSeconds / (1024.0 * 1024.0), annexbUsPerFrame * fps / 1e4);
+    std::printf("  %-16s %12.2f %12.1f %14.4f\n", "fmp4 remux", fmp4UsPerFrame,
+                totalBytes / fmp4Seconds / (1024.0 * 1024.0), fmp4UsPerFrame * fps / 1e4);
+    std::printf("  wire bytes: annexb %zu, fmp4 %zu (%+.2f%%)\n", annexbBytes, fmp4Bytes,
+                (static_cast<double>(fmp4Bytes) - annexbBytes) * 100.0 / annexbBytes);
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Fragment sizing benchmark: WebSocket messages, TLS records, send()
+// calls and wire bytes for the fixed FRAGMENT_THRESHOLD versus the
+// per-connection size from FrameProtocol::SelectFragmentSize, over a few
+// path profiles. TlsServer::SendData writes one record per send(), so
+// records and syscalls are counted as equal.
+//
+// Usage: fragment_size_bench [frame_count] [avg_frame_bytes] [gop]
+//   frame_count      access units to frame (default: 5000)
+//   avg_frame_bytes  average slice payload size in bytes (default: 12000)
+//   gop              keyframe interval in frames (default: 50)
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "frame_protocol.h"
+
+using namespace server;
+
+static const size_t DEFAULT_FRAME_COUNT = 5000;
+static const size_t DEFAULT_AVG_FRAME_BYTES = 12000;
+static const size_t DEFAULT_GOP = 50;
+
+// TLS 1.2 AES-GCM: 5-byte record header, 8-byte explicit nonce, 16-byte tag
+static const size_t TLS_RECORD_OVERHEAD = 29;
+
+struct PathProfile {
+    const char* name;
+    size_t maxRecordPayload;
+    uint32_t mssBytes;
+    uint32_t cwndSegments;
+    size_t clientMax;
+};
+
+static const PathProfile PROFILES[] = {
+    {"no path info", 16384, 0, 0, 0},
+    {"WAN cwnd 10", 16384, 1448, 10, 0},
+    {"LAN cwnd 200", 16384, 1448, 200, 0},
+    {"client max 8192", 16384, 1448, 200, 8192},
+    {"4 KB records", 4096, 1448, 10, 0},
+};
+
+struct WireCount {
+    size_t messages;
+    size_t records;
+    size_t wireBytes;
+};
+
+// Server-to-client WebSocket frames are unmasked
+static size_t WebSocketHeaderSize(size_t payloadSize) {
+    if (payloadSize < 126) {
+        return 2;
+    }
+    return (payloadSize <= 0xFFFF) ? 4 : 10;
+}
+
+// Annex-B access unit with one slice whose payload never forms a start code
+static std::vector<uint8_t> MakeAccessUnit(std::mt19937& rng, size_t payloadBytes,
+                                           bool isKeyframe) {
+    std::vector<uint8_t> au = {0x00, 0x00, 0x00, 0x01,
+                               static_cast<uint8_t>(isKeyframe ? 0x65 : 0x41)};
+    std::uniform_int_distribution<uint32_t> byteDist(1, 255);
+    for (size_t i = 0; i < payloadBytes; ++i) {
+        au.push_back(static_cast<uint8_t>(byteDist(rng)));
+    }
+    return au;
+}
+
+static WireCount CountWire(const std::vector<std::vector<uint8_t>>& accessUnits, size_t gop,
+                           size_t fragmentSize, size_t maxRecordPayload) {
+    WireCount count = {0, 0, 0};
+    for (size_t i = 0; i < accessUnits.size(); ++i) {
+        const std::vector<uint8_t>& au = accessUnits[i];
+        int64_t timeMs = static_cast<int64_t>(i * 40);
+        auto frames = FrameProtocol::EncodeVideoFrame(
+            au.data(), au.size(), VideoCodec::H264,
+            (i % gop == 0) ? VideoFrameType::IDR : VideoFrameType::P_FRAME,
+            timeMs, timeMs, timeMs, static_cast<uint16_t>(i), false, fragmentSize);
+        for (const auto& frame : frames) {
+            size_t wsBytes = WebSocketHeaderSize(frame.size()) + frame.size();
+            size_t records = (wsBytes + maxRecordPayload - 1) / maxRecordPayload;
+            count.messages++;
+            count.records += records;
+            count.wireBytes += wsBytes + records * TLS_RECORD_OVERHEAD;
+        }
+    }
+    return count;
+}
+
+static double PercentChange(size_t before, size_t after) {
+    return (static_cast<double>(after) - before) * 100.0 / before;
+}
+
+int main(int argc, char* argv[]) {
+    size_t frameCount = (argc > 1) ? static_cast<size_t>(std::atol(argv[1])) : DEFAULT_FRAME_COUNT;
+    size_t avgBytes = (argc > 2) ? static_cast<size_t>(std::atol(argv[2])) : DEFAULT_AVG_FRAME_BYTES;
+    size_t gop = (argc > 3) ? static_cast<size_t>(std::atol(argv[3])) : DEFAULT_GOP;
+    if (frameCount == 0 || avgBytes < 2 || gop == 0) {
+        std::fprintf(stderr, "Usage: %s [frame_count] [avg_frame_bytes] [gop]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> sizeDist(1, avgBytes * 2 - 1);
+    std::vector<std::vector<uint8_t>> accessUnits;
+    size_t totalBytes = 0;
+    for (size_t i = 0; i < frameCount; ++i) {
+        bool isKeyframe = (i % gop == 0);
+        // Keyframes are several times larger than the frames between them
+        size_t payload = isKeyframe ? sizeDist(rng) * 6 : sizeDist(rng);
+        accessUnits.push_back(MakeAccessUnit(rng, payload, isKeyframe));
+        totalBytes += accessUnits.back().size();
+    }
+
+    std::printf("%zu access units, %.1f MiB, GOP %zu\n", frameCount,
+                totalBytes / (1024.0 * 1024.0), gop);
+    std::printf("  %-16s %9s %10s %10s %10s %10s %9s\n", "profile", "fragment", "messages",
+                "records", "vs fixed", "wire MiB", "vs fixed");
+
+    for (const PathProfile& profile : PROFILES) {
+        size_t fragmentSize = FrameProtocol::SelectFragmentSize(
+            profile.maxRecordPayload, profile.mssBytes, profile.cwndSegments, profile.clientMax);
+        WireCount fixed = CountWire(accessUnits, gop, FRAGMENT_THRESHOLD,
+                                    profile.maxRecordPayload);
+        WireCount tuned = CountWire(accessUnits, gop, fragmentSize, profile.maxRecordPayload);
+
+        std::printf("  %-16s %9u %10zu %10zu %10s %10.2f %9s\n", profile.name,
+                    static_cast<unsigned>(FRAGMENT_THRESHOLD), fixed.messages, fixed.records, "",
+                    fixed.wireBytes / (1024.0 * 1024.0), "");
+        std::printf("  %-16s %9zu %10zu %10zu %+9.2f%% %10.2f %+8.2f%%\n", "", fragmentSize,
+                    tuned.messages, tuned.records, PercentChange(fixed.records, tuned.records),
+                    tuned.wireBytes / (1024.0 * 1024.0),
+                    PercentChange(fixed.wireBytes, tuned.wireBytes));
+    }
+    std::printf("  (records = send() calls: one TLS record per write)\n");
+    return 0;
+}
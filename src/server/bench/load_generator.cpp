@@ -0,0 +1,379 @@
+// End-to-end load generator: N concurrent WSS clients pull a stream the way
+// the browser player does. With a seek interval each client also seeks to
+// random positions and measures seek-to-first-frame latency (seek sent to
+// first video frame received after the DISCONTINUITY marker).
+//
+// Usage: load_generator <host> <port> [clients] [seconds] [path] [seek_interval_ms] [seek_range_ms]
+//   clients           concurrent connections (default: 10)
+//   seconds           test duration (default: 30)
+//   path              stream path, e.g. /stream/lobby (default: /)
+//   seek_interval_ms  seek every N ms, 0 = never (default: 0)
+//   seek_range_ms     seek positions are drawn from [0, range) (default: 60000)
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_protocol.h"
+
+using namespace server;
+using Clock = std::chrono::steady_clock;
+
+static const int32_t DEFAULT_CLIENTS = 10;
+static const int32_t DEFAULT_SECONDS = 30;
+static const int32_t DEFAULT_SEEK_RANGE_MS = 60000;
+static const uint32_t READ_TIMEOUT_MS = 50;
+static const size_t READ_CHUNK_BYTES = 64 * 1024;
+
+struct LoadOptions {
+    std::string host;
+    std::string port;
+    std::string path;
+    int32_t seconds;
+    int32_t seekIntervalMs;
+    int32_t seekRangeMs;
+};
+
+struct ClientResult {
+    bool isConnected;
+    uint64_t bytes;
+    uint64_t messages;
+    uint64_t videoFrames;
+    std::vector<double> seekLatenciesMs;
+};
+
+static double MillisecondsSince(Clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+/**
+ * @brief One TLS WebSocket client connection
+ */
+class LoadClient {
+public:
+    explicit LoadClient(uint32_t seed) : rng_(seed) {
+        mbedtls_net_init(&net_);
+        mbedtls_ssl_init(&ssl_);
+        mbedtls_ssl_config_init(&config_);
+        mbedtls_ctr_drbg_init(&ctrDrbg_);
+        mbedtls_entropy_init(&entropy_);
+    }
+
+    ~LoadClient() {
+        mbedtls_ssl_close_notify(&ssl_);
+        mbedtls_net_free(&net_);
+        mbedtls_ssl_free(&ssl_);
+        mbedtls_ssl_config_free(&config_);
+        mbedtls_ctr_drbg_free(&ctrDrbg_);
+        mbedtls_entropy_free(&entropy_);
+    }
+
+    bool Connect(const LoadOptions& options) {
+        const char* personalization = "load_generator";
+        if (mbedtls_ctr_drbg_seed(&ctrDrbg_, mbedtls_entropy_func, &entropy_,
+                                  reinterpret_cast<const unsigned char*>(personalization),
+                                  std::strlen(personalization)) != 0 ||
+            mbedtls_net_connect(&net_, options.host.c_str(), options.port.c_str(),
+                                MBEDTLS_NET_PROTO_TCP) != 0 ||
+            mbedtls_ssl_config_defaults(&config_, MBEDTLS_SSL_IS_CLIENT,
+                                        MBEDTLS_SSL_TRANSPORT_STREAM,
+                                        MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+            return false;
+        }
+
+        // Test servers use self-signed certificates
+        mbedtls_ssl_conf_authmode(&config_, MBEDTLS_SSL_VERIFY_NONE);
+        mbedtls_ssl_conf_rng(&config_, mbedtls_ctr_drbg_random, &ctrDrbg_);
+        mbedtls_ssl_conf_read_timeout(&config_, READ_TIMEOUT_MS);
+        if (mbedtls_ssl_setup(&ssl_, &config_) != 0) {
+            return false;
+        }
+        mbedtls_ssl_set_bio(&ssl_, &net_, mbedtls_net_send, nullptr, mbedtls_net_recv_timeout);
+
+        int ret;
+        while ((ret = mbedtls_ssl_handshake(&ssl_)) != 0) {
+            if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+                return false;
+            }
+        }
+        return Upgrade(options);
+    }
+
+    void Run(const LoadOptions& options, ClientResult& result) {
+        auto deadline = Clock::now() + std::chrono::seconds(options.seconds);
+        auto nextSeek = Clock::now() + std::chrono::milliseconds(options.seekIntervalMs);
+        std::uniform_int_distribution<int64_t> positionDist(0, options.seekRangeMs - 1);
+        std::vector<uint8_t> chunk(READ_CHUNK_BYTES);
+
+        while (Clock::now() < deadline) {
+            if (options.seekIntervalMs > 0 && isStreaming_ && Clock::now() >= nextSeek) {
+                SendSeek(positionDist(rng_));
+                nextSeek = Clock::now() + std::chrono::milliseconds(options.seekIntervalMs);
+            }
+
+            int ret = mbedtls_ssl_read(&ssl_, chunk.data(), chunk.size());
+            if (ret == MBEDTLS_ERR_SSL_TIMEOUT || ret == MBEDTLS_ERR_SSL_WANT_READ) {
+                continue;
+            }
+            if (ret <= 0) {
+                break;
+            }
+            result.bytes += static_cast<uint64_t>(ret);
+            recvBuffer_.insert(recvBuffer_.end(), chunk.data(), chunk.data() + ret);
+            ProcessFrames(result);
+        }
+    }
+
+private:
+    bool Upgrade(const LoadOptions& options) {
+        std::string request =
+            "GET " + options.path + " HTTP/1.1\r\n"
+            "Host: " + options.host + ":" + options.port + "\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+        if (!WriteAll(reinterpret_cast<const uint8_t*>(request.data()), request.size())) {
+            return false;
+        }
+
+        std::vector<uint8_t> chunk(READ_CHUNK_BYTES);
+        std::string response;
+        size_t headerEnd;
+        while ((headerEnd = response.find("\r\n\r\n")) == std::string::npos) {
+            int ret = mbedtls_ssl_read(&ssl_, chunk.data(), chunk.size());
+            if (ret == MBEDTLS_ERR_SSL_TIMEOUT || ret == MBEDTLS_ERR_SSL_WANT_READ) {
+                continue;
+            }
+            if (ret <= 0) {
+                return false;
+            }
+            response.append(reinterpret_cast<const char*>(chunk.data()), static_cast<size_t>(ret));
+        }
+
+        // Frames may follow the handshake response in the same read
+        recvBuffer_.assign(response.begin() + headerEnd + 4, response.end());
+        return response.compare(0, 12, "HTTP/1.1 101") == 0;
+    }
+
+    bool WriteAll(const uint8_t* data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            int ret = mbedtls_ssl_write(&ssl_, data + done, size - done);
+            if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                continue;
+            }
+            if (ret <= 0) {
+                return false;
+            }
+            done += static_cast<size_t>(ret);
+        }
+        return true;
+    }
+
+    // Client-to-server WebSocket frames must be masked
+    bool SendWsFrame(uint8_t opcode, const uint8_t* payload, size_t size) {
+        std::vector<uint8_t> frame;
+        frame.push_back(static_cast<uint8_t>(0x80 | opcode));
+        if (size < 126) {
+            frame.push_back(static_cast<uint8_t>(0x80 | size));
+        } else {
+            frame.push_back(0x80 | 126);
+            frame.push_back(static_cast<uint8_t>(size >> 8));
+            frame.push_back(static_cast<uint8_t>(size & 0xFF));
+        }
+        uint8_t mask[4];
+        for (auto& byte : mask) {
+            byte = static_cast<uint8_t>(rng_());
+        }
+        frame.insert(frame.end(), mask, mask + 4);
+        for (size_t i = 0; i < size; ++i) {
+            frame.push_back(payload[i] ^ mask[i % 4]);
+        }
+        return WriteAll(frame.data(), frame.size());
+    }
+
+    void SendSeek(int64_t positionMs) {
+        std::vector<uint8_t> payload;
+        FrameProtocol::WriteBE64(payload, positionMs);
+        auto control = FrameProtocol::EncodeControlFrame(ControlType::SEEK, payload.data(),
+                                                         payload.size(), 0);
+        if (SendWsFrame(0x2, control.data(), control.size())) {
+            seekSentAt_ = Clock::now();
+            isSeekPending_ = true;
+            isMarkerSeen_ = false;
+        }
+    }
+
+    void ProcessFrames(ClientResult& result) {
+        size_t offset = 0;
+        while (recvBuffer_.size() - offset >= 2) {
+            const uint8_t* frame = recvBuffer_.data() + offset;
+            size_t available = recvBuffer_.size() - offset;
+            uint8_t opcode = frame[0] & 0x0F;
+            size_t headerSize = 2;
+            uint64_t payloadSize = frame[1] & 0x7F;
+            if (payloadSize == 126) {
+                headerSize = 4;
+                if (available < headerSize) break;
+                payloadSize = (static_cast<uint64_t>(frame[2]) << 8) | frame[3];
+            } else if (payloadSize == 127) {
+                headerSize = 10;
+                if (available < headerSize) break;
+                payloadSize = static_cast<uint64_t>(FrameProtocol::ReadBE64(frame + 2));
+            }
+            if (available - headerSize < payloadSize) {
+                break;
+            }
+
+            HandleMessage(opcode, frame + headerSize, static_cast<size_t>(payloadSize), result);
+            offset += headerSize + static_cast<size_t>(payloadSize);
+        }
+        recvBuffer_.erase(recvBuffer_.begin(), recvBuffer_.begin() + offset);
+    }
+
+    void HandleMessage(uint8_t opcode, const uint8_t* payload, size_t size, ClientResult& result) {
+        result.messages++;
+
+        if (opcode == 0x1) {
+            std::string text(reinterpret_cast<const char*>(payload), size);
+            if (text.find("\"media-offer\"") != std::string::npos) {
+                std::string answer = "{\"type\":\"media-answer\",\"payload\":{\"accepted\":true}}";
+                SendWsFrame(0x1, reinterpret_cast<const uint8_t*>(answer.data()), answer.size());
+                isStreaming_ = true;
+            }
+            return;
+        }
+        if (opcode != 0x2 || size < FIXED_HEADER_SIZE) {
+            return;
+        }
+
+        ControlMessage control;
+        if (FrameProtocol::ParseControlFrame(payload, size, control)) {
+            if (control.type == ControlType::DISCONTINUITY) {
+                isMarkerSeen_ = true;
+            }
+            return;
+        }
+
+        // Count a video frame once: unfragmented or its first fragment
+        bool isFirstPiece = (payload[4] & FLAG_FRAGMENT) == 0 ||
+                            (size >= FIXED_HEADER_SIZE + 4 &&
+                             payload[FIXED_HEADER_SIZE + 2] == 0 && payload[FIXED_HEADER_SIZE + 3] == 0);
+        if (payload[3] != static_cast<uint8_t>(MsgType::VIDEO) || !isFirstPiece) {
+            return;
+        }
+        result.videoFrames++;
+        if (isSeekPending_ && isMarkerSeen_) {
+            result.seekLatenciesMs.push_back(MillisecondsSince(seekSentAt_));
+            isSeekPending_ = false;
+        }
+    }
+
+    mbedtls_net_context net_;
+    mbedtls_ssl_context ssl_;
+    mbedtls_ssl_config config_;
+    mbedtls_ctr_drbg_context ctrDrbg_;
+    mbedtls_entropy_context entropy_;
+    std::mt19937 rng_;
+    std::vector<uint8_t> recvBuffer_;
+    bool isStreaming_ = false;
+    bool isSeekPending_ = false;
+    bool isMarkerSeen_ = false;
+    Clock::time_point seekSentAt_;
+};
+
+static void RunClient(const LoadOptions& options, uint32_t seed, ClientResult& result) {
+    LoadClient client(seed);
+    result.isConnected = client.Connect(options);
+    if (result.isConnected) {
+        client.Run(options, result);
+    }
+}
+
+static double Percentile(std::vector<double>& values, double fraction) {
+    size_t index = static_cast<size_t>(fraction * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: %s <host> <port> [clients] [seconds] [path] "
+                     "[seek_interval_ms] [seek_range_ms]\n", argv[0]);
+        return 1;
+    }
+
+    LoadOptions options;
+    options.host = argv[1];
+    options.port = argv[2];
+    int32_t clientCount = (argc > 3) ? std::atoi(argv[3]) : DEFAULT_CLIENTS;
+    options.seconds = (argc > 4) ? std::atoi(argv[4]) : DEFAULT_SECONDS;
+    options.path = (argc > 5) ? argv[5] : "/";
+    options.seekIntervalMs = (argc > 6) ? std::atoi(argv[6]) : 0;
+    options.seekRangeMs = (argc > 7) ? std::atoi(argv[7]) : DEFAULT_SEEK_RANGE_MS;
+    if (clientCount <= 0 || options.seconds <= 0 || options.seekRangeMs <= 0) {
+        std::fprintf(stderr, "clients, seconds and seek_range_ms must be positive\n");
+        return 1;
+    }
+
+    std::printf("%d clients -> %s:%s%s for %d s", clientCount, options.host.c_str(),
+                options.port.c_str(), options.path.c_str(), options.seconds);
+    if (options.seekIntervalMs > 0) {
+        std::printf(", seeking every %d ms", options.seekIntervalMs);
+    }
+    std::printf("\n");
+
+    std::vector<ClientResult> results(static_cast<size_t>(clientCount), ClientResult());
+    std::vector<std::thread> threads;
+    auto begin = Clock::now();
+    for (int32_t i = 0; i < clientCount; ++i) {
+        threads.emplace_back(RunClient, std::cref(options), static_cast<uint32_t>(i + 1),
+                             std::ref(results[static_cast<size_t>(i)]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsedSec = MillisecondsSince(begin) / 1000.0;
+
+    int32_t connected = 0;
+    uint64_t bytes = 0;
+    uint64_t messages = 0;
+    uint64_t videoFrames = 0;
+    std::vector<double> seekLatencies;
+    for (const auto& result : results) {
+        connected += result.isConnected ? 1 : 0;
+        bytes += result.bytes;
+        messages += result.messages;
+        videoFrames += result.videoFrames;
+        seekLatencies.insert(seekLatencies.end(), result.seekLatenciesMs.begin(),
+                             result.seekLatenciesMs.end());
+    }
+
+    std::printf("  connected:    %d/%d\n", connected, clientCount);
+    std::printf("  received:     %.1f MiB (%.2f Mbit/s total)\n", bytes / (1024.0 * 1024.0),
+                bytes * 8.0 / 1e6 / elapsedSec);
+    std::printf("  messages:     %llu\n", static_cast<unsigned long long>(messages));
+    std::printf("  video frames: %llu (%.1f fps per client)\n",
+                static_cast<unsigned long long>(videoFrames),
+                (connected > 0) ? videoFrames / elapsedSec / connected : 0.0);
+    if (!seekLatencies.empty()) {
+        std::printf("  seek to first frame: %zu seeks, p50 %.1f ms, p95 %.1f ms, max %.1f ms\n",
+                    seekLatencies.size(), Percentile(seekLatencies, 0.5),
+                    Percentile(seekLatencies, 0.95),
+                    *std::max_element(seekLatencies.begin(), seekLatencies.end()));
+    }
+    return (connected == clientCount) ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+// Load and scan microbenchmark: PacketStore (SoA metadata + slab arena)
+// versus the previous vector-per-packet layout.
+//
+// Usage: packet_store_bench [packet_count] [avg_packet_bytes]
+//   packet_count      number of packets (default: 1000000)
+//   avg_packet_bytes  average payload size in bytes (default: 1024)
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "packet_store.h"
+
+using namespace server;
+
+static const size_t DEFAULT_PACKET_COUNT = 1000000;
+static const size_t DEFAULT_AVG_PACKET_BYTES = 1024;
+static const int32_t SCAN_ITERATIONS = 20;
+
+// Previous layout: each packet owns a heap vector next to its metadata
+struct LegacyPacket {
+    PacketIndexEntry entry;
+    std::vector<uint8_t> data;
+};
+
+static double SecondsSince(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static PacketIndexEntry MakeEntry(size_t i, uint32_t size) {
+    PacketIndexEntry entry;
+    entry.offset = i * 1024;
+    entry.size = size;
+    entry.ptsMs = static_cast<int64_t>(i) * 10;
+    entry.dtsMs = entry.ptsMs;
+    entry.type = (i % 3 == 0) ? MediaType::AUDIO : MediaType::VIDEO;
+    entry.isKeyframe = (i % 250 == 0);
+    entry.frameType = entry.isKeyframe ? VideoFrameType::IDR : VideoFrameType::P_FRAME;
+    entry.isReference = true;
+    entry.temporalId = 0;
+    return entry;
+}
+
+// Count packets due at each playback position, as the MP4 timer loop does
+static size_t ScanLegacy(const std::vector<LegacyPacket>& packets, int64_t stepMs) {
+    size_t due = 0;
+    int64_t lastPts = packets.back().entry.ptsMs;
+    for (int64_t now = 0; now <= lastPts; now += stepMs) {
+        for (const auto& pkt : packets) {
+            if (pkt.entry.ptsMs > now) break;
+            due++;
+        }
+    }
+    return due;
+}
+
+static size_t ScanStore(const PacketStore& store, int64_t stepMs) {
+    size_t due = 0;
+    int64_t lastPts = store.GetPtsMs(store.GetCount() - 1);
+    for (int64_t now = 0; now <= lastPts; now += stepMs) {
+        for (size_t i = 0; i < store.GetCount(); ++i) {
+            if (store.GetPtsMs(i) > now) break;
+            due++;
+        }
+    }
+    return due;
+}
+
+int main(int argc, char* argv[]) {
+    size_t packetCount = (argc > 1) ? static_cast<size_t>(std::atol(argv[1])) : DEFAULT_PACKET_COUNT;
+    size_t avgBytes = (argc > 2) ? static_cast<size_t>(std::atol(argv[2])) : DEFAULT_AVG_PACKET_BYTES;
+    if (packetCount == 0 || avgBytes < 2) {
+        std::fprintf(stderr, "Usage: %s [packet_count] [avg_packet_bytes]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<uint32_t> sizeDist(1, static_cast<uint32_t>(avgBytes * 2 - 1));
+    std::vector<uint32_t> sizes(packetCount);
+    size_t maxSize = 0;
+    size_t totalBytes = 0;
+    for (auto& size : sizes) {
+        size = sizeDist(rng);
+        maxSize = (size > maxSize) ? size : maxSize;
+        totalBytes += size;
+    }
+    std::vector<uint8_t> source(maxSize, 0xA5);
+
+    std::printf("%zu packets, %.1f MiB payload\n", packetCount, totalBytes / (1024.0 * 1024.0));
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<LegacyPacket> legacy;
+    for (size_t i = 0; i < packetCount; ++i) {
+        LegacyPacket pkt;
+        pkt.entry = MakeEntry(i, sizes[i]);
+        pkt.data.assign(source.data(), source.data() + sizes[i]);
+        legacy.push_back(std::move(pkt));
+    }
+    double legacyLoad = SecondsSince(begin);
+
+    begin = std::chrono::steady_clock::now();
+    PacketStore store;
+    for (size_t i = 0; i < packetCount; ++i) {
+        if (!store.Append(MakeEntry(i, sizes[i]), source.data(), sizes[i])) {
+            std::fprintf(stderr, "Arena allocation failed\n");
+            return 1;
+        }
+    }
+    double storeLoad = SecondsSince(begin);
+
+    // Scan step chosen so that each layout walks ~SCAN_ITERATIONS full tables
+    int64_t stepMs = static_cast<int64_t>(packetCount) * 10 / SCAN_ITERATIONS;
+    if (stepMs <= 0) stepMs = 1;
+
+    begin = std::chrono::steady_clock::now();
+    size_t legacyDue = ScanLegacy(legacy, stepMs);
+    double legacyScan = SecondsSince(begin);
+
+    begin = std::chrono::steady_clock::now();
+    size_t storeDue = ScanStore(store, stepMs);
+    double storeScan = SecondsSince(begin);
+
+    std::printf("  %-16s %10s %10s\n", "layout", "load (s)", "scan (s)");
+    std::printf("  %-16s %10.3f %10.3f\n", "vector/packet", legacyLoad, legacyScan);
+    std::printf("  %-16s %10.3f %10.3f%s\n", "soa + arena", storeLoad, storeScan,
+                legacyDue == storeDue ? "" : "  MISMATCH");
+    std::printf("  arena: %.1f MiB used, %.1f MiB reserved\n",
+                store.GetArenaBytes() / (1024.0 * 1024.0),
+                store.GetArenaReservedBytes() / (1024.0 * 1024.0));
+    return 0;
+}
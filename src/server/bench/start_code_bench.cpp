@@ -0,0 +1,102 @@
+// Throughput microbenchmark for StartCodeScanner on a synthetic Annex B stream.
+//
+// Usage: start_code_bench [size_mb] [avg_nal_bytes]
+//   size_mb        synthetic stream size in MiB (default: 2048)
+//   avg_nal_bytes  average NAL unit size in bytes (default: 8192)
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "start_code_scanner.h"
+
+using namespace server;
+
+static const size_t DEFAULT_SIZE_MB = 2048;
+static const size_t DEFAULT_AVG_NAL_BYTES = 8192;
+static const int32_t ITERATIONS = 3;
+
+// Random payload without emulated start codes (no 00 00 0x, x <= 3),
+// with start codes of both lengths inserted between NAL units.
+static std::vector<uint8_t> GenerateStream(size_t size, size_t avgNalBytes, size_t& nalCount) {
+    std::vector<uint8_t> stream(size);
+    std::mt19937_64 rng(12345);
+    std::uniform_int_distribution<size_t> nalSizeDist(avgNalBytes / 2, avgNalBytes * 3 / 2);
+
+    nalCount = 0;
+    size_t pos = 0;
+    while (pos + 4 < size) {
+        bool isLong = (rng() & 1) != 0;
+        stream[pos++] = 0;
+        stream[pos++] = 0;
+        if (isLong) stream[pos++] = 0;
+        stream[pos++] = 1;
+        nalCount++;
+
+        size_t nalEnd = pos + nalSizeDist(rng);
+        if (nalEnd > size) nalEnd = size;
+        uint64_t bits = 0;
+        for (size_t i = pos; i < nalEnd; ++i) {
+            if ((i & 7) == 0 || bits == 0) bits = rng();
+            uint8_t byte = static_cast<uint8_t>(bits);
+            bits >>= 8;
+            // Sprinkle zero bytes (as in real slice data) but never two in a row
+            if (byte < 16 && i > pos && stream[i - 1] != 0) byte = 0;
+            if (byte == 0 && i > pos && stream[i - 1] == 0) byte = 0x80;
+            stream[i] = byte;
+        }
+        pos = nalEnd;
+    }
+    return stream;
+}
+
+static void RunImpl(ScanImpl impl, const std::vector<uint8_t>& stream, size_t expectedNals) {
+    double bestSeconds = 1e30;
+    size_t found = 0;
+
+    for (int32_t iter = 0; iter < ITERATIONS; ++iter) {
+        auto begin = std::chrono::steady_clock::now();
+        found = 0;
+        size_t pos = StartCodeScanner::FindNextWith(impl, stream.data(), stream.size(), 0);
+        while (pos < stream.size()) {
+            found++;
+            pos = StartCodeScanner::FindNextWith(impl, stream.data(), stream.size(), pos + 3);
+        }
+        double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - begin).count();
+        if (seconds < bestSeconds) bestSeconds = seconds;
+    }
+
+    double gbPerSecond = stream.size() / bestSeconds / 1e9;
+    std::printf("  %-7s %8.3f s  %7.2f GB/s  start codes: %zu%s\n",
+                StartCodeScanner::GetImplName(impl), bestSeconds, gbPerSecond, found,
+                found == expectedNals ? "" : "  MISMATCH");
+}
+
+int main(int argc, char* argv[]) {
+    size_t sizeMb = (argc > 1) ? static_cast<size_t>(std::atol(argv[1])) : DEFAULT_SIZE_MB;
+    size_t avgNalBytes = (argc > 2) ? static_cast<size_t>(std::atol(argv[2])) : DEFAULT_AVG_NAL_BYTES;
+    if (sizeMb == 0 || avgNalBytes < 16) {
+        std::fprintf(stderr, "Usage: %s [size_mb] [avg_nal_bytes]\n", argv[0]);
+        return 1;
+    }
+
+    std::printf("Generating %zu MiB synthetic Annex B stream (avg NAL %zu bytes)...\n",
+                sizeMb, avgNalBytes);
+    size_t nalCount = 0;
+    std::vector<uint8_t> stream = GenerateStream(sizeMb * 1024 * 1024, avgNalBytes, nalCount);
+
+    std::printf("Best of %d runs, best available: %s\n", ITERATIONS,
+                StartCodeScanner::GetImplName(StartCodeScanner::GetBestImpl()));
+    RunImpl(ScanImpl::SCALAR, stream, nalCount);
+    if (StartCodeScanner::GetBestImpl() != ScanImpl::SCALAR) {
+        RunImpl(ScanImpl::SSE2, stream, nalCount);
+    }
+    if (StartCodeScanner::GetBestImpl() == ScanImpl::AVX2) {
+        RunImpl(ScanImpl::AVX2, stream, nalCount);
+    }
+    return 0;
+}
@@ -2,58 +2,98 @@
 
 #include <cstdio>
 
+#include "media_source.h"
+
 namespace server {
 
+static void PrintLatency(const char* label, const LatencyHistogram& histogram) {
+    std::printf("   %s latency: p50 %.0f / p95 %.0f / p99 %.0f / max %.0f ms (%llu probes)\n",
+                label, histogram.GetPercentile(0.5), histogram.GetPercentile(0.95),
+                histogram.GetPercentile(0.99), histogram.GetMax(),
+                static_cast<unsigned long long>(histogram.GetCount()));
+}
+
+MediaStream::MediaStream(uint8_t streamId, MediaSource* mediaSource)
+    : id(streamId),
+      source(mediaSource),
+      isNegotiated(false),
+      rendition(0),
+      bytesSent(0),
+      maxLayer(mediaSource->GetMaxTemporalLayer()),
+      isFmp4(false),
+      isNalAligned(false),
+      protocolVersion(PROTOCOL_VERSION),
+      isAudioBatched(false),
+      audioBatchStartMs(0.0),
+      auIndex(0),
+      packetIndex(0),
+      playbackTimeMs(0.0),
+      playbackRate(1.0),
+      rateAnchorSrcMs(0),
+      rateAnchorOutMs(0),
+      lastSrcPtsMs(0),
+      lastOutPtsMs(0),
+      lastTrickOutMs(0),
+      isSeekPending(false),
+      deficit(0),
+      creditMode(CreditMode::NONE),
+      credit(0),
+      isAwaitingKeyframe(false),
+      isLatencyProbed(false) {
+    abr.Reset(mediaSource->GetBitrates());
+}
+
+MediaStream* Connection::FindStream(uint8_t streamId) {
+    for (auto& stream : streams) {
+        if (stream.id == streamId) {
+            return &stream;
+        }
+    }
+    return nullptr;
+}
+
 ConnectionManager::ConnectionManager() : totalConnections_(0) {
 }
 
-int32_t ConnectionManager::AddConnection(int32_t fd, const std::string& ip) {
+Connection* ConnectionManager::AddConnection(int32_t fd, const std::string& ip) {
     int32_t id = ++totalConnections_;
 
-    Connection conn {};
-    conn.fd = fd;
-    conn.id = id;
-    conn.ip = ip;
-    conn.state = ConnState::HANDSHAKING_WS;
-    conn.auIndex = 0;
-    conn.stats.messagesSent = 0;
-    conn.stats.bytesSent = 0;
-    conn.stats.connectedAt = std::chrono::steady_clock::now();
+    // Value-initialized: counters and flags start at zero
+    std::unique_ptr<Connection> conn(new Connection());
+    conn->fd = fd;
+    conn->ip = ip;
+    conn->id = id;
+    conn->slot = connections_.size();
+    conn->state = ConnState::HANDSHAKING_TLS;
+    conn->fragmentSize = FRAGMENT_THRESHOLD;
+    conn->stats.connectedAt = std::chrono::steady_clock::now();
 
-    connections_[fd] = std::move(conn);
+    Connection* added = conn.get();
+    connections_.push_back(std::move(conn));
 
     std::printf("[Connection #%d] New client connected\n", id);
     std::printf("   IP Address: %s\n", ip.c_str());
     std::printf("   Current connections: %zu\n\n", connections_.size());
 
-    return id;
+    return added;
 }
 
-void ConnectionManager::RemoveConnection(int32_t fd) {
-    auto it = connections_.find(fd);
-    if (it == connections_.end()) {
+void ConnectionManager::RemoveConnection(Connection* conn) {
+    size_t slot = conn->slot;
+    if (slot >= connections_.size() || connections_[slot].get() != conn) {
         return;
     }
 
-    LogConnectionStats(fd);
-    connections_.erase(it);
-}
-
-Connection* ConnectionManager::GetConnection(int32_t fd) {
-    auto it = connections_.find(fd);
-    if (it == connections_.end()) {
-        return nullptr;
+    LogConnectionStats(*conn);
+    removed_.push_back(std::move(connections_[slot]));
+    if (slot + 1 != connections_.size()) {
+        connections_[slot] = std::move(connections_.back());
+        connections_[slot]->slot = slot;
     }
-    return &it->second;
+    connections_.pop_back();
 }
 
-void ConnectionManager::LogConnectionStats(int32_t fd) const {
-    auto it = connections_.find(fd);
-    if (it == connections_.end()) {
-        return;
-    }
-
-    const Connection& conn = it->second;
+void ConnectionManager::LogConnectionStats(const Connection& conn) const {
     auto now = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(
         now - conn.stats.connectedAt).count();
@@ -63,6 +103,44 @@ void ConnectionManager::LogConnectionStats(int32_t fd) const {
     std::printf("   Connection duration: %lld seconds\n", static_cast<long long>(duration));
     std::printf("   Messages sent: %llu\n", static_cast<unsigned long long>(conn.stats.messagesSent));
     std::printf("   Data sent: %.2f MB\n", mbSent);
+    if (conn.stats.seeks > 0) {
+        std::printf("   Seeks: %u (max %.1f ms to first frame)\n", conn.stats.seeks,
+                    conn.stats.maxSeekLatencyMs);
+    }
+    if (conn.stats.framesThinned > 0) {
+        std::printf("   Frames thinned: %llu\n",
+                    static_cast<unsigned long long>(conn.stats.framesThinned));
+    }
+    if (conn.stats.framesOutOfCredit > 0) {
+        std::printf("   Frames dropped out of credit: %llu\n",
+                    static_cast<unsigned long long>(conn.stats.framesOutOfCredit));
+    }
+    if (conn.stats.audioBatchMessages > 0) {
+        std::printf("   Audio batches: %llu messages, %llu frames\n",
+                    static_cast<unsigned long long>(conn.stats.audioBatchMessages),
+                    static_cast<unsigned long long>(conn.stats.audioBatchFrames));
+    }
+    if (conn.networkLatency.GetCount() > 0) {
+        PrintLatency("Network", conn.networkLatency);
+    }
+    if (conn.decodeLatency.GetCount() > 0) {
+        PrintLatency("Decode", conn.decodeLatency);
+    }
+    if (conn.streams.size() > 1) {
+        std::printf("   Streams: %zu\n", conn.streams.size());
+    }
+    for (const auto& stream : conn.streams) {
+        if (stream.abr.GetHistory().empty()) {
+            continue;
+        }
+        std::printf("   ABR switches (stream %u): %u down, %u up\n", stream.id,
+                    stream.abr.GetSwitchesDown(), stream.abr.GetSwitchesUp());
+        for (const auto& decision : stream.abr.GetHistory()) {
+            std::printf("      %8.1fs  %d -> %d  (drain %u kbps, queue %u bytes)\n",
+                        decision.timeMs / 1000.0, decision.from, decision.to,
+                        decision.drainKbps, decision.queueBytes);
+        }
+    }
     std::printf("   Remaining connections: %zu\n\n", connections_.size() - 1);
 }
 
@@ -73,10 +151,20 @@ void ConnectionManager::LogServerStatus() const {
 
     uint64_t totalBytesSent = 0;
     uint64_t totalMessagesSent = 0;
-
-    for (const auto& pair : connections_) {
-        totalBytesSent += pair.second.stats.bytesSent;
-        totalMessagesSent += pair.second.stats.messagesSent;
+    uint64_t totalSwitchesDown = 0;
+    uint64_t totalSwitchesUp = 0;
+    LatencyHistogram networkLatency;
+    LatencyHistogram decodeLatency;
+
+    for (const auto& conn : connections_) {
+        totalBytesSent += conn->stats.bytesSent;
+        totalMessagesSent += conn->stats.messagesSent;
+        networkLatency.Merge(conn->networkLatency);
+        decodeLatency.Merge(conn->decodeLatency);
+        for (const auto& stream : conn->streams) {
+            totalSwitchesDown += stream.abr.GetSwitchesDown();
+            totalSwitchesUp += stream.abr.GetSwitchesUp();
+        }
     }
 
     std::printf("\nServer status:\n");
@@ -88,6 +176,25 @@ void ConnectionManager::LogServerStatus() const {
         std::printf("   Total sent: %llu messages, %.2f MB\n",
                     static_cast<unsigned long long>(totalMessagesSent), mbSent);
     }
+    if (totalSwitchesDown + totalSwitchesUp > 0) {
+        std::printf("   ABR switches: %llu down, %llu up\n",
+                    static_cast<unsigned long long>(totalSwitchesDown),
+                    static_cast<unsigned long long>(totalSwitchesUp));
+    }
+    if (networkLatency.GetCount() > 0) {
+        PrintLatency("Network", networkLatency);
+        PrintLatency("Decode", decodeLatency);
+        // Per viewer, so a slow client stands out from the aggregate
+        for (const auto& entry : connections_) {
+            const Connection& conn = *entry;
+            if (conn.networkLatency.GetCount() == 0) {
+                continue;
+            }
+            std::printf("      #%d network p95 %.0f ms, decode p95 %.0f ms\n", conn.id,
+                        conn.networkLatency.GetPercentile(0.95),
+                        conn.decodeLatency.GetPercentile(0.95));
+        }
+    }
     std::printf("\n");
 }
 
@@ -3,12 +3,21 @@
 
 #include <chrono>
 #include <cstdint>
+#include <deque>
+#include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+#include "abr_controller.h"
+#include "fmp4_muxer.h"
+#include "frame_protocol.h"
+#include "latency_histogram.h"
+#include "tls_server.h"
+
 namespace server {
 
+class MediaSource;
+
 /**
  * @brief Connection state
  */
@@ -27,23 +36,113 @@ enum class ConnState {
 struct ConnStats {
     uint64_t messagesSent;
     uint64_t bytesSent;
+    uint64_t framesThinned;   // video frames dropped by the temporal layer cap
+    uint64_t framesOutOfCredit;   // video frames dropped for lack of client credit
+    uint64_t audioBatchFrames;    // audio frames sent inside AUDIO_BATCH messages
+    uint64_t audioBatchMessages;
+    uint32_t seeks;
+    double maxSeekLatencyMs;  // seek command to first frame sent
     std::chrono::steady_clock::time_point connectedAt;
 };
 
 /**
- * @brief Client connection info
+ * @brief Unit of the credit a client grants with FLOW_CONTROL messages
+ */
+enum class CreditMode {
+    NONE,     // no flow control: video is sent at media rate
+    FRAMES,   // video frames on the wire (a fragmented frame counts once)
+    BYTES     // video protocol message bytes
+};
+
+/**
+ * @brief Send state of one media stream carried by a connection
+ *
+ * Stream 0 is the source picked by the request path. A connection to the
+ * multiplexing path starts with none and adds streams with SUBSCRIBE
+ * control messages; the stream_id byte of the fixed header tells them
+ * apart on the wire.
+ */
+struct MediaStream {
+    uint8_t id;
+    MediaSource* source;
+    bool isNegotiated;     // media-answer received, media is being sent
+    std::chrono::steady_clock::time_point negotiateOfferTime;
+    size_t rendition;      // rendition being sent (index into the source ladder)
+    AbrController abr;     // picks the target rendition
+    std::chrono::steady_clock::time_point lastAbrSample;
+    uint64_t bytesSent;
+    int32_t maxLayer;      // highest temporal layer sent, or MediaSource::KEYFRAMES_ONLY
+    bool isFmp4;           // video sent as fMP4 segments instead of Annex-B
+    bool isNalAligned;     // video fragments cut between NAL units
+    Fmp4Muxer fmp4Muxer;
+    uint8_t protocolVersion;  // media framing: PROTOCOL_VERSION or COMPACT_VERSION
+    CompactTimeline timeline; // version 2 timestamp state
+    bool isAudioBatched;      // audio frames are aggregated into AUDIO_BATCH messages
+    AudioBatch audioBatch;    // audio frames not sent yet
+    double audioBatchStartMs; // playback time the first frame of the batch was due
+    size_t auIndex;        // for raw bitstream mode (NalParser)
+    size_t packetIndex;    // for MP4 mode (Mp4Demuxer)
+    double playbackTimeMs; // elapsed playback time in ms
+    double playbackRate;   // source ms per wall ms, set by a CONTROL message
+    int64_t rateAnchorSrcMs;  // source/sent timestamps where the rate last changed
+    int64_t rateAnchorOutMs;
+    int64_t lastSrcPtsMs;     // source/sent timestamps of the last video frame
+    int64_t lastOutPtsMs;
+    int64_t lastTrickOutMs;   // sent timestamp of the last trick-play keyframe
+    bool isSeekPending;       // no frame sent yet since the last seek
+    std::chrono::steady_clock::time_point seekRequestTime;
+    std::deque<std::vector<uint8_t>> outbox;  // protocol messages due this tick
+    size_t deficit;           // fair scheduler credit in bytes
+    CreditMode creditMode;    // flow control negotiated in the media-answer
+    int64_t credit;           // video the client can still take, in creditMode units
+    bool isAwaitingKeyframe;  // out of credit: pictures dropped up to the next keyframe
+    bool isLatencyProbed;     // video frames periodically carry a seq_number
+    std::chrono::steady_clock::time_point lastLatencyProbe;
+
+    /**
+     * @param streamId stream ID on the wire
+     * @param mediaSource source to send (acquired by the caller)
+     */
+    MediaStream(uint8_t streamId, MediaSource* mediaSource);
+};
+
+/**
+ * @brief A latency probe sent and not reported by the client yet
+ */
+struct LatencyProbe {
+    uint32_t seqNumber;
+    int64_t sentMs;     // abs_time of the probe frame (UTC ms)
+};
+
+/**
+ * @brief Client connection: socket, TLS and WebSocket state and the streams
+ *        it carries, in one object
+ *
+ * The epoll registration points at it, so socket events reach it without
+ * any lookup. It never moves once created (mbedtls holds a pointer to it).
  */
-struct Connection {
-    int32_t fd;
+struct Connection : TlsConnection {
     int32_t id;
-    std::string ip;
+    size_t slot;            // index in ConnectionManager's connection array
     ConnState state;
     ConnStats stats;
-    size_t auIndex;        // for raw bitstream mode (NalParser)
-    size_t packetIndex;    // for MP4 mode (Mp4Demuxer)
-    double playbackTimeMs; // elapsed playback time in ms for MP4 mode
+    std::vector<MediaStream> streams;
     std::vector<uint8_t> recvBuffer;
-    std::chrono::steady_clock::time_point negotiateOfferTime;
+    size_t fragmentSize;            // media payload bytes per fragment
+    size_t clientMaxFragment;       // 0 = client set no limit
+    std::chrono::steady_clock::time_point lastFragmentTune;
+    uint32_t lastProbeSeq;              // latency probe seq_number, per connection
+    std::deque<LatencyProbe> latencyProbes;  // awaiting a report, oldest first
+    LatencyHistogram networkLatency;    // probe sent -> received by the client
+    LatencyHistogram decodeLatency;     // received -> decoded by the client
+    bool isOverview;                    // subscribed to the thumbnails of every source
+    std::vector<uint32_t> thumbnailGenerations;  // per source, last thumbnail sent (0 = none)
+
+    /**
+     * @brief Find a stream by its wire ID
+     * @return pointer to the stream, nullptr if not subscribed
+     */
+    MediaStream* FindStream(uint8_t streamId);
 };
 
 /**
@@ -57,27 +156,26 @@ public:
      * @brief Add new connection
      * @param fd file descriptor
      * @param ip client IP address
-     * @return connection ID
+     * @return the connection, owned by the manager
      */
-    int32_t AddConnection(int32_t fd, const std::string& ip);
+    Connection* AddConnection(int32_t fd, const std::string& ip);
 
     /**
-     * @brief Remove connection
-     * @param fd file descriptor
+     * @brief Remove connection; it stays allocated until FreeRemoved()
+     * @param conn connection returned by AddConnection()
      */
-    void RemoveConnection(int32_t fd);
+    void RemoveConnection(Connection* conn);
 
     /**
-     * @brief Get connection by fd
-     * @param fd file descriptor
-     * @return pointer to connection, nullptr if not found
+     * @brief Free the connections removed so far; call between event
+     *        batches, when no epoll event can still point at them
      */
-    Connection* GetConnection(int32_t fd);
+    void FreeRemoved() { removed_.clear(); }
 
     /**
-     * @brief Get all connections
+     * @brief Get all connections, densely packed in no particular order
      */
-    std::unordered_map<int32_t, Connection>& GetConnections() { return connections_; }
+    const std::vector<std::unique_ptr<Connection>>& GetConnections() const { return connections_; }
 
     /**
      * @brief Get connection count
@@ -91,9 +189,9 @@ public:
 
     /**
      * @brief Log connection statistics
-     * @param fd file descriptor
+     * @param conn connection
      */
-    void LogConnectionStats(int32_t fd) const;
+    void LogConnectionStats(const Connection& conn) const;
 
     /**
      * @brief Log server status
@@ -101,7 +199,10 @@ public:
     void LogServerStatus() const;
 
 private:
-    std::unordered_map<int32_t, Connection> connections_;
+    // Dense array scanned by every scheduler tick; removal swaps the last
+    // entry into the freed slot. The objects themselves never move.
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::vector<std::unique_ptr<Connection>> removed_;
     int32_t totalConnections_;
 };
 
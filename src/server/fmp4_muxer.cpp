@@ -0,0 +1,509 @@
+#include "fmp4_muxer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "sps_parser.h"
+#include "start_code_scanner.h"
+
+namespace server {
+
+static const int64_t MAX_SAMPLE_DURATION_MS = 1000;  // longer gaps are jumps, not frame timing
+static const uint32_t SAMPLE_FLAGS_SYNC = 0x02000000;       // depends on no other sample
+static const uint32_t SAMPLE_FLAGS_NON_SYNC = 0x01010000;   // depends on others, non-sync
+static const size_t PROFILE_TIER_LEVEL_SIZE = 12;
+
+// H.264 / H.265 NAL unit types handled by the muxer
+static const uint8_t H264_NAL_SPS = 7;
+static const uint8_t H264_NAL_PPS = 8;
+static const uint8_t H264_NAL_AUD = 9;
+static const uint8_t H265_NAL_VPS = 32;
+static const uint8_t H265_NAL_SPS = 33;
+static const uint8_t H265_NAL_PPS = 34;
+static const uint8_t H265_NAL_AUD = 35;
+
+static void Put8(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static void Put16(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static void Put32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static void Put64(std::vector<uint8_t>& out, uint64_t value) {
+    Put32(out, static_cast<uint32_t>(value >> 32));
+    Put32(out, static_cast<uint32_t>(value));
+}
+
+static void PutZeros(std::vector<uint8_t>& out, size_t count) {
+    out.insert(out.end(), count, 0);
+}
+
+static void PutBytes(std::vector<uint8_t>& out, const std::vector<uint8_t>& bytes) {
+    out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+static void Patch32(std::vector<uint8_t>& out, size_t offset, uint32_t value) {
+    out[offset] = static_cast<uint8_t>(value >> 24);
+    out[offset + 1] = static_cast<uint8_t>(value >> 16);
+    out[offset + 2] = static_cast<uint8_t>(value >> 8);
+    out[offset + 3] = static_cast<uint8_t>(value);
+}
+
+// Box header with a size placeholder; EndBox() fills in the size
+static size_t BeginBox(std::vector<uint8_t>& out, const char* type) {
+    size_t start = out.size();
+    Put32(out, 0);
+    out.insert(out.end(), type, type + 4);
+    return start;
+}
+
+static size_t BeginFullBox(std::vector<uint8_t>& out, const char* type, uint8_t version,
+                           uint32_t flags) {
+    size_t start = BeginBox(out, type);
+    Put32(out, (static_cast<uint32_t>(version) << 24) | (flags & 0xFFFFFF));
+    return start;
+}
+
+static void EndBox(std::vector<uint8_t>& out, size_t start) {
+    Patch32(out, start, static_cast<uint32_t>(out.size() - start));
+}
+
+static void PutMatrix(std::vector<uint8_t>& out) {
+    static const uint32_t UNITY[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+    for (uint32_t value : UNITY) {
+        Put32(out, value);
+    }
+}
+
+/**
+ * @brief Iterate over the NAL units of an Annex-B buffer
+ * @param pos in: search position, out: position after the NAL unit
+ * @return false when no NAL unit is left
+ */
+static bool NextNal(const uint8_t* data, size_t size, size_t& pos,
+                    const uint8_t*& nal, size_t& nalSize) {
+    size_t startCode = StartCodeScanner::FindNext(data, size, pos);
+    if (startCode >= size) {
+        pos = size;
+        return false;
+    }
+    size_t begin = startCode + 3;
+    size_t end = StartCodeScanner::FindNext(data, size, begin);
+    pos = end;
+
+    // Zero bytes before the next start code are the 4-byte start code's
+    // leading zero or trailing_zero_8bits, not part of the NAL unit
+    while (end > begin && data[end - 1] == 0) {
+        --end;
+    }
+    nal = data + begin;
+    nalSize = end - begin;
+    return true;
+}
+
+static uint8_t GetNalType(const uint8_t* nal, bool isH265) {
+    return isH265 ? static_cast<uint8_t>((nal[0] >> 1) & 0x3F)
+                  : static_cast<uint8_t>(nal[0] & 0x1F);
+}
+
+// Strip emulation prevention bytes from the first maxBytes of a NAL unit
+static std::vector<uint8_t> Unescape(const uint8_t* nal, size_t size, size_t maxBytes) {
+    std::vector<uint8_t> rbsp;
+    for (size_t i = 0; i < size && rbsp.size() < maxBytes; ++i) {
+        if (i >= 2 && nal[i] == 0x03 && nal[i - 1] == 0x00 && nal[i - 2] == 0x00) {
+            continue;
+        }
+        rbsp.push_back(nal[i]);
+    }
+    return rbsp;
+}
+
+static bool ParsePicture(const std::vector<uint8_t>& sps, bool isH265, SpsPictureInfo& info) {
+    std::vector<uint8_t> withStartCode = {0, 0, 0, 1};
+    withStartCode.insert(withStartCode.end(), sps.begin(), sps.end());
+    return isH265 ? SpsParser::ParseH265Picture(withStartCode, info)
+                  : SpsParser::ParseH264Picture(withStartCode, info);
+}
+
+std::string Fmp4Muxer::GetCodecString(const uint8_t* data, size_t size, bool isH265) {
+    size_t pos = 0;
+    const uint8_t* nal = nullptr;
+    size_t nalSize = 0;
+    while (NextNal(data, size, pos, nal, nalSize)) {
+        if (nalSize == 0) {
+            continue;
+        }
+        uint8_t type = GetNalType(nal, isH265);
+        char codec[64];
+
+        if (!isH265 && type == H264_NAL_SPS && nalSize >= 4) {
+            // profile_idc, constraint flags, level_idc
+            std::snprintf(codec, sizeof(codec), "avc1.%02X%02X%02X", nal[1], nal[2], nal[3]);
+            return codec;
+        }
+
+        if (isH265 && type == H265_NAL_SPS) {
+            // 2-byte NAL header, 1 byte of SPS fields, then profile_tier_level
+            std::vector<uint8_t> rbsp = Unescape(nal, nalSize, 3 + PROFILE_TIER_LEVEL_SIZE);
+            if (rbsp.size() < 3 + PROFILE_TIER_LEVEL_SIZE) {
+                return "";
+            }
+            const uint8_t* ptl = rbsp.data() + 3;
+            static const char* PROFILE_SPACE[4] = {"", "A", "B", "C"};
+            uint32_t compat = (static_cast<uint32_t>(ptl[1]) << 24) | (ptl[2] << 16) |
+                              (ptl[3] << 8) | ptl[4];
+            uint32_t reversed = 0;
+            for (int32_t bit = 0; bit < 32; ++bit) {
+                reversed |= ((compat >> bit) & 1) << (31 - bit);
+            }
+
+            // ISO/IEC 14496-15 E.3: space+profile, reversed compatibility
+            // flags, tier+level, constraint bytes without trailing zeros
+            std::snprintf(codec, sizeof(codec), "hvc1.%s%u.%X.%c%u", PROFILE_SPACE[ptl[0] >> 6],
+                          ptl[0] & 0x1F, reversed, (ptl[0] & 0x20) ? 'H' : 'L', ptl[11]);
+            std::string result = codec;
+            size_t constraintCount = 6;
+            while (constraintCount > 0 && ptl[5 + constraintCount - 1] == 0) {
+                --constraintCount;
+            }
+            for (size_t i = 0; i < constraintCount; ++i) {
+                std::snprintf(codec, sizeof(codec), ".%X", ptl[5 + i]);
+                result += codec;
+            }
+            return result;
+        }
+    }
+    return "";
+}
+
+bool Fmp4Muxer::GetPictureInfo(const uint8_t* data, size_t size, bool isH265,
+                               SpsPictureInfo& info) {
+    size_t pos = 0;
+    const uint8_t* nal = nullptr;
+    size_t nalSize = 0;
+    while (NextNal(data, size, pos, nal, nalSize)) {
+        if (nalSize > 0 && GetNalType(nal, isH265) == (isH265 ? H265_NAL_SPS : H264_NAL_SPS)) {
+            return ParsePicture(std::vector<uint8_t>(nal, nal + nalSize), isH265, info);
+        }
+    }
+    return false;
+}
+
+Fmp4Muxer::Fmp4Muxer()
+    : isH265_(false), defaultDuration_(TIMESCALE / 25), hasInit_(false),
+      sequenceNumber_(0), lastDtsMs_(0), hasLastDts_(false) {
+}
+
+void Fmp4Muxer::Reset(bool isH265, double frameIntervalMs) {
+    isH265_ = isH265;
+    defaultDuration_ = static_cast<uint32_t>(std::lround(frameIntervalMs * TIMESCALE / 1000.0));
+    params_ = ParameterSets();
+    initParams_ = ParameterSets();
+    hasInit_ = false;
+    sequenceNumber_ = 0;
+    hasLastDts_ = false;
+}
+
+bool Fmp4Muxer::HasParameterSets() const {
+    return !params_.sps.empty() && !params_.pps.empty() && (!isH265_ || !params_.vps.empty());
+}
+
+bool Fmp4Muxer::WriteAccessUnit(const uint8_t* data, size_t size, int64_t ptsMs, int64_t dtsMs,
+                                bool isKeyframe, std::vector<uint8_t>& initSegment,
+                                std::vector<uint8_t>& mediaSegment) {
+    initSegment.clear();
+    mediaSegment.clear();
+    sample_.clear();
+
+    // Annex-B to length-prefixed NAL units; parameter sets go to the init
+    // segment and access unit delimiters are dropped
+    size_t pos = 0;
+    const uint8_t* nal = nullptr;
+    size_t nalSize = 0;
+    while (NextNal(data, size, pos, nal, nalSize)) {
+        if (nalSize == 0) {
+            continue;
+        }
+        uint8_t type = GetNalType(nal, isH265_);
+        std::vector<uint8_t>* paramSet = nullptr;
+        if (isH265_) {
+            if (type == H265_NAL_AUD) continue;
+            paramSet = (type == H265_NAL_VPS) ? &params_.vps
+                     : (type == H265_NAL_SPS) ? &params_.sps
+                     : (type == H265_NAL_PPS) ? &params_.pps : nullptr;
+        } else {
+            if (type == H264_NAL_AUD) continue;
+            paramSet = (type == H264_NAL_SPS) ? &params_.sps
+                     : (type == H264_NAL_PPS) ? &params_.pps : nullptr;
+        }
+        if (paramSet != nullptr) {
+            paramSet->assign(nal, nal + nalSize);
+            continue;
+        }
+        Put32(sample_, static_cast<uint32_t>(nalSize));
+        sample_.insert(sample_.end(), nal, nal + nalSize);
+    }
+
+    if (sample_.empty()) {
+        return false;
+    }
+
+    if (isKeyframe && HasParameterSets() && (!hasInit_ || !(params_ == initParams_))) {
+        WriteInitSegment(initSegment);
+        initParams_ = params_;
+        hasInit_ = true;
+    }
+    if (!hasInit_) {
+        return false;
+    }
+
+    // Frames are muxed as they are sent, so the duration of a sample is
+    // predicted from the previous gap; that keeps the timeline right when
+    // frames are thinned or paced for trick play
+    uint32_t duration = defaultDuration_;
+    if (hasLastDts_ && dtsMs > lastDtsMs_ && dtsMs - lastDtsMs_ <= MAX_SAMPLE_DURATION_MS) {
+        duration = static_cast<uint32_t>((dtsMs - lastDtsMs_) * (TIMESCALE / 1000));
+    }
+    lastDtsMs_ = dtsMs;
+    hasLastDts_ = true;
+
+    WriteMediaSegment(mediaSegment, ptsMs, dtsMs, duration, isKeyframe);
+    return true;
+}
+
+void Fmp4Muxer::WriteInitSegment(std::vector<uint8_t>& out) const {
+    SpsPictureInfo picture;
+    if (!ParsePicture(params_.sps, isH265_, picture)) {
+        // The decoder reads the picture format from the parameter sets
+        // anyway; the sample entry fields are informative
+        std::fprintf(stderr, "[Fmp4Muxer] Cannot parse SPS picture format\n");
+        picture.width = 0;
+        picture.height = 0;
+        picture.chromaFormat = 1;
+        picture.bitDepthLuma = 8;
+        picture.bitDepthChroma = 8;
+    }
+
+    size_t ftyp = BeginBox(out, "ftyp");
+    out.insert(out.end(), {'i', 's', 'o', '6'});
+    Put32(out, 0);  // minor_version
+    out.insert(out.end(), {'i', 's', 'o', '6', 'c', 'm', 'f', 'c', 'm', 'p', '4', '1'});
+    EndBox(out, ftyp);
+
+    size_t moov = BeginBox(out, "moov");
+
+    size_t mvhd = BeginFullBox(out, "mvhd", 0, 0);
+    Put32(out, 0);            // creation_time
+    Put32(out, 0);            // modification_time
+    Put32(out, 1000);         // timescale
+    Put32(out, 0);            // duration: unknown, fragmented
+    Put32(out, 0x00010000);   // rate 1.0
+    Put16(out, 0x0100);       // volume 1.0
+    PutZeros(out, 10);
+    PutMatrix(out);
+    PutZeros(out, 24);        // pre_defined
+    Put32(out, 2);            // next_track_ID
+    EndBox(out, mvhd);
+
+    size_t trak = BeginBox(out, "trak");
+    size_t tkhd = BeginFullBox(out, "tkhd", 0, 0x000003);  // enabled, in movie
+    Put32(out, 0);            // creation_time
+    Put32(out, 0);            // modification_time
+    Put32(out, 1);            // track_ID
+    Put32(out, 0);
+    Put32(out, 0);            // duration
+    PutZeros(out, 8);
+    Put16(out, 0);            // layer
+    Put16(out, 0);            // alternate_group
+    Put16(out, 0);            // volume
+    Put16(out, 0);
+    PutMatrix(out);
+    Put32(out, picture.width << 16);
+    Put32(out, picture.height << 16);
+    EndBox(out, tkhd);
+
+    size_t mdia = BeginBox(out, "mdia");
+    size_t mdhd = BeginFullBox(out, "mdhd", 0, 0);
+    Put32(out, 0);
+    Put32(out, 0);
+    Put32(out, TIMESCALE);
+    Put32(out, 0);
+    Put16(out, 0x55C4);       // language "und"
+    Put16(out, 0);
+    EndBox(out, mdhd);
+
+    size_t hdlr = BeginFullBox(out, "hdlr", 0, 0);
+    Put32(out, 0);
+    out.insert(out.end(), {'v', 'i', 'd', 'e'});
+    PutZeros(out, 12);
+    const char name[] = "VideoHandler";
+    out.insert(out.end(), name, name + sizeof(name));  // with the terminating NUL
+    EndBox(out, hdlr);
+
+    size_t minf = BeginBox(out, "minf");
+    size_t vmhd = BeginFullBox(out, "vmhd", 0, 0x000001);
+    PutZeros(out, 8);         // graphicsmode, opcolor
+    EndBox(out, vmhd);
+
+    size_t dinf = BeginBox(out, "dinf");
+    size_t dref = BeginFullBox(out, "dref", 0, 0);
+    Put32(out, 1);
+    size_t url = BeginFullBox(out, "url ", 0, 0x000001);  // media in the same file
+    EndBox(out, url);
+    EndBox(out, dref);
+    EndBox(out, dinf);
+
+    // Sample tables are empty; samples are described by the fragments
+    size_t stbl = BeginBox(out, "stbl");
+    size_t stsd = BeginFullBox(out, "stsd", 0, 0);
+    Put32(out, 1);
+    WriteSampleEntry(out, picture);
+    EndBox(out, stsd);
+    const char* emptyTables[] = {"stts", "stsc", "stco"};
+    for (const char* type : emptyTables) {
+        size_t box = BeginFullBox(out, type, 0, 0);
+        Put32(out, 0);
+        EndBox(out, box);
+    }
+    size_t stsz = BeginFullBox(out, "stsz", 0, 0);
+    Put32(out, 0);
+    Put32(out, 0);
+    EndBox(out, stsz);
+    EndBox(out, stbl);
+
+    EndBox(out, minf);
+    EndBox(out, mdia);
+    EndBox(out, trak);
+
+    size_t mvex = BeginBox(out, "mvex");
+    size_t trex = BeginFullBox(out, "trex", 0, 0);
+    Put32(out, 1);            // track_ID
+    Put32(out, 1);            // default_sample_description_index
+    Put32(out, 0);
+    Put32(out, 0);
+    Put32(out, 0);
+    EndBox(out, trex);
+    EndBox(out, mvex);
+
+    EndBox(out, moov);
+}
+
+void Fmp4Muxer::WriteSampleEntry(std::vector<uint8_t>& out, const SpsPictureInfo& picture) const {
+    size_t entry = BeginBox(out, isH265_ ? "hvc1" : "avc1");
+    PutZeros(out, 6);
+    Put16(out, 1);            // data_reference_index
+    PutZeros(out, 16);        // pre_defined, reserved
+    Put16(out, picture.width);
+    Put16(out, picture.height);
+    Put32(out, 0x00480000);   // 72 dpi
+    Put32(out, 0x00480000);
+    Put32(out, 0);
+    Put16(out, 1);            // frame_count
+    PutZeros(out, 32);        // compressorname
+    Put16(out, 0x0018);       // depth
+    Put16(out, 0xFFFF);       // pre_defined = -1
+
+    if (!isH265_) {
+        const std::vector<uint8_t>& sps = params_.sps;
+        size_t avcC = BeginBox(out, "avcC");
+        Put8(out, 1);                         // configurationVersion
+        Put8(out, sps.size() > 1 ? sps[1] : 0);  // AVCProfileIndication
+        Put8(out, sps.size() > 2 ? sps[2] : 0);  // profile_compatibility
+        Put8(out, sps.size() > 3 ? sps[3] : 0);  // AVCLevelIndication
+        Put8(out, 0xFF);                      // lengthSizeMinusOne = 3
+        Put8(out, 0xE1);                      // one SPS
+        Put16(out, static_cast<uint32_t>(sps.size()));
+        PutBytes(out, sps);
+        Put8(out, 1);                         // one PPS
+        Put16(out, static_cast<uint32_t>(params_.pps.size()));
+        PutBytes(out, params_.pps);
+        uint8_t profile = sps.size() > 1 ? sps[1] : 0;
+        if (profile == 100 || profile == 110 || profile == 122 || profile == 144) {
+            Put8(out, 0xFC | picture.chromaFormat);
+            Put8(out, 0xF8 | (picture.bitDepthLuma - 8));
+            Put8(out, 0xF8 | (picture.bitDepthChroma - 8));
+            Put8(out, 0);                     // numOfSequenceParameterSetExt
+        }
+        EndBox(out, avcC);
+    } else {
+        std::vector<uint8_t> rbsp = Unescape(params_.sps.data(), params_.sps.size(),
+                                             3 + PROFILE_TIER_LEVEL_SIZE);
+        rbsp.resize(3 + PROFILE_TIER_LEVEL_SIZE, 0);
+        uint32_t maxSubLayersMinus1 = (rbsp[2] >> 1) & 0x07;
+        uint32_t temporalIdNesting = rbsp[2] & 0x01;
+
+        size_t hvcC = BeginBox(out, "hvcC");
+        Put8(out, 1);                         // configurationVersion
+        out.insert(out.end(), rbsp.begin() + 3, rbsp.end());  // general profile_tier_level
+        Put16(out, 0xF000);                   // min_spatial_segmentation_idc = 0
+        Put8(out, 0xFC);                      // parallelismType = 0
+        Put8(out, 0xFC | picture.chromaFormat);
+        Put8(out, 0xF8 | (picture.bitDepthLuma - 8));
+        Put8(out, 0xF8 | (picture.bitDepthChroma - 8));
+        Put16(out, 0);                        // avgFrameRate
+        Put8(out, ((maxSubLayersMinus1 + 1) << 3) | (temporalIdNesting << 2) | 0x03);
+        Put8(out, 3);                         // numOfArrays
+        const std::vector<uint8_t>* arrays[3] = {&params_.vps, &params_.sps, &params_.pps};
+        const uint8_t types[3] = {H265_NAL_VPS, H265_NAL_SPS, H265_NAL_PPS};
+        for (int32_t i = 0; i < 3; ++i) {
+            Put8(out, 0x80 | types[i]);       // array_completeness = 1
+            Put16(out, 1);
+            Put16(out, static_cast<uint32_t>(arrays[i]->size()));
+            PutBytes(out, *arrays[i]);
+        }
+        EndBox(out, hvcC);
+    }
+
+    EndBox(out, entry);
+}
+
+void Fmp4Muxer::WriteMediaSegment(std::vector<uint8_t>& out, int64_t ptsMs, int64_t dtsMs,
+                                  uint32_t duration, bool isKeyframe) {
+    out.reserve(128 + sample_.size());
+
+    size_t moof = BeginBox(out, "moof");
+    size_t mfhd = BeginFullBox(out, "mfhd", 0, 0);
+    Put32(out, ++sequenceNumber_);
+    EndBox(out, mfhd);
+
+    size_t traf = BeginBox(out, "traf");
+    size_t tfhd = BeginFullBox(out, "tfhd", 0, 0x020000);  // default-base-is-moof
+    Put32(out, 1);            // track_ID
+    EndBox(out, tfhd);
+
+    size_t tfdt = BeginFullBox(out, "tfdt", 1, 0);
+    Put64(out, static_cast<uint64_t>(dtsMs > 0 ? dtsMs : 0) * (TIMESCALE / 1000));
+    EndBox(out, tfdt);
+
+    // data offset, duration, size, flags and composition offset per sample
+    size_t trun = BeginFullBox(out, "trun", 1, 0x000F01);
+    Put32(out, 1);            // sample_count
+    size_t dataOffset = out.size();
+    Put32(out, 0);
+    Put32(out, duration);
+    Put32(out, static_cast<uint32_t>(sample_.size()));
+    Put32(out, isKeyframe ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+    Put32(out, static_cast<uint32_t>(static_cast<int32_t>((ptsMs - dtsMs) * (TIMESCALE / 1000))));
+    EndBox(out, trun);
+    EndBox(out, traf);
+    EndBox(out, moof);
+
+    // Sample data starts after the mdat header
+    Patch32(out, dataOffset, static_cast<uint32_t>(out.size() - moof + 8));
+
+    Put32(out, static_cast<uint32_t>(8 + sample_.size()));
+    out.insert(out.end(), {'m', 'd', 'a', 't'});
+    PutBytes(out, sample_);
+}
+
+}  // namespace server
@@ -0,0 +1,106 @@
+#ifndef FMP4_MUXER_H
+#define FMP4_MUXER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace server {
+
+struct SpsPictureInfo;
+
+/**
+ * @brief Remuxes Annex-B H.264/H.265 access units into fragmented MP4
+ *        (CMAF) segments for Media Source Extensions playback
+ *
+ * Each access unit becomes one media segment (moof + mdat holding a single
+ * sample), so a frame is sent as soon as it is due, as in Annex-B mode.
+ * Parameter sets are moved out of the samples into the init segment; a new
+ * init segment is produced at the next keyframe whenever they change (e.g.
+ * after a rendition switch). Access units before the first keyframe are
+ * dropped.
+ *
+ * One muxer per connection; not thread-safe.
+ */
+class Fmp4Muxer {
+public:
+    static const uint32_t TIMESCALE = 90000;
+
+    Fmp4Muxer();
+
+    /**
+     * @brief Start a new stream
+     * @param isH265 true for H.265/HEVC, false for H.264/AVC
+     * @param frameIntervalMs sample duration used when no previous frame
+     *        gives one
+     */
+    void Reset(bool isH265, double frameIntervalMs);
+
+    /**
+     * @brief Forget the previous frame timing (after a seek), so the next
+     *        sample gets the default duration instead of the jump
+     */
+    void MarkDiscontinuity() { hasLastDts_ = false; }
+
+    /**
+     * @brief Remux one access unit
+     * @param data Annex-B access unit
+     * @param size access unit size in bytes
+     * @param ptsMs presentation timestamp in ms
+     * @param dtsMs decode timestamp in ms
+     * @param isKeyframe true for an IDR picture
+     * @param initSegment receives an init segment when one is due, else cleared
+     * @param mediaSegment receives the media segment, else cleared
+     * @return true if a media segment was produced; false for parameter-set
+     *         only access units and before the first keyframe
+     */
+    bool WriteAccessUnit(const uint8_t* data, size_t size, int64_t ptsMs, int64_t dtsMs,
+                         bool isKeyframe, std::vector<uint8_t>& initSegment,
+                         std::vector<uint8_t>& mediaSegment);
+
+    /**
+     * @brief Get the RFC 6381 codec string (e.g. "avc1.64001F") from the SPS
+     *        in an Annex-B buffer
+     * @return codec string, or empty if the buffer holds no SPS
+     */
+    static std::string GetCodecString(const uint8_t* data, size_t size, bool isH265);
+
+    /**
+     * @brief Parse the picture format of the first SPS in an Annex-B buffer
+     * @return false if the buffer holds no parsable SPS
+     */
+    static bool GetPictureInfo(const uint8_t* data, size_t size, bool isH265,
+                               SpsPictureInfo& info);
+
+private:
+    struct ParameterSets {
+        std::vector<uint8_t> vps;   // NAL units without start code
+        std::vector<uint8_t> sps;
+        std::vector<uint8_t> pps;
+
+        bool operator==(const ParameterSets& other) const {
+            return vps == other.vps && sps == other.sps && pps == other.pps;
+        }
+    };
+
+    bool HasParameterSets() const;
+    void WriteInitSegment(std::vector<uint8_t>& out) const;
+    void WriteSampleEntry(std::vector<uint8_t>& out, const SpsPictureInfo& picture) const;
+    void WriteMediaSegment(std::vector<uint8_t>& out, int64_t ptsMs, int64_t dtsMs,
+                           uint32_t duration, bool isKeyframe);
+
+    bool isH265_;
+    uint32_t defaultDuration_;      // in TIMESCALE units
+    ParameterSets params_;          // latest parameter sets in the stream
+    ParameterSets initParams_;      // parameter sets of the last init segment
+    bool hasInit_;
+    uint32_t sequenceNumber_;
+    int64_t lastDtsMs_;
+    bool hasLastDts_;
+    std::vector<uint8_t> sample_;   // length-prefixed NAL units of the current sample
+};
+
+}  // namespace server
+
+#endif  // FMP4_MUXER_H
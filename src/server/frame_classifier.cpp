@@ -0,0 +1,244 @@
+#include "frame_classifier.h"
+
+#include "bitstream_reader.h"
+#include "start_code_scanner.h"
+
+namespace server {
+
+static const size_t SLICE_HEADER_PREFIX = 32;  // bytes of RBSP needed for the fields we read
+static const size_t H265_MAX_PPS = 64;
+
+// H.264 NAL unit types
+static const uint8_t H264_NAL_SLICE = 1;
+static const uint8_t H264_NAL_DPA = 2;
+static const uint8_t H264_NAL_IDR = 5;
+static const uint8_t H264_NAL_PREFIX = 14;
+static const uint8_t H264_NAL_SLICE_EXT = 20;
+
+// H.265 NAL unit types
+static const uint8_t H265_NAL_BLA_W_LP = 16;
+static const uint8_t H265_NAL_IDR_W_RADL = 19;
+static const uint8_t H265_NAL_IDR_N_LP = 20;
+static const uint8_t H265_NAL_CRA = 21;
+static const uint8_t H265_NAL_RSV_IRAP_23 = 23;
+static const uint8_t H265_NAL_VPS = 32;
+static const uint8_t H265_NAL_PPS = 34;
+
+/**
+ * @brief Copy up to maxOut RBSP bytes, dropping emulation prevention bytes
+ * @return number of bytes written
+ */
+static size_t UnescapeRbsp(const uint8_t* src, size_t size, uint8_t* dst, size_t maxOut) {
+    size_t out = 0;
+    uint32_t zeros = 0;
+    for (size_t i = 0; i < size && out < maxOut; ++i) {
+        if (zeros >= 2 && src[i] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        zeros = (src[i] == 0) ? zeros + 1 : 0;
+        dst[out++] = src[i];
+    }
+    return out;
+}
+
+/**
+ * @brief Rank used to combine slice types of a multi-slice AU
+ */
+static uint8_t GetFrameTypeRank(VideoFrameType type) {
+    switch (type) {
+        case VideoFrameType::SPS_PPS: return 0;
+        case VideoFrameType::VPS:     return 1;
+        case VideoFrameType::I_FRAME: return 2;
+        case VideoFrameType::P_FRAME: return 3;
+        case VideoFrameType::B_FRAME: return 4;
+        case VideoFrameType::IDR:     return 5;
+        default:                      return 0;
+    }
+}
+
+static VideoFrameType SliceTypeToFrameType(int8_t sliceType) {
+    if (sliceType == 1) return VideoFrameType::B_FRAME;
+    if (sliceType == 2) return VideoFrameType::I_FRAME;
+    return VideoFrameType::P_FRAME;
+}
+
+FrameClassifier::FrameClassifier() : isH265_(false) {
+}
+
+void FrameClassifier::Reset(bool isH265) {
+    isH265_ = isH265;
+    ppsExtraSliceHeaderBits_.assign(H265_MAX_PPS, 0);
+}
+
+NalInfo FrameClassifier::ParseNal(const uint8_t* nal, size_t size) {
+    if (size == 0) {
+        NalInfo info = {0xFF, 0, false, false, false, false, -1};
+        return info;
+    }
+    return isH265_ ? ParseH265Nal(nal, size) : ParseH264Nal(nal, size);
+}
+
+NalInfo FrameClassifier::ParseH264Nal(const uint8_t* nal, size_t size) const {
+    NalInfo info = {0, 0, false, false, false, false, -1};
+    info.type = nal[0] & 0x1F;
+    info.isReference = ((nal[0] >> 5) & 0x03) != 0;
+    info.isVcl = (info.type >= H264_NAL_SLICE && info.type <= H264_NAL_IDR);
+
+    // SEI(6), SPS(7), PPS(8), AUD(9), prefix(14), subset SPS(15), 16-18 reserved
+    info.startsNewAu = (info.type >= 6 && info.type <= 9) ||
+                       (info.type >= H264_NAL_PREFIX && info.type <= 18);
+
+    // SVC/MVC header extension carries temporal_id in its third byte
+    if ((info.type == H264_NAL_PREFIX || info.type == H264_NAL_SLICE_EXT) && size >= 4) {
+        info.temporalId = nal[3] >> 5;
+    }
+
+    // Partitions B/C (3, 4) have no slice header
+    if (info.type == H264_NAL_SLICE || info.type == H264_NAL_DPA || info.type == H264_NAL_IDR) {
+        uint8_t rbsp[SLICE_HEADER_PREFIX];
+        size_t rbspSize = UnescapeRbsp(nal + 1, size - 1, rbsp, sizeof(rbsp));
+        BitstreamReader reader(rbsp, rbspSize);
+        uint32_t firstMbInSlice = reader.ReadUE();
+        uint32_t sliceType = reader.ReadUE() % 5;  // 5-9 mean "all slices of this type"
+        info.isFirstSliceInPic = (firstMbInSlice == 0);
+        // P(0)/SP(3) -> P, B(1) -> B, I(2)/SI(4) -> I
+        if (sliceType == 1) {
+            info.sliceType = 1;
+        } else if (sliceType == 2 || sliceType == 4) {
+            info.sliceType = 2;
+        } else {
+            info.sliceType = 0;
+        }
+    }
+    return info;
+}
+
+NalInfo FrameClassifier::ParseH265Nal(const uint8_t* nal, size_t size) {
+    NalInfo info = {0, 0, false, false, false, false, -1};
+    if (size < 2) {
+        info.type = 0xFF;
+        return info;
+    }
+    info.type = (nal[0] >> 1) & 0x3F;
+    uint8_t temporalIdPlus1 = nal[1] & 0x07;
+    info.temporalId = (temporalIdPlus1 > 0) ? temporalIdPlus1 - 1 : 0;
+    info.isVcl = (info.type <= 31);
+    // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N, RSV_VCL_N10/12/14
+    info.isReference = info.isVcl && !(info.type <= 14 && info.type % 2 == 0);
+
+    // VPS/SPS/PPS/AUD(32-35), prefix SEI(39), reserved 41-44 and 48-55
+    info.startsNewAu = (info.type >= H265_NAL_VPS && info.type <= 35) || info.type == 39 ||
+                       (info.type >= 41 && info.type <= 44) ||
+                       (info.type >= 48 && info.type <= 55);
+
+    uint8_t rbsp[SLICE_HEADER_PREFIX];
+    size_t rbspSize = UnescapeRbsp(nal + 2, size - 2, rbsp, sizeof(rbsp));
+    BitstreamReader reader(rbsp, rbspSize);
+
+    if (info.type == H265_NAL_PPS) {
+        uint32_t ppsId = reader.ReadUE();
+        reader.ReadUE();       // pps_seq_parameter_set_id
+        reader.SkipBits(2);    // dependent_slice_segments_enabled_flag, output_flag_present_flag
+        if (ppsId < H265_MAX_PPS) {
+            ppsExtraSliceHeaderBits_[ppsId] = static_cast<uint8_t>(reader.ReadBits(3));
+        }
+        return info;
+    }
+
+    // Only defined VCL types (0-9, 16-21) carry a slice header we can read
+    if (!info.isVcl || (info.type > 9 && info.type < H265_NAL_BLA_W_LP) || info.type > H265_NAL_CRA) {
+        return info;
+    }
+
+    info.isFirstSliceInPic = reader.ReadBit() != 0;
+    if (info.type >= H265_NAL_BLA_W_LP && info.type <= H265_NAL_RSV_IRAP_23) {
+        reader.SkipBits(1);  // no_output_of_prior_pics_flag
+    }
+    uint32_t ppsId = reader.ReadUE();
+
+    // slice_type follows slice_segment_address for non-first slices, which needs
+    // SPS picture size; the first slice of the picture is enough to classify it
+    if (info.isFirstSliceInPic && ppsId < H265_MAX_PPS) {
+        reader.SkipBits(ppsExtraSliceHeaderBits_[ppsId]);
+        uint32_t sliceType = reader.ReadUE();  // 0 = B, 1 = P, 2 = I
+        if (sliceType == 0) {
+            info.sliceType = 1;
+        } else if (sliceType == 1) {
+            info.sliceType = 0;
+        } else if (sliceType == 2) {
+            info.sliceType = 2;
+        }
+    }
+    return info;
+}
+
+bool FrameClassifier::IsAuBoundary(const NalInfo& info, bool auHasVcl) {
+    if (!auHasVcl) {
+        return false;
+    }
+    return info.startsNewAu || (info.isVcl && info.isFirstSliceInPic);
+}
+
+FrameInfo FrameClassifier::BeginFrame() {
+    FrameInfo frame = {VideoFrameType::SPS_PPS, false, 0};
+    return frame;
+}
+
+void FrameClassifier::AddNal(FrameInfo& frame, const NalInfo& info) const {
+    bool hasVcl = GetFrameTypeRank(frame.frameType) >= GetFrameTypeRank(VideoFrameType::I_FRAME);
+
+    if (!info.isVcl) {
+        if (isH265_ && info.type == H265_NAL_VPS && !hasVcl) {
+            frame.frameType = VideoFrameType::VPS;
+        }
+        if (!isH265_ && info.type == H264_NAL_PREFIX) {
+            frame.temporalId = info.temporalId;
+        }
+        return;
+    }
+
+    VideoFrameType sliceFrameType;
+    if (isH265_ && (info.type == H265_NAL_IDR_W_RADL || info.type == H265_NAL_IDR_N_LP)) {
+        sliceFrameType = VideoFrameType::IDR;
+    } else if (isH265_ && info.type >= H265_NAL_BLA_W_LP && info.type <= H265_NAL_RSV_IRAP_23) {
+        sliceFrameType = VideoFrameType::I_FRAME;  // BLA/CRA
+    } else if (!isH265_ && info.type == H264_NAL_IDR) {
+        sliceFrameType = VideoFrameType::IDR;
+    } else {
+        sliceFrameType = SliceTypeToFrameType(info.sliceType);
+    }
+
+    if (!hasVcl) {
+        frame.temporalId = isH265_ ? info.temporalId : frame.temporalId;
+        frame.frameType = sliceFrameType;
+    } else if (GetFrameTypeRank(sliceFrameType) > GetFrameTypeRank(frame.frameType)) {
+        frame.frameType = sliceFrameType;
+    }
+    frame.isReference = frame.isReference || info.isReference;
+}
+
+FrameInfo FrameClassifier::ClassifyAccessUnit(const uint8_t* data, size_t size) {
+    FrameInfo frame = BeginFrame();
+    bool hasVcl = false;
+
+    size_t pos = StartCodeScanner::FindNext(data, size, 0);
+    while (pos < size) {
+        size_t nalStart = pos + 3;
+        size_t next = StartCodeScanner::FindNext(data, size, nalStart);
+        size_t nalEnd = (next == size) ? size : next + 3 - StartCodeScanner::GetStartCodeLength(data, next);
+
+        NalInfo info = ParseNal(data + nalStart, nalEnd - nalStart);
+        AddNal(frame, info);
+        hasVcl = hasVcl || info.isVcl;
+        pos = next;
+    }
+
+    // An AU without slices only carries parameter sets, which must always be delivered
+    if (!hasVcl) {
+        frame.isReference = true;
+    }
+    return frame;
+}
+
+}  // namespace server
@@ -0,0 +1,94 @@
+#ifndef FRAME_CLASSIFIER_H
+#define FRAME_CLASSIFIER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame_protocol.h"
+
+namespace server {
+
+/**
+ * @brief Header fields of one NAL unit relevant to AU boundaries and frame type
+ */
+struct NalInfo {
+    uint8_t type;              // nal_unit_type
+    uint8_t temporalId;        // H.265 TemporalId (nuh_temporal_id_plus1 - 1), 0 for H.264
+    bool isVcl;                // coded slice
+    bool isReference;          // H.264 nal_ref_idc != 0, H.265 not a sub-layer non-reference type
+    bool isFirstSliceInPic;    // first_mb_in_slice == 0 / first_slice_segment_in_pic_flag
+    bool startsNewAu;          // non-VCL type that begins a new AU when it follows a VCL NAL
+    int8_t sliceType;          // 0 = P, 1 = B, 2 = I, -1 = unknown
+};
+
+/**
+ * @brief Classification of one Access Unit
+ */
+struct FrameInfo {
+    VideoFrameType frameType;
+    bool isReference;
+    uint8_t temporalId;
+};
+
+/**
+ * @brief H.264/H.265 NAL header and slice header classifier
+ *
+ * Parses just enough of each NAL unit (header, first slice header fields,
+ * H.265 PPS extra slice header bits) to find AU boundaries in a single pass
+ * and to classify frames as IDR/I/P/B with reference flag and temporal ID.
+ */
+class FrameClassifier {
+public:
+    FrameClassifier();
+
+    /**
+     * @brief Reset state for a new stream
+     * @param isH265 true for H.265/HEVC, false for H.264/AVC
+     */
+    void Reset(bool isH265);
+
+    /**
+     * @brief Parse one NAL unit (without start code)
+     * @param nal NAL unit data starting at the NAL header
+     * @param size NAL unit size
+     * @return parsed header info
+     */
+    NalInfo ParseNal(const uint8_t* nal, size_t size);
+
+    /**
+     * @brief Check whether a NAL unit starts a new AU
+     * @param info parsed NAL unit
+     * @param auHasVcl true if the current AU already contains a VCL NAL
+     */
+    static bool IsAuBoundary(const NalInfo& info, bool auHasVcl);
+
+    /**
+     * @brief Begin accumulating a new AU classification
+     */
+    static FrameInfo BeginFrame();
+
+    /**
+     * @brief Fold one NAL unit of an AU into its classification
+     */
+    void AddNal(FrameInfo& frame, const NalInfo& info) const;
+
+    /**
+     * @brief Classify an Annex B buffer holding exactly one AU
+     * @param data Annex B data (with start codes)
+     * @param size data size
+     * @return classification of all NAL units in the buffer
+     */
+    FrameInfo ClassifyAccessUnit(const uint8_t* data, size_t size);
+
+private:
+    NalInfo ParseH264Nal(const uint8_t* nal, size_t size) const;
+    NalInfo ParseH265Nal(const uint8_t* nal, size_t size);
+
+    bool isH265_;
+    std::vector<uint8_t> ppsExtraSliceHeaderBits_;  // H.265, indexed by PPS id
+};
+
+}  // namespace server
+
+#endif  // FRAME_CLASSIFIER_H
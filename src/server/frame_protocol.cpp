@@ -1,7 +1,11 @@
 #include "frame_protocol.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 
+#include "start_code_scanner.h"
+
 namespace server {
 
 void FrameProtocol::WriteBE16(std::vector<uint8_t>& buf, uint16_t val) {
@@ -23,6 +27,129 @@ void FrameProtocol::WriteBE64(std::vector<uint8_t>& buf, int64_t val) {
     }
 }
 
+uint32_t FrameProtocol::ReadBE32(const uint8_t* data) {
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+           (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+}
+
+int64_t FrameProtocol::ReadBE64(const uint8_t* data) {
+    uint64_t val = (static_cast<uint64_t>(ReadBE32(data)) << 32) | ReadBE32(data + 4);
+    return static_cast<int64_t>(val);
+}
+
+std::vector<uint8_t> FrameProtocol::EncodeControlFrame(ControlType type,
+                                                       const uint8_t* payload,
+                                                       size_t payloadSize,
+                                                       int64_t timestampMs) {
+    // ctrl_type(1) + reserved(1)
+    const uint8_t controlExtSize = 2;
+
+    std::vector<uint8_t> buf;
+    buf.reserve(FIXED_HEADER_SIZE + controlExtSize + payloadSize);
+    WriteFixedHeader(buf, MsgType::CONTROL, 0, timestampMs, controlExtSize,
+                     static_cast<uint32_t>(payloadSize));
+    buf.push_back(static_cast<uint8_t>(type));
+    buf.push_back(0);
+    buf.insert(buf.end(), payload, payload + payloadSize);
+    return buf;
+}
+
+std::vector<uint8_t> FrameProtocol::EncodeImageFrame(ImageFormat format,
+                                                     ImagePurpose purpose,
+                                                     uint16_t picId,
+                                                     const uint8_t* image,
+                                                     size_t imageSize,
+                                                     int64_t timestampMs) {
+    // format(1) + purpose(1) + pic_id(2)
+    const uint8_t imageExtSize = 4;
+
+    std::vector<uint8_t> buf;
+    buf.reserve(FIXED_HEADER_SIZE + imageExtSize + imageSize);
+    WriteFixedHeader(buf, MsgType::IMAGE, 0, timestampMs, imageExtSize,
+                     static_cast<uint32_t>(imageSize));
+    buf.push_back(static_cast<uint8_t>(format));
+    buf.push_back(static_cast<uint8_t>(purpose));
+    WriteBE16(buf, picId);
+    buf.insert(buf.end(), image, image + imageSize);
+    return buf;
+}
+
+std::vector<uint8_t> FrameProtocol::EncodeMetadataFrame(MetadataType type,
+                                                        MetadataFormat format,
+                                                        uint8_t assocStream,
+                                                        const uint8_t* payload,
+                                                        size_t payloadSize,
+                                                        int64_t timestampMs) {
+    // meta_type(1) + format(1) + assoc_stream(1) + reserved(1)
+    const uint8_t metadataExtSize = 4;
+
+    std::vector<uint8_t> buf;
+    buf.reserve(FIXED_HEADER_SIZE + metadataExtSize + payloadSize);
+    WriteFixedHeader(buf, MsgType::METADATA, 0, timestampMs, metadataExtSize,
+                     static_cast<uint32_t>(payloadSize));
+    buf.push_back(static_cast<uint8_t>(type));
+    buf.push_back(static_cast<uint8_t>(format));
+    buf.push_back(assocStream);
+    buf.push_back(0);
+    buf.insert(buf.end(), payload, payload + payloadSize);
+    return buf;
+}
+
+bool FrameProtocol::ParseControlFrame(const uint8_t* data, size_t size, ControlMessage& msg) {
+    if (size < FIXED_HEADER_SIZE) {
+        return false;
+    }
+
+    uint16_t magic = static_cast<uint16_t>((data[0] << 8) | data[1]);
+    uint8_t flags = data[4];
+    if (magic != PROTOCOL_MAGIC || data[3] != static_cast<uint8_t>(MsgType::CONTROL) ||
+        (flags & FLAG_FRAGMENT) != 0) {
+        return false;
+    }
+
+    size_t extLength = data[13];
+    size_t payloadLength = ReadBE32(data + 14);
+    if (FIXED_HEADER_SIZE + extLength + payloadLength > size) {
+        return false;
+    }
+
+    // Skip the common ext header; the control ext header follows it
+    size_t extOffset = 0;
+    if ((flags & FLAG_HAS_COMMON) != 0) {
+        if (extLength == 0) {
+            return false;
+        }
+        extOffset = data[FIXED_HEADER_SIZE];
+    }
+    if (extOffset >= extLength) {
+        return false;
+    }
+
+    msg.streamId = data[STREAM_ID_OFFSET];
+    msg.type = static_cast<ControlType>(data[FIXED_HEADER_SIZE + extOffset]);
+    msg.payload = data + FIXED_HEADER_SIZE + extLength;
+    msg.payloadSize = payloadLength;
+    return true;
+}
+
+bool FrameProtocol::ParseLatencyReport(const ControlMessage& msg,
+                                       std::vector<LatencyReportEntry>& entries) {
+    entries.clear();
+    if (msg.type != ControlType::LATENCY_REPORT ||
+        msg.payloadSize % LATENCY_REPORT_ENTRY_SIZE != 0) {
+        return false;
+    }
+    for (size_t offset = 0; offset < msg.payloadSize; offset += LATENCY_REPORT_ENTRY_SIZE) {
+        const uint8_t* p = msg.payload + offset;
+        LatencyReportEntry entry;
+        entry.seqNumber = ReadBE32(p);
+        entry.receivedMs = ReadBE64(p + 4);
+        entry.decodedMs = ReadBE64(p + 12);
+        entries.push_back(entry);
+    }
+    return true;
+}
+
 void FrameProtocol::WriteFixedHeader(std::vector<uint8_t>& buf,
                                      MsgType msgType,
                                      uint8_t flags,
@@ -48,14 +175,36 @@ void FrameProtocol::WriteFixedHeader(std::vector<uint8_t>& buf,
     buf.push_back(0);
 }
 
+uint8_t FrameProtocol::GetCommonExtSize(int32_t dtsOffsetMs, uint32_t seqNumber) {
+    // common_length(1) + common_flags(1) + abs_time(8) [+ seq_number(4)] [+ dts_offset(4)]
+    return static_cast<uint8_t>(10 + (seqNumber != 0 ? 4 : 0) + (dtsOffsetMs != 0 ? 4 : 0));
+}
+
 void FrameProtocol::WriteCommonExtHeader(std::vector<uint8_t>& buf,
-                                         int64_t absTimeMs) {
-    // common_length = 1(self) + 1(common_flags) + 8(abs_time) = 10
-    buf.push_back(10);
-    // common_flags: bit0 = abs_time
-    buf.push_back(COMMON_ABS_TIME);
+                                         int64_t absTimeMs,
+                                         int32_t dtsOffsetMs,
+                                         uint32_t seqNumber) {
+    // common_length includes this byte
+    buf.push_back(GetCommonExtSize(dtsOffsetMs, seqNumber));
+    // common_flags: bit0 = abs_time, bit2 = seq_number, bit3 = dts_offset
+    uint8_t commonFlags = COMMON_ABS_TIME;
+    if (seqNumber != 0) {
+        commonFlags |= COMMON_SEQ_NUMBER;
+    }
+    if (dtsOffsetMs != 0) {
+        commonFlags |= COMMON_DTS_OFFSET;
+    }
+    buf.push_back(commonFlags);
     // abs_time (8B)
     WriteBE64(buf, absTimeMs);
+    // seq_number (4B)
+    if (seqNumber != 0) {
+        WriteBE32(buf, seqNumber);
+    }
+    // dts_offset (4B, signed)
+    if (dtsOffsetMs != 0) {
+        WriteBE32(buf, static_cast<uint32_t>(dtsOffsetMs));
+    }
 }
 
 void FrameProtocol::WriteVideoExtHeader(std::vector<uint8_t>& buf,
@@ -83,46 +232,66 @@ std::vector<std::vector<uint8_t>> FrameProtocol::EncodeVideoFrame(
     VideoCodec codec,
     VideoFrameType frameType,
     int64_t timestampMs,
+    int64_t dtsMs,
     int64_t absTimeMs,
     uint16_t frameId) {
+    return EncodeVideoFrame(payload.data(), payload.size(), codec, frameType,
+                            timestampMs, dtsMs, absTimeMs, frameId);
+}
+
+std::vector<std::vector<uint8_t>> FrameProtocol::EncodeVideoFrame(
+    const uint8_t* payload,
+    size_t payloadSize,
+    VideoCodec codec,
+    VideoFrameType frameType,
+    int64_t timestampMs,
+    int64_t dtsMs,
+    int64_t absTimeMs,
+    uint16_t frameId,
+    bool isNalAligned,
+    size_t fragmentSize,
+    uint32_t seqNumber) {
 
     std::vector<std::vector<uint8_t>> frames;
 
     // Extension header sizes
-    const uint8_t kCommonExtSize = 10;  // common_length(1) + common_flags(1) + abs_time(8)
+    const int32_t dtsOffsetMs = static_cast<int32_t>(timestampMs - dtsMs);
+    const uint8_t kCommonExtSize = GetCommonExtSize(dtsOffsetMs, seqNumber);
     const uint8_t kVideoExtSize = 4;   // codec(1) + frame_type(1) + resolution(2)
     const uint8_t kFragExtSize = 6;    // frame_id(2) + fragment_index(2) + total_fragments(2)
 
-    if (payload.size() <= FRAGMENT_THRESHOLD) {
+    fragmentSize = FitFragmentSize(payloadSize, fragmentSize);
+    if (payloadSize <= fragmentSize) {
         // Single frame: fixed header + common ext + video ext + payload
         uint8_t extLength = kCommonExtSize + kVideoExtSize;
         uint8_t flags = FLAG_HAS_COMMON;
 
         std::vector<uint8_t> frame;
-        frame.reserve(FIXED_HEADER_SIZE + extLength + payload.size());
+        frame.reserve(FIXED_HEADER_SIZE + extLength + payloadSize);
 
         WriteFixedHeader(frame, MsgType::VIDEO, flags, timestampMs,
-                         extLength, static_cast<uint32_t>(payload.size()));
-        WriteCommonExtHeader(frame, absTimeMs);
+                         extLength, static_cast<uint32_t>(payloadSize));
+        WriteCommonExtHeader(frame, absTimeMs, dtsOffsetMs, seqNumber);
         WriteVideoExtHeader(frame, codec, frameType);
-        frame.insert(frame.end(), payload.begin(), payload.end());
+        frame.insert(frame.end(), payload, payload + payloadSize);
 
         frames.push_back(std::move(frame));
     } else {
-        // Fragmented: split payload into chunks of FRAGMENT_THRESHOLD
-        uint16_t totalFragments = static_cast<uint16_t>(
-            (payload.size() + FRAGMENT_THRESHOLD - 1) / FRAGMENT_THRESHOLD);
+        // Fragmented: split payload into chunks of at most fragmentSize
+        std::vector<FragmentSpan> spans = PlanFragments(payload, payloadSize, isNalAligned,
+                                                        fragmentSize);
+        uint16_t totalFragments = static_cast<uint16_t>(spans.size());
 
         for (uint16_t i = 0; i < totalFragments; ++i) {
-            size_t offset = static_cast<size_t>(i) * FRAGMENT_THRESHOLD;
-            size_t chunkSize = payload.size() - offset;
-            if (chunkSize > FRAGMENT_THRESHOLD) {
-                chunkSize = FRAGMENT_THRESHOLD;
-            }
+            size_t offset = spans[i].offset;
+            size_t chunkSize = spans[i].size;
 
             std::vector<uint8_t> frame;
             uint8_t flags = FLAG_FRAGMENT;
             uint8_t extLength;
+            if (isNalAligned && spans[i].endsOnNal) {
+                flags |= FLAG_NAL_ALIGNED;
+            }
 
             if (i == 0) {
                 // First fragment: frag ext + common ext + video ext
@@ -133,7 +302,7 @@ std::vector<std::vector<uint8_t>> FrameProtocol::EncodeVideoFrame(
                 WriteFixedHeader(frame, MsgType::VIDEO, flags, timestampMs,
                                  extLength, static_cast<uint32_t>(chunkSize));
                 WriteFragmentExtHeader(frame, frameId, i, totalFragments);
-                WriteCommonExtHeader(frame, absTimeMs);
+                WriteCommonExtHeader(frame, absTimeMs, dtsOffsetMs, seqNumber);
                 WriteVideoExtHeader(frame, codec, frameType);
             } else {
                 // Subsequent fragments: frag ext only
@@ -145,8 +314,8 @@ std::vector<std::vector<uint8_t>> FrameProtocol::EncodeVideoFrame(
                 WriteFragmentExtHeader(frame, frameId, i, totalFragments);
             }
 
-            frame.insert(frame.end(), payload.begin() + offset,
-                         payload.begin() + offset + chunkSize);
+            frame.insert(frame.end(), payload + offset,
+                         payload + offset + chunkSize);
 
             frames.push_back(std::move(frame));
         }
@@ -155,6 +324,65 @@ std::vector<std::vector<uint8_t>> FrameProtocol::EncodeVideoFrame(
     return frames;
 }
 
+size_t FrameProtocol::FitFragmentSize(size_t payloadSize, size_t fragmentSize) {
+    // Small per-connection fragments would split a large keyframe into more
+    // pieces than the receiver reassembles
+    return std::max(fragmentSize, (payloadSize + MAX_FRAGMENTS - 1) / MAX_FRAGMENTS);
+}
+
+std::vector<FrameProtocol::FragmentSpan> FrameProtocol::PlanFragments(const uint8_t* payload,
+                                                                     size_t payloadSize,
+                                                                     bool isNalAligned,
+                                                                     size_t fragmentSize) {
+    std::vector<FragmentSpan> spans;
+    if (payloadSize <= fragmentSize || !isNalAligned) {
+        for (size_t offset = 0; offset < payloadSize || spans.empty(); offset += fragmentSize) {
+            size_t chunkSize = std::min(payloadSize - offset, fragmentSize);
+            spans.push_back({offset, chunkSize, offset + chunkSize == payloadSize});
+        }
+        return spans;
+    }
+
+    // NAL units start at their start code; anything before the first one
+    // stays with it
+    size_t chunkStart = 0;
+    size_t packedEnd = 0;   // end of the whole NAL units packed since chunkStart
+    size_t pos = StartCodeScanner::FindNext(payload, payloadSize, 0);
+    while (packedEnd < payloadSize) {
+        size_t next = (pos < payloadSize)
+            ? StartCodeScanner::FindNext(payload, payloadSize, pos + 3) : payloadSize;
+        size_t nalEnd = (next < payloadSize)
+            ? next - (StartCodeScanner::GetStartCodeLength(payload, next) - 3) : payloadSize;
+        pos = next;
+        if (nalEnd <= packedEnd) {
+            continue;
+        }
+
+        if (nalEnd - chunkStart > fragmentSize) {
+            if (packedEnd > chunkStart) {
+                spans.push_back({chunkStart, packedEnd - chunkStart, true});
+                chunkStart = packedEnd;
+            }
+            // A NAL unit larger than a fragment is cut at fixed offsets
+            while (nalEnd - chunkStart > fragmentSize) {
+                spans.push_back({chunkStart, fragmentSize, false});
+                chunkStart += fragmentSize;
+            }
+        }
+        packedEnd = nalEnd;
+    }
+    spans.push_back({chunkStart, payloadSize - chunkStart, true});
+
+    // Half-full fragments (NAL units just over half the threshold) can
+    // nearly double the count; the receiver drops frames past its limit
+    if (spans.size() > MAX_FRAGMENTS) {
+        std::fprintf(stderr, "NAL-aligned split of %zu bytes needs %zu fragments, "
+                     "using fixed-size fragments\n", payloadSize, spans.size());
+        return PlanFragments(payload, payloadSize, false, fragmentSize);
+    }
+    return spans;
+}
+
 void FrameProtocol::WriteAudioExtHeader(std::vector<uint8_t>& buf,
                                         AudioCodec codec,
                                         SampleRateCode sampleRate,
@@ -183,6 +411,20 @@ std::vector<std::vector<uint8_t>> FrameProtocol::EncodeAudioFrame(
     int64_t timestampMs,
     int64_t absTimeMs,
     uint16_t frameId) {
+    return EncodeAudioFrame(payload.data(), payload.size(), codec, sampleRate, channels,
+                            timestampMs, absTimeMs, frameId);
+}
+
+std::vector<std::vector<uint8_t>> FrameProtocol::EncodeAudioFrame(
+    const uint8_t* payload,
+    size_t payloadSize,
+    AudioCodec codec,
+    SampleRateCode sampleRate,
+    uint8_t channels,
+    int64_t timestampMs,
+    int64_t absTimeMs,
+    uint16_t frameId,
+    size_t fragmentSize) {
 
     std::vector<std::vector<uint8_t>> frames;
 
@@ -190,29 +432,29 @@ std::vector<std::vector<uint8_t>> FrameProtocol::EncodeAudioFrame(
     const uint8_t kAudioExtSize = 4;   // codec(1) + sample_rate(1) + channels(1) + reserved(1)
     const uint8_t kFragExtSize = 6;
 
-    if (payload.size() <= FRAGMENT_THRESHOLD) {
+    if (payloadSize <= fragmentSize) {
         uint8_t extLength = kCommonExtSize + kAudioExtSize;
         uint8_t flags = FLAG_HAS_COMMON;
 
         std::vector<uint8_t> frame;
-        frame.reserve(FIXED_HEADER_SIZE + extLength + payload.size());
+        frame.reserve(FIXED_HEADER_SIZE + extLength + payloadSize);
 
         WriteFixedHeader(frame, MsgType::AUDIO, flags, timestampMs,
-                         extLength, static_cast<uint32_t>(payload.size()));
+                         extLength, static_cast<uint32_t>(payloadSize));
         WriteCommonExtHeader(frame, absTimeMs);
         WriteAudioExtHeader(frame, codec, sampleRate, channels);
-        frame.insert(frame.end(), payload.begin(), payload.end());
+        frame.insert(frame.end(), payload, payload + payloadSize);
 
         frames.push_back(std::move(frame));
     } else {
         uint16_t totalFragments = static_cast<uint16_t>(
-            (payload.size() + FRAGMENT_THRESHOLD - 1) / FRAGMENT_THRESHOLD);
+            (payloadSize + fragmentSize - 1) / fragmentSize);
 
         for (uint16_t i = 0; i < totalFragments; ++i) {
-            size_t offset = static_cast<size_t>(i) * FRAGMENT_THRESHOLD;
-            size_t chunkSize = payload.size() - offset;
-            if (chunkSize > FRAGMENT_THRESHOLD) {
-                chunkSize = FRAGMENT_THRESHOLD;
+            size_t offset = static_cast<size_t>(i) * fragmentSize;
+            size_t chunkSize = payloadSize - offset;
+            if (chunkSize > fragmentSize) {
+                chunkSize = fragmentSize;
             }
 
             std::vector<uint8_t> frame;
@@ -238,8 +480,8 @@ std::vector<std::vector<uint8_t>> FrameProtocol::EncodeAudioFrame(
                 WriteFragmentExtHeader(frame, frameId, i, totalFragments);
             }
 
-            frame.insert(frame.end(), payload.begin() + offset,
-                         payload.begin() + offset + chunkSize);
+            frame.insert(frame.end(), payload + offset,
+                         payload + offset + chunkSize);
 
             frames.push_back(std::move(frame));
         }
@@ -248,4 +490,218 @@ std::vector<std::vector<uint8_t>> FrameProtocol::EncodeAudioFrame(
     return frames;
 }
 
+void CompactTimeline::Reset() {
+    for (size_t i = 0; i < MSG_TYPE_SLOTS; ++i) {
+        lastTimestampMs[i] = 0;
+        sinceRefresh[i] = COMPACT_REFRESH_INTERVAL;
+    }
+}
+
+void FrameProtocol::WriteVarint(std::vector<uint8_t>& buf, uint64_t val) {
+    while (val >= 0x80) {
+        buf.push_back(static_cast<uint8_t>(val | 0x80));
+        val >>= 7;
+    }
+    buf.push_back(static_cast<uint8_t>(val));
+}
+
+void FrameProtocol::WriteSignedVarint(std::vector<uint8_t>& buf, int64_t val) {
+    WriteVarint(buf, (static_cast<uint64_t>(val) << 1) ^ static_cast<uint64_t>(val >> 63));
+}
+
+std::vector<std::vector<uint8_t>> FrameProtocol::EncodeCompactVideoFrame(
+    const uint8_t* payload,
+    size_t payloadSize,
+    VideoFrameType frameType,
+    int64_t timestampMs,
+    int64_t dtsMs,
+    int64_t absTimeMs,
+    uint16_t frameId,
+    CompactTimeline& timeline,
+    bool isNalAligned,
+    size_t fragmentSize,
+    uint32_t seqNumber) {
+    // A decoder can start at these, so a resyncing receiver gets an
+    // absolute timestamp there
+    bool isRefresh = frameType == VideoFrameType::IDR || frameType == VideoFrameType::I_FRAME ||
+                     frameType == VideoFrameType::SPS_PPS || frameType == VideoFrameType::VPS ||
+                     frameType == VideoFrameType::INIT_SEGMENT;
+    return EncodeCompactFrame(MsgType::VIDEO, static_cast<uint8_t>(frameType) << 4,
+                              payload, payloadSize, timestampMs,
+                              static_cast<int32_t>(timestampMs - dtsMs), absTimeMs,
+                              isRefresh, frameId, isNalAligned,
+                              FitFragmentSize(payloadSize, fragmentSize), seqNumber, timeline);
+}
+
+std::vector<std::vector<uint8_t>> FrameProtocol::EncodeCompactAudioFrame(
+    const uint8_t* payload,
+    size_t payloadSize,
+    int64_t timestampMs,
+    int64_t absTimeMs,
+    uint16_t frameId,
+    CompactTimeline& timeline,
+    size_t fragmentSize) {
+    return EncodeCompactFrame(MsgType::AUDIO, 0, payload, payloadSize, timestampMs, 0,
+                              absTimeMs, false, frameId, false, fragmentSize, 0, timeline);
+}
+
+std::vector<std::vector<uint8_t>> FrameProtocol::EncodeCompactFrame(
+    MsgType msgType,
+    uint8_t typeFlags,
+    const uint8_t* payload,
+    size_t payloadSize,
+    int64_t timestampMs,
+    int32_t dtsOffsetMs,
+    int64_t absTimeMs,
+    bool isRefresh,
+    uint16_t frameId,
+    bool isNalAligned,
+    size_t fragmentSize,
+    uint32_t seqNumber,
+    CompactTimeline& timeline) {
+
+    std::vector<std::vector<uint8_t>> frames;
+
+    // A sequence number rides on an absolute message only
+    if (!timeline.isSequenced) {
+        seqNumber = 0;
+    }
+    size_t slot = static_cast<size_t>(msgType) % CompactTimeline::MSG_TYPE_SLOTS;
+    bool isAbsolute = isRefresh || seqNumber != 0 ||
+                      timeline.sinceRefresh[slot] >= COMPACT_REFRESH_INTERVAL;
+
+    uint8_t flags = typeFlags;
+    if (isAbsolute) {
+        flags |= COMPACT_ABSOLUTE;
+    }
+    if (dtsOffsetMs != 0) {
+        flags |= COMPACT_DTS_OFFSET;
+    }
+
+    std::vector<FragmentSpan> spans = PlanFragments(payload, payloadSize, isNalAligned,
+                                                    fragmentSize);
+    bool isFragmented = spans.size() > 1;
+    uint16_t totalFragments = static_cast<uint16_t>(spans.size());
+    uint8_t versionType = static_cast<uint8_t>((COMPACT_VERSION << 4) |
+                                               static_cast<uint8_t>(msgType));
+
+    for (uint16_t i = 0; i < totalFragments; ++i) {
+        size_t offset = spans[i].offset;
+        size_t chunkSize = spans[i].size;
+        uint8_t alignedFlag = (isFragmented && isNalAligned && spans[i].endsOnNal)
+            ? COMPACT_NAL_ALIGNED : 0;
+
+        // Fixed part + fragment fields + the longest timing fields
+        std::vector<uint8_t> frame;
+        frame.reserve(COMPACT_BASE_HEADER_SIZE + 8 + 24 + chunkSize);
+        frame.push_back(versionType);
+
+        if (i == 0) {
+            frame.push_back(isFragmented ? (flags | COMPACT_FRAGMENT | alignedFlag) : flags);
+            frame.push_back(0);  // stream_id, set by SetStreamId
+            if (isFragmented) {
+                WriteBE16(frame, frameId);
+                WriteVarint(frame, i);
+                WriteVarint(frame, totalFragments);
+            }
+            if (isAbsolute) {
+                WriteSignedVarint(frame, timestampMs);
+                WriteVarint(frame, static_cast<uint64_t>(absTimeMs));
+                if (timeline.isSequenced) {
+                    WriteVarint(frame, seqNumber);
+                }
+            } else {
+                WriteSignedVarint(frame, timestampMs - timeline.lastTimestampMs[slot]);
+            }
+            if (dtsOffsetMs != 0) {
+                WriteSignedVarint(frame, dtsOffsetMs);
+            }
+        } else {
+            // Continuation fragments carry only the fragment fields
+            frame.push_back(COMPACT_FRAGMENT | alignedFlag);
+            frame.push_back(0);
+            WriteBE16(frame, frameId);
+            WriteVarint(frame, i);
+            WriteVarint(frame, totalFragments);
+        }
+
+        frame.insert(frame.end(), payload + offset, payload + offset + chunkSize);
+        frames.push_back(std::move(frame));
+    }
+
+    timeline.lastTimestampMs[slot] = timestampMs;
+    timeline.sinceRefresh[slot] = isAbsolute ? 1 : timeline.sinceRefresh[slot] + 1;
+    return frames;
+}
+
+void FrameProtocol::AddToAudioBatch(AudioBatch& batch,
+                                    const uint8_t* payload,
+                                    size_t payloadSize,
+                                    int64_t timestampMs,
+                                    int64_t absTimeMs) {
+    if (batch.IsEmpty()) {
+        batch.firstTimestampMs = timestampMs;
+        batch.lastTimestampMs = timestampMs;
+        batch.absTimeMs = absTimeMs;
+    }
+    WriteVarint(batch.payload, static_cast<uint64_t>(timestampMs - batch.lastTimestampMs));
+    WriteVarint(batch.payload, payloadSize);
+    batch.payload.insert(batch.payload.end(), payload, payload + payloadSize);
+    batch.lastTimestampMs = timestampMs;
+    batch.frameCount++;
+}
+
+std::vector<uint8_t> FrameProtocol::EncodeAudioBatch(const AudioBatch& batch,
+                                                     AudioCodec codec,
+                                                     SampleRateCode sampleRate,
+                                                     uint8_t channels) {
+    const uint8_t kCommonExtSize = 10;
+    const uint8_t kAudioExtSize = 4;
+    uint8_t extLength = kCommonExtSize + kAudioExtSize;
+
+    std::vector<uint8_t> frame;
+    frame.reserve(FIXED_HEADER_SIZE + extLength + batch.payload.size());
+
+    WriteFixedHeader(frame, MsgType::AUDIO_BATCH, FLAG_HAS_COMMON, batch.firstTimestampMs,
+                     extLength, static_cast<uint32_t>(batch.payload.size()));
+    WriteCommonExtHeader(frame, batch.absTimeMs);
+    WriteAudioExtHeader(frame, codec, sampleRate, channels);
+    frame.insert(frame.end(), batch.payload.begin(), batch.payload.end());
+    return frame;
+}
+
+std::vector<uint8_t> FrameProtocol::EncodeCompactAudioBatch(const AudioBatch& batch,
+                                                            CompactTimeline& timeline) {
+    // The whole batch goes in one message
+    auto frames = EncodeCompactFrame(MsgType::AUDIO_BATCH, 0, batch.payload.data(),
+                                     batch.payload.size(), batch.firstTimestampMs, 0,
+                                     batch.absTimeMs, false, 0, false,
+                                     std::max<size_t>(batch.payload.size(), 1), 0, timeline);
+    return std::move(frames.front());
+}
+
+size_t FrameProtocol::SelectFragmentSize(size_t maxRecordPayload,
+                                        uint32_t mssBytes,
+                                        uint32_t cwndSegments,
+                                        size_t clientMax) {
+    size_t recordSize = (maxRecordPayload > FRAGMENT_HEADER_RESERVE)
+        ? maxRecordPayload : FRAGMENT_THRESHOLD;
+
+    // Half the congestion window, in whole records
+    size_t records = 1;
+    if (mssBytes > 0 && cwndSegments > 0) {
+        size_t halfWindow = static_cast<size_t>(mssBytes) * cwndSegments / 2;
+        records = std::max<size_t>(1, std::min(MAX_FRAGMENT_RECORDS, halfWindow / recordSize));
+    }
+    // Small records (max_fragment_length) are packed several per fragment
+    size_t minRecords = (MIN_FRAGMENT_SIZE + FRAGMENT_HEADER_RESERVE + recordSize - 1) / recordSize;
+    records = std::max(records, minRecords);
+    size_t fragmentSize = records * recordSize - FRAGMENT_HEADER_RESERVE;
+
+    if (clientMax > 0) {
+        fragmentSize = std::min(fragmentSize, std::max(MIN_FRAGMENT_SIZE, clientMax));
+    }
+    return fragmentSize;
+}
+
 }  // namespace server
@@ -1,6 +1,7 @@
 #ifndef FRAME_PROTOCOL_H
 #define FRAME_PROTOCOL_H
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -10,7 +11,21 @@ namespace server {
 static const uint16_t PROTOCOL_MAGIC        = 0xEB01;
 static const uint8_t  PROTOCOL_VERSION      = 1;
 static const uint8_t  FIXED_HEADER_SIZE     = 20;
-static const uint16_t FRAGMENT_THRESHOLD    = 16384;  // 16KB
+static const uint16_t FRAGMENT_THRESHOLD    = 16384;  // 16KB, default fragment payload size
+static const size_t   STREAM_ID_OFFSET      = 18;     // fixed header byte carrying stream_id
+static const size_t   MAX_FRAGMENTS         = 256;    // fragments per frame the receiver reassembles
+
+// Protocol version 2 (compact headers), negotiated per stream in the
+// media-offer/answer; CONTROL messages always use version 1
+static const uint8_t  COMPACT_VERSION           = 2;
+static const uint8_t  COMPACT_BASE_HEADER_SIZE  = 3;  // version|msg_type, flags, stream_id
+static const size_t   COMPACT_STREAM_ID_OFFSET  = 2;
+static const uint32_t COMPACT_REFRESH_INTERVAL  = 50; // messages between absolute timestamps
+
+// Per-connection fragment sizing (FrameProtocol::SelectFragmentSize)
+static const size_t MIN_FRAGMENT_SIZE        = 4096;  // larger frames get larger fragments (FitFragmentSize)
+static const size_t MAX_FRAGMENT_RECORDS     = 4;   // TLS records per fragment at most
+static const size_t FRAGMENT_HEADER_RESERVE  = 64;  // WebSocket header + largest protocol header
 
 // msg_type
 enum class MsgType : uint8_t {
@@ -18,7 +33,8 @@ enum class MsgType : uint8_t {
     AUDIO    = 0x02,
     IMAGE    = 0x03,
     METADATA = 0x04,
-    CONTROL  = 0x05
+    CONTROL  = 0x05,
+    AUDIO_BATCH = 0x06  // consecutive audio frames of one stream in one message
 };
 
 // flags bit definitions
@@ -26,14 +42,24 @@ enum FrameFlag : uint8_t {
     FLAG_FRAGMENT   = 0x01,  // bit 0
     FLAG_ENCRYPTED  = 0x02,  // bit 1
     FLAG_COMPRESSED = 0x04,  // bit 2
-    FLAG_HAS_COMMON = 0x08   // bit 3
+    FLAG_HAS_COMMON = 0x08,  // bit 3
+    FLAG_NAL_ALIGNED = 0x10  // bit 4: fragment ends on a NAL unit boundary
 };
 
 // common_flags bit definitions
 enum CommonFlag : uint8_t {
     COMMON_ABS_TIME   = 0x01,  // bit 0: abs_time (8 bytes)
     COMMON_WATERMARK  = 0x02,  // bit 1: watermark (4 bytes)
-    COMMON_SEQ_NUMBER = 0x04   // bit 2: seq_number (4 bytes)
+    COMMON_SEQ_NUMBER = 0x04,  // bit 2: seq_number (4 bytes)
+    COMMON_DTS_OFFSET = 0x08   // bit 3: dts_offset = pts - dts in ms (4 bytes, signed)
+};
+
+// Version 2 flags bit definitions; bits 4-7 carry the video frame_type
+enum CompactFlag : uint8_t {
+    COMPACT_FRAGMENT   = 0x01,  // bit 0: frame_id(2B) + fragment_index + total_fragments
+    COMPACT_ABSOLUTE   = 0x02,  // bit 1: timestamp is absolute and abs_time follows it
+    COMPACT_DTS_OFFSET = 0x04,  // bit 2: dts_offset follows the timestamp
+    COMPACT_NAL_ALIGNED = 0x08  // bit 3: fragment ends on a NAL unit boundary
 };
 
 // Video codec types (in video ext header)
@@ -66,19 +92,137 @@ enum class VideoFrameType : uint8_t {
     P_FRAME = 3,
     B_FRAME = 4,
     SPS_PPS = 5,
-    VPS     = 6
+    VPS     = 6,
+    INIT_SEGMENT = 7    // fMP4 container: init segment (ftyp + moov)
+};
+
+// Image formats (in image ext header)
+enum class ImageFormat : uint8_t {
+    JPEG = 1,
+    PNG  = 2,
+    BMP  = 3
+};
+
+// Why an image was taken (in image ext header)
+enum class ImagePurpose : uint8_t {
+    SNAPSHOT  = 1,   // manual capture
+    ALARM     = 2,
+    THUMBNAIL = 3    // source overview still, see ThumbnailCache
+};
+
+// Metadata types (in metadata ext header)
+enum class MetadataType : uint8_t {
+    OBJECT_DETECTION = 1,
+    FACE             = 2,
+    BEHAVIOR         = 3,
+    OSD              = 4,
+    SOURCE_SUMMARY   = 5   // server -> client ahead of the media-offer, see MediaSource
+};
+
+// Metadata payload formats (in metadata ext header)
+enum class MetadataFormat : uint8_t {
+    JSON     = 1,
+    BINARY   = 2,
+    PROTOBUF = 3
+};
+
+// Control message types (in control ext header)
+enum class ControlType : uint8_t {
+    HEARTBEAT     = 1,
+    HEARTBEAT_ACK = 2,
+    FLOW_CONTROL  = 3,  // client -> server; payload: credit granted (4B), in frames or bytes
+    ERROR_NOTIFY  = 4,
+    STREAM_CHANGE = 5,
+    PLAYBACK_RATE = 6,  // client -> server; payload: rate x 1000 (4B), 1000 = 1x
+    SEEK          = 7,  // client -> server; payload: position in ms from start (8B)
+    DISCONTINUITY = 8,  // server -> client; payload: position in ms resumed at (8B)
+    SUBSCRIBE     = 9,  // client -> server; payload: request path of the source to add
+    UNSUBSCRIBE   = 10, // client -> server; no payload
+    LATENCY_REPORT = 11, // client -> server; payload: LatencyReportEntry records
+    CLOCK_SYNC    = 12  // client -> server: client time (8B); server -> client: client
+                        // time (8B) + server time when answered (8B), both in UTC ms
+};
+
+// One probe in a LATENCY_REPORT payload; times are UTC ms on the server's
+// clock (the client applies its CLOCK_SYNC offset)
+static const size_t LATENCY_REPORT_ENTRY_SIZE = 20;  // seq(4) + received(8) + decoded(8)
+
+struct LatencyReportEntry {
+    uint32_t seqNumber;
+    int64_t receivedMs;   // last byte of the frame received
+    int64_t decodedMs;    // frame decoded, 0 if the client does not decode it
+};
+
+/**
+ * @brief A parsed CONTROL message; payload points into the parsed buffer
+ */
+struct ControlMessage {
+    uint8_t streamId;
+    ControlType type;
+    const uint8_t* payload;
+    size_t payloadSize;
+};
+
+/**
+ * @brief Sender side timestamp state of one stream in protocol version 2
+ *
+ * Timestamps are sent as deltas from the previous message of the same
+ * msg_type. Every COMPACT_REFRESH_INTERVAL messages, at video keyframes
+ * and after Reset() the timestamp is sent absolute, so a receiver that
+ * dropped messages resyncs there.
+ */
+struct CompactTimeline {
+    static const size_t MSG_TYPE_SLOTS = 8;   // indexed by msg_type
+
+    int64_t lastTimestampMs[MSG_TYPE_SLOTS];
+    uint32_t sinceRefresh[MSG_TYPE_SLOTS];
+    bool isSequenced;   // absolute messages carry a seq_number (0 = none)
+
+    CompactTimeline() : isSequenced(false) { Reset(); }
+
+    /**
+     * @brief Send the next message of every type with an absolute
+     *        timestamp (e.g. after a seek)
+     */
+    void Reset();
+};
+
+/**
+ * @brief Audio frames collected for one AUDIO_BATCH message
+ *
+ * The payload is a sequence of sub-frames, each a varint timestamp delta
+ * from the previous one (0 for the first, which has the message
+ * timestamp), a varint size and the frame data.
+ */
+struct AudioBatch {
+    std::vector<uint8_t> payload;
+    size_t frameCount;
+    int64_t firstTimestampMs;
+    int64_t lastTimestampMs;
+    int64_t absTimeMs;        // absolute time of the first frame
+
+    AudioBatch() : frameCount(0), firstTimestampMs(0), lastTimestampMs(0), absTimeMs(0) {}
+
+    bool IsEmpty() const { return frameCount == 0; }
+
+    void Clear() {
+        payload.clear();
+        frameCount = 0;
+    }
 };
 
 class FrameProtocol {
 public:
     /**
      * Encode an Access Unit into one or more protocol frames.
-     * If payload > FRAGMENT_THRESHOLD, generates multiple fragments.
+     * If payload > fragmentSize, generates multiple fragments.
      *
      * @param payload      merged NAL unit data
      * @param codec        video codec type
      * @param frameType    video frame type
-     * @param timestampMs  relative timestamp in ms
+     * @param timestampMs  relative timestamp in ms (presentation time)
+     * @param dtsMs        decode timestamp in ms; sent as a common ext field
+     *                     only when it differs from timestampMs
      * @param absTimeMs    absolute UTC timestamp in ms
      * @param frameId      frame ID for fragmentation tracking
      * @return vector of encoded protocol frames (each is a complete binary frame)
@@ -88,9 +232,34 @@ public:
         VideoCodec codec,
         VideoFrameType frameType,
         int64_t timestampMs,
+        int64_t dtsMs,
         int64_t absTimeMs,
         uint16_t frameId);
 
+    /**
+     * Same as above, encoding a payload span that is not owned by a vector
+     * (e.g. an Access Unit inside a mapped file).
+     *
+     * @param isNalAligned cut fragments between NAL units where possible and
+     *                     mark those with FLAG_NAL_ALIGNED, so the receiver
+     *                     can decode slices before the last fragment arrives
+     * @param fragmentSize largest payload per message (SelectFragmentSize)
+     * @param seqNumber    latency probe sequence number sent in the common
+     *                     ext header; 0 sends none
+     */
+    static std::vector<std::vector<uint8_t>> EncodeVideoFrame(
+        const uint8_t* payload,
+        size_t payloadSize,
+        VideoCodec codec,
+        VideoFrameType frameType,
+        int64_t timestampMs,
+        int64_t dtsMs,
+        int64_t absTimeMs,
+        uint16_t frameId,
+        bool isNalAligned = false,
+        size_t fragmentSize = FRAGMENT_THRESHOLD,
+        uint32_t seqNumber = 0);
+
     /**
      * Encode audio data into one or more protocol frames.
      *
@@ -112,9 +281,211 @@ public:
         int64_t absTimeMs,
         uint16_t frameId);
 
+    /**
+     * Same as above, encoding a payload span that is not owned by a vector.
+     */
+    static std::vector<std::vector<uint8_t>> EncodeAudioFrame(
+        const uint8_t* payload,
+        size_t payloadSize,
+        AudioCodec codec,
+        SampleRateCode sampleRate,
+        uint8_t channels,
+        int64_t timestampMs,
+        int64_t absTimeMs,
+        uint16_t frameId,
+        size_t fragmentSize = FRAGMENT_THRESHOLD);
+
+    /**
+     * Encode an Access Unit in protocol version 2: codec parameters are
+     * in the media-offer, the payload length is the message length, and
+     * the timestamps are varints relative to the stream's timeline.
+     *
+     * @param timeline     sender state of the stream, updated
+     * @param isNalAligned as for EncodeVideoFrame (COMPACT_NAL_ALIGNED)
+     * @param seqNumber    latency probe sequence number; non-zero makes the
+     *                     message absolute (needs timeline.isSequenced)
+     * @return vector of encoded protocol frames
+     */
+    static std::vector<std::vector<uint8_t>> EncodeCompactVideoFrame(
+        const uint8_t* payload,
+        size_t payloadSize,
+        VideoFrameType frameType,
+        int64_t timestampMs,
+        int64_t dtsMs,
+        int64_t absTimeMs,
+        uint16_t frameId,
+        CompactTimeline& timeline,
+        bool isNalAligned = false,
+        size_t fragmentSize = FRAGMENT_THRESHOLD,
+        uint32_t seqNumber = 0);
+
+    /**
+     * Encode audio data in protocol version 2; codec, sample rate and
+     * channels are in the media-offer.
+     */
+    static std::vector<std::vector<uint8_t>> EncodeCompactAudioFrame(
+        const uint8_t* payload,
+        size_t payloadSize,
+        int64_t timestampMs,
+        int64_t absTimeMs,
+        uint16_t frameId,
+        CompactTimeline& timeline,
+        size_t fragmentSize = FRAGMENT_THRESHOLD);
+
+    /**
+     * Append an audio frame to a batch; frames must be in timestamp order.
+     */
+    static void AddToAudioBatch(AudioBatch& batch,
+                                const uint8_t* payload,
+                                size_t payloadSize,
+                                int64_t timestampMs,
+                                int64_t absTimeMs);
+
+    /**
+     * Encode a batch as one AUDIO_BATCH message (never fragmented; keep
+     * the batch under the connection's fragment size).
+     */
+    static std::vector<uint8_t> EncodeAudioBatch(const AudioBatch& batch,
+                                                 AudioCodec codec,
+                                                 SampleRateCode sampleRate,
+                                                 uint8_t channels);
+
+    /**
+     * Encode a batch as one AUDIO_BATCH message in protocol version 2.
+     */
+    static std::vector<uint8_t> EncodeCompactAudioBatch(const AudioBatch& batch,
+                                                        CompactTimeline& timeline);
+
     static SampleRateCode SampleRateToCode(int32_t sampleRate);
 
+    /**
+     * Pick the fragment payload size for a connection. A fragment plus its
+     * headers fits whole TLS records, so no record is sent nearly empty
+     * (a 16 KB payload plus headers takes a full record and a tiny one).
+     * It spans more records, up to MAX_FRAGMENT_RECORDS, when the
+     * congestion window holds at least twice as many, so fast paths send
+     * fewer, larger messages. The client may ask for smaller fragments.
+     * Video frames too large for MAX_FRAGMENTS of this size are sent with
+     * larger fragments when they are encoded.
+     *
+     * @param maxRecordPayload  TLS record payload limit, 0 if unknown
+     * @param mssBytes          TCP send MSS, 0 if unknown
+     * @param cwndSegments      TCP congestion window in segments, 0 if unknown
+     * @param clientMax         limit from the media-answer, 0 if none
+     * @return payload bytes per fragment
+     */
+    static size_t SelectFragmentSize(size_t maxRecordPayload,
+                                     uint32_t mssBytes,
+                                     uint32_t cwndSegments,
+                                     size_t clientMax);
+
+    /**
+     * Parse an unfragmented CONTROL frame received from the client.
+     *
+     * @param data  complete protocol frame
+     * @param size  frame length
+     * @param msg   parsed message
+     * @return false if the frame is malformed or not a CONTROL message
+     */
+    static bool ParseControlFrame(const uint8_t* data, size_t size, ControlMessage& msg);
+
+    /**
+     * Parse the entries of a LATENCY_REPORT control message.
+     *
+     * @param msg      parsed CONTROL message
+     * @param entries  receives the entries (cleared first)
+     * @return false if the payload is not a whole number of entries
+     */
+    static bool ParseLatencyReport(const ControlMessage& msg,
+                                   std::vector<LatencyReportEntry>& entries);
+
+    /**
+     * Encode a CONTROL message sent to the client.
+     *
+     * @param type         control type
+     * @param payload      control payload
+     * @param payloadSize  payload length
+     * @param timestampMs  relative timestamp in ms
+     * @return encoded protocol frame
+     */
+    static std::vector<uint8_t> EncodeControlFrame(ControlType type,
+                                                   const uint8_t* payload,
+                                                   size_t payloadSize,
+                                                   int64_t timestampMs);
+
+    /**
+     * Encode an IMAGE message (not fragmented).
+     *
+     * @param format       image format
+     * @param purpose      why the image was taken
+     * @param picId        picture ID, links the image to metadata
+     * @param image        encoded image
+     * @param imageSize    image length
+     * @param timestampMs  relative timestamp in ms
+     * @return encoded protocol frame
+     */
+    static std::vector<uint8_t> EncodeImageFrame(ImageFormat format,
+                                                 ImagePurpose purpose,
+                                                 uint16_t picId,
+                                                 const uint8_t* image,
+                                                 size_t imageSize,
+                                                 int64_t timestampMs);
+
+    /**
+     * Encode a METADATA message (not fragmented).
+     *
+     * @param type         metadata type
+     * @param format       payload format
+     * @param assocStream  stream_id of the video the metadata belongs to
+     * @param payload      metadata payload
+     * @param payloadSize  payload length
+     * @param timestampMs  relative timestamp in ms
+     * @return encoded protocol frame
+     */
+    static std::vector<uint8_t> EncodeMetadataFrame(MetadataType type,
+                                                    MetadataFormat format,
+                                                    uint8_t assocStream,
+                                                    const uint8_t* payload,
+                                                    size_t payloadSize,
+                                                    int64_t timestampMs);
+
+    /**
+     * Set the stream_id of an encoded message (every fragment carries it).
+     * Stream 0 is the connection's own source; others are multiplexed.
+     */
+    static void SetStreamId(std::vector<uint8_t>& message, uint8_t streamId) {
+        bool isCompact = (message[0] >> 4) == COMPACT_VERSION;
+        message[isCompact ? COMPACT_STREAM_ID_OFFSET : STREAM_ID_OFFSET] = streamId;
+    }
+
+    static uint32_t ReadBE32(const uint8_t* data);
+    static int64_t ReadBE64(const uint8_t* data);
+    static void WriteBE64(std::vector<uint8_t>& buf, int64_t val);
+
+    // LEB128 varint; signed values are zigzag encoded first
+    static void WriteVarint(std::vector<uint8_t>& buf, uint64_t val);
+
 private:
+    // Payload range carried by one fragment
+    struct FragmentSpan {
+        size_t offset;
+        size_t size;
+        bool endsOnNal;
+    };
+
+    // Fragment size for one frame: fragmentSize, raised just enough for the
+    // payload to fit in MAX_FRAGMENTS fragments
+    static size_t FitFragmentSize(size_t payloadSize, size_t fragmentSize);
+
+    // Split a payload into fragments of at most fragmentSize bytes;
+    // with isNalAligned, whole NAL units are packed into each fragment and
+    // only NAL units larger than the threshold are cut inside. Packing that
+    // would need more than MAX_FRAGMENTS falls back to the fixed-size split
+    static std::vector<FragmentSpan> PlanFragments(const uint8_t* payload,
+                                                   size_t payloadSize,
+                                                   bool isNalAligned,
+                                                   size_t fragmentSize);
+
     static void WriteFixedHeader(std::vector<uint8_t>& buf,
                                  MsgType msgType,
                                  uint8_t flags,
@@ -122,8 +493,14 @@ private:
                                  uint8_t extLength,
                                  uint32_t payloadLength);
 
+    // dtsOffsetMs == 0 omits the dts_offset field, seqNumber == 0 the
+    // seq_number field
+    static uint8_t GetCommonExtSize(int32_t dtsOffsetMs, uint32_t seqNumber = 0);
+
     static void WriteCommonExtHeader(std::vector<uint8_t>& buf,
-                                     int64_t absTimeMs);
+                                     int64_t absTimeMs,
+                                     int32_t dtsOffsetMs = 0,
+                                     uint32_t seqNumber = 0);
 
     static void WriteVideoExtHeader(std::vector<uint8_t>& buf,
                                     VideoCodec codec,
@@ -139,9 +516,26 @@ private:
                                        uint16_t fragmentIndex,
                                        uint16_t totalFragments);
 
+    static std::vector<std::vector<uint8_t>> EncodeCompactFrame(
+        MsgType msgType,
+        uint8_t typeFlags,
+        const uint8_t* payload,
+        size_t payloadSize,
+        int64_t timestampMs,
+        int32_t dtsOffsetMs,
+        int64_t absTimeMs,
+        bool isRefresh,
+        uint16_t frameId,
+        bool isNalAligned,
+        size_t fragmentSize,
+        uint32_t seqNumber,
+        CompactTimeline& timeline);
+
+    // Varint of the zigzag-encoded value
+    static void WriteSignedVarint(std::vector<uint8_t>& buf, int64_t val);
+
     static void WriteBE16(std::vector<uint8_t>& buf, uint16_t val);
     static void WriteBE32(std::vector<uint8_t>& buf, uint32_t val);
-    static void WriteBE64(std::vector<uint8_t>& buf, int64_t val);
 };
 
 }  // namespace server
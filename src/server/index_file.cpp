@@ -0,0 +1,266 @@
+#include "index_file.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+namespace server {
+
+static const uint32_t INDEX_MAGIC = 0x58495356;  // "VSIX" in little-endian byte order
+static const uint32_t INDEX_FORMAT_VERSION = 4;
+static const size_t HASH_BLOCK_BYTES = 64 * 1024;
+static const size_t SECTION_ALIGN = 8;
+
+/**
+ * @brief Fixed header at the start of every index file
+ */
+struct IndexFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind;
+    uint32_t sectionCount;
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    uint64_t contentHash;
+};
+
+static uint64_t Fnv1a(uint64_t hash, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool ReadFully(int32_t fd, uint8_t* buffer, size_t size, uint64_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, buffer + done, size - done, static_cast<off_t>(offset + done));
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static size_t AlignUp(size_t value) {
+    return (value + SECTION_ALIGN - 1) & ~(SECTION_ALIGN - 1);
+}
+
+std::string IndexFile::GetSidecarPath(const std::string& sourcePath) {
+    return sourcePath + ".vsidx";
+}
+
+std::string IndexFile::GetSharedPath(const IndexSourceKey& key) {
+    char name[96];
+    std::snprintf(name, sizeof(name), "/dev/shm/video_server-%016llx-%llx.vsidx",
+                  static_cast<unsigned long long>(key.contentHash),
+                  static_cast<unsigned long long>(key.size));
+    return std::string(name);
+}
+
+bool IndexFile::ReadSourceKey(const std::string& sourcePath, IndexSourceKey& key) {
+    int32_t fd = open(sourcePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    key.size = static_cast<uint64_t>(st.st_size);
+    key.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+
+    // Sampling head and tail keeps the key O(1) in media size while still
+    // catching files rewritten in place with the same size and mtime
+    uint64_t hash = Fnv1a(0xcbf29ce484222325ULL, reinterpret_cast<const uint8_t*>(&key.size),
+                          sizeof(key.size));
+    std::vector<uint8_t> block(HASH_BLOCK_BYTES);
+    size_t headSize = (key.size < HASH_BLOCK_BYTES) ? static_cast<size_t>(key.size) : HASH_BLOCK_BYTES;
+    bool isOk = ReadFully(fd, block.data(), headSize, 0);
+    hash = Fnv1a(hash, block.data(), headSize);
+    if (isOk && key.size > HASH_BLOCK_BYTES) {
+        isOk = ReadFully(fd, block.data(), HASH_BLOCK_BYTES, key.size - HASH_BLOCK_BYTES);
+        hash = Fnv1a(hash, block.data(), HASH_BLOCK_BYTES);
+    }
+    close(fd);
+
+    key.contentHash = hash;
+    return isOk;
+}
+
+IndexFile::IndexFile() : sections_(nullptr), sectionCount_(0) {
+}
+
+bool IndexFile::Open(const std::string& indexPath, IndexKind kind, const IndexSourceKey& key) {
+    Close();
+
+    if (access(indexPath.c_str(), R_OK) != 0 || !file_.Open(indexPath)) {
+        return false;
+    }
+
+    const uint8_t* data = file_.GetData();
+    size_t size = file_.GetSize();
+    if (size < sizeof(IndexFileHeader)) {
+        Close();
+        return false;
+    }
+
+    IndexFileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    bool isCurrent = header.magic == INDEX_MAGIC &&
+                     header.version == INDEX_FORMAT_VERSION &&
+                     header.kind == static_cast<uint32_t>(kind) &&
+                     header.sourceSize == key.size &&
+                     header.sourceMtimeNs == key.mtimeNs &&
+                     header.contentHash == key.contentHash;
+    size_t directorySize = static_cast<size_t>(header.sectionCount) * sizeof(IndexSectionEntry);
+    if (!isCurrent || directorySize > size - sizeof(IndexFileHeader)) {
+        Close();
+        return false;
+    }
+
+    sections_ = reinterpret_cast<const IndexSectionEntry*>(data + sizeof(IndexFileHeader));
+    sectionCount_ = header.sectionCount;
+
+    for (uint32_t i = 0; i < sectionCount_; ++i) {
+        const IndexSectionEntry& section = sections_[i];
+        if (section.offset % SECTION_ALIGN != 0 || section.offset > size ||
+            (section.recordSize > 0 && section.count > (size - section.offset) / section.recordSize)) {
+            std::fprintf(stderr, "Corrupt index file: %s\n", indexPath.c_str());
+            Close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void IndexFile::Close() {
+    file_.Close();
+    sections_ = nullptr;
+    sectionCount_ = 0;
+}
+
+bool IndexFile::FindSection(uint32_t id, size_t recordSize, const void*& data,
+                            size_t& count) const {
+    for (uint32_t i = 0; i < sectionCount_; ++i) {
+        if (sections_[i].id == id) {
+            if (sections_[i].recordSize != recordSize) {
+                return false;
+            }
+            data = file_.GetData() + sections_[i].offset;
+            count = static_cast<size_t>(sections_[i].count);
+            return true;
+        }
+    }
+    return false;
+}
+
+IndexFileWriter::IndexFileWriter() {
+}
+
+IndexFileWriter::~IndexFileWriter() {
+    Wait();
+}
+
+void IndexFileWriter::AddSection(uint32_t id, const void* records, size_t recordSize,
+                                 size_t count) {
+    data_.resize(AlignUp(data_.size()), 0);
+
+    IndexSectionEntry section;
+    section.id = id;
+    section.recordSize = static_cast<uint32_t>(recordSize);
+    section.count = 0;
+    section.offset = data_.size();  // relative to the data area until written
+    sections_.push_back(section);
+
+    AppendToSection(records, count);
+}
+
+void IndexFileWriter::AppendToSection(const void* records, size_t count) {
+    IndexSectionEntry& section = sections_.back();
+    const uint8_t* bytes = static_cast<const uint8_t*>(records);
+    data_.insert(data_.end(), bytes, bytes + section.recordSize * count);
+    section.count += count;
+}
+
+void IndexFileWriter::WriteAsync(const std::string& indexPath, IndexKind kind,
+                                 const IndexSourceKey& key) {
+    Wait();
+
+    IndexFileHeader header;
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_FORMAT_VERSION;
+    header.kind = static_cast<uint32_t>(kind);
+    header.sectionCount = static_cast<uint32_t>(sections_.size());
+    header.sourceSize = key.size;
+    header.sourceMtimeNs = key.mtimeNs;
+    header.contentHash = key.contentHash;
+
+    size_t dataStart = AlignUp(sizeof(header) + sections_.size() * sizeof(IndexSectionEntry));
+    for (auto& section : sections_) {
+        section.offset += dataStart;
+    }
+
+    std::vector<uint8_t> head(dataStart, 0);
+    std::memcpy(head.data(), &header, sizeof(header));
+    if (!sections_.empty()) {
+        std::memcpy(head.data() + sizeof(header), sections_.data(),
+                    sections_.size() * sizeof(IndexSectionEntry));
+    }
+
+    // The data area is handed over as-is, so large images are not copied again
+    std::vector<uint8_t> body;
+    body.swap(data_);
+    sections_.clear();
+
+    thread_ = std::thread(&IndexFileWriter::WriteImage, indexPath, std::move(head),
+                          std::move(body));
+}
+
+void IndexFileWriter::Wait() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+static bool WriteFully(int32_t fd, const std::vector<uint8_t>& bytes) {
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = write(fd, bytes.data() + done, bytes.size() - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void IndexFileWriter::WriteImage(std::string indexPath, std::vector<uint8_t> head,
+                                 std::vector<uint8_t> body) {
+    std::string tempPath = indexPath + ".tmp";
+    int32_t fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::fprintf(stderr, "Cannot write index file: %s\n", tempPath.c_str());
+        return;
+    }
+
+    bool isOk = WriteFully(fd, head) && WriteFully(fd, body) && fsync(fd) == 0;
+    close(fd);
+
+    if (!isOk || rename(tempPath.c_str(), indexPath.c_str()) != 0) {
+        std::fprintf(stderr, "Failed to write index file: %s\n", indexPath.c_str());
+        unlink(tempPath.c_str());
+        return;
+    }
+    std::printf("Wrote index file: %s (%zu bytes)\n", indexPath.c_str(),
+                head.size() + body.size());
+}
+
+}  // namespace server
@@ -0,0 +1,173 @@
+#ifndef INDEX_FILE_H
+#define INDEX_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace server {
+
+/**
+ * @brief Kind of media a sidecar index was built for
+ */
+enum class IndexKind : uint32_t {
+    RAW_H264 = 1,
+    RAW_H265 = 2,
+    MP4 = 3,
+    MP4_SHARED = 4   // MP4 index plus payloads, in shared memory
+};
+
+/**
+ * @brief Identity of a source file: an index is only valid for the same key
+ */
+struct IndexSourceKey {
+    uint64_t size;         // file size in bytes
+    int64_t mtimeNs;       // modification time in nanoseconds
+    uint64_t contentHash;  // FNV-1a over the size and the first/last 64 KiB
+};
+
+/**
+ * @brief Directory entry of one record array stored in an index file
+ */
+struct IndexSectionEntry {
+    uint32_t id;          // section id, defined by the index owner
+    uint32_t recordSize;  // sizeof(record) at build time
+    uint64_t count;       // number of records
+    uint64_t offset;      // file offset of the first record (8-byte aligned)
+};
+
+/**
+ * @brief Read-only sidecar index (<source>.vsidx), mmapped on load
+ *
+ * Layout: fixed header, section directory, then the section records as
+ * raw host-endian structs. Records are only accepted when the format
+ * version, kind, record size and source key all match, so a stale or
+ * foreign index is treated as missing.
+ */
+class IndexFile {
+public:
+    IndexFile();
+
+    IndexFile(const IndexFile&) = delete;
+    IndexFile& operator=(const IndexFile&) = delete;
+
+    /**
+     * @brief Get the sidecar index path for a source file
+     */
+    static std::string GetSidecarPath(const std::string& sourcePath);
+
+    /**
+     * @brief Get the shared-memory image path for a source key
+     *
+     * The path lives on tmpfs (/dev/shm) and is derived from the source
+     * key only, so every process serving the same file finds the same image.
+     */
+    static std::string GetSharedPath(const IndexSourceKey& key);
+
+    /**
+     * @brief Compute the key of a source file (stat plus two 64 KiB reads)
+     * @return true on success
+     */
+    static bool ReadSourceKey(const std::string& sourcePath, IndexSourceKey& key);
+
+    /**
+     * @brief Map and validate a sidecar index
+     * @param indexPath path to index file
+     * @param kind expected media kind
+     * @param key expected source key
+     * @return true if the index exists and is current
+     */
+    bool Open(const std::string& indexPath, IndexKind kind, const IndexSourceKey& key);
+
+    /**
+     * @brief Unmap the index
+     */
+    void Close();
+
+    /**
+     * @brief Get the mapped size in bytes, 0 if not open
+     */
+    size_t GetSize() const { return file_.GetSize(); }
+
+    /**
+     * @brief Get a section's records, pointing into the mapping
+     * @param id section id
+     * @param records output pointer to the first record
+     * @param count output number of records
+     * @return true if the section exists and its record size matches T
+     */
+    template <typename T>
+    bool GetSection(uint32_t id, const T*& records, size_t& count) const {
+        const void* data = nullptr;
+        if (!FindSection(id, sizeof(T), data, count)) {
+            return false;
+        }
+        records = static_cast<const T*>(data);
+        return true;
+    }
+
+private:
+    bool FindSection(uint32_t id, size_t recordSize, const void*& data, size_t& count) const;
+
+    MappedFile file_;
+    const IndexSectionEntry* sections_;
+    uint32_t sectionCount_;
+};
+
+/**
+ * @brief Builds a sidecar index image and writes it on a background thread
+ *
+ * Sections are copied into the image when added, so the caller's arrays
+ * may change or go away while the write is in progress. The file is
+ * written to a temporary name and renamed, so readers never see a
+ * partial index.
+ */
+class IndexFileWriter {
+public:
+    IndexFileWriter();
+    ~IndexFileWriter();
+
+    IndexFileWriter(const IndexFileWriter&) = delete;
+    IndexFileWriter& operator=(const IndexFileWriter&) = delete;
+
+    /**
+     * @brief Append a record array to the image
+     */
+    void AddSection(uint32_t id, const void* records, size_t recordSize, size_t count);
+
+    template <typename T>
+    void AddSection(uint32_t id, const std::vector<T>& records) {
+        AddSection(id, records.data(), sizeof(T), records.size());
+    }
+
+    /**
+     * @brief Append more records to the most recently added section
+     */
+    void AppendToSection(const void* records, size_t count);
+
+    /**
+     * @brief Start writing the image to indexPath in the background
+     */
+    void WriteAsync(const std::string& indexPath, IndexKind kind, const IndexSourceKey& key);
+
+    /**
+     * @brief Wait for a pending background write to finish
+     */
+    void Wait();
+
+private:
+    static void WriteImage(std::string indexPath, std::vector<uint8_t> head,
+                           std::vector<uint8_t> body);
+
+    std::vector<IndexSectionEntry> sections_;
+    std::vector<uint8_t> data_;
+    std::thread thread_;
+};
+
+}  // namespace server
+
+#endif  // INDEX_FILE_H
@@ -0,0 +1,54 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+
+namespace server {
+
+// Upper bounds in ms; the last bucket holds everything above 5 s
+static const double BUCKET_UPPER_MS[LatencyHistogram::BUCKET_COUNT - 1] = {
+    1, 2, 5, 10, 15, 20, 30, 50, 75, 100, 150, 200, 300, 500, 1000, 2000, 5000,
+};
+
+LatencyHistogram::LatencyHistogram() : count_(0), sumMs_(0.0), maxMs_(0.0) {
+    std::fill(buckets_, buckets_ + BUCKET_COUNT, 0);
+}
+
+void LatencyHistogram::Record(double ms) {
+    ms = std::max(ms, 0.0);
+    size_t bucket = 0;
+    while (bucket < BUCKET_COUNT - 1 && ms > BUCKET_UPPER_MS[bucket]) {
+        ++bucket;
+    }
+    buckets_[bucket]++;
+    count_++;
+    sumMs_ += ms;
+    maxMs_ = std::max(maxMs_, ms);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        buckets_[i] += other.buckets_[i];
+    }
+    count_ += other.count_;
+    sumMs_ += other.sumMs_;
+    maxMs_ = std::max(maxMs_, other.maxMs_);
+}
+
+double LatencyHistogram::GetPercentile(double fraction) const {
+    if (count_ == 0) {
+        return 0.0;
+    }
+    uint64_t rank = static_cast<uint64_t>(fraction * count_ + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, count_));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT - 1; ++i) {
+        seen += buckets_[i];
+        if (seen >= rank) {
+            return std::min(BUCKET_UPPER_MS[i], maxMs_);
+        }
+    }
+    return maxMs_;
+}
+
+}  // namespace server
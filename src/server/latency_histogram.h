@@ -0,0 +1,54 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace server {
+
+/**
+ * @brief Fixed-bucket latency histogram
+ *
+ * Buckets grow roughly geometrically from 1 ms to 5 s, so percentiles are
+ * resolved to the bucket's upper bound: a few ms at the low end, coarser
+ * above 100 ms where the SLO questions are about tails. Recording is a
+ * short linear scan; no allocation.
+ */
+class LatencyHistogram {
+public:
+    static const size_t BUCKET_COUNT = 18;
+
+    LatencyHistogram();
+
+    /**
+     * @brief Record one sample; negative values (clock error) count as 0
+     */
+    void Record(double ms);
+
+    /**
+     * @brief Add the samples of another histogram
+     */
+    void Merge(const LatencyHistogram& other);
+
+    /**
+     * @brief Get the upper bound of the bucket holding the given fraction
+     *        of the samples (0.5 = median), or the largest sample if that
+     *        is lower
+     * @return latency in ms, 0 if empty
+     */
+    double GetPercentile(double fraction) const;
+
+    uint64_t GetCount() const { return count_; }
+    double GetMax() const { return maxMs_; }
+    double GetMean() const { return (count_ > 0) ? sumMs_ / count_ : 0.0; }
+
+private:
+    uint64_t buckets_[BUCKET_COUNT];
+    uint64_t count_;
+    double sumMs_;
+    double maxMs_;
+};
+
+}  // namespace server
+
+#endif  // LATENCY_HISTOGRAM_H
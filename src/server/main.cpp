@@ -1,3 +1,5 @@
+#include <sys/stat.h>
+
 #include <csignal>
 #include <cstdint>
 #include <cstdio>
@@ -6,14 +8,17 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <ostream>
 #include <string>
 #include <iostream>
 
 #include "connection.h"
 #include "frame_protocol.h"
-#include "mp4_demuxer.h"
-#include "nal_parser.h"
+#include "media_cache.h"
+#include "media_source.h"
+#include "stream_catalog.h"
+#include "thumbnail_cache.h"
 #include "tls_server.h"
 #include "timer.h"
 #include "websocket.h"
@@ -21,6 +26,29 @@
 using namespace server;
 
 static const uint16_t DEFAULT_PORT = 6061;
+static const uint32_t TIMER_INTERVAL_MS = 10;
+static const int32_t DEFAULT_AUDIO_BATCH_MS = 40;
+// Room for the two varints in front of each frame of an audio batch
+static const size_t AUDIO_BATCH_FRAME_OVERHEAD = 20;
+static const int32_t STATUS_INTERVAL_SEC = 60;
+static const int32_t ABR_SAMPLE_INTERVAL_MS = 500;
+static const int32_t FRAGMENT_TUNE_INTERVAL_MS = 1000;
+static const int32_t LATENCY_PROBE_INTERVAL_MS = 250;  // per stream
+static const size_t MAX_PENDING_PROBES = 64;           // per connection, awaiting a report
+// Byte credit check before framing: protocol headers per fragment, plus room
+// for parameter sets added to MP4 keyframes and for fMP4 boxes
+static const size_t MAX_VIDEO_HEADER_BYTES = 64;
+static const size_t CREDIT_SIZE_SLACK = 512;
+static const double MIN_PLAYBACK_RATE = 0.25;
+static const double MAX_PLAYBACK_RATE = 32.0;
+static const double TRICK_PLAY_MIN_RATE = 2.0;  // above this only keyframes are sent
+static const int32_t NEGOTIATION_TIMEOUT_SEC = 5;
+static const char* MUX_PATH = "/mux";          // streams added by SUBSCRIBE, none at start
+static const size_t MAX_STREAMS_PER_CONNECTION = 16;
+static const char* OVERVIEW_PATH = "/overview";   // thumbnails of every source, no media
+static const int32_t DEFAULT_THUMBNAIL_INTERVAL_SEC = 10;
+static const uint32_t THUMBNAIL_WIDTH = 320;
+static const int32_t THUMBNAIL_POLL_INTERVAL_MS = 200;
 
 static volatile bool gRunning = true;
 
@@ -29,9 +57,9 @@ static void SignalHandler(int sig) {
     gRunning = false;
 }
 
-static bool HasSuffix(const std::string& str, const std::string& suffix) {
-    if (suffix.size() > str.size()) return false;
-    return std::equal(suffix.rbegin(), suffix.rend(), str.rbegin());
+static bool IsDirectory(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
 }
 
 static AudioCodec AudioCodecNameToEnum(const std::string& name) {
@@ -47,9 +75,15 @@ public:
     VideoServer()
         : port_(DEFAULT_PORT),
           isH265_(false),
-          isMp4Mode_(false),
+          isLazyLoad_(false),
+          useMmap_(false),
+          useIndexFile_(false),
+          useSharedMemory_(false),
+          audioWindowMs_(0),
+          audioBatchMs_(DEFAULT_AUDIO_BATCH_MS),
+          cacheBudgetMb_(0),
+          thumbnailIntervalSec_(DEFAULT_THUMBNAIL_INTERVAL_SEC),
           frameId_(0),
-          frameIntervalMs_(40.0),
           certPath_(""),
           keyPath_("") {
     }
@@ -57,45 +91,33 @@ public:
     bool Initialize(int32_t argc, char* argv[]) {
         ParseArgs(argc, argv);
 
-        isMp4Mode_ = HasSuffix(videoPath_, ".mp4");
-
-        std::printf("Input file: %s (%s mode)\n",
-                    videoPath_.c_str(), isMp4Mode_ ? "MP4" : "raw bitstream");
+        if (!LoadSources()) {
+            return false;
+        }
 
-        if (isMp4Mode_) {
-            if (!mp4Demuxer_.LoadFile(videoPath_)) {
-                return false;
-            }
-            isH265_ = mp4Demuxer_.GetVideoInfo().isH265;
-            double fps = mp4Demuxer_.GetFrameRate();
-            frameIntervalMs_ = 1000.0 / fps;
-        } else {
-            std::printf("Codec type: %s\n", isH265_ ? "H.265/HEVC" : "H.264/AVC");
-            if (!nalParser_.LoadFile(videoPath_, isH265_)) {
-                return false;
-            }
-            double fps = nalParser_.GetFrameRate();
-            frameIntervalMs_ = 1000.0 / fps;
+        if (thumbnailIntervalSec_ > 0 &&
+            !thumbnailCache_.Start(catalog_.GetSourceCount(), THUMBNAIL_WIDTH)) {
+            return false;
         }
 
         if (!tlsServer_.Start(port_, certPath_, keyPath_)) {
             return false;
         }
 
-        // For MP4 mode, use a fine-grained base timer (10ms)
-        // For raw mode, use frame interval as before
-        uint32_t timerIntervalMs = isMp4Mode_
-            ? 10
-            : static_cast<uint32_t>(frameIntervalMs_);
-
-        std::printf("Timer interval: %u ms\n", timerIntervalMs);
+        // One fine-grained base timer paces every source; each connection
+        // keeps its own playback clock
+        std::printf("Timer interval: %u ms\n", TIMER_INTERVAL_MS);
 
-        if (!timer_.Start(timerIntervalMs)) {
+        if (!timer_.Start(TIMER_INTERVAL_MS)) {
             return false;
         }
 
         tlsServer_.RegisterTimer(timer_.GetFd());
         SetupCallbacks();
+        lastStatusTime_ = std::chrono::steady_clock::now();
+        startTime_ = lastStatusTime_;
+        lastThumbnailRefresh_ = lastStatusTime_ - std::chrono::seconds(thumbnailIntervalSec_);
+        lastThumbnailPoll_ = lastStatusTime_;
 
         return true;
     }
@@ -106,12 +128,50 @@ public:
 
         while (gRunning && tlsServer_.IsRunning()) {
             tlsServer_.ProcessEvents(1000);
+            connManager_.FreeRemoved();
         }
 
         Shutdown();
     }
 
 private:
+    bool LoadSources() {
+        SourceLoadOptions options;
+        options.isH265 = isH265_;
+        options.isLazy = isLazyLoad_;
+        options.useMmap = useMmap_;
+        // Evicted sources are reloaded from their sidecar index
+        options.useIndex = useIndexFile_ || cacheBudgetMb_ > 0;
+        options.useSharedMemory = useSharedMemory_;
+        options.audioWindowMs = audioWindowMs_;
+        mediaCache_.SetBudgetBytes(cacheBudgetMb_ * 1024 * 1024);
+
+        // -f is the default source ("/"); catalog entries follow it. It is
+        // loaded up front so that a bad file still fails at startup
+        if (!videoPath_.empty()) {
+            if (!catalog_.AddSource("default", videoPath_, options)) {
+                return false;
+            }
+            MediaSource* source = catalog_.Find("default");
+            if (!mediaCache_.Acquire(source)) {
+                return false;
+            }
+            mediaCache_.Release(source);
+        }
+
+        if (!catalogPath_.empty()) {
+            bool isOk = IsDirectory(catalogPath_)
+                ? catalog_.LoadDirectory(catalogPath_, options)
+                : catalog_.LoadConfig(catalogPath_, options);
+            if (!isOk) {
+                return false;
+            }
+        }
+
+        std::printf("Serving %zu source(s)\n", catalog_.GetSourceCount());
+        return catalog_.GetSourceCount() > 0;
+    }
+
     void ParseArgs(int32_t argc, char* argv[]) {
         // Check CODEC_TYPE env var
         const char* codecEnv = std::getenv("CODEC_TYPE");
@@ -133,20 +193,43 @@ private:
             } else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
                 videoPath_ = argv[i + 1];
                 ++i;
+            } else if (std::strcmp(argv[i], "--catalog") == 0 && i + 1 < argc) {
+                catalogPath_ = argv[i + 1];
+                ++i;
             } else if (std::strcmp(argv[i], "--cert") == 0 && i + 1 < argc) {
                 certPath_ = argv[i + 1];
                 ++i;
             } else if (std::strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
                 keyPath_ = argv[i + 1];
                 ++i;
+            } else if (std::strcmp(argv[i], "--lazy") == 0) {
+                isLazyLoad_ = true;
+            } else if (std::strcmp(argv[i], "--mmap") == 0) {
+                useMmap_ = true;
+            } else if (std::strcmp(argv[i], "--index") == 0) {
+                useIndexFile_ = true;
+            } else if (std::strcmp(argv[i], "--shm") == 0) {
+                useSharedMemory_ = true;
+            } else if (std::strcmp(argv[i], "--audio-window") == 0 && i + 1 < argc) {
+                audioWindowMs_ = std::atoi(argv[i + 1]);
+                ++i;
+            } else if (std::strcmp(argv[i], "--audio-batch") == 0 && i + 1 < argc) {
+                audioBatchMs_ = std::atoi(argv[i + 1]);
+                ++i;
+            } else if (std::strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+                cacheBudgetMb_ = static_cast<size_t>(std::atol(argv[i + 1]));
+                ++i;
+            } else if (std::strcmp(argv[i], "--thumbnails") == 0 && i + 1 < argc) {
+                thumbnailIntervalSec_ = std::atoi(argv[i + 1]);
+                ++i;
             } else if (std::strcmp(argv[i], "-h") == 0) {
                 PrintUsage(argv[0]);
                 std::exit(0);
             }
         }
 
-        // Set default video path if not specified
-        if (videoPath_.empty()) {
+        // Set default video path if neither a file nor a catalog is given
+        if (videoPath_.empty() && catalogPath_.empty()) {
             videoPath_ = isH265_ ? "./tests/fixtures/TSU_640x360.h265"
                                  : "./tests/fixtures/test_video.h264";
         }
@@ -167,9 +250,27 @@ private:
         std::printf("Options:\n");
         std::printf("  -p <port>      Port number (default: %u)\n", DEFAULT_PORT);
         std::printf("  -c <codec>     Codec type: h264, h265 (default: h264)\n");
-        std::printf("  -f <file>      Media file path (.mp4, .h264, .h265)\n");
+        std::printf("  -f <file>      Media file path (.mp4, .h264, .h265), served at /\n");
+        std::printf("  --catalog <dir|file>  Serve named sources at /stream/<name>: every media\n");
+        std::printf("                 file in a directory (named by file stem), or a config\n");
+        std::printf("                 file with \"<name> <path> [h264|h265]\" lines\n");
         std::printf("  --cert <file>  TLS certificate file (PEM format)\n");
         std::printf("  --key <file>   TLS private key file (PEM format)\n");
+        std::printf("  --lazy         MP4: index samples only, read payloads on demand\n");
+        std::printf("  --mmap         Raw bitstream: mmap the file instead of reading it\n");
+        std::printf("  --index        Load/build a sidecar index (<file>.vsidx) for fast startup\n");
+        std::printf("  --shm          Share loaded media between server processes on this host\n");
+        std::printf("                 (MP4: /dev/shm store built by the first process; raw: mmap)\n");
+        std::printf("  --audio-window <ms>  MP4: send audio this far ahead of video DTS (default: 0)\n");
+        std::printf("  --audio-batch <ms>   MP4: aggregate audio frames into one message for up to\n");
+        std::printf("                 this long if the client supports it, 0 disables (default: %d)\n",
+                    DEFAULT_AUDIO_BATCH_MS);
+        std::printf("  --cache-mb <n> Memory budget for loaded sources; idle sources are evicted\n");
+        std::printf("                 LRU and reloaded from the index (implies --index, default: unlimited)\n");
+        std::printf("  --thumbnails <sec>  Refresh the JPEG thumbnails served at %s this often\n",
+                    OVERVIEW_PATH);
+        std::printf("                 while it has subscribers, 0 disables (default: %d)\n",
+                    DEFAULT_THUMBNAIL_INTERVAL_SEC);
         std::printf("  -h             Show this help\n");
         std::printf("\nTLS:\n");
         std::printf("  Both --cert and --key must be specified together.\n");
@@ -179,18 +280,27 @@ private:
     }
 
     void SetupCallbacks() {
-        TcpCallbacks callbacks;
+        // Every client object is a Connection made by onAccept
+        TlsCallbacks callbacks;
 
-        callbacks.onConnect = [this](int32_t fd, const std::string& ip) {
-            connManager_.AddConnection(fd, ip);
+        callbacks.onAccept = [this](int32_t fd, const std::string& ip) -> TlsConnection* {
+            return connManager_.AddConnection(fd, ip);
         };
 
-        callbacks.onDisconnect = [this](int32_t fd) {
-            connManager_.RemoveConnection(fd);
+        callbacks.onConnect = [](TlsConnection* client) {
+            static_cast<Connection*>(client)->state = ConnState::HANDSHAKING_WS;
         };
 
-        callbacks.onData = [this](int32_t fd, const uint8_t* data, size_t len) {
-            HandleData(fd, data, len);
+        callbacks.onDisconnect = [this](TlsConnection* client) {
+            Connection* conn = static_cast<Connection*>(client);
+            for (const auto& stream : conn->streams) {
+                mediaCache_.Release(stream.source);
+            }
+            connManager_.RemoveConnection(conn);
+        };
+
+        callbacks.onData = [this](TlsConnection* client, const uint8_t* data, size_t len) {
+            HandleData(static_cast<Connection*>(client), data, len);
         };
 
         tlsServer_.SetCallbacks(callbacks);
@@ -200,24 +310,19 @@ private:
         });
     }
 
-    void HandleData(int32_t fd, const uint8_t* data, size_t len) {
-        Connection* conn = connManager_.GetConnection(fd);
-        if (conn == nullptr) {
-            return;
-        }
-
+    void HandleData(Connection* conn, const uint8_t* data, size_t len) {
         // Append to receive buffer
         conn->recvBuffer.insert(conn->recvBuffer.end(), data, data + len);
 
         if (conn->state == ConnState::HANDSHAKING_WS) {
-            HandleHandshake(fd, conn);
+            HandleHandshake(conn);
         } else if (conn->state == ConnState::NEGOTIATING ||
                    conn->state == ConnState::STREAMING) {
-            HandleWebSocketFrame(fd, conn);
+            HandleWebSocketFrame(conn);
         }
     }
 
-    void HandleHandshake(int32_t fd, Connection* conn) {
+    void HandleHandshake(Connection* conn) {
         // Check for complete HTTP request
         std::string request(conn->recvBuffer.begin(), conn->recvBuffer.end());
         if (request.find("\r\n\r\n") == std::string::npos) {
@@ -225,29 +330,73 @@ private:
         }
 
         if (!WebSocket::IsHttpRequest(conn->recvBuffer.data(), conn->recvBuffer.size())) {
-            tlsServer_.CloseConnection(fd);
+            tlsServer_.CloseConnection(conn);
+            return;
+        }
+
+        std::string path = WebSocket::GetRequestPath(request);
+        bool isMux = (path == MUX_PATH);
+        bool isOverview = (path == OVERVIEW_PATH && thumbnailIntervalSec_ > 0);
+        MediaSource* source = (isMux || isOverview) ? nullptr : catalog_.Resolve(path);
+        if (!isMux && !isOverview && source == nullptr) {
+            std::printf("[Connection #%d] Unknown stream path: %s\n", conn->id, path.c_str());
+            std::string notFound = WebSocket::CreateHttpErrorResponse(404, "Not Found");
+            tlsServer_.SendData(conn, reinterpret_cast<const uint8_t*>(notFound.data()),
+                                notFound.size());
+            tlsServer_.CloseConnection(conn);
             return;
         }
 
         std::string response;
         if (!WebSocket::HandleHandshake(request, response)) {
-            tlsServer_.CloseConnection(fd);
+            tlsServer_.CloseConnection(conn);
             return;
         }
 
-        tlsServer_.SendData(fd, reinterpret_cast<const uint8_t*>(response.data()),
+        if (source != nullptr && !mediaCache_.Acquire(source)) {
+            std::string unavailable = WebSocket::CreateHttpErrorResponse(503, "Service Unavailable");
+            tlsServer_.SendData(conn, reinterpret_cast<const uint8_t*>(unavailable.data()),
+                                unavailable.size());
+            tlsServer_.CloseConnection(conn);
+            return;
+        }
+
+        tlsServer_.SendData(conn, reinterpret_cast<const uint8_t*>(response.data()),
                             response.size());
 
         conn->recvBuffer.clear();
+
+        // A multiplexed connection has nothing to negotiate until the
+        // client subscribes to its first stream
+        if (isMux) {
+            conn->state = ConnState::STREAMING;
+            std::printf("[Connection #%d] WebSocket handshake completed, multiplexed\n", conn->id);
+            return;
+        }
+
+        // The overview carries thumbnails only: the source list goes out
+        // now, the images as the thumbnail poll finds them
+        if (isOverview) {
+            conn->state = ConnState::STREAMING;
+            conn->isOverview = true;
+            conn->thumbnailGenerations.assign(catalog_.GetSourceCount(), 0);
+            std::printf("[Connection #%d] WebSocket handshake completed, overview\n", conn->id);
+            SendOverviewOffer(*conn);
+            return;
+        }
+
         conn->state = ConnState::CONNECTED;
+        conn->streams.emplace_back(0, source);
 
-        std::printf("[Connection #%d] WebSocket handshake completed\n", conn->id);
+        std::printf("[Connection #%d] WebSocket handshake completed, source '%s'\n",
+                    conn->id, source->GetName().c_str());
 
-        SendMediaOffer(fd, conn);
+        SendMediaOffer(*conn, conn->streams.back());
     }
 
-    void HandleWebSocketFrame(int32_t fd, Connection* conn) {
-        while (!conn->recvBuffer.empty()) {
+    void HandleWebSocketFrame(Connection* conn) {
+        // A handled frame may close the connection
+        while (conn->fd >= 0 && !conn->recvBuffer.empty()) {
             WsFrame frame;
             size_t consumed = 0;
 
@@ -264,25 +413,35 @@ private:
             switch (frame.opcode) {
                 case WsOpcode::TEXT: {
                     std::string msg(frame.payload.begin(), frame.payload.end());
-                    if (conn->state == ConnState::NEGOTIATING) {
-                        HandleNegotiation(fd, conn, msg);
+                    // Subscribed streams are negotiated while others play
+                    if (conn->state == ConnState::NEGOTIATING ||
+                        ExtractJsonString(msg, "type") == "media-answer") {
+                        HandleNegotiation(conn, msg);
                     } else {
                         std::printf("[Connection #%d] Received text: %s\n", conn->id, msg.c_str());
                     }
                     break;
                 }
-                case WsOpcode::BINARY:
-                    std::printf("[Connection #%d] Received binary: %zu bytes\n",
-                                conn->id, frame.payload.size());
+                case WsOpcode::BINARY: {
+                    ControlMessage control;
+                    if (conn->state == ConnState::STREAMING &&
+                        FrameProtocol::ParseControlFrame(frame.payload.data(),
+                                                         frame.payload.size(), control)) {
+                        HandleControl(*conn, control);
+                    } else {
+                        std::printf("[Connection #%d] Received binary: %zu bytes\n",
+                                    conn->id, frame.payload.size());
+                    }
                     break;
+                }
                 case WsOpcode::PING: {
                     auto pong = WebSocket::CreatePongFrame(frame.payload);
-                    tlsServer_.SendData(fd, pong.data(), pong.size());
+                    tlsServer_.SendData(conn, pong.data(), pong.size());
                     break;
                 }
                 case WsOpcode::CLOSE:
                     conn->state = ConnState::CLOSING;
-                    tlsServer_.CloseConnection(fd);
+                    tlsServer_.CloseConnection(conn);
                     return;
                 default:
                     break;
@@ -290,32 +449,6 @@ private:
         }
     }
 
-    std::string BuildMediaOffer() const {
-        const char* videoCodecStr = isH265_ ? "h265" : "h264";
-        double fps = 1000.0 / frameIntervalMs_;
-
-        char buf[512];
-
-        if (isMp4Mode_ && mp4Demuxer_.GetAudioInfo().present) {
-            const AudioInfo& audio = mp4Demuxer_.GetAudioInfo();
-            std::snprintf(buf, sizeof(buf),
-                "{\"type\":\"media-offer\",\"payload\":{\"version\":1,\"streams\":["
-                "{\"type\":\"video\",\"codec\":\"%s\",\"framerate\":%.2f},"
-                "{\"type\":\"audio\",\"codec\":\"%s\",\"sampleRate\":%d,\"channels\":%d}"
-                "]}}",
-                videoCodecStr, fps,
-                audio.codecName.c_str(), audio.sampleRate, audio.channels);
-        } else {
-            std::snprintf(buf, sizeof(buf),
-                "{\"type\":\"media-offer\",\"payload\":{\"version\":1,\"streams\":["
-                "{\"type\":\"video\",\"codec\":\"%s\",\"framerate\":%.2f}"
-                "]}}",
-                videoCodecStr, fps);
-        }
-
-        return std::string(buf);
-    }
-
     // Extracts the first string value for a given JSON key.
     static std::string ExtractJsonString(const std::string& json, const std::string& key) {
         std::string searchKey = "\"" + key + "\"";
@@ -344,107 +477,662 @@ private:
         return defaultVal;
     }
 
-    void SendMediaOffer(int32_t fd, Connection* conn) {
-        std::string offer = BuildMediaOffer();
+    // Extracts a numeric value for a given JSON key.
+    static double ExtractJsonNumber(const std::string& json, const std::string& key, double defaultVal) {
+        std::string searchKey = "\"" + key + "\"";
+        size_t pos = json.find(searchKey);
+        if (pos == std::string::npos) return defaultVal;
+        pos = json.find(':', pos + searchKey.size());
+        if (pos == std::string::npos) return defaultVal;
+        const char* begin = json.c_str() + pos + 1;
+        char* end = nullptr;
+        double value = std::strtod(begin, &end);
+        return (end == begin) ? defaultVal : value;
+    }
+
+    void SendMediaOffer(Connection& conn, MediaStream& stream) {
+        // The source summary goes first so the client can size its decoder
+        // and canvas before it answers
+        const std::vector<uint8_t>& summary = stream.source->GetSummary();
+        if (!summary.empty()) {
+            auto message = FrameProtocol::EncodeMetadataFrame(
+                MetadataType::SOURCE_SUMMARY, MetadataFormat::BINARY, stream.id,
+                summary.data(), summary.size(), 0);
+            SendMessage(conn, stream.id, message);
+        }
+
+        std::string offer = stream.source->BuildMediaOffer(stream.id);
+        auto wsFrame = WebSocket::EncodeFrame(WsOpcode::TEXT,
+            reinterpret_cast<const uint8_t*>(offer.data()), offer.size());
+        tlsServer_.SendData(&conn, wsFrame.data(), wsFrame.size());
+        if (stream.id == 0) {
+            conn.state = ConnState::NEGOTIATING;
+        }
+        stream.negotiateOfferTime = std::chrono::steady_clock::now();
+        std::printf("[Connection #%d] Sent media-offer: %s\n", conn.id, offer.c_str());
+    }
+
+    // Sources in catalog order; a thumbnail's pic_id is the source's index
+    void SendOverviewOffer(Connection& conn) {
+        std::string offer = "{\"type\":\"overview\",\"payload\":{\"refreshSec\":" +
+                            std::to_string(thumbnailIntervalSec_) + ",\"sources\":[";
+        const auto& sources = catalog_.GetSources();
+        for (size_t i = 0; i < sources.size(); ++i) {
+            offer += (i > 0 ? ",\"" : "\"") + sources[i]->GetName() + "\"";
+        }
+        offer += "]}}";
         auto wsFrame = WebSocket::EncodeFrame(WsOpcode::TEXT,
             reinterpret_cast<const uint8_t*>(offer.data()), offer.size());
-        tlsServer_.SendData(fd, wsFrame.data(), wsFrame.size());
-        conn->state = ConnState::NEGOTIATING;
-        conn->negotiateOfferTime = std::chrono::steady_clock::now();
-        std::printf("[Connection #%d] Sent media-offer: %s\n", conn->id, offer.c_str());
+        tlsServer_.SendData(&conn, wsFrame.data(), wsFrame.size());
+    }
+
+    // Apply the optional maxFramerate / temporalLayer caps of a media-answer;
+    // the stricter of the two wins
+    void SelectTemporalLayer(Connection* conn, MediaStream& stream, const std::string& answer) {
+        const MediaSource& source = *stream.source;
+        int32_t layer = source.GetMaxTemporalLayer();
+
+        double maxFramerate = ExtractJsonNumber(answer, "maxFramerate", 0.0);
+        if (maxFramerate > 0.0) {
+            layer = std::min(layer, source.SelectTemporalLayer(maxFramerate));
+        }
+        double temporalLayer = ExtractJsonNumber(answer, "temporalLayer", -2.0);
+        if (temporalLayer >= -1.0) {
+            layer = std::min(layer, static_cast<int32_t>(temporalLayer));
+        }
+
+        stream.maxLayer = layer;
+        if (layer == MediaSource::KEYFRAMES_ONLY) {
+            std::printf("[Connection #%d] Thinning to keyframes only\n", conn->id);
+        } else if (layer < source.GetMaxTemporalLayer()) {
+            std::printf("[Connection #%d] Thinning to temporal layer %d (%.2f fps of %.2f)\n",
+                        conn->id, layer, source.GetLayerFrameRate(layer),
+                        source.GetLayerFrameRate(source.GetMaxTemporalLayer()));
+        }
     }
 
-    void HandleNegotiation(int32_t fd, Connection* conn, const std::string& msg) {
+    // Send video as fMP4 segments if the media-answer picks the container
+    // and the source offered it
+    void SelectContainer(Connection* conn, MediaStream& stream, const std::string& answer) {
+        const MediaSource& source = *stream.source;
+        stream.isFmp4 = ExtractJsonString(answer, "container") == "fmp4" &&
+                        !source.GetFmp4Codec().empty();
+        if (stream.isFmp4) {
+            stream.fmp4Muxer.Reset(source.IsH265(), source.GetFrameIntervalMs());
+            std::printf("[Connection #%d] Sending video as fMP4 (%s)\n", conn->id,
+                        source.GetFmp4Codec().c_str());
+        }
+    }
+
+    // Frame media in the protocol version picked by the media-answer
+    void SelectProtocol(Connection* conn, MediaStream& stream, const std::string& answer) {
+        if (ExtractJsonNumber(answer, "protocol", PROTOCOL_VERSION) == COMPACT_VERSION) {
+            stream.protocolVersion = COMPACT_VERSION;
+            stream.timeline.Reset();
+            std::printf("[Connection #%d] Stream %u uses compact headers (protocol 2)\n",
+                        conn->id, stream.id);
+        }
+    }
+
+    // Cut video fragments between NAL units if the media-answer asks for
+    // it; fMP4 segments are not Annex-B and keep fixed-size fragments.
+    // A maxFragmentSize in the answer caps the connection's fragment size
+    // (the smallest cap of all its streams applies).
+    void SelectFragmentation(Connection* conn, MediaStream& stream, const std::string& answer) {
+        stream.isNalAligned = !stream.isFmp4 && ExtractJsonBool(answer, "nalFragments");
+        if (stream.isNalAligned) {
+            std::printf("[Connection #%d] Stream %u fragments video on NAL unit boundaries\n",
+                        conn->id, stream.id);
+        }
+        double maxFragment = ExtractJsonNumber(answer, "maxFragmentSize", 0.0);
+        if (maxFragment > 0.0) {
+            size_t clientMax = static_cast<size_t>(maxFragment);
+            if (conn->clientMaxFragment == 0 || clientMax < conn->clientMaxFragment) {
+                conn->clientMaxFragment = clientMax;
+            }
+        }
+        TuneFragmentSize(*conn);
+    }
+
+    // Re-derive the connection's fragment size from the TLS record limit,
+    // the TCP path (MSS and congestion window) and the client's cap
+    void TuneFragmentSize(Connection& conn) {
+        uint32_t mssBytes = 0;
+        uint32_t cwndSegments = 0;
+        tlsServer_.GetPathInfo(conn.fd, mssBytes, cwndSegments);
+        size_t fragmentSize = FrameProtocol::SelectFragmentSize(
+            tlsServer_.GetMaxRecordPayload(&conn), mssBytes, cwndSegments,
+            conn.clientMaxFragment);
+        conn.lastFragmentTune = std::chrono::steady_clock::now();
+        if (fragmentSize != conn.fragmentSize) {
+            std::printf("[Connection #%d] Fragment size %zu -> %zu (mss %u, cwnd %u)\n",
+                        conn.id, conn.fragmentSize, fragmentSize, mssBytes, cwndSegments);
+            conn.fragmentSize = fragmentSize;
+        }
+    }
+
+    // Aggregate audio frames if the media-answer supports AUDIO_BATCH
+    void SelectAudioBatching(Connection* conn, MediaStream& stream, const std::string& answer) {
+        stream.isAudioBatched = audioBatchMs_ > 0 && stream.source->IsMp4() &&
+                                ExtractJsonBool(answer, "audioBatch");
+        stream.audioBatch.Clear();
+        if (stream.isAudioBatched) {
+            std::printf("[Connection #%d] Stream %u batches audio within %d ms\n", conn->id,
+                        stream.id, audioBatchMs_);
+        }
+    }
+
+    // Send latency probes if the media-answer asks for them: a video frame
+    // every LATENCY_PROBE_INTERVAL_MS carries a seq_number that the client
+    // echoes with its receive and decode times in LATENCY_REPORT
+    void SelectLatencyProbes(Connection* conn, MediaStream& stream, const std::string& answer) {
+        stream.isLatencyProbed = ExtractJsonBool(answer, "latencyProbes");
+        stream.timeline.isSequenced = stream.isLatencyProbed;
+        if (stream.isLatencyProbed) {
+            std::printf("[Connection #%d] Stream %u sends latency probes\n", conn->id,
+                        stream.id);
+        }
+    }
+
+    // Hold video to the client's credit if the media-answer asks for flow
+    // control: "credit" is the initial grant, FLOW_CONTROL messages add to it
+    void SelectFlowControl(Connection* conn, MediaStream& stream, const std::string& answer) {
+        std::string mode = ExtractJsonString(answer, "flowControl");
+        if (mode == "frames") {
+            stream.creditMode = CreditMode::FRAMES;
+        } else if (mode == "bytes") {
+            stream.creditMode = CreditMode::BYTES;
+        } else {
+            stream.creditMode = CreditMode::NONE;
+        }
+        stream.credit = static_cast<int64_t>(ExtractJsonNumber(answer, "credit", 0.0));
+        stream.isAwaitingKeyframe = false;
+        if (stream.creditMode != CreditMode::NONE) {
+            std::printf("[Connection #%d] Stream %u flow controlled, initial credit %lld %s\n",
+                        conn->id, stream.id, static_cast<long long>(stream.credit),
+                        mode.c_str());
+        }
+    }
+
+    // Whether a video picture passes the connection's temporal layer cap;
+    // parameter sets always do
+    static bool IsLayerForwarded(const MediaStream& stream, VideoFrameType type,
+                                 bool isReference, uint8_t temporalId) {
+        if (type == VideoFrameType::SPS_PPS || type == VideoFrameType::VPS) {
+            return true;
+        }
+        if (stream.maxLayer == MediaSource::KEYFRAMES_ONLY) {
+            return type == VideoFrameType::IDR || type == VideoFrameType::I_FRAME;
+        }
+        return MediaSource::GetTemporalLayer(isReference, temporalId) <= stream.maxLayer;
+    }
+
+    void HandleNegotiation(Connection* conn, const std::string& msg) {
         std::string type = ExtractJsonString(msg, "type");
         if (type != "media-answer") {
             std::printf("[Connection #%d] Unexpected message in NEGOTIATING state: type=%s\n",
                         conn->id, type.c_str());
             return;
         }
+        uint8_t streamId = static_cast<uint8_t>(ExtractJsonNumber(msg, "streamId", 0.0));
+        MediaStream* stream = conn->FindStream(streamId);
+        if (stream == nullptr || stream->isNegotiated) {
+            std::printf("[Connection #%d] Unexpected media-answer for stream %u\n",
+                        conn->id, streamId);
+            return;
+        }
+
         bool accepted = ExtractJsonBool(msg, "accepted");
         if (accepted) {
+            SelectTemporalLayer(conn, *stream, msg);
+            SelectContainer(conn, *stream, msg);
+            SelectProtocol(conn, *stream, msg);
+            SelectFragmentation(conn, *stream, msg);
+            SelectAudioBatching(conn, *stream, msg);
+            SelectLatencyProbes(conn, *stream, msg);
+            SelectFlowControl(conn, *stream, msg);
+            stream->isNegotiated = true;
             conn->state = ConnState::STREAMING;
-            std::printf("[Connection #%d] Negotiation accepted, starting stream\n", conn->id);
+            std::printf("[Connection #%d] Negotiation accepted, starting stream %u\n",
+                        conn->id, streamId);
+            return;
+        }
+
+        std::string reason = ExtractJsonString(msg, "reason");
+        std::printf("[Connection #%d] Negotiation rejected for stream %u: %s\n", conn->id,
+                    streamId, reason.c_str());
+        if (streamId != 0) {
+            RemoveStream(*conn, streamId);
         } else {
-            std::string reason = ExtractJsonString(msg, "reason");
-            std::printf("[Connection #%d] Negotiation rejected: %s\n", conn->id, reason.c_str());
             conn->state = ConnState::CLOSING;
             auto closeFrame = WebSocket::CreateCloseFrame(1000, "Negotiation rejected");
-            tlsServer_.SendData(fd, closeFrame.data(), closeFrame.size());
-            tlsServer_.CloseConnection(fd);
+            tlsServer_.SendData(conn, closeFrame.data(), closeFrame.size());
+            tlsServer_.CloseConnection(conn);
         }
     }
 
-    VideoFrameType DetectFrameType(const AccessUnit& au) {
-        for (const auto& nal : au.nalUnits) {
-            size_t offset = 0;
-            if (nal.data.size() >= 4 && nal.data[0] == 0 && nal.data[1] == 0) {
-                if (nal.data[2] == 0 && nal.data[3] == 1) {
-                    offset = 4;
-                } else if (nal.data[2] == 1) {
-                    offset = 3;
+    void HandleControl(Connection& conn, const ControlMessage& control) {
+        if (control.type == ControlType::SUBSCRIBE) {
+            std::string path(reinterpret_cast<const char*>(control.payload), control.payloadSize);
+            Subscribe(conn, control.streamId, path);
+            return;
+        }
+        if (control.type == ControlType::UNSUBSCRIBE) {
+            RemoveStream(conn, control.streamId);
+            return;
+        }
+        if (control.type == ControlType::CLOCK_SYNC) {
+            AnswerClockSync(conn, control);
+            return;
+        }
+        if (control.type == ControlType::LATENCY_REPORT) {
+            RecordLatencyReport(conn, control);
+            return;
+        }
+
+        MediaStream* stream = conn.FindStream(control.streamId);
+        if (stream == nullptr || !stream->isNegotiated) {
+            std::printf("[Connection #%d] Control type %u for unknown stream %u\n", conn.id,
+                        static_cast<uint32_t>(control.type), control.streamId);
+            return;
+        }
+
+        switch (control.type) {
+            case ControlType::PLAYBACK_RATE:
+                if (control.payloadSize >= 4) {
+                    SetPlaybackRate(conn, *stream,
+                                    FrameProtocol::ReadBE32(control.payload) / 1000.0);
                 }
-            }
-            if (offset == 0 || offset >= nal.data.size()) {
+                break;
+            case ControlType::SEEK:
+                if (control.payloadSize >= 8) {
+                    Seek(conn, *stream, FrameProtocol::ReadBE64(control.payload));
+                }
+                break;
+            case ControlType::FLOW_CONTROL:
+                if (control.payloadSize >= 4) {
+                    stream->credit += FrameProtocol::ReadBE32(control.payload);
+                }
+                break;
+            default:
+                std::printf("[Connection #%d] Unhandled control type %u\n", conn.id,
+                            static_cast<uint32_t>(control.type));
+                break;
+        }
+    }
+
+    // Echo the client's time with the server's UTC time right away, so the
+    // client can estimate its clock offset from the round trip
+    void AnswerClockSync(Connection& conn, const ControlMessage& control) {
+        if (control.payloadSize < 8) {
+            return;
+        }
+        int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::vector<uint8_t> payload(control.payload, control.payload + 8);
+        FrameProtocol::WriteBE64(payload, nowMs);
+        auto message = FrameProtocol::EncodeControlFrame(ControlType::CLOCK_SYNC, payload.data(),
+                                                         payload.size(), 0);
+        SendMessage(conn, control.streamId, message);
+    }
+
+    // Match reported probes to their send times: network latency is sent to
+    // received, decode latency received to decoded. Reports for probes no
+    // longer pending (evicted or repeated) are ignored.
+    static void RecordLatencyReport(Connection& conn, const ControlMessage& control) {
+        std::vector<LatencyReportEntry> entries;
+        if (!FrameProtocol::ParseLatencyReport(control, entries)) {
+            std::printf("[Connection #%d] Malformed latency report (%zu bytes)\n", conn.id,
+                        control.payloadSize);
+            return;
+        }
+        for (const auto& entry : entries) {
+            auto probe = std::find_if(conn.latencyProbes.begin(), conn.latencyProbes.end(),
+                                      [&entry](const LatencyProbe& p) {
+                                          return p.seqNumber == entry.seqNumber;
+                                      });
+            if (probe == conn.latencyProbes.end()) {
                 continue;
             }
-
-            if (isH265_) {
-                uint8_t nalType = (nal.data[offset] >> 1) & 0x3F;
-                if (nalType == 32) return VideoFrameType::VPS;
-                if (nalType == 33 || nalType == 34) return VideoFrameType::SPS_PPS;
-                // IDR_W_RADL(19), IDR_N_LP(20)
-                if (nalType == 19 || nalType == 20) return VideoFrameType::IDR;
-                // BLA/CRA (16-23 are IRAP)
-                if (nalType >= 16 && nalType <= 23) return VideoFrameType::I_FRAME;
-                // TRAIL_R(1), TSA_R(3), STSA_R(5) etc - treated as P
-                if (nalType >= 0 && nalType <= 15) return VideoFrameType::P_FRAME;
-            } else {
-                uint8_t nalType = nal.data[offset] & 0x1F;
-                if (nalType == 7 || nalType == 8) return VideoFrameType::SPS_PPS;
-                if (nalType == 5) return VideoFrameType::IDR;
-                if (nalType == 1) return VideoFrameType::P_FRAME;
+            conn.networkLatency.Record(static_cast<double>(entry.receivedMs - probe->sentMs));
+            if (entry.decodedMs != 0) {
+                conn.decodeLatency.Record(static_cast<double>(entry.decodedMs - entry.receivedMs));
             }
+            conn.latencyProbes.erase(probe);
         }
-        return VideoFrameType::P_FRAME;
     }
 
-    // Detect video frame type from raw MP4 packet data (Annex B or AVCC)
-    VideoFrameType DetectFrameTypeFromPacket(const std::vector<uint8_t>& data) {
-        if (data.size() < 5) return VideoFrameType::P_FRAME;
+    // Add a stream to the connection and offer it; failures are reported
+    // with ERROR_NOTIFY on the requested stream ID
+    void Subscribe(Connection& conn, uint8_t streamId, const std::string& path) {
+        const char* error = nullptr;
+        MediaSource* source = nullptr;
+        if (streamId == 0) {
+            error = "Stream ID 0 is reserved";
+        } else if (conn.FindStream(streamId) != nullptr) {
+            error = "Stream ID in use";
+        } else if (conn.streams.size() >= MAX_STREAMS_PER_CONNECTION) {
+            error = "Too many streams";
+        } else if ((source = catalog_.Resolve(path)) == nullptr) {
+            error = "Unknown stream path";
+        } else if (!mediaCache_.Acquire(source)) {
+            error = "Service unavailable";
+        }
+
+        if (error != nullptr) {
+            std::printf("[Connection #%d] Subscribe %s as stream %u failed: %s\n", conn.id,
+                        path.c_str(), streamId, error);
+            SendError(conn, streamId, error);
+            return;
+        }
+
+        conn.streams.emplace_back(streamId, source);
+        std::printf("[Connection #%d] Subscribed stream %u to source '%s'\n", conn.id,
+                    streamId, source->GetName().c_str());
+        SendMediaOffer(conn, conn.streams.back());
+    }
 
-        // Try Annex B start code
-        size_t offset = 0;
-        if (data[0] == 0 && data[1] == 0) {
-            if (data[2] == 0 && data[3] == 1) {
-                offset = 4;
-            } else if (data[2] == 1) {
-                offset = 3;
+    void RemoveStream(Connection& conn, uint8_t streamId) {
+        for (auto it = conn.streams.begin(); it != conn.streams.end(); ++it) {
+            if (it->id == streamId) {
+                mediaCache_.Release(it->source);
+                conn.streams.erase(it);
+                std::printf("[Connection #%d] Removed stream %u\n", conn.id, streamId);
+                return;
             }
         }
+    }
+
+    void SendError(Connection& conn, uint8_t streamId, const char* reason) {
+        auto message = FrameProtocol::EncodeControlFrame(
+            ControlType::ERROR_NOTIFY, reinterpret_cast<const uint8_t*>(reason),
+            std::strlen(reason), 0);
+        SendMessage(conn, streamId, message);
+    }
 
-        // AVCC length-prefixed (4-byte length)
-        if (offset == 0 && data.size() >= 5) {
-            offset = 4;
+    // Send one protocol message of a stream right away, ahead of any
+    // media still waiting in the outboxes
+    int32_t SendMessage(Connection& conn, uint8_t streamId, std::vector<uint8_t>& message) {
+        FrameProtocol::SetStreamId(message, streamId);
+        auto wsFrame = WebSocket::EncodeFrame(WsOpcode::BINARY, message.data(), message.size());
+        return tlsServer_.SendData(&conn, wsFrame.data(), wsFrame.size());
+    }
+
+    // Deficit round robin over the stream outboxes: each round a stream may
+    // send one fragment size more bytes, so one stream's keyframe goes out
+    // interleaved with the other streams' frames instead of ahead of them.
+    // SendData blocks until the bytes are handed to TLS, so every outbox is
+    // drained before the next tick.
+    void FlushStreams(Connection& conn) {
+        bool isPending = true;
+        while (isPending) {
+            isPending = false;
+            for (auto& stream : conn.streams) {
+                if (stream.outbox.empty()) {
+                    continue;
+                }
+                stream.deficit += conn.fragmentSize;
+                while (!stream.outbox.empty() && stream.outbox.front().size() <= stream.deficit) {
+                    std::vector<uint8_t>& message = stream.outbox.front();
+                    stream.deficit -= message.size();
+                    if (SendMessage(conn, stream.id, message) > 0) {
+                        conn.stats.messagesSent++;
+                        conn.stats.bytesSent += message.size();
+                        stream.bytesSent += message.size();
+                    }
+                    stream.outbox.pop_front();
+                }
+                if (stream.outbox.empty()) {
+                    stream.deficit = 0;
+                } else {
+                    isPending = true;
+                }
+            }
         }
+    }
 
-        if (offset >= data.size()) return VideoFrameType::P_FRAME;
+    // The sent timeline continues from the last frame and runs at 1x wall
+    // time, so the client's clock needs no notice of the rate change
+    void SetPlaybackRate(Connection& conn, MediaStream& stream, double rate) {
+        rate = std::max(MIN_PLAYBACK_RATE, std::min(MAX_PLAYBACK_RATE, rate));
+        stream.rateAnchorSrcMs = stream.lastSrcPtsMs;
+        stream.rateAnchorOutMs = stream.lastOutPtsMs;
+        stream.playbackRate = rate;
+        stream.lastTrickOutMs = INT64_MIN / 2;
+
+        if (IsTrickPlay(stream)) {
+            std::printf("[Connection #%d] Playback rate %.2fx, keyframes only at %.1f fps\n",
+                        conn.id, rate, stream.source->GetTrickPlayFrameRate(stream.rendition));
+        } else {
+            std::printf("[Connection #%d] Playback rate %.2fx%s\n", conn.id, rate,
+                        (rate != 1.0) ? ", audio paused" : "");
+        }
+    }
 
-        if (isH265_) {
-            uint8_t nalType = (data[offset] >> 1) & 0x3F;
-            if (nalType == 32) return VideoFrameType::VPS;
-            if (nalType == 33 || nalType == 34) return VideoFrameType::SPS_PPS;
-            if (nalType == 19 || nalType == 20) return VideoFrameType::IDR;
-            if (nalType >= 16 && nalType <= 23) return VideoFrameType::I_FRAME;
+    // Move the cursor to the keyframe at or before positionMs. Media already
+    // handed to the socket cannot be recalled, so a DISCONTINUITY marker
+    // tells the client where to drop its queue and reset its clocks.
+    void Seek(Connection& conn, MediaStream& stream, int64_t positionMs) {
+        const MediaSource& source = *stream.source;
+        size_t keyframe = source.FindKeyframe(stream.rendition, positionMs);
+        int64_t srcPtsMs = 0;
+
+        if (source.IsMp4()) {
+            const Mp4Demuxer& demuxer = source.GetMp4Demuxer(stream.rendition);
+            size_t packetCount = demuxer.GetPacketCount();
+            PacketIndexEntry entry;
+            if (packetCount == 0 || !demuxer.GetIndexEntry(keyframe, entry)) {
+                return;
+            }
+            int64_t firstSendMs = demuxer.GetSendTimeMs(0);
+            int64_t totalDurationMs = demuxer.GetSendTimeMs(packetCount - 1) - firstSendMs;
+            if (totalDurationMs <= 0) totalDurationMs = 1;
+
+            // Stay in the current loop so the playback clock keeps counting up
+            size_t loopCount = stream.packetIndex / packetCount;
+            stream.packetIndex = loopCount * packetCount + keyframe;
+            stream.playbackTimeMs = static_cast<double>(
+                demuxer.GetSendTimeMs(keyframe) - firstSendMs + loopCount * totalDurationMs);
+            srcPtsMs = entry.ptsMs;
         } else {
-            uint8_t nalType = data[offset] & 0x1F;
-            if (nalType == 7 || nalType == 8) return VideoFrameType::SPS_PPS;
-            if (nalType == 5) return VideoFrameType::IDR;
+            size_t auCount = source.GetNalParser(stream.rendition).GetAccessUnitCount();
+            if (auCount == 0) {
+                return;
+            }
+            stream.auIndex = (stream.auIndex / auCount) * auCount + keyframe;
+            stream.playbackTimeMs = stream.auIndex * source.GetFrameIntervalMs();
+            srcPtsMs = static_cast<int64_t>(stream.playbackTimeMs);
+        }
+
+        // The client restarts its clocks at the marker, so the sent timeline
+        // restarts at the keyframe's own timestamp
+        stream.rateAnchorSrcMs = srcPtsMs;
+        stream.rateAnchorOutMs = srcPtsMs;
+        stream.lastSrcPtsMs = srcPtsMs;
+        stream.lastOutPtsMs = srcPtsMs;
+        stream.lastTrickOutMs = INT64_MIN / 2;
+        stream.fmp4Muxer.MarkDiscontinuity();
+        stream.timeline.Reset();
+        stream.audioBatch.Clear();
+
+        const Rendition& rendition = source.GetRendition(stream.rendition);
+        auto it = std::lower_bound(rendition.keyframes.begin(), rendition.keyframes.end(), keyframe);
+        int64_t resumedMs = (it != rendition.keyframes.end())
+            ? rendition.keyframeTimesMs[it - rendition.keyframes.begin()] : 0;
+
+        std::vector<uint8_t> payload;
+        FrameProtocol::WriteBE64(payload, resumedMs);
+        auto marker = FrameProtocol::EncodeControlFrame(ControlType::DISCONTINUITY, payload.data(),
+                                                        payload.size(), srcPtsMs);
+        SendMessage(conn, stream.id, marker);
+
+        stream.isSeekPending = true;
+        stream.seekRequestTime = std::chrono::steady_clock::now();
+        conn.stats.seeks++;
+        std::printf("[Connection #%d] Seek to %lld ms, resuming at keyframe %lld ms\n", conn.id,
+                    static_cast<long long>(positionMs), static_cast<long long>(resumedMs));
+    }
+
+    static void RecordSeekLatency(Connection& conn, MediaStream& stream) {
+        if (!stream.isSeekPending) {
+            return;
+        }
+        stream.isSeekPending = false;
+        double latencyMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - stream.seekRequestTime).count();
+        conn.stats.maxSeekLatencyMs = std::max(conn.stats.maxSeekLatencyMs, latencyMs);
+        std::printf("[Connection #%d] First frame after seek sent in %.1f ms\n", conn.id, latencyMs);
+    }
+
+    static bool IsTrickPlay(const MediaStream& stream) {
+        return stream.playbackRate > TRICK_PLAY_MIN_RATE &&
+               !stream.source->GetRendition(stream.rendition).keyframes.empty();
+    }
+
+    // Map a source timestamp onto the timeline sent to the client
+    static int64_t MapTimestamp(const MediaStream& stream, int64_t srcMs) {
+        return stream.rateAnchorOutMs +
+               std::llround((srcMs - stream.rateAnchorSrcMs) / stream.playbackRate);
+    }
+
+    // Keyframe-only delivery: skip keyframes due sooner than the trick-play
+    // frame rate allows on the sent timeline
+    bool IsTrickKeyframeDue(MediaStream& stream, int64_t srcPtsMs) {
+        int64_t outMs = MapTimestamp(stream, srcPtsMs);
+        double intervalMs = 1000.0 / stream.source->GetTrickPlayFrameRate(stream.rendition);
+        if (outMs - stream.lastTrickOutMs < intervalMs) {
+            return false;
+        }
+        stream.lastTrickOutMs = outMs;
+        return true;
+    }
+
+    // Encode an Annex-B access unit into protocol frames; on an fMP4
+    // connection it is remuxed first and a pending init segment goes ahead
+    // of its media segment
+    std::vector<std::vector<uint8_t>> EncodeVideo(Connection& conn, MediaStream& stream,
+                                                  const uint8_t* data, size_t size,
+                                                  VideoFrameType frameType, bool isKeyframe,
+                                                  int64_t ptsMs, int64_t dtsMs, int64_t absTimeMs) {
+        bool isPicture = frameType != VideoFrameType::SPS_PPS && frameType != VideoFrameType::VPS;
+        if (!stream.isFmp4) {
+            uint32_t seqNumber = isPicture ? NextProbeSeq(conn, stream, absTimeMs) : 0;
+            auto protocolFrames = EncodeVideoMessage(conn, stream, data, size, frameType, ptsMs,
+                                                     dtsMs, absTimeMs, frameId_, seqNumber);
+            ChargeCredit(stream, protocolFrames, 1);
+            return protocolFrames;
+        }
+
+        std::vector<std::vector<uint8_t>> protocolFrames;
+        if (!stream.fmp4Muxer.WriteAccessUnit(data, size, ptsMs, dtsMs, isKeyframe,
+                                              initSegment_, mediaSegment_)) {
+            return protocolFrames;
+        }
+        if (!initSegment_.empty()) {
+            protocolFrames = EncodeVideoMessage(conn, stream, initSegment_.data(),
+                                                initSegment_.size(),
+                                                VideoFrameType::INIT_SEGMENT, ptsMs, dtsMs,
+                                                absTimeMs, frameId_++, 0);
+        }
+        auto mediaFrames = EncodeVideoMessage(conn, stream, mediaSegment_.data(),
+                                              mediaSegment_.size(), frameType, ptsMs, dtsMs,
+                                              absTimeMs, frameId_,
+                                              NextProbeSeq(conn, stream, absTimeMs));
+        protocolFrames.insert(protocolFrames.end(), mediaFrames.begin(), mediaFrames.end());
+        ChargeCredit(stream, protocolFrames, initSegment_.empty() ? 1 : 2);
+        return protocolFrames;
+    }
+
+    // Credit flow control: whether a video access unit of size bytes may be
+    // framed. Out of credit, pictures are dropped up to the next keyframe
+    // (or the parameter sets ahead of it) that fits, so the client never
+    // gets a picture whose references were dropped
+    static bool IsCreditAvailable(Connection& conn, MediaStream& stream, VideoFrameType type,
+                                  bool isKeyframe, size_t size) {
+        if (stream.creditMode == CreditMode::NONE) {
+            return true;
+        }
+        int64_t cost = 1;
+        if (stream.creditMode == CreditMode::BYTES) {
+            size_t fragments = size / conn.fragmentSize + 1;
+            cost = static_cast<int64_t>(size + fragments * MAX_VIDEO_HEADER_BYTES +
+                                        CREDIT_SIZE_SLACK);
+        }
+        bool isRandomAccess = isKeyframe || type == VideoFrameType::SPS_PPS ||
+                              type == VideoFrameType::VPS;
+        if (stream.credit >= cost && (!stream.isAwaitingKeyframe || isRandomAccess)) {
+            stream.isAwaitingKeyframe = false;
+            return true;
+        }
+        if (!stream.isAwaitingKeyframe) {
+            stream.isAwaitingKeyframe = true;
+            // The next segment gets the default duration instead of the gap
+            stream.fmp4Muxer.MarkDiscontinuity();
+        }
+        conn.stats.framesOutOfCredit++;
+        return false;
+    }
+
+    // Take the messages of one video access unit out of the stream's
+    // credit; frameCount is the number of frames on the wire (an fMP4 init
+    // segment is one of its own)
+    static void ChargeCredit(MediaStream& stream,
+                             const std::vector<std::vector<uint8_t>>& protocolFrames,
+                             int64_t frameCount) {
+        if (protocolFrames.empty()) {
+            return;
+        }
+        if (stream.creditMode == CreditMode::FRAMES) {
+            stream.credit -= frameCount;
+        } else if (stream.creditMode == CreditMode::BYTES) {
+            for (const auto& protoFrame : protocolFrames) {
+                stream.credit -= static_cast<int64_t>(protoFrame.size());
+            }
+        }
+    }
+
+    // Frame one video payload in the stream's protocol version, cut at the
+    // connection's fragment size
+    static std::vector<std::vector<uint8_t>> EncodeVideoMessage(
+        const Connection& conn, MediaStream& stream, const uint8_t* data, size_t size,
+        VideoFrameType frameType, int64_t ptsMs, int64_t dtsMs, int64_t absTimeMs,
+        uint16_t frameId, uint32_t seqNumber) {
+        if (stream.protocolVersion == COMPACT_VERSION) {
+            return FrameProtocol::EncodeCompactVideoFrame(data, size, frameType, ptsMs, dtsMs,
+                                                          absTimeMs, frameId, stream.timeline,
+                                                          stream.isNalAligned, conn.fragmentSize,
+                                                          seqNumber);
         }
-        return VideoFrameType::P_FRAME;
+        VideoCodec codec = stream.source->IsH265() ? VideoCodec::H265 : VideoCodec::H264;
+        return FrameProtocol::EncodeVideoFrame(data, size, codec, frameType, ptsMs, dtsMs,
+                                               absTimeMs, frameId, stream.isNalAligned,
+                                               conn.fragmentSize, seqNumber);
     }
 
-    void SendPacket(Connection& conn, const MediaPacket& pkt) {
+    // Sequence number for a video frame about to be framed: non-zero once
+    // per LATENCY_PROBE_INTERVAL_MS on a probed stream, and kept with its
+    // send time until the client reports it
+    static uint32_t NextProbeSeq(Connection& conn, MediaStream& stream, int64_t absTimeMs) {
+        auto now = std::chrono::steady_clock::now();
+        if (!stream.isLatencyProbed ||
+            now - stream.lastLatencyProbe < std::chrono::milliseconds(LATENCY_PROBE_INTERVAL_MS)) {
+            return 0;
+        }
+        stream.lastLatencyProbe = now;
+        // 0 means no seq_number on the wire
+        if (++conn.lastProbeSeq == 0) {
+            ++conn.lastProbeSeq;
+        }
+        conn.latencyProbes.push_back(LatencyProbe{conn.lastProbeSeq, absTimeMs});
+        if (conn.latencyProbes.size() > MAX_PENDING_PROBES) {
+            conn.latencyProbes.pop_front();
+        }
+        return conn.lastProbeSeq;
+    }
+
+    // Encode a demuxed packet into the stream's outbox
+    void SendPacket(Connection& conn, MediaStream& stream, const MediaSource& source,
+                    const PacketIndexEntry& entry, const MediaPacket& pkt) {
         auto now = std::chrono::system_clock::now();
         int64_t absTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
             now.time_since_epoch()).count();
@@ -452,136 +1140,429 @@ private:
         std::vector<std::vector<uint8_t>> protocolFrames;
 
         if (pkt.type == MediaType::VIDEO) {
-            VideoCodec codec = isH265_ ? VideoCodec::H265 : VideoCodec::H264;
-            VideoFrameType frameType = DetectFrameTypeFromPacket(pkt.data);
-
-            protocolFrames = FrameProtocol::EncodeVideoFrame(
-                pkt.data, codec, frameType, pkt.ptsMs, absTimeMs, frameId_);
+            int64_t ptsMs = MapTimestamp(stream, pkt.ptsMs);
+            protocolFrames = EncodeVideo(conn, stream, pkt.data, pkt.size, entry.frameType,
+                                         entry.isKeyframe, ptsMs,
+                                         MapTimestamp(stream, entry.dtsMs), absTimeMs);
+            stream.lastSrcPtsMs = pkt.ptsMs;
+            stream.lastOutPtsMs = ptsMs;
         } else {
-            const AudioInfo& audio = mp4Demuxer_.GetAudioInfo();
-            AudioCodec audioCodec = AudioCodecNameToEnum(audio.codecName);
-            SampleRateCode rateCode = FrameProtocol::SampleRateToCode(audio.sampleRate);
-            uint8_t channels = static_cast<uint8_t>(audio.channels);
+            int64_t ptsMs = MapTimestamp(stream, pkt.ptsMs);
+            if (stream.isAudioBatched && BatchAudio(conn, stream, pkt, ptsMs, absTimeMs)) {
+                return;
+            }
+            if (stream.protocolVersion == COMPACT_VERSION) {
+                // Codec, sample rate and channels are in the media-offer
+                protocolFrames = FrameProtocol::EncodeCompactAudioFrame(
+                    pkt.data, pkt.size, ptsMs, absTimeMs, frameId_, stream.timeline,
+                    conn.fragmentSize);
+            } else {
+                const AudioInfo& audio = source.GetMp4Demuxer(stream.rendition).GetAudioInfo();
+                AudioCodec audioCodec = AudioCodecNameToEnum(audio.codecName);
+                SampleRateCode rateCode = FrameProtocol::SampleRateToCode(audio.sampleRate);
+                uint8_t channels = static_cast<uint8_t>(audio.channels);
+
+                protocolFrames = FrameProtocol::EncodeAudioFrame(
+                    pkt.data, pkt.size, audioCodec, rateCode, channels, ptsMs, absTimeMs,
+                    frameId_, conn.fragmentSize);
+            }
+        }
 
-            protocolFrames = FrameProtocol::EncodeAudioFrame(
-                pkt.data, audioCodec, rateCode, channels,
-                pkt.ptsMs, absTimeMs, frameId_);
+        for (auto& protoFrame : protocolFrames) {
+            stream.outbox.push_back(std::move(protoFrame));
+        }
+        if (pkt.type == MediaType::VIDEO) {
+            RecordSeekLatency(conn, stream);
         }
 
-        for (const auto& protoFrame : protocolFrames) {
-            auto wsFrame = WebSocket::EncodeFrame(WsOpcode::BINARY,
-                                                  protoFrame.data(), protoFrame.size());
-            int32_t sent = tlsServer_.SendData(conn.fd, wsFrame.data(), wsFrame.size());
-            if (sent > 0) {
-                conn.stats.messagesSent++;
-                conn.stats.bytesSent += protoFrame.size();
-            }
+        frameId_++;
+    }
+
+    // Add an audio frame to the stream's batch, flushing the batch first if
+    // the frame would not fit; false if the frame must be sent on its own
+    bool BatchAudio(Connection& conn, MediaStream& stream, const MediaPacket& pkt,
+                    int64_t ptsMs, int64_t absTimeMs) {
+        size_t frameBytes = pkt.size + AUDIO_BATCH_FRAME_OVERHEAD;
+        bool isOrdered = stream.audioBatch.IsEmpty() || ptsMs >= stream.audioBatch.lastTimestampMs;
+        if (!stream.audioBatch.IsEmpty() &&
+            (!isOrdered || stream.audioBatch.payload.size() + frameBytes > conn.fragmentSize)) {
+            FlushAudioBatch(conn, stream);
         }
+        if (frameBytes > conn.fragmentSize) {
+            return false;
+        }
+        if (stream.audioBatch.IsEmpty()) {
+            stream.audioBatchStartMs = stream.playbackTimeMs;
+        }
+        FrameProtocol::AddToAudioBatch(stream.audioBatch, pkt.data, pkt.size, ptsMs, absTimeMs);
+        return true;
+    }
 
+    // Queue the stream's audio batch as one AUDIO_BATCH message
+    void FlushAudioBatch(Connection& conn, MediaStream& stream) {
+        AudioBatch& batch = stream.audioBatch;
+        if (batch.IsEmpty()) {
+            return;
+        }
+        if (stream.protocolVersion == COMPACT_VERSION) {
+            stream.outbox.push_back(FrameProtocol::EncodeCompactAudioBatch(batch, stream.timeline));
+        } else {
+            const AudioInfo& audio = stream.source->GetMp4Demuxer(stream.rendition).GetAudioInfo();
+            stream.outbox.push_back(FrameProtocol::EncodeAudioBatch(
+                batch, AudioCodecNameToEnum(audio.codecName),
+                FrameProtocol::SampleRateToCode(audio.sampleRate),
+                static_cast<uint8_t>(audio.channels)));
+        }
+        conn.stats.audioBatchMessages++;
+        conn.stats.audioBatchFrames += batch.frameCount;
+        batch.Clear();
         frameId_++;
     }
 
-    void OnTimerMp4(Connection& conn) {
-        size_t packetCount = mp4Demuxer_.GetPacketCount();
-        if (packetCount == 0) return;
+    // Continue from the IDR with the same DTS in the ABR target rendition;
+    // false if the target has no IDR there (IDRs not aligned)
+    bool SwitchRenditionMp4(Connection& conn, MediaStream& stream, size_t loopCount, int64_t idrDtsMs) {
+        size_t target = static_cast<size_t>(stream.abr.GetTarget());
+        const Mp4Demuxer& next = stream.source->GetMp4Demuxer(target);
+        size_t count = next.GetPacketCount();
+
+        // Video send time is the DTS, and send times are non-decreasing
+        size_t lo = 0;
+        size_t hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (next.GetSendTimeMs(mid) < idrDtsMs) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
 
-        // Get the first packet's PTS as base for cyclic playback
-        const MediaPacket* firstPkt = mp4Demuxer_.GetPacket(0);
-        const MediaPacket* lastPkt = mp4Demuxer_.GetPacket(packetCount - 1);
-        int64_t totalDurationMs = lastPkt->ptsMs - firstPkt->ptsMs;
-        if (totalDurationMs <= 0) totalDurationMs = 1;
+        PacketIndexEntry entry;
+        for (size_t i = lo; i < count && next.GetSendTimeMs(i) == idrDtsMs; ++i) {
+            if (next.GetIndexEntry(i, entry) && entry.type == MediaType::VIDEO &&
+                entry.frameType == VideoFrameType::IDR) {
+                std::printf("[Connection #%d] Rendition %zu -> %zu at DTS %lld ms\n", conn.id,
+                            stream.rendition, target, static_cast<long long>(idrDtsMs));
+                stream.packetIndex = loopCount * count + i;
+                stream.rendition = target;
+                return true;
+            }
+        }
+        return false;
+    }
 
-        // std::cout << "packetCount " << packetCount << " totalDurationMs " << totalDurationMs << std::endl;
+    void OnTimerMp4(Connection& conn, MediaStream& stream) {
+        const MediaSource& source = *stream.source;
+        if (source.GetMp4Demuxer(stream.rendition).GetPacketCount() == 0) return;
 
-        // Send all packets whose PTS <= current playback time
+        // Send all packets whose send time (video DTS) <= current playback time
         while (true) {
-            size_t idx = conn.packetIndex % packetCount;
-            const MediaPacket* pkt = mp4Demuxer_.GetPacket(idx);
-            if (pkt == nullptr) {
+            const Mp4Demuxer& demuxer = source.GetMp4Demuxer(stream.rendition);
+            size_t packetCount = demuxer.GetPacketCount();
+
+            // Get the first packet's send time as base for cyclic playback
+            int64_t firstSendMs = demuxer.GetSendTimeMs(0);
+            int64_t totalDurationMs = demuxer.GetSendTimeMs(packetCount - 1) - firstSendMs;
+            if (totalDurationMs <= 0) totalDurationMs = 1;
+
+            size_t idx = stream.packetIndex % packetCount;
+
+            // Calculate effective send time (video DTS) considering cyclic loops
+            size_t loopCount = stream.packetIndex / packetCount;
+            double effectiveSendMs = demuxer.GetSendTimeMs(idx) - firstSendMs
+                                     + loopCount * totalDurationMs;
+
+            if (effectiveSendMs > stream.playbackTimeMs) {
                 break;
             }
 
-            // Calculate effective PTS considering cyclic loops
-            size_t loopCount = conn.packetIndex / packetCount;
-            double effectivePtsMs = pkt->ptsMs - firstPkt->ptsMs
-                                    + loopCount * totalDurationMs;
-
-            if (effectivePtsMs > conn.playbackTimeMs) {
-                // std::cerr << "packetIndex " << conn.packetIndex << " loopCount " << loopCount << std::endl;
-                // std::cerr << "pkt pts " << pkt->ptsMs << " first pts " << firstPkt->ptsMs << std::endl;
+            PacketIndexEntry entry;
+            if (!demuxer.GetIndexEntry(idx, entry)) {
                 break;
             }
 
-            SendPacket(conn, *pkt);
-            conn.packetIndex++;
+            // Renditions are switched only at an IDR, so the decoder never
+            // gets a picture that references the other rendition
+            if (stream.rendition != static_cast<size_t>(stream.abr.GetTarget()) &&
+                entry.type == MediaType::VIDEO && entry.frameType == VideoFrameType::IDR &&
+                SwitchRenditionMp4(conn, stream, loopCount, demuxer.GetSendTimeMs(idx))) {
+                continue;
+            }
+
+            // Audio cannot follow a scaled clock; it resumes at 1x
+            if (entry.type == MediaType::AUDIO && stream.playbackRate != 1.0) {
+                stream.packetIndex++;
+                continue;
+            }
+
+            // Trick play jumps between keyframes through the keyframe index
+            if (IsTrickPlay(stream)) {
+                if (entry.type != MediaType::VIDEO || entry.frameType != VideoFrameType::IDR) {
+                    stream.packetIndex = source.NextKeyframe(stream.rendition, stream.packetIndex);
+                    continue;
+                }
+                if (!IsTrickKeyframeDue(stream, entry.ptsMs)) {
+                    stream.packetIndex = source.NextKeyframe(stream.rendition, stream.packetIndex + 1);
+                    continue;
+                }
+            }
+
+            // Thinned pictures are skipped on the same clock, so the ones
+            // sent keep their source PTS/DTS and A/V sync is unaffected
+            if (entry.type == MediaType::VIDEO &&
+                !IsLayerForwarded(stream, entry.frameType, entry.isReference, entry.temporalId)) {
+                conn.stats.framesThinned++;
+                stream.packetIndex++;
+                continue;
+            }
+
+            if (entry.type == MediaType::VIDEO &&
+                !IsCreditAvailable(conn, stream, entry.frameType, entry.isKeyframe, entry.size)) {
+                stream.packetIndex++;
+                continue;
+            }
+
+            // Payload is read only for packets that are actually sent
+            const MediaPacket* pkt = demuxer.GetPacket(idx);
+            if (pkt != nullptr) {
+                SendPacket(conn, stream, source, entry, *pkt);
+            }
+            stream.packetIndex++;
+        }
+
+        // A batch goes out once its first frame has waited the latency budget
+        if (!stream.audioBatch.IsEmpty() &&
+            stream.playbackTimeMs - stream.audioBatchStartMs >= audioBatchMs_) {
+            FlushAudioBatch(conn, stream);
         }
 
-        // Advance playback clock by timer interval (10ms)
-        conn.playbackTimeMs += 10.0;
+        // Advance playback clock by timer interval (10ms), scaled by the rate
+        stream.playbackTimeMs += TIMER_INTERVAL_MS * stream.playbackRate;
     }
 
-    void OnTimerRaw(Connection& conn) {
-        if (nalParser_.GetAccessUnitCount() == 0) return;
+    static bool IsRandomAccessPoint(VideoFrameType type) {
+        return type == VideoFrameType::IDR || type == VideoFrameType::SPS_PPS ||
+               type == VideoFrameType::VPS;
+    }
 
-        size_t auIndex = conn.auIndex % nalParser_.GetAccessUnitCount();
-        const AccessUnit* au = nalParser_.GetAccessUnit(auIndex);
-        if (au == nullptr) return;
+    // Switch to the ABR target if its AU at the same position starts the
+    // same random access point; renditions must share the frame rate
+    bool SwitchRenditionRaw(Connection& conn, MediaStream& stream, const AccessUnit& au) {
+        size_t target = static_cast<size_t>(stream.abr.GetTarget());
+        const NalParser& current = stream.source->GetNalParser(stream.rendition);
+        const NalParser& next = stream.source->GetNalParser(target);
+        if (next.GetAccessUnitCount() == 0 ||
+            std::fabs(next.GetFrameRate() - current.GetFrameRate()) > 0.01) {
+            return false;
+        }
 
-        // Log every 25 Access Units
-        if (auIndex % 25 == 0) {
-            std::printf("[Connection #%d] Sending AU %zu/%zu (%zu NAL units)\n",
-                        conn.id, auIndex, nalParser_.GetAccessUnitCount(), au->nalUnits.size());
+        const AccessUnit* nextAu = next.GetAccessUnit(stream.auIndex % next.GetAccessUnitCount());
+        if (nextAu == nullptr || nextAu->frameType != au.frameType) {
+            return false;
         }
 
-        // Merge all NAL units into a single payload
-        std::vector<uint8_t> payload;
-        for (const auto& nal : au->nalUnits) {
-            payload.insert(payload.end(), nal.data.begin(), nal.data.end());
+        std::printf("[Connection #%d] Rendition %zu -> %zu at AU %zu\n", conn.id,
+                    stream.rendition, target, stream.auIndex);
+        stream.rendition = target;
+        return true;
+    }
+
+    void OnTimerRaw(Connection& conn, MediaStream& stream) {
+        const MediaSource& source = *stream.source;
+        if (source.GetNalParser(stream.rendition).GetAccessUnitCount() == 0) return;
+
+        double frameIntervalMs = source.GetFrameIntervalMs();
+
+        // Send every AU whose timestamp is due on this connection's clock, so
+        // sources with different frame rates share the base timer
+        while (stream.auIndex * frameIntervalMs <= stream.playbackTimeMs) {
+            const NalParser& parser = source.GetNalParser(stream.rendition);
+            size_t auCount = parser.GetAccessUnitCount();
+            size_t auIndex = stream.auIndex % auCount;
+            const AccessUnit* au = parser.GetAccessUnit(auIndex);
+            if (au == nullptr) break;
+
+            if (stream.rendition != static_cast<size_t>(stream.abr.GetTarget()) &&
+                IsRandomAccessPoint(au->frameType) && SwitchRenditionRaw(conn, stream, *au)) {
+                continue;
+            }
+
+            int64_t timestampMs = static_cast<int64_t>(stream.auIndex * frameIntervalMs);
+            if (IsTrickPlay(stream)) {
+                if (!IsRandomAccessPoint(au->frameType)) {
+                    stream.auIndex = source.NextKeyframe(stream.rendition, stream.auIndex);
+                    continue;
+                }
+                // Pacing is decided at the first AU of the random access
+                // point, so its parameter sets go out only with its IDR
+                bool isRunStart = source.NextKeyframe(stream.rendition, stream.auIndex) ==
+                                  stream.auIndex;
+                if (isRunStart && !IsTrickKeyframeDue(stream, timestampMs)) {
+                    stream.auIndex = source.NextKeyframe(stream.rendition, stream.auIndex + 1);
+                    continue;
+                }
+            }
+
+            if (!IsLayerForwarded(stream, au->frameType, au->isReference, au->temporalId)) {
+                conn.stats.framesThinned++;
+                stream.auIndex++;
+                continue;
+            }
+
+            if (!IsCreditAvailable(conn, stream, au->frameType,
+                                   au->frameType == VideoFrameType::IDR, au->size)) {
+                stream.auIndex++;
+                continue;
+            }
+
+            // Log every 25 Access Units
+            if (auIndex % 25 == 0) {
+                std::printf("[Connection #%d] Sending AU %zu/%zu (%u NAL units)\n",
+                            conn.id, auIndex, auCount, au->nalCount);
+            }
+
+            int64_t outMs = MapTimestamp(stream, timestampMs);
+            auto now = std::chrono::system_clock::now();
+            int64_t absTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                now.time_since_epoch()).count();
+
+            // The AU is one contiguous span in the source, sent without merging
+            auto protocolFrames = EncodeVideo(conn, stream, parser.GetData(au->offset), au->size,
+                                              au->frameType,
+                                              au->frameType == VideoFrameType::IDR,
+                                              outMs, outMs, absTimeMs);
+            stream.lastSrcPtsMs = timestampMs;
+            stream.lastOutPtsMs = outMs;
+
+            for (auto& protoFrame : protocolFrames) {
+                stream.outbox.push_back(std::move(protoFrame));
+            }
+            RecordSeekLatency(conn, stream);
+
+            stream.auIndex++;
+            frameId_++;
         }
 
-        VideoCodec codec = isH265_ ? VideoCodec::H265 : VideoCodec::H264;
-        VideoFrameType frameType = DetectFrameType(*au);
+        stream.playbackTimeMs += TIMER_INTERVAL_MS * stream.playbackRate;
+    }
 
-        int64_t timestampMs = static_cast<int64_t>(conn.auIndex * frameIntervalMs_);
-        auto now = std::chrono::system_clock::now();
-        int64_t absTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+    void SampleAbr(Connection& conn, MediaStream& stream, std::chrono::steady_clock::time_point now) {
+        if (stream.source->GetRenditionCount() < 2 ||
+            now - stream.lastAbrSample < std::chrono::milliseconds(ABR_SAMPLE_INTERVAL_MS)) {
+            return;
+        }
+        stream.lastAbrSample = now;
+        int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
             now.time_since_epoch()).count();
+        stream.abr.OnSample(nowMs, stream.bytesSent, tlsServer_.GetSendQueueBytes(conn.fd));
+    }
 
-        auto protocolFrames = FrameProtocol::EncodeVideoFrame(
-            payload, codec, frameType, timestampMs, absTimeMs, frameId_);
+    static bool IsNegotiationExpired(const MediaStream& stream,
+                                     std::chrono::steady_clock::time_point now) {
+        return !stream.isNegotiated &&
+               now - stream.negotiateOfferTime > std::chrono::seconds(NEGOTIATION_TIMEOUT_SEC);
+    }
 
-        for (const auto& protoFrame : protocolFrames) {
-            auto wsFrame = WebSocket::EncodeFrame(WsOpcode::BINARY,
-                                                  protoFrame.data(), protoFrame.size());
+    // Submit one keyframe per source to the thumbnail worker: the keyframe
+    // at the source's looping position on the server clock, from its
+    // smallest rendition. A source no viewer has loaded is loaded once, for
+    // its first thumbnail, and otherwise keeps its last one.
+    void RefreshThumbnails(std::chrono::steady_clock::time_point now) {
+        int64_t elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - startTime_).count();
+        const auto& sources = catalog_.GetSources();
+        for (size_t i = 0; i < sources.size(); ++i) {
+            MediaSource* source = sources[i].get();
+            // Loading runs on this thread and would stall every stream, so a
+            // source gets thumbnails only while a viewer has it loaded
+            if (thumbnailCache_.IsPending(i) || !source->IsLoaded()) {
+                continue;
+            }
 
-            int32_t sent = tlsServer_.SendData(conn.fd, wsFrame.data(), wsFrame.size());
-            if (sent > 0) {
-                conn.stats.messagesSent++;
-                conn.stats.bytesSent += protoFrame.size();
+            size_t rendition = source->GetRenditionCount() - 1;
+            int64_t durationMs = static_cast<int64_t>(
+                source->GetRendition(rendition).videoFrameCount * source->GetFrameIntervalMs());
+            int64_t positionMs = (durationMs > 0) ? elapsedMs % durationMs : 0;
+            std::vector<uint8_t> keyframe;
+            if (source->CopyKeyframe(rendition, source->FindKeyframe(rendition, positionMs),
+                                     keyframe)) {
+                thumbnailCache_.Submit(i, source->IsH265(), std::move(keyframe),
+                                       static_cast<uint16_t>(i));
             }
         }
+    }
 
-        conn.auIndex++;
-        frameId_++;
+    // Thumbnails are made only while the overview has subscribers. A new
+    // thumbnail is framed once and the same bytes go to every subscriber.
+    void PollThumbnails(std::chrono::steady_clock::time_point now) {
+        std::vector<Connection*> viewers;
+        for (const auto& conn : connManager_.GetConnections()) {
+            if (conn->isOverview && conn->state == ConnState::STREAMING) {
+                viewers.push_back(conn.get());
+            }
+        }
+        if (viewers.empty()) {
+            return;
+        }
+
+        if (now - lastThumbnailRefresh_ >= std::chrono::seconds(thumbnailIntervalSec_)) {
+            lastThumbnailRefresh_ = now;
+            RefreshThumbnails(now);
+        }
+
+        for (size_t i = 0; i < catalog_.GetSourceCount(); ++i) {
+            std::shared_ptr<const Thumbnail> thumbnail = thumbnailCache_.Get(i);
+            if (!thumbnail) {
+                continue;
+            }
+            std::vector<uint8_t> wsFrame;
+            for (Connection* conn : viewers) {
+                if (conn->thumbnailGenerations[i] == thumbnail->generation) {
+                    continue;
+                }
+                if (wsFrame.empty()) {
+                    wsFrame = WebSocket::EncodeFrame(WsOpcode::BINARY, thumbnail->message.data(),
+                                                     thumbnail->message.size());
+                }
+                tlsServer_.SendData(conn, wsFrame.data(), wsFrame.size());
+                conn->thumbnailGenerations[i] = thumbnail->generation;
+                conn->stats.messagesSent++;
+                conn->stats.bytesSent += thumbnail->message.size();
+            }
+        }
     }
 
     void OnTimer() {
         timer_.Read();
 
-        // Collect timed-out connections to close after iteration
-        std::vector<int32_t> negotiationTimeouts;
+        auto nowSteady = std::chrono::steady_clock::now();
+        if (nowSteady - lastStatusTime_ > std::chrono::seconds(STATUS_INTERVAL_SEC)) {
+            lastStatusTime_ = nowSteady;
+            connManager_.LogServerStatus();
+            mediaCache_.LogStats();
+        }
+
+        if (thumbnailIntervalSec_ > 0 &&
+            nowSteady - lastThumbnailPoll_ > std::chrono::milliseconds(THUMBNAIL_POLL_INTERVAL_MS)) {
+            lastThumbnailPoll_ = nowSteady;
+            PollThumbnails(nowSteady);
+        }
+
+        // Collect timed-out connections to close after iteration: closing
+        // reorders the connection array
+        std::vector<Connection*> negotiationTimeouts;
 
-        for (auto& pair : connManager_.GetConnections()) {
-            Connection& conn = pair.second;
+        for (const auto& entry : connManager_.GetConnections()) {
+            Connection& conn = *entry;
 
             if (conn.state == ConnState::NEGOTIATING) {
-                auto elapsed = std::chrono::steady_clock::now() - conn.negotiateOfferTime;
-                if (elapsed > std::chrono::seconds(5)) {
+                if (IsNegotiationExpired(conn.streams.front(), nowSteady)) {
                     std::printf("[Connection #%d] Negotiation timeout\n", conn.id);
                     auto closeFrame = WebSocket::CreateCloseFrame(1008, "Negotiation timeout");
-                    tlsServer_.SendData(conn.fd, closeFrame.data(), closeFrame.size());
+                    tlsServer_.SendData(&conn, closeFrame.data(), closeFrame.size());
                     conn.state = ConnState::CLOSING;
-                    negotiationTimeouts.push_back(conn.fd);
+                    negotiationTimeouts.push_back(&conn);
                 }
                 continue;
             }
@@ -590,46 +1571,94 @@ private:
                 continue;
             }
 
-            if (isMp4Mode_) {
-                OnTimerMp4(conn);
-            } else {
-                OnTimerRaw(conn);
+            // A subscribed stream left unanswered is dropped on its own
+            for (size_t i = conn.streams.size(); i-- > 0;) {
+                MediaStream& stream = conn.streams[i];
+                if (IsNegotiationExpired(stream, nowSteady)) {
+                    std::printf("[Connection #%d] Negotiation timeout for stream %u\n",
+                                conn.id, stream.id);
+                    SendError(conn, stream.id, "Negotiation timeout");
+                    RemoveStream(conn, stream.id);
+                }
             }
+
+            if (nowSteady - conn.lastFragmentTune >
+                std::chrono::milliseconds(FRAGMENT_TUNE_INTERVAL_MS)) {
+                TuneFragmentSize(conn);
+            }
+
+            for (auto& stream : conn.streams) {
+                if (!stream.isNegotiated) {
+                    continue;
+                }
+
+                SampleAbr(conn, stream, nowSteady);
+
+                if (stream.source->IsMp4()) {
+                    OnTimerMp4(conn, stream);
+                } else {
+                    OnTimerRaw(conn, stream);
+                }
+            }
+
+            FlushStreams(conn);
         }
 
-        for (int32_t fd : negotiationTimeouts) {
-            tlsServer_.CloseConnection(fd);
+        for (Connection* conn : negotiationTimeouts) {
+            tlsServer_.CloseConnection(conn);
         }
     }
 
     void Shutdown() {
         std::printf("\nShutting down server...\n");
 
-        // Send close frame to all clients
+        // Send close frame to all clients and close them; closing removes
+        // them from the connection array
         auto closeFrame = WebSocket::CreateCloseFrame(1000, "Server is shutting down");
-        for (auto& pair : connManager_.GetConnections()) {
-            tlsServer_.SendData(pair.first, closeFrame.data(), closeFrame.size());
+        std::vector<Connection*> open;
+        for (const auto& conn : connManager_.GetConnections()) {
+            open.push_back(conn.get());
+        }
+        for (Connection* conn : open) {
+            tlsServer_.SendData(conn, closeFrame.data(), closeFrame.size());
+            tlsServer_.CloseConnection(conn);
         }
+        connManager_.FreeRemoved();
 
         timer_.Stop();
         tlsServer_.Stop();
+        thumbnailCache_.Stop();
 
         std::printf("Server closed\n");
     }
 
     TlsServer tlsServer_;
     Timer timer_;
-    NalParser nalParser_;
-    Mp4Demuxer mp4Demuxer_;
+    StreamCatalog catalog_;
+    MediaCache mediaCache_;
     ConnectionManager connManager_;
     uint16_t port_;
     bool isH265_;
-    bool isMp4Mode_;
+    bool isLazyLoad_;
+    bool useMmap_;
+    bool useIndexFile_;
+    bool useSharedMemory_;
+    int32_t audioWindowMs_;
+    int32_t audioBatchMs_;    // latency budget of an audio batch, 0 disables batching
+    size_t cacheBudgetMb_;
+    int32_t thumbnailIntervalSec_;    // 0 disables the overview
+    ThumbnailCache thumbnailCache_;
+    std::chrono::steady_clock::time_point startTime_;
+    std::chrono::steady_clock::time_point lastThumbnailRefresh_;
+    std::chrono::steady_clock::time_point lastThumbnailPoll_;
     uint16_t frameId_;
-    double frameIntervalMs_;
+    std::vector<uint8_t> initSegment_;    // fMP4 remux output, reused across frames
+    std::vector<uint8_t> mediaSegment_;
     std::string videoPath_;
+    std::string catalogPath_;
     std::string certPath_;
     std::string keyPath_;
+    std::chrono::steady_clock::time_point lastStatusTime_;
 };
 
 int main(int argc, char* argv[]) {
@@ -0,0 +1,64 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace server {
+
+MappedFile::MappedFile() : data_(nullptr), size_(0), isEmptyFile_(false) {
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const std::string& filePath) {
+    Close();
+
+    int32_t fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::fprintf(stderr, "Failed to open file: %s\n", filePath.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        std::fprintf(stderr, "Failed to stat file: %s\n", filePath.c_str());
+        close(fd);
+        return false;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        isEmptyFile_ = true;
+        return true;
+    }
+
+    void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // mapping keeps its own reference
+    if (addr == MAP_FAILED) {
+        std::fprintf(stderr, "Failed to mmap %s: %s\n", filePath.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    data_ = static_cast<const uint8_t*>(addr);
+    size_ = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data_ != nullptr) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    isEmptyFile_ = false;
+}
+
+}  // namespace server
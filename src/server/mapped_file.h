@@ -0,0 +1,45 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace server {
+
+/**
+ * @brief Read-only memory mapping of a whole file (RAII)
+ */
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief Map a file read-only
+     * @param filePath path to file
+     * @return true on success (an empty file maps to size 0)
+     */
+    bool Open(const std::string& filePath);
+
+    /**
+     * @brief Unmap the file
+     */
+    void Close();
+
+    const uint8_t* GetData() const { return data_; }
+    size_t GetSize() const { return size_; }
+    bool IsOpen() const { return data_ != nullptr || isEmptyFile_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    bool isEmptyFile_;
+};
+
+}  // namespace server
+
+#endif  // MAPPED_FILE_H
@@ -0,0 +1,110 @@
+#include "media_cache.h"
+
+#include <cstdio>
+
+namespace server {
+
+MediaCache::MediaCache(size_t budgetBytes)
+    : budgetBytes_(budgetBytes),
+      residentBytes_(0),
+      hits_(0),
+      misses_(0),
+      evictions_(0) {
+}
+
+bool MediaCache::Acquire(MediaSource* source) {
+    auto it = entries_.find(source);
+    if (it != entries_.end()) {
+        hits_++;
+        Entry& entry = it->second;
+        if (entry.viewers == 0) {
+            idleSources_.erase(entry.lruPos);
+        }
+        entry.viewers++;
+        return true;
+    }
+
+    misses_++;
+    if (!source->Load()) {
+        std::fprintf(stderr, "Failed to load source '%s'\n", source->GetName().c_str());
+        return false;
+    }
+
+    Entry entry;
+    entry.viewers = 1;
+    entry.residentBytes = source->GetResidentBytes();
+    entry.lruPos = idleSources_.end();
+    entries_[source] = entry;
+    residentBytes_ += entry.residentBytes;
+
+    EnforceBudget();
+    return true;
+}
+
+void MediaCache::Release(MediaSource* source) {
+    auto it = entries_.find(source);
+    if (it == entries_.end() || it->second.viewers == 0) {
+        return;
+    }
+
+    Entry& entry = it->second;
+    entry.viewers--;
+    if (entry.viewers == 0) {
+        entry.lruPos = idleSources_.insert(idleSources_.end(), source);
+        EnforceBudget();
+    }
+}
+
+void MediaCache::EnforceBudget() {
+    if (budgetBytes_ == 0) {
+        return;
+    }
+
+    while (residentBytes_ > budgetBytes_ && !idleSources_.empty()) {
+        MediaSource* victim = idleSources_.front();
+        idleSources_.pop_front();
+
+        auto it = entries_.find(victim);
+        residentBytes_ -= it->second.residentBytes;
+        std::printf("Evicting source '%s' (%.2f MB)\n", victim->GetName().c_str(),
+                    it->second.residentBytes / 1024.0 / 1024.0);
+        entries_.erase(it);
+        victim->Unload();
+        evictions_++;
+    }
+
+    if (residentBytes_ > budgetBytes_) {
+        std::printf("Media cache over budget: %.2f / %.2f MB held by active sources\n",
+                    residentBytes_ / 1024.0 / 1024.0, budgetBytes_ / 1024.0 / 1024.0);
+    }
+}
+
+MediaCacheStats MediaCache::GetStats() const {
+    MediaCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.evictions = evictions_;
+    stats.residentBytes = residentBytes_;
+    return stats;
+}
+
+void MediaCache::LogStats() const {
+    std::printf("\nMedia cache:\n");
+    std::printf("   Resident: %.2f MB", residentBytes_ / 1024.0 / 1024.0);
+    if (budgetBytes_ > 0) {
+        std::printf(" / %.2f MB budget", budgetBytes_ / 1024.0 / 1024.0);
+    }
+    std::printf("\n");
+    std::printf("   Hits: %llu, misses: %llu, evictions: %llu\n",
+                static_cast<unsigned long long>(hits_),
+                static_cast<unsigned long long>(misses_),
+                static_cast<unsigned long long>(evictions_));
+
+    for (const auto& pair : entries_) {
+        std::printf("   %-24s %8.2f MB  %d viewer(s)\n", pair.first->GetName().c_str(),
+                    pair.second.residentBytes / 1024.0 / 1024.0, pair.second.viewers);
+    }
+    std::printf("\n");
+}
+
+}  // namespace server
@@ -0,0 +1,89 @@
+#ifndef MEDIA_CACHE_H
+#define MEDIA_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+#include "media_source.h"
+
+namespace server {
+
+/**
+ * @brief Media cache counters
+ */
+struct MediaCacheStats {
+    uint64_t hits;          // subscribe found the source loaded
+    uint64_t misses;        // subscribe had to load the source
+    uint64_t evictions;     // idle sources unloaded to meet the budget
+    size_t residentBytes;   // bytes held by all loaded sources
+};
+
+/**
+ * @brief Keeps media sources loaded within a global byte budget
+ *
+ * Sources are loaded on first subscribe. Once a source has no viewers it
+ * stays loaded but becomes evictable; when the resident total exceeds the
+ * budget, idle sources are unloaded in least-recently-used order. Sources
+ * with viewers are never evicted, so the budget can be exceeded while they
+ * are all in use.
+ */
+class MediaCache {
+public:
+    /**
+     * @param budgetBytes resident byte budget, 0 for unlimited
+     */
+    explicit MediaCache(size_t budgetBytes = 0);
+
+    MediaCache(const MediaCache&) = delete;
+    MediaCache& operator=(const MediaCache&) = delete;
+
+    /**
+     * @brief Set the resident byte budget, 0 for unlimited
+     */
+    void SetBudgetBytes(size_t budgetBytes) { budgetBytes_ = budgetBytes; }
+
+    /**
+     * @brief Add a viewer to a source, loading it if needed
+     * @param source source to subscribe to
+     * @return true if the source is loaded
+     */
+    bool Acquire(MediaSource* source);
+
+    /**
+     * @brief Remove a viewer from a source; idle sources become evictable
+     * @param source source previously passed to Acquire()
+     */
+    void Release(MediaSource* source);
+
+    /**
+     * @brief Get counters and the resident total
+     */
+    MediaCacheStats GetStats() const;
+
+    /**
+     * @brief Log counters and resident bytes per loaded source
+     */
+    void LogStats() const;
+
+private:
+    struct Entry {
+        int32_t viewers;
+        size_t residentBytes;                  // sampled at load time
+        std::list<MediaSource*>::iterator lruPos;  // valid while idle
+    };
+
+    void EnforceBudget();
+
+    size_t budgetBytes_;
+    size_t residentBytes_;
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t evictions_;
+    std::unordered_map<MediaSource*, Entry> entries_;   // loaded sources
+    std::list<MediaSource*> idleSources_;                // front = least recently used
+};
+
+}  // namespace server
+
+#endif  // MEDIA_CACHE_H
@@ -0,0 +1,572 @@
+#include "media_source.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "fmp4_muxer.h"
+#include "frame_protocol.h"
+#include "sps_parser.h"
+
+namespace server {
+
+static bool HasSuffix(const std::string& str, const std::string& suffix) {
+    if (suffix.size() > str.size()) return false;
+    return std::equal(suffix.rbegin(), suffix.rend(), str.rbegin());
+}
+
+static const double TRICK_PLAY_MIN_FPS = 1.0;
+static const double TRICK_PLAY_MAX_FPS = 10.0;
+static const uint8_t SUMMARY_VERSION = 1;
+
+static uint32_t ToBitrate(uint64_t bytes, double durationMs) {
+    if (durationMs <= 0.0) {
+        return 0;
+    }
+    return static_cast<uint32_t>(bytes * 8000.0 / durationMs);
+}
+
+// A video frame for the summary statistics: send time and size
+struct FrameSample {
+    int64_t timeMs;
+    uint32_t size;
+};
+
+// Frame-size histogram, largest frame and peak one-second bitrate; frames
+// are in send order
+static void MeasureFrames(const std::vector<FrameSample>& frames, Rendition& rendition) {
+    rendition.frameSizeHistogram.assign(FRAME_SIZE_BUCKET_COUNT, 0);
+    rendition.maxFrameBytes = 0;
+    rendition.peakBitrateBps = 0;
+    rendition.videoFrameCount = frames.size();
+
+    uint64_t windowBytes = 0;
+    size_t windowStart = 0;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        uint32_t size = frames[i].size;
+        size_t bucket = 0;
+        while (bucket + 1 < FRAME_SIZE_BUCKET_COUNT && size >= (FRAME_SIZE_BUCKET_BASE << bucket)) {
+            ++bucket;
+        }
+        rendition.frameSizeHistogram[bucket]++;
+        rendition.maxFrameBytes = std::max(rendition.maxFrameBytes, size);
+
+        windowBytes += size;
+        while (frames[i].timeMs - frames[windowStart].timeMs >= 1000) {
+            windowBytes -= frames[windowStart++].size;
+        }
+        rendition.peakBitrateBps = std::max(rendition.peakBitrateBps,
+                                            ToBitrate(windowBytes, 1000.0));
+    }
+}
+
+MediaSource::MediaSource(const std::string& name, const std::string& path,
+                         const SourceLoadOptions& options, const std::string& label)
+    : name_(name),
+      options_(options),
+      isLoaded_(false),
+      isMp4_(HasSuffix(path, ".mp4")),
+      isH265_(false),
+      frameIntervalMs_(40.0),
+      profileIdc_(0),
+      levelIdc_(0) {
+    AddRendition(label, path);
+}
+
+void MediaSource::AddRendition(const std::string& label, const std::string& path) {
+    Rendition rendition;
+    rendition.label = label;
+    rendition.path = path;
+    rendition.bitrateBps = 0;
+    rendition.avgKeyframeBytes = 0;
+    rendition.width = 0;
+    rendition.height = 0;
+    rendition.peakBitrateBps = 0;
+    rendition.maxFrameBytes = 0;
+    rendition.videoFrameCount = 0;
+    renditions_.push_back(std::move(rendition));
+}
+
+bool MediaSource::LoadRendition(Rendition& rendition) {
+    const std::string& path = rendition.path;
+    std::printf("Source '%s': %s (%s mode)\n", name_.c_str(), path.c_str(),
+                isMp4_ ? "MP4" : "raw bitstream");
+
+    if (HasSuffix(path, ".mp4") != isMp4_) {
+        std::fprintf(stderr, "Rendition %s: container differs from the other renditions\n",
+                     path.c_str());
+        return false;
+    }
+
+    if (isMp4_) {
+        std::unique_ptr<Mp4Demuxer> demuxer(new Mp4Demuxer());
+        demuxer->SetAudioWindowMs(options_.audioWindowMs);
+        demuxer->SetSharedStore(options_.useSharedMemory);
+        if (!demuxer->LoadFile(path, options_.isLazy, options_.useIndex)) {
+            return false;
+        }
+
+        uint64_t bytes = 0;
+        uint64_t keyframeBytes = 0;
+        std::vector<FrameSample> frames;
+        rendition.keyframes.clear();
+        rendition.keyframeTimesMs.clear();
+        PacketIndexEntry entry;
+        for (size_t i = 0; demuxer->GetIndexEntry(i, entry); ++i) {
+            bytes += entry.size;
+            if (entry.type == MediaType::VIDEO) {
+                frames.push_back(FrameSample{entry.dtsMs, entry.size});
+            }
+            // Sync samples include H.265 CRA/BLA, whose leading pictures
+            // reference the previous GOP; only IDRs are safe entry points
+            if (entry.type == MediaType::VIDEO && entry.frameType == VideoFrameType::IDR) {
+                rendition.keyframes.push_back(i);
+                rendition.keyframeTimesMs.push_back(entry.ptsMs);
+                keyframeBytes += entry.size;
+            }
+        }
+        // Positions count from the first keyframe
+        if (!rendition.keyframeTimesMs.empty()) {
+            int64_t originMs = rendition.keyframeTimesMs.front();
+            for (auto& timeMs : rendition.keyframeTimesMs) {
+                timeMs -= originMs;
+            }
+        }
+        if (!rendition.keyframes.empty()) {
+            rendition.avgKeyframeBytes =
+                static_cast<uint32_t>(keyframeBytes / rendition.keyframes.size());
+        }
+        size_t count = demuxer->GetPacketCount();
+        double durationMs = (count > 1)
+            ? static_cast<double>(demuxer->GetSendTimeMs(count - 1) - demuxer->GetSendTimeMs(0))
+            : 0.0;
+        rendition.bitrateBps = ToBitrate(bytes, durationMs);
+        MeasureFrames(frames, rendition);
+        rendition.mp4Demuxer = std::move(demuxer);
+        return true;
+    }
+
+    bool isH265 = HasSuffix(path, ".h265") || HasSuffix(path, ".265") ||
+                  HasSuffix(path, ".hevc") ||
+                  (!HasSuffix(path, ".h264") && !HasSuffix(path, ".264") && options_.isH265);
+    std::printf("Codec type: %s\n", isH265 ? "H.265/HEVC" : "H.264/AVC");
+
+    // A raw bitstream is served as-is, so a mapping of the file is already
+    // shared through the page cache
+    bool useMmap = options_.useMmap || options_.useSharedMemory;
+    std::unique_ptr<NalParser> parser(new NalParser());
+    if (!parser->LoadFile(path, isH265, useMmap, options_.useIndex)) {
+        return false;
+    }
+    // A random access point starts at the first parameter-set or IDR AU of a run
+    uint64_t keyframeBytes = 0;
+    bool wasRandomAccess = false;
+    std::vector<FrameSample> frames;
+    rendition.keyframes.clear();
+    rendition.keyframeTimesMs.clear();
+    for (size_t i = 0; i < parser->GetAccessUnitCount(); ++i) {
+        const AccessUnit* au = parser->GetAccessUnit(i);
+        int64_t timeMs = static_cast<int64_t>(i * 1000.0 / parser->GetFrameRate());
+        bool isRandomAccess = au->frameType == VideoFrameType::IDR ||
+                              au->frameType == VideoFrameType::SPS_PPS ||
+                              au->frameType == VideoFrameType::VPS;
+        if (isRandomAccess && !wasRandomAccess) {
+            rendition.keyframes.push_back(i);
+            rendition.keyframeTimesMs.push_back(timeMs);
+        }
+        if (au->frameType != VideoFrameType::SPS_PPS && au->frameType != VideoFrameType::VPS) {
+            frames.push_back(FrameSample{timeMs, static_cast<uint32_t>(au->size)});
+        }
+        if (au->frameType == VideoFrameType::IDR) {
+            keyframeBytes += au->size;
+        }
+        wasRandomAccess = isRandomAccess;
+    }
+    if (!rendition.keyframes.empty()) {
+        rendition.avgKeyframeBytes =
+            static_cast<uint32_t>(keyframeBytes / rendition.keyframes.size());
+    }
+
+    double durationMs = parser->GetAccessUnitCount() * 1000.0 / parser->GetFrameRate();
+    rendition.bitrateBps = ToBitrate(parser->GetFileSize(), durationMs);
+    MeasureFrames(frames, rendition);
+    rendition.nalParser = std::move(parser);
+    return true;
+}
+
+bool MediaSource::Load() {
+    if (isLoaded_) {
+        return true;
+    }
+
+    for (auto& rendition : renditions_) {
+        if (!LoadRendition(rendition)) {
+            Unload();
+            return false;
+        }
+    }
+
+    std::stable_sort(renditions_.begin(), renditions_.end(),
+                     [](const Rendition& a, const Rendition& b) {
+                         return a.bitrateBps > b.bitrateBps;
+                     });
+
+    const Rendition& top = renditions_.front();
+    if (isMp4_) {
+        isH265_ = top.mp4Demuxer->GetVideoInfo().isH265;
+        frameIntervalMs_ = 1000.0 / top.mp4Demuxer->GetFrameRate();
+    } else {
+        isH265_ = top.nalParser->IsH265();
+        frameIntervalMs_ = 1000.0 / top.nalParser->GetFrameRate();
+    }
+
+    for (const auto& rendition : renditions_) {
+        bool isH265 = isMp4_ ? rendition.mp4Demuxer->GetVideoInfo().isH265
+                             : rendition.nalParser->IsH265();
+        if (isH265 != isH265_) {
+            std::fprintf(stderr, "Source '%s': rendition %s uses a different codec\n",
+                         name_.c_str(), rendition.path.c_str());
+            Unload();
+            return false;
+        }
+    }
+
+    CountTemporalLayers();
+    FindFmp4Codec();
+
+    profileIdc_ = 0;
+    levelIdc_ = 0;
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        SpsPictureInfo picture;
+        if (!ReadPictureInfo(renditions_[i], picture)) {
+            continue;
+        }
+        renditions_[i].width = picture.width;
+        renditions_[i].height = picture.height;
+        if (i == 0) {
+            profileIdc_ = picture.profileIdc;
+            levelIdc_ = picture.levelIdc;
+        }
+    }
+    BuildSummary();
+
+    if (renditions_.size() > 1) {
+        std::printf("Source '%s': %zu renditions\n", name_.c_str(), renditions_.size());
+        for (const auto& rendition : renditions_) {
+            std::printf("   %-8s %8u kbps  %s\n", rendition.label.c_str(),
+                        rendition.bitrateBps / 1000, rendition.path.c_str());
+        }
+    }
+
+    isLoaded_ = true;
+    return true;
+}
+
+void MediaSource::CountTemporalLayers() {
+    // Layer structure is taken from the top rendition; the ladder is
+    // expected to share its GOP structure
+    std::vector<size_t> counts;
+    size_t total = 0;
+    auto countPicture = [&counts, &total](VideoFrameType type, bool isReference,
+                                          uint8_t temporalId) {
+        if (type == VideoFrameType::SPS_PPS || type == VideoFrameType::VPS) {
+            return;
+        }
+        size_t layer = static_cast<size_t>(GetTemporalLayer(isReference, temporalId));
+        if (layer >= counts.size()) {
+            counts.resize(layer + 1, 0);
+        }
+        counts[layer]++;
+        total++;
+    };
+
+    const Rendition& top = renditions_.front();
+    if (isMp4_) {
+        PacketIndexEntry entry;
+        for (size_t i = 0; top.mp4Demuxer->GetIndexEntry(i, entry); ++i) {
+            if (entry.type == MediaType::VIDEO) {
+                countPicture(entry.frameType, entry.isReference, entry.temporalId);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < top.nalParser->GetAccessUnitCount(); ++i) {
+            const AccessUnit* au = top.nalParser->GetAccessUnit(i);
+            countPicture(au->frameType, au->isReference, au->temporalId);
+        }
+    }
+
+    double fps = 1000.0 / frameIntervalMs_;
+    layerFrameRates_.assign(1, fps);
+    if (total == 0) {
+        return;
+    }
+    layerFrameRates_.clear();
+    size_t forwarded = 0;
+    for (size_t count : counts) {
+        forwarded += count;
+        layerFrameRates_.push_back(fps * forwarded / total);
+    }
+}
+
+void MediaSource::FindFmp4Codec() {
+    // MP4 keyframes carry their parameter sets; in a raw bitstream they are
+    // separate AUs at the start of the random access point
+    fmp4Codec_.clear();
+    const Rendition& top = renditions_.front();
+    if (top.keyframes.empty()) {
+        return;
+    }
+    if (isMp4_) {
+        const MediaPacket* pkt = top.mp4Demuxer->GetPacket(top.keyframes.front());
+        if (pkt != nullptr) {
+            fmp4Codec_ = Fmp4Muxer::GetCodecString(pkt->data, pkt->size, isH265_);
+        }
+    } else {
+        const NalParser& parser = *top.nalParser;
+        for (size_t i = top.keyframes.front(); i < parser.GetAccessUnitCount(); ++i) {
+            const AccessUnit* au = parser.GetAccessUnit(i);
+            fmp4Codec_ = Fmp4Muxer::GetCodecString(parser.GetData(au->offset), au->size, isH265_);
+            if (!fmp4Codec_.empty() || au->frameType == VideoFrameType::IDR) {
+                break;
+            }
+        }
+    }
+    if (!fmp4Codec_.empty()) {
+        std::printf("Source '%s': fMP4 codec %s\n", name_.c_str(), fmp4Codec_.c_str());
+    }
+}
+
+bool MediaSource::ReadPictureInfo(const Rendition& rendition, SpsPictureInfo& picture) const {
+    // Parameter sets are found the same way as for the fMP4 codec string
+    if (rendition.keyframes.empty()) {
+        return false;
+    }
+    if (isMp4_) {
+        const MediaPacket* pkt = rendition.mp4Demuxer->GetPacket(rendition.keyframes.front());
+        return pkt != nullptr && Fmp4Muxer::GetPictureInfo(pkt->data, pkt->size, isH265_, picture);
+    }
+    const NalParser& parser = *rendition.nalParser;
+    for (size_t i = rendition.keyframes.front(); i < parser.GetAccessUnitCount(); ++i) {
+        const AccessUnit* au = parser.GetAccessUnit(i);
+        if (Fmp4Muxer::GetPictureInfo(parser.GetData(au->offset), au->size, isH265_, picture)) {
+            return true;
+        }
+        if (au->frameType == VideoFrameType::IDR) {
+            break;
+        }
+    }
+    return false;
+}
+
+// Layout (integers are LEB128 varints unless sized):
+//   version(1B) codec(1B) profile_idc(1B) level_idc(1B) fps x 1000
+//   gop_frames duration_ms keyframe_count keyframe_deltas_ms[]
+//   rendition_count(1B), then per rendition:
+//     width height bitrate_bps peak_bitrate_bps max_frame_bytes
+//     bucket_count(1B) frame_size_buckets[]
+void MediaSource::BuildSummary() {
+    const Rendition& top = renditions_.front();
+    std::vector<uint8_t>& out = summary_;
+    out.clear();
+    out.push_back(SUMMARY_VERSION);
+    out.push_back(static_cast<uint8_t>(isH265_ ? VideoCodec::H265 : VideoCodec::H264));
+    out.push_back(static_cast<uint8_t>(profileIdc_));
+    out.push_back(static_cast<uint8_t>(levelIdc_));
+    FrameProtocol::WriteVarint(out, static_cast<uint64_t>(std::llround(1000000.0 / frameIntervalMs_)));
+
+    size_t keyframeCount = top.keyframes.size();
+    size_t gopFrames = (keyframeCount > 0) ? top.videoFrameCount / keyframeCount : 0;
+    FrameProtocol::WriteVarint(out, gopFrames);
+    FrameProtocol::WriteVarint(out, static_cast<uint64_t>(
+        std::llround(top.videoFrameCount * frameIntervalMs_)));
+
+    // Renditions share their keyframe positions; the top one's are sent
+    FrameProtocol::WriteVarint(out, top.keyframeTimesMs.size());
+    int64_t previousMs = 0;
+    for (int64_t timeMs : top.keyframeTimesMs) {
+        FrameProtocol::WriteVarint(out, static_cast<uint64_t>(std::max<int64_t>(0, timeMs - previousMs)));
+        previousMs = std::max(previousMs, timeMs);
+    }
+
+    out.push_back(static_cast<uint8_t>(renditions_.size()));
+    for (const auto& rendition : renditions_) {
+        FrameProtocol::WriteVarint(out, rendition.width);
+        FrameProtocol::WriteVarint(out, rendition.height);
+        FrameProtocol::WriteVarint(out, rendition.bitrateBps);
+        FrameProtocol::WriteVarint(out, rendition.peakBitrateBps);
+        FrameProtocol::WriteVarint(out, rendition.maxFrameBytes);
+        out.push_back(static_cast<uint8_t>(rendition.frameSizeHistogram.size()));
+        for (uint32_t count : rendition.frameSizeHistogram) {
+            FrameProtocol::WriteVarint(out, count);
+        }
+    }
+
+    std::printf("Source '%s': %ux%u, GOP %zu frames, %zu keyframes, summary %zu bytes\n",
+                name_.c_str(), top.width, top.height, gopFrames, keyframeCount, out.size());
+}
+
+int32_t MediaSource::SelectTemporalLayer(double maxFrameRate) const {
+    int32_t layer = KEYFRAMES_ONLY;
+    for (size_t i = 0; i < layerFrameRates_.size(); ++i) {
+        if (layerFrameRates_[i] <= maxFrameRate + 0.01) {
+            layer = static_cast<int32_t>(i);
+        }
+    }
+    return layer;
+}
+
+void MediaSource::Unload() {
+    for (auto& rendition : renditions_) {
+        rendition.mp4Demuxer.reset();
+        rendition.nalParser.reset();
+    }
+    isLoaded_ = false;
+}
+
+size_t MediaSource::GetResidentBytes() const {
+    size_t total = 0;
+    for (const auto& rendition : renditions_) {
+        if (rendition.mp4Demuxer != nullptr) {
+            total += rendition.mp4Demuxer->GetResidentBytes();
+        }
+        if (rendition.nalParser != nullptr) {
+            total += rendition.nalParser->GetResidentBytes();
+        }
+    }
+    return total;
+}
+
+size_t MediaSource::NextKeyframe(size_t rendition, size_t index) const {
+    const Rendition& r = renditions_[rendition];
+    size_t count = isMp4_ ? r.mp4Demuxer->GetPacketCount() : r.nalParser->GetAccessUnitCount();
+    if (r.keyframes.empty() || count == 0) {
+        return index;
+    }
+
+    size_t loopStart = index - index % count;
+    auto it = std::lower_bound(r.keyframes.begin(), r.keyframes.end(), index % count);
+    if (it == r.keyframes.end()) {
+        return loopStart + count + r.keyframes.front();
+    }
+    return loopStart + *it;
+}
+
+size_t MediaSource::FindKeyframe(size_t rendition, int64_t positionMs) const {
+    const Rendition& r = renditions_[rendition];
+    if (r.keyframes.empty()) {
+        return 0;
+    }
+
+    auto it = std::upper_bound(r.keyframeTimesMs.begin(), r.keyframeTimesMs.end(), positionMs);
+    size_t found = static_cast<size_t>(it - r.keyframeTimesMs.begin());
+    return r.keyframes[(found > 0) ? found - 1 : 0];
+}
+
+bool MediaSource::CopyKeyframe(size_t rendition, size_t index,
+                               std::vector<uint8_t>& out) const {
+    out.clear();
+    const Rendition& r = renditions_[rendition];
+    if (!isLoaded_ || !std::binary_search(r.keyframes.begin(), r.keyframes.end(), index)) {
+        return false;
+    }
+    // MP4 keyframes carry their parameter sets in Annex-B form
+    if (isMp4_) {
+        const MediaPacket* pkt = r.mp4Demuxer->GetPacket(index);
+        if (pkt == nullptr) {
+            return false;
+        }
+        out.assign(pkt->data, pkt->data + pkt->size);
+        return true;
+    }
+    // Raw: the parameter set AUs up to and including the IDR
+    const NalParser& parser = *r.nalParser;
+    for (size_t i = index; i < parser.GetAccessUnitCount(); ++i) {
+        const AccessUnit* au = parser.GetAccessUnit(i);
+        const uint8_t* data = parser.GetData(au->offset);
+        out.insert(out.end(), data, data + au->size);
+        if (au->frameType != VideoFrameType::SPS_PPS && au->frameType != VideoFrameType::VPS) {
+            return true;
+        }
+    }
+    return false;
+}
+
+double MediaSource::GetTrickPlayFrameRate(size_t rendition) const {
+    const Rendition& r = renditions_[rendition];
+    if (r.avgKeyframeBytes == 0) {
+        return TRICK_PLAY_MIN_FPS;
+    }
+    double fps = r.bitrateBps / 8.0 / r.avgKeyframeBytes;
+    return std::max(TRICK_PLAY_MIN_FPS, std::min(TRICK_PLAY_MAX_FPS, fps));
+}
+
+std::vector<uint32_t> MediaSource::GetBitrates() const {
+    std::vector<uint32_t> bitrates;
+    for (const auto& rendition : renditions_) {
+        bitrates.push_back(rendition.bitrateBps);
+    }
+    return bitrates;
+}
+
+std::string MediaSource::BuildMediaOffer(uint8_t streamId) const {
+    const char* videoCodecStr = isH265_ ? "h265" : "h264";
+    double fps = 1000.0 / frameIntervalMs_;
+
+    std::string ladder;
+    if (renditions_.size() > 1) {
+        ladder = ",\"renditions\":[";
+        for (size_t i = 0; i < renditions_.size(); ++i) {
+            char entry[128];
+            std::snprintf(entry, sizeof(entry), "%s{\"id\":%zu,\"label\":\"%s\",\"bitrate\":%u}",
+                          (i > 0) ? "," : "", i, renditions_[i].label.c_str(),
+                          renditions_[i].bitrateBps);
+            ladder += entry;
+        }
+        ladder += "]";
+    }
+
+    // Frame rate per temporal layer cap, for thinning in the media-answer
+    std::string layers;
+    if (layerFrameRates_.size() > 1) {
+        layers = ",\"layers\":[";
+        for (size_t i = 0; i < layerFrameRates_.size(); ++i) {
+            char rate[32];
+            std::snprintf(rate, sizeof(rate), "%s%.2f", (i > 0) ? "," : "", layerFrameRates_[i]);
+            layers += rate;
+        }
+        layers += "]";
+    }
+
+    // Containers the video can be sent in; fMP4 needs a codec string for
+    // the client's SourceBuffer
+    std::string containers = ",\"containers\":[\"annexb\"]";
+    if (!fmp4Codec_.empty()) {
+        containers = ",\"containers\":[\"annexb\",\"fmp4\"],\"fmp4Codec\":\"" + fmp4Codec_ + "\"";
+    }
+
+    char video[128];
+    std::snprintf(video, sizeof(video),
+        "{\"type\":\"video\",\"codec\":\"%s\",\"framerate\":%.2f", videoCodecStr, fps);
+    std::string streams = std::string(video) + containers + layers + ladder + "}";
+
+    const Mp4Demuxer* demuxer = renditions_.front().mp4Demuxer.get();
+    if (isMp4_ && demuxer->GetAudioInfo().present) {
+        const AudioInfo& audio = demuxer->GetAudioInfo();
+        char audioStream[192];
+        std::snprintf(audioStream, sizeof(audioStream),
+            ",{\"type\":\"audio\",\"codec\":\"%s\",\"sampleRate\":%d,\"channels\":%d}",
+            audio.codecName.c_str(), audio.sampleRate, audio.channels);
+        streams += audioStream;
+    }
+
+    std::string streamField;
+    if (streamId != 0) {
+        streamField = ",\"streamId\":" + std::to_string(streamId);
+    }
+    // Protocol versions the media can be framed in; 2 has compact headers
+    return "{\"type\":\"media-offer\",\"payload\":{\"version\":1,\"protocols\":[1,2]" +
+           streamField +
+           ",\"streams\":[" + streams + "]}}";
+}
+
+}  // namespace server
@@ -0,0 +1,241 @@
+#ifndef MEDIA_SOURCE_H
+#define MEDIA_SOURCE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mp4_demuxer.h"
+#include "nal_parser.h"
+
+namespace server {
+
+// Frame-size histogram of the source summary: bucket i counts video frames
+// smaller than FRAME_SIZE_BUCKET_BASE << i, the last bucket the rest
+static const size_t FRAME_SIZE_BUCKET_COUNT = 12;
+static const uint32_t FRAME_SIZE_BUCKET_BASE = 1024;
+
+struct SpsPictureInfo;
+
+/**
+ * @brief Options applied when loading a media source
+ */
+struct SourceLoadOptions {
+    bool isH265;            // raw bitstream codec when the extension does not tell
+    bool isLazy;            // MP4: index only, read payloads on demand
+    bool useMmap;           // raw: mmap instead of reading into memory
+    bool useIndex;          // use/build sidecar index files
+    bool useSharedMemory;   // share loaded media with other processes on the host
+    int32_t audioWindowMs;  // MP4: audio lead against video DTS
+};
+
+/**
+ * @brief One encoding of a source's content
+ */
+struct Rendition {
+    std::string label;      // e.g. "1080"
+    std::string path;
+    uint32_t bitrateBps;    // average over the file, measured on load
+    std::vector<size_t> keyframes;  // packet (MP4) / AU (raw) index of each random access point
+    std::vector<int64_t> keyframeTimesMs;  // position of each keyframe, ms from start
+    uint32_t avgKeyframeBytes;
+    // Video statistics for the source summary, measured on load
+    uint32_t width;             // from the first keyframe's SPS, 0 if unknown
+    uint32_t height;
+    uint32_t peakBitrateBps;    // highest video bitrate over a one-second window
+    uint32_t maxFrameBytes;
+    size_t videoFrameCount;
+    std::vector<uint32_t> frameSizeHistogram;  // FRAME_SIZE_BUCKET_COUNT buckets
+    std::unique_ptr<Mp4Demuxer> mp4Demuxer;
+    std::unique_ptr<NalParser> nalParser;
+};
+
+/**
+ * @brief One named piece of content (MP4 or raw H.264/H.265 bitstream)
+ *        that connections can subscribe to
+ *
+ * A source has one or more renditions: pre-encoded files of the same
+ * content at different bitrates, with aligned IDRs, so a connection can
+ * switch between them at an IDR. All renditions must share container and
+ * codec. After Load() they are ordered by bitrate, index 0 highest.
+ *
+ * A source can be unloaded to release its packets and loaded again later;
+ * MediaCache decides when.
+ */
+class MediaSource {
+public:
+    static const int32_t KEYFRAMES_ONLY = -1;   // layer cap: intra pictures only
+
+    /**
+     * @param name catalog name, used in /stream/<name>
+     * @param path media file path of the first rendition
+     * @param options load options used by every Load()
+     * @param label label of the first rendition
+     */
+    MediaSource(const std::string& name, const std::string& path,
+                const SourceLoadOptions& options, const std::string& label = "");
+
+    MediaSource(const MediaSource&) = delete;
+    MediaSource& operator=(const MediaSource&) = delete;
+
+    /**
+     * @brief Add another rendition of the same content (before Load())
+     * @param label rendition label advertised in the media-offer
+     * @param path media file path
+     */
+    void AddRendition(const std::string& label, const std::string& path);
+
+    /**
+     * @brief Load all renditions; the mode follows the file extension
+     * @return true on success
+     */
+    bool Load();
+
+    /**
+     * @brief Release the demuxed/parsed media; Load() may be called again
+     */
+    void Unload();
+
+    /**
+     * @brief Check whether the media is loaded
+     */
+    bool IsLoaded() const { return isLoaded_; }
+
+    /**
+     * @brief Get bytes held in memory by the loaded media, 0 if unloaded
+     */
+    size_t GetResidentBytes() const;
+
+    /**
+     * @brief Build the JSON media-offer sent after the WebSocket handshake
+     *        (source must be loaded); lists the rendition ladder when there
+     *        is more than one rendition
+     * @param streamId multiplexed stream the offer is for; 0 (the
+     *        connection's own stream) omits the field
+     */
+    std::string BuildMediaOffer(uint8_t streamId = 0) const;
+
+    /**
+     * @brief Get the binary source summary sent as METADATA ahead of the
+     *        media-offer (resolution, profile, GOP, keyframe times and
+     *        frame sizes per rendition); built on load
+     */
+    const std::vector<uint8_t>& GetSummary() const { return summary_; }
+
+    const std::string& GetName() const { return name_; }
+    const std::string& GetPath() const { return renditions_.front().path; }
+    bool IsMp4() const { return isMp4_; }
+    bool IsH265() const { return isH265_; }
+    double GetFrameIntervalMs() const { return frameIntervalMs_; }
+
+    /**
+     * @brief Get the RFC 6381 codec string for fMP4 output, empty if the
+     *        first keyframe carries no usable SPS (fMP4 not offered)
+     */
+    const std::string& GetFmp4Codec() const { return fmp4Codec_; }
+
+    size_t GetRenditionCount() const { return renditions_.size(); }
+    const Rendition& GetRendition(size_t index) const { return renditions_[index]; }
+
+    /**
+     * @brief Get rendition bitrates, index 0 highest (source must be loaded)
+     */
+    std::vector<uint32_t> GetBitrates() const;
+
+    /**
+     * @brief Temporal layer of a picture, for thinning
+     *
+     * Reference pictures sit at their TemporalId (always 0 for H.264 without
+     * SVC); non-reference pictures one above. A picture only references
+     * pictures at its own layer or below, so dropping every layer above a
+     * cap leaves a decodable stream.
+     */
+    static int32_t GetTemporalLayer(bool isReference, uint8_t temporalId) {
+        return temporalId + (isReference ? 0 : 1);
+    }
+
+    /**
+     * @brief Get the highest temporal layer present (source must be loaded)
+     */
+    int32_t GetMaxTemporalLayer() const {
+        return static_cast<int32_t>(layerFrameRates_.size()) - 1;
+    }
+
+    /**
+     * @brief Get the frame rate when forwarding layers 0..layer
+     */
+    double GetLayerFrameRate(int32_t layer) const { return layerFrameRates_[layer]; }
+
+    /**
+     * @brief Pick the highest layer cap whose frame rate does not exceed
+     *        maxFrameRate
+     * @return layer cap, or KEYFRAMES_ONLY when even layer 0 is too fast
+     */
+    int32_t SelectTemporalLayer(double maxFrameRate) const;
+
+    /**
+     * @brief Find the first random access point at or after a playback index
+     * @param rendition rendition index
+     * @param index packet (MP4) or AU (raw) index, counting on across loops
+     * @return index of the keyframe, on the same looping scale
+     */
+    size_t NextKeyframe(size_t rendition, size_t index) const;
+
+    /**
+     * @brief Find the keyframe at or before a position (binary search)
+     * @param rendition rendition index
+     * @param positionMs position in ms from the start of the source
+     * @return packet (MP4) or AU (raw) index of the keyframe, or 0 if the
+     *         rendition has no keyframe index
+     */
+    size_t FindKeyframe(size_t rendition, int64_t positionMs) const;
+
+    /**
+     * @brief Copy a keyframe as one Annex-B buffer that decodes on its own
+     *        (parameter sets included), e.g. for a decoder on another thread
+     * @param rendition rendition index
+     * @param index packet (MP4) or AU (raw) index from FindKeyframe()
+     * @param out receives the keyframe bytes
+     * @return true if the index is a keyframe of the loaded source
+     */
+    bool CopyKeyframe(size_t rendition, size_t index, std::vector<uint8_t>& out) const;
+
+    /**
+     * @brief Keyframe rate for keyframe-only trick play that keeps the
+     *        bitrate near the rendition's 1x bitrate
+     */
+    double GetTrickPlayFrameRate(size_t rendition) const;
+
+    // Valid only while loaded
+    const Mp4Demuxer& GetMp4Demuxer(size_t rendition = 0) const {
+        return *renditions_[rendition].mp4Demuxer;
+    }
+    const NalParser& GetNalParser(size_t rendition = 0) const {
+        return *renditions_[rendition].nalParser;
+    }
+
+private:
+    bool LoadRendition(Rendition& rendition);
+    void CountTemporalLayers();
+    void FindFmp4Codec();
+    bool ReadPictureInfo(const Rendition& rendition, SpsPictureInfo& picture) const;
+    void BuildSummary();
+
+    std::string name_;
+    SourceLoadOptions options_;
+    std::vector<Rendition> renditions_;
+    bool isLoaded_;
+    bool isMp4_;
+    bool isH265_;
+    double frameIntervalMs_;
+    std::vector<double> layerFrameRates_;   // cumulative fps per layer cap
+    std::string fmp4Codec_;
+    uint32_t profileIdc_;     // of the top rendition's SPS
+    uint32_t levelIdc_;
+    std::vector<uint8_t> summary_;
+};
+
+}  // namespace server
+
+#endif  // MEDIA_SOURCE_H
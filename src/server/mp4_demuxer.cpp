@@ -1,7 +1,17 @@
 #include "mp4_demuxer.h"
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <climits>
 #include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "mp4_sample_table.h"
+#include "start_code_scanner.h"
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -11,15 +21,518 @@ extern "C" {
 
 namespace server {
 
+static const uint64_t READAHEAD_BYTES = 4 * 1024 * 1024;  // lazy mode readahead window
+static const size_t PROBE_PAGE_BYTES = 4096;             // sample header read, sparse probes
+static const size_t PROBE_BATCH_BYTES = 64 * 1024;       // sample header read, every sample probed
+static const uint8_t START_CODE[4] = {0, 0, 0, 1};
+
+// Sidecar index sections
+static const uint32_t SECTION_META = 1;
+static const uint32_t SECTION_PARAMETER_SETS = 2;
+static const uint32_t SECTION_OFFSETS = 3;
+static const uint32_t SECTION_SIZES = 4;
+static const uint32_t SECTION_PTS = 5;
+static const uint32_t SECTION_DTS = 6;
+static const uint32_t SECTION_TYPES = 7;
+static const uint32_t SECTION_FRAME_TYPES = 8;
+static const uint32_t SECTION_FLAGS = 9;
+static const uint32_t SECTION_TEMPORAL_IDS = 10;
+static const uint32_t SECTION_PAYLOAD_OFFSETS = 11;   // shared image only
+static const uint32_t SECTION_PAYLOAD_SIZES = 12;     // shared image only
+static const uint32_t SECTION_PAYLOADS = 13;          // shared image only
+
+/**
+ * @brief Stream-level values stored in the sidecar index
+ */
+struct Mp4IndexMeta {
+    double frameRate;
+    int32_t sampleRate;
+    int32_t channels;
+    uint32_t nalLengthSize;
+    uint8_t isH265;
+    uint8_t hasAudio;
+    char audioCodec[16];
+};
+
+/**
+ * @brief Exclusive lock on "<path>.lock" held for the object's lifetime, so
+ *        that only one process builds a shared image
+ */
+class SharedImageLock {
+public:
+    explicit SharedImageLock(const std::string& path)
+        : fd_(open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0644)) {
+        if (fd_ >= 0) {
+            flock(fd_, LOCK_EX);
+        }
+    }
+
+    ~SharedImageLock() {
+        if (fd_ >= 0) {
+            flock(fd_, LOCK_UN);
+            close(fd_);
+        }
+    }
+
+    SharedImageLock(const SharedImageLock&) = delete;
+    SharedImageLock& operator=(const SharedImageLock&) = delete;
+
+private:
+    int32_t fd_;
+};
+
+static uint32_t MakeFourCC(char a, char b, char c, char d) {
+    return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) |
+           (static_cast<uint32_t>(c) << 8) | static_cast<uint32_t>(d);
+}
+
+static uint16_t ReadBE16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static void AppendAnnexBNal(std::vector<uint8_t>& out, const uint8_t* nal, size_t size) {
+    out.insert(out.end(), START_CODE, START_CODE + sizeof(START_CODE));
+    out.insert(out.end(), nal, nal + size);
+}
+
 Mp4Demuxer::Mp4Demuxer()
     : videoInfo_{"", 0.0, false, false},
-      audioInfo_{"", 0, 0, false} {
+      audioInfo_{"", 0, 0, false},
+      audioWindowMs_(0),
+      useSharedStore_(false),
+      isLazy_(false),
+      fileFd_(-1),
+      nalLengthSize_(0),
+      probeOffset_(0),
+      probeWindowBytes_(PROBE_PAGE_BYTES),
+      readAheadEnd_(0) {
 }
 
 Mp4Demuxer::~Mp4Demuxer() {
+    if (fileFd_ >= 0) {
+        close(fileFd_);
+    }
 }
 
-bool Mp4Demuxer::LoadFile(const std::string& filePath) {
+bool Mp4Demuxer::ParseVideoExtradata(const uint8_t* data, size_t size) {
+    parameterSets_.clear();
+
+    // Extradata already in Annex B: samples are Annex B too
+    if (size >= 3 && data[0] == 0 && data[1] == 0 &&
+        (data[2] == 1 || (size >= 4 && data[2] == 0 && data[3] == 1))) {
+        nalLengthSize_ = 0;
+        parameterSets_.assign(data, data + size);
+        return true;
+    }
+
+    size_t pos = 0;
+    if (!videoInfo_.isH265) {
+        // avcC: version, profile, compat, level, lengthSizeMinusOne, numSps
+        if (size < 7 || data[0] != 1) return false;
+        nalLengthSize_ = (data[4] & 0x03) + 1u;
+        uint32_t numSets = data[5] & 0x1F;
+        pos = 6;
+        for (int32_t pass = 0; pass < 2; ++pass) {
+            for (uint32_t i = 0; i < numSets; ++i) {
+                if (pos + 2 > size) return false;
+                size_t len = ReadBE16(data + pos);
+                if (pos + 2 + len > size) return false;
+                AppendAnnexBNal(parameterSets_, data + pos + 2, len);
+                pos += 2 + len;
+            }
+            if (pass == 0) {
+                if (pos >= size) return false;
+                numSets = data[pos++];  // numPps
+            }
+        }
+        return true;
+    }
+
+    // hvcC: 22-byte header, lengthSizeMinusOne at byte 21, numArrays at 22
+    if (size < 23) return false;
+    nalLengthSize_ = (data[21] & 0x03) + 1u;
+    uint32_t numArrays = data[22];
+    pos = 23;
+    for (uint32_t a = 0; a < numArrays; ++a) {
+        if (pos + 3 > size) return false;
+        uint32_t numNalus = ReadBE16(data + pos + 1);
+        pos += 3;
+        for (uint32_t i = 0; i < numNalus; ++i) {
+            if (pos + 2 > size) return false;
+            size_t len = ReadBE16(data + pos);
+            if (pos + 2 + len > size) return false;
+            AppendAnnexBNal(parameterSets_, data + pos + 2, len);
+            pos += 2 + len;
+        }
+    }
+    return true;
+}
+
+void Mp4Demuxer::ClassifyFromSampleTable(const Mp4Sample& sample, int64_t maxPtsSoFar,
+                                         bool isIdr, PacketIndexEntry& entry) {
+    // Without payloads, classify from stss/sdtp and decode vs presentation order
+    uint8_t dependsOn = (sample.dependencyFlags >> 4) & 0x03;
+    uint8_t isDependedOn = (sample.dependencyFlags >> 2) & 0x03;
+
+    entry.isReference = (isDependedOn != 2);
+    if (sample.isSync) {
+        // H.265 CRA/BLA are sync samples too, but their leading pictures
+        // reference the previous GOP
+        entry.frameType = isIdr ? VideoFrameType::IDR : VideoFrameType::I_FRAME;
+    } else if (dependsOn == 2) {
+        entry.frameType = VideoFrameType::I_FRAME;
+    } else if (sample.pts < maxPtsSoFar) {
+        // Shown before an already decoded picture: predicted from the future
+        entry.frameType = VideoFrameType::B_FRAME;
+    } else {
+        entry.frameType = VideoFrameType::P_FRAME;
+    }
+}
+
+const uint8_t* Mp4Demuxer::ReadProbe(uint64_t offset, size_t wanted, size_t& available) {
+    uint64_t windowEnd = probeOffset_ + probeWindow_.size();
+    if (offset < probeOffset_ || offset + wanted > windowEnd) {
+        // Leading SEI/AUD/parameter sets and the slice header usually sit
+        // in one page; when every sample is probed, one larger read also
+        // covers the following samples of the chunk
+        probeWindow_.resize(std::max(wanted, probeWindowBytes_));
+        probeOffset_ = offset;
+        size_t done = 0;
+        while (done < probeWindow_.size()) {
+            ssize_t n = pread(fileFd_, probeWindow_.data() + done, probeWindow_.size() - done,
+                              static_cast<off_t>(offset + done));
+            if (n < 0) {
+                std::fprintf(stderr, "Failed to read sample header at offset %llu\n",
+                             static_cast<unsigned long long>(offset));
+                break;
+            }
+            if (n == 0) {
+                break;  // end of file
+            }
+            done += static_cast<size_t>(n);
+        }
+        probeWindow_.resize(done);
+        windowEnd = probeOffset_ + done;
+    }
+    available = (offset < windowEnd) ? static_cast<size_t>(windowEnd - offset) : 0;
+    return probeWindow_.data() + (offset - probeOffset_);
+}
+
+bool Mp4Demuxer::ProbeSample(uint64_t offset, uint32_t size, FrameInfo& frame) {
+    // Fold the NAL units up to the first slice into the classification, as
+    // the eager path does for the whole AU; only NAL and slice headers are read
+    static const int32_t MAX_LEADING_NALS = 16;
+    static const size_t ANNEXB_HEAD_BYTES = 4096;
+    static const size_t SLICE_HEADER_BYTES = 64;
+    size_t available = 0;
+
+    if (nalLengthSize_ == 0) {
+        // Annex B samples: look for the first slice in the sample's head
+        const uint8_t* head = ReadProbe(offset, std::min<size_t>(size, ANNEXB_HEAD_BYTES),
+                                        available);
+        size_t headSize = std::min<size_t>(std::min<size_t>(available, size), ANNEXB_HEAD_BYTES);
+        size_t pos = StartCodeScanner::FindNext(head, headSize, 0);
+        while (pos + 3 < headSize) {
+            size_t next = StartCodeScanner::FindNext(head, headSize, pos + 3);
+            NalInfo info = classifier_.ParseNal(head + pos + 3, next - pos - 3);
+            classifier_.AddNal(frame, info);
+            if (info.isVcl) {
+                return true;
+            }
+            pos = next;
+        }
+        return false;
+    }
+
+    uint64_t pos = offset;
+    uint64_t end = offset + size;
+    for (int32_t i = 0; i < MAX_LEADING_NALS && pos + nalLengthSize_ + 1 <= end; ++i) {
+        const uint8_t* data = ReadProbe(pos, nalLengthSize_ + SLICE_HEADER_BYTES, available);
+        if (available < nalLengthSize_ + 1) {
+            return false;
+        }
+        uint64_t nalSize = 0;
+        for (uint32_t j = 0; j < nalLengthSize_; ++j) {
+            nalSize = (nalSize << 8) | data[j];
+        }
+        size_t nalBytes = static_cast<size_t>(std::min<uint64_t>(
+            std::min<uint64_t>(nalSize, end - pos - nalLengthSize_), available - nalLengthSize_));
+        NalInfo info = classifier_.ParseNal(data + nalLengthSize_, nalBytes);
+        classifier_.AddNal(frame, info);
+        if (info.isVcl) {
+            return true;
+        }
+        pos += nalLengthSize_ + nalSize;
+    }
+    return false;
+}
+
+bool Mp4Demuxer::LoadIndex(const std::string& filePath, int32_t videoStreamIndex,
+                           int32_t audioStreamIndex) {
+    std::vector<Mp4Track> tracks;
+    if (!Mp4SampleTable::ParseFile(filePath, tracks)) {
+        return false;
+    }
+    if (videoStreamIndex >= static_cast<int32_t>(tracks.size()) ||
+        tracks[videoStreamIndex].handlerType != MakeFourCC('v', 'i', 'd', 'e') ||
+        tracks[videoStreamIndex].samples.empty()) {
+        std::fprintf(stderr, "Sample table does not match video stream, using eager load\n");
+        return false;
+    }
+    if (!OpenLazyFile(filePath)) {
+        return false;
+    }
+    // H.265 sync samples may be CRA/BLA, and layers come from NAL headers
+    // (TemporalId, nal_ref_idc) unless sdtp marks disposable H.264 samples;
+    // scattered header reads gain nothing from readahead
+    const std::vector<Mp4Sample>& videoSamples = tracks[videoStreamIndex].samples;
+    bool hasSdtp = std::any_of(videoSamples.begin(), videoSamples.end(),
+                               [](const Mp4Sample& sample) { return sample.dependencyFlags != 0; });
+    probeWindowBytes_ = (videoInfo_.isH265 || !hasSdtp) ? PROBE_BATCH_BYTES : PROBE_PAGE_BYTES;
+    posix_fadvise(fileFd_, 0, 0, POSIX_FADV_RANDOM);
+
+    store_.Clear();
+    for (int32_t pass = 0; pass < 2; ++pass) {
+        int32_t streamIndex = (pass == 0) ? videoStreamIndex : audioStreamIndex;
+        if (streamIndex < 0 || streamIndex >= static_cast<int32_t>(tracks.size())) continue;
+        if (pass == 1 && !audioInfo_.present) continue;
+
+        const Mp4Track& track = tracks[streamIndex];
+        MediaType type = (pass == 0) ? MediaType::VIDEO : MediaType::AUDIO;
+        int64_t maxPts = INT64_MIN;
+        for (const auto& sample : track.samples) {
+            PacketIndexEntry entry;
+            entry.offset = sample.offset;
+            entry.size = sample.size;
+            entry.ptsMs = sample.pts * 1000 / track.timescale;
+            entry.dtsMs = sample.dts * 1000 / track.timescale;
+            entry.type = type;
+            entry.isKeyframe = sample.isSync;
+            entry.frameType = VideoFrameType::I_FRAME;
+            entry.isReference = true;
+            entry.temporalId = 0;
+            if (type == MediaType::VIDEO) {
+                // H.264 sync samples are taken as IDRs (reference, layer 0)
+                FrameInfo frame = FrameClassifier::BeginFrame();
+                bool isProbed = (videoInfo_.isH265 || (!hasSdtp && !sample.isSync)) &&
+                                ProbeSample(sample.offset, sample.size, frame);
+                bool isIdr = sample.isSync &&
+                             (!videoInfo_.isH265 || frame.frameType == VideoFrameType::IDR);
+                ClassifyFromSampleTable(sample, maxPts, isIdr, entry);
+                if (isProbed) {
+                    entry.isReference = frame.isReference;
+                    entry.temporalId = frame.temporalId;
+                }
+            }
+            maxPts = std::max(maxPts, sample.pts);
+            store_.Append(entry, nullptr, 0);
+        }
+    }
+
+    std::vector<uint8_t>().swap(probeWindow_);
+    posix_fadvise(fileFd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    SortPacketsForSending();
+    return true;
+}
+
+bool Mp4Demuxer::OpenLazyFile(const std::string& filePath) {
+    fileFd_ = open(filePath.c_str(), O_RDONLY);
+    if (fileFd_ < 0) {
+        std::fprintf(stderr, "Failed to open file: %s\n", filePath.c_str());
+        return false;
+    }
+    posix_fadvise(fileFd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+}
+
+bool Mp4Demuxer::ReadIndexSections(const IndexFile& index) {
+    const Mp4IndexMeta* meta = nullptr;
+    const uint8_t* parameterSets = nullptr;
+    size_t metaCount = 0;
+    size_t parameterSetsSize = 0;
+    if (!index.GetSection(SECTION_META, meta, metaCount) || metaCount != 1 ||
+        !index.GetSection(SECTION_PARAMETER_SETS, parameterSets, parameterSetsSize)) {
+        return false;
+    }
+
+    // One section per metadata column; all must have the same length
+    const uint64_t* offsets = nullptr;
+    const uint32_t* sizes = nullptr;
+    const int64_t* pts = nullptr;
+    const int64_t* dts = nullptr;
+    const MediaType* types = nullptr;
+    const VideoFrameType* frameTypes = nullptr;
+    const uint8_t* flags = nullptr;
+    const uint8_t* temporalIds = nullptr;
+    size_t counts[8] = {0};
+    if (!index.GetSection(SECTION_OFFSETS, offsets, counts[0]) ||
+        !index.GetSection(SECTION_SIZES, sizes, counts[1]) ||
+        !index.GetSection(SECTION_PTS, pts, counts[2]) ||
+        !index.GetSection(SECTION_DTS, dts, counts[3]) ||
+        !index.GetSection(SECTION_TYPES, types, counts[4]) ||
+        !index.GetSection(SECTION_FRAME_TYPES, frameTypes, counts[5]) ||
+        !index.GetSection(SECTION_FLAGS, flags, counts[6]) ||
+        !index.GetSection(SECTION_TEMPORAL_IDS, temporalIds, counts[7]) ||
+        std::count(counts, counts + 8, counts[0]) != 8) {
+        return false;
+    }
+
+    videoInfo_.present = true;
+    videoInfo_.isH265 = (meta->isH265 != 0);
+    videoInfo_.codecName = videoInfo_.isH265 ? "h265" : "h264";
+    videoInfo_.frameRate = meta->frameRate;
+    audioInfo_.present = (meta->hasAudio != 0);
+    audioInfo_.codecName.assign(meta->audioCodec, strnlen(meta->audioCodec, sizeof(meta->audioCodec)));
+    audioInfo_.sampleRate = meta->sampleRate;
+    audioInfo_.channels = meta->channels;
+
+    nalLengthSize_ = meta->nalLengthSize;
+    parameterSets_.assign(parameterSets, parameterSets + parameterSetsSize);
+    store_.AssignColumns(offsets, sizes, pts, dts, types, frameTypes, flags, temporalIds,
+                         counts[0]);
+    return true;
+}
+
+void Mp4Demuxer::AddIndexSections() {
+    Mp4IndexMeta meta;
+    std::memset(&meta, 0, sizeof(meta));
+    meta.frameRate = videoInfo_.frameRate;
+    meta.sampleRate = audioInfo_.sampleRate;
+    meta.channels = audioInfo_.channels;
+    meta.nalLengthSize = nalLengthSize_;
+    meta.isH265 = videoInfo_.isH265 ? 1 : 0;
+    meta.hasAudio = audioInfo_.present ? 1 : 0;
+    std::strncpy(meta.audioCodec, audioInfo_.codecName.c_str(), sizeof(meta.audioCodec) - 1);
+
+    indexWriter_.AddSection(SECTION_META, &meta, sizeof(meta), 1);
+    indexWriter_.AddSection(SECTION_PARAMETER_SETS, parameterSets_);
+    indexWriter_.AddSection(SECTION_OFFSETS, store_.GetOffsets());
+    indexWriter_.AddSection(SECTION_SIZES, store_.GetSizes());
+    indexWriter_.AddSection(SECTION_PTS, store_.GetPtsColumn());
+    indexWriter_.AddSection(SECTION_DTS, store_.GetDtsColumn());
+    indexWriter_.AddSection(SECTION_TYPES, store_.GetTypes());
+    indexWriter_.AddSection(SECTION_FRAME_TYPES, store_.GetFrameTypes());
+    indexWriter_.AddSection(SECTION_FLAGS, store_.GetFlags());
+    indexWriter_.AddSection(SECTION_TEMPORAL_IDS, store_.GetTemporalIds());
+}
+
+bool Mp4Demuxer::LoadIndexFile(const std::string& filePath, const std::string& indexPath,
+                               const IndexSourceKey& key) {
+    IndexFile index;
+    if (!index.Open(indexPath, IndexKind::MP4, key) || !ReadIndexSections(index)) {
+        return false;
+    }
+
+    if (!OpenLazyFile(filePath)) {
+        store_.Clear();
+        return false;
+    }
+
+    SortPacketsForSending();  // the audio window may differ from the one at build time
+    isLazy_ = true;
+    return true;
+}
+
+void Mp4Demuxer::WriteIndexFile(const std::string& indexPath, const IndexSourceKey& key) {
+    AddIndexSections();
+    indexWriter_.WriteAsync(indexPath, IndexKind::MP4, key);
+}
+
+bool Mp4Demuxer::LoadSharedImage(const std::string& sharedPath, const IndexSourceKey& key) {
+    if (!sharedImage_.Open(sharedPath, IndexKind::MP4_SHARED, key)) {
+        return false;
+    }
+
+    // Validate everything before touching the store, so a bad image leaves
+    // the current packets in place
+    const uint64_t* packetOffsets = nullptr;
+    const uint64_t* payloadOffsets = nullptr;
+    const uint32_t* payloadSizes = nullptr;
+    const uint8_t* payloads = nullptr;
+    size_t packetCount = 0;
+    size_t offsetCount = 0;
+    size_t sizeCount = 0;
+    size_t payloadBytes = 0;
+    bool isValid = sharedImage_.GetSection(SECTION_OFFSETS, packetOffsets, packetCount) &&
+                   sharedImage_.GetSection(SECTION_PAYLOAD_OFFSETS, payloadOffsets, offsetCount) &&
+                   sharedImage_.GetSection(SECTION_PAYLOAD_SIZES, payloadSizes, sizeCount) &&
+                   sharedImage_.GetSection(SECTION_PAYLOADS, payloads, payloadBytes) &&
+                   offsetCount == packetCount && sizeCount == packetCount;
+    for (size_t i = 0; isValid && i < offsetCount; ++i) {
+        isValid = payloadOffsets[i] <= payloadBytes &&
+                  payloadSizes[i] <= payloadBytes - payloadOffsets[i];
+    }
+    if (!isValid) {
+        sharedImage_.Close();
+        return false;
+    }
+
+    if (!ReadIndexSections(sharedImage_) || store_.GetCount() != packetCount) {
+        store_.Clear();
+        sharedImage_.Close();
+        return false;
+    }
+
+    store_.AssignExternalPayloads(payloads, payloadOffsets, payloadSizes);
+    SortPacketsForSending();
+    isLazy_ = false;
+    return true;
+}
+
+bool Mp4Demuxer::PublishSharedImage(const std::string& sharedPath, const IndexSourceKey& key) {
+    AddIndexSections();
+
+    std::vector<uint64_t> payloadOffsets(store_.GetCount());
+    uint64_t payloadBytes = 0;
+    for (size_t i = 0; i < store_.GetCount(); ++i) {
+        payloadOffsets[i] = payloadBytes;
+        payloadBytes += store_.GetPayloadSize(i);
+    }
+    std::vector<uint32_t> payloadSizes(store_.GetCount());
+    for (size_t i = 0; i < store_.GetCount(); ++i) {
+        payloadSizes[i] = store_.GetPayloadSize(i);
+    }
+    indexWriter_.AddSection(SECTION_PAYLOAD_OFFSETS, payloadOffsets);
+    indexWriter_.AddSection(SECTION_PAYLOAD_SIZES, payloadSizes);
+    indexWriter_.AddSection(SECTION_PAYLOADS, nullptr, 1, 0);
+    for (size_t i = 0; i < store_.GetCount(); ++i) {
+        indexWriter_.AppendToSection(store_.GetPayload(i), store_.GetPayloadSize(i));
+    }
+
+    // Written synchronously: this process switches to the shared copy and
+    // frees its private arena right after
+    indexWriter_.WriteAsync(sharedPath, IndexKind::MP4_SHARED, key);
+    indexWriter_.Wait();
+    return LoadSharedImage(sharedPath, key);
+}
+
+bool Mp4Demuxer::LoadFile(const std::string& filePath, bool isLazy, bool useIndex) {
+    IndexSourceKey key;
+    std::string indexPath = IndexFile::GetSidecarPath(filePath);
+    bool hasKey = (isLazy ? useIndex : useSharedStore_) && IndexFile::ReadSourceKey(filePath, key);
+    if (isLazy && hasKey && LoadIndexFile(filePath, indexPath, key)) {
+        std::printf("Video: %s, %.2f fps\n", videoInfo_.codecName.c_str(), videoInfo_.frameRate);
+        std::printf("Loaded %zu packets from index file %s\n", store_.GetCount(),
+                    indexPath.c_str());
+        return true;
+    }
+
+    // Shared store: the first process demuxes and publishes the image while
+    // holding the lock; the others wait for it and map it
+    bool isShared = !isLazy && hasKey;
+    std::string sharedPath = isShared ? IndexFile::GetSharedPath(key) : std::string();
+    std::unique_ptr<SharedImageLock> sharedLock;
+    if (isShared) {
+        sharedLock.reset(new SharedImageLock(sharedPath));
+        if (LoadSharedImage(sharedPath, key)) {
+            std::printf("Video: %s, %.2f fps\n", videoInfo_.codecName.c_str(), videoInfo_.frameRate);
+            std::printf("Mapped %zu packets from shared store %s\n", store_.GetCount(),
+                        sharedPath.c_str());
+            return true;
+        }
+    }
+
     AVFormatContext* fmtCtx = nullptr;
 
     if (avformat_open_input(&fmtCtx, filePath.c_str(), nullptr, nullptr) < 0) {
@@ -69,6 +582,8 @@ bool Mp4Demuxer::LoadFile(const std::string& filePath) {
 
     std::printf("Video: %s, %.2f fps\n", videoInfo_.codecName.c_str(), videoInfo_.frameRate);
 
+    classifier_.Reset(videoInfo_.isH265);
+
     // Create bitstream filter to convert AVCC -> Annex B
     const char* bsfName = videoInfo_.isH265 ? "hevc_mp4toannexb" : "h264_mp4toannexb";
     const AVBitStreamFilter* bsf = av_bsf_get_by_name(bsfName);
@@ -122,6 +637,23 @@ bool Mp4Demuxer::LoadFile(const std::string& filePath) {
         }
     }
 
+    if (isLazy) {
+        AVCodecParameters* par = videoStream->codecpar;
+        isLazy_ = ParseVideoExtradata(par->extradata, static_cast<size_t>(par->extradata_size)) &&
+                  LoadIndex(filePath, videoStreamIndex, audioStreamIndex);
+        if (isLazy_) {
+            av_bsf_free(&bsfCtx);
+            avformat_close_input(&fmtCtx);
+            if (hasKey) {
+                WriteIndexFile(indexPath, key);
+            }
+            std::printf("Indexed %zu packets, payloads read on demand (%s)\n",
+                        store_.GetCount(), filePath.c_str());
+            return true;
+        }
+        std::fprintf(stderr, "Lazy index unavailable, loading all packets\n");
+    }
+
     // Read all packets
     AVPacket* pkt = av_packet_alloc();
     if (pkt == nullptr) {
@@ -129,7 +661,8 @@ bool Mp4Demuxer::LoadFile(const std::string& filePath) {
         return false;
     }
 
-    while (av_read_frame(fmtCtx, pkt) >= 0) {
+    bool isStored = true;
+    while (isStored && av_read_frame(fmtCtx, pkt) >= 0) {
         if (pkt->stream_index != videoStreamIndex &&
             pkt->stream_index != audioStreamIndex) {
             av_packet_unref(pkt);
@@ -152,29 +685,11 @@ bool Mp4Demuxer::LoadFile(const std::string& filePath) {
                 continue;
             }
             while (av_bsf_receive_packet(bsfCtx, pkt) == 0) {
-                MediaPacket mediaPkt;
-                mediaPkt.type = MediaType::VIDEO;
-                mediaPkt.data.assign(pkt->data, pkt->data + pkt->size);
-                if (pkt->pts != AV_NOPTS_VALUE) {
-                    mediaPkt.ptsMs = av_rescale_q(pkt->pts, stream->time_base,
-                                                  AVRational{1, 1000});
-                } else {
-                    mediaPkt.ptsMs = 0;
-                }
-                packets_.push_back(std::move(mediaPkt));
+                isStored = isStored && AppendEagerPacket(pkt, stream, MediaType::VIDEO);
                 av_packet_unref(pkt);
             }
         } else {
-            MediaPacket mediaPkt;
-            mediaPkt.type = MediaType::AUDIO;
-            mediaPkt.data.assign(pkt->data, pkt->data + pkt->size);
-            if (pkt->pts != AV_NOPTS_VALUE) {
-                mediaPkt.ptsMs = av_rescale_q(pkt->pts, stream->time_base,
-                                              AVRational{1, 1000});
-            } else {
-                mediaPkt.ptsMs = 0;
-            }
-            packets_.push_back(std::move(mediaPkt));
+            isStored = AppendEagerPacket(pkt, stream, MediaType::AUDIO);
             av_packet_unref(pkt);
         }
     }
@@ -183,22 +698,169 @@ bool Mp4Demuxer::LoadFile(const std::string& filePath) {
     av_packet_free(&pkt);
     avformat_close_input(&fmtCtx);
 
-    // Sort by PTS for interleaved sending
-    std::sort(packets_.begin(), packets_.end(),
-              [](const MediaPacket& a, const MediaPacket& b) {
-                  return a.ptsMs < b.ptsMs;
-              });
+    if (!isStored) {
+        store_.Clear();
+        return false;
+    }
+
+    SortPacketsForSending();
+
+    std::printf("Loaded %zu packets, %.1f MB arena (%s)\n", store_.GetCount(),
+                store_.GetArenaBytes() / (1024.0 * 1024.0), filePath.c_str());
+
+    if (isShared) {
+        if (PublishSharedImage(sharedPath, key)) {
+            std::printf("Published shared store %s, private arena released\n", sharedPath.c_str());
+        } else if (store_.GetCount() == 0) {
+            return false;
+        } else {
+            std::fprintf(stderr, "Shared store unavailable, keeping private packets\n");
+        }
+    }
+
+    return true;
+}
 
-    std::printf("Loaded %zu packets (%s)\n", packets_.size(), filePath.c_str());
+bool Mp4Demuxer::AppendEagerPacket(const AVPacket* pkt, const AVStream* stream, MediaType type) {
+    const AVRational msTimeBase = {1, 1000};
+
+    PacketIndexEntry entry;
+    entry.offset = (pkt->pos >= 0) ? static_cast<uint64_t>(pkt->pos) : 0;
+    entry.size = static_cast<uint32_t>(pkt->size);
+    entry.ptsMs = (pkt->pts != AV_NOPTS_VALUE)
+        ? av_rescale_q(pkt->pts, stream->time_base, msTimeBase)
+        : 0;
+    entry.dtsMs = (pkt->dts != AV_NOPTS_VALUE)
+        ? av_rescale_q(pkt->dts, stream->time_base, msTimeBase)
+        : entry.ptsMs;
+    entry.type = type;
+    entry.isKeyframe = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+    entry.frameType = VideoFrameType::I_FRAME;
+    entry.isReference = true;
+    entry.temporalId = 0;
+
+    // Classify on all NAL units of the Annex B AU, not only the leading SPS/AUD
+    if (type == MediaType::VIDEO) {
+        FrameInfo frame = classifier_.ClassifyAccessUnit(pkt->data, static_cast<size_t>(pkt->size));
+        entry.frameType = frame.frameType;
+        entry.isReference = frame.isReference;
+        entry.temporalId = frame.temporalId;
+    }
+
+    return store_.Append(entry, pkt->data, static_cast<size_t>(pkt->size));
+}
+
+void Mp4Demuxer::SortPacketsForSending() {
+    // Video in DTS order (B-frames precede the frames they are displayed
+    // before); audio by PTS, shifted by the window against the video DTS
+    std::vector<int64_t> keys(store_.GetCount());
+    std::vector<size_t> order(store_.GetCount());
+    for (size_t i = 0; i < order.size(); ++i) {
+        keys[i] = (store_.GetType(i) == MediaType::VIDEO)
+            ? store_.GetDtsMs(i)
+            : store_.GetPtsMs(i) - audioWindowMs_;
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) {
+        return keys[a] < keys[b];
+    });
+    store_.Permute(order);
+
+    // Payloads stay in place in the arena; only the schedule is rebuilt
+    sendTimesMs_.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        sendTimesMs_[i] = keys[order[i]];
+    }
+}
 
+bool Mp4Demuxer::GetIndexEntry(size_t index, PacketIndexEntry& entry) const {
+    if (index >= store_.GetCount()) {
+        return false;
+    }
+    entry = store_.GetEntry(index);
     return true;
 }
 
 const MediaPacket* Mp4Demuxer::GetPacket(size_t index) const {
-    if (index >= packets_.size()) {
+    if (index >= store_.GetCount()) {
         return nullptr;
     }
-    return &packets_[index];
+
+    scratchPacket_.type = store_.GetType(index);
+    scratchPacket_.ptsMs = store_.GetPtsMs(index);
+    if (!isLazy_) {
+        scratchPacket_.data = store_.GetPayload(index);
+        scratchPacket_.size = store_.GetPayloadSize(index);
+        return &scratchPacket_;
+    }
+
+    if (!ReadLazyPacket(store_.GetEntry(index), lazyPayload_)) {
+        return nullptr;
+    }
+    scratchPacket_.data = lazyPayload_.data();
+    scratchPacket_.size = lazyPayload_.size();
+    return &scratchPacket_;
+}
+
+void Mp4Demuxer::ReadAhead(uint64_t offset) const {
+    uint64_t windowStart = (readAheadEnd_ >= READAHEAD_BYTES) ? readAheadEnd_ - READAHEAD_BYTES : 0;
+    if (offset >= windowStart && offset + READAHEAD_BYTES / 2 < readAheadEnd_) {
+        return;
+    }
+    posix_fadvise(fileFd_, static_cast<off_t>(offset), static_cast<off_t>(READAHEAD_BYTES),
+                  POSIX_FADV_WILLNEED);
+    readAheadEnd_ = offset + READAHEAD_BYTES;
+}
+
+bool Mp4Demuxer::ReadAt(uint64_t offset, uint8_t* data, size_t size) const {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fileFd_, data + done, size - done, static_cast<off_t>(offset + done));
+        if (n <= 0) {
+            std::fprintf(stderr, "Failed to read packet at offset %llu\n",
+                         static_cast<unsigned long long>(offset));
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool Mp4Demuxer::ReadLazyPacket(const PacketIndexEntry& entry, std::vector<uint8_t>& out) const {
+    ReadAhead(entry.offset);
+
+    readBuffer_.resize(entry.size);
+    if (!ReadAt(entry.offset, readBuffer_.data(), entry.size)) {
+        return false;
+    }
+
+    // Audio and Annex B samples (in-band parameter sets) are sent as stored
+    if (entry.type == MediaType::AUDIO || nalLengthSize_ == 0) {
+        out.swap(readBuffer_);
+        return true;
+    }
+
+    // AVCC/HVCC -> Annex B, prepending parameter sets on keyframes like mp4toannexb
+    out.clear();
+    out.reserve(entry.size + parameterSets_.size() + 16);
+    if (entry.isKeyframe) {
+        out.insert(out.end(), parameterSets_.begin(), parameterSets_.end());
+    }
+
+    size_t pos = 0;
+    while (pos + nalLengthSize_ <= readBuffer_.size()) {
+        size_t nalSize = 0;
+        for (uint32_t i = 0; i < nalLengthSize_; ++i) {
+            nalSize = (nalSize << 8) | readBuffer_[pos + i];
+        }
+        pos += nalLengthSize_;
+        if (nalSize > readBuffer_.size() - pos) {
+            break;
+        }
+        AppendAnnexBNal(out, readBuffer_.data() + pos, nalSize);
+        pos += nalSize;
+    }
+    return true;
 }
 
 double Mp4Demuxer::GetFrameRate() const {
@@ -208,4 +870,10 @@ double Mp4Demuxer::GetFrameRate() const {
     return 25.0;
 }
 
+size_t Mp4Demuxer::GetResidentBytes() const {
+    // Shared store pages count in full, as each process keeps them mapped
+    return store_.GetArenaBytes() + sharedImage_.GetSize() + store_.GetIndexBytes() +
+           sendTimesMs_.capacity() * sizeof(int64_t) + parameterSets_.capacity();
+}
+
 }  // namespace server
@@ -5,19 +5,23 @@
 #include <string>
 #include <vector>
 
-namespace server {
+#include "frame_classifier.h"
+#include "index_file.h"
+#include "mp4_sample_table.h"
+#include "packet_store.h"
 
-enum class MediaType : uint8_t {
-    VIDEO = 0,
-    AUDIO = 1
-};
+struct AVPacket;
+struct AVStream;
+
+namespace server {
 
 /**
- * @brief A single media packet extracted from MP4 container
+ * @brief One media packet ready to send; the payload is not owned
  */
 struct MediaPacket {
     MediaType type;
-    std::vector<uint8_t> data;
+    const uint8_t* data;
+    size_t size;
     int64_t ptsMs;  // presentation timestamp in milliseconds
 };
 
@@ -54,23 +58,87 @@ public:
     Mp4Demuxer& operator=(const Mp4Demuxer&) = delete;
 
     /**
-     * @brief Open MP4 file and extract all packets
+     * @brief Open MP4 file and build the packet index
+     *
+     * Video packets are kept in decode (DTS) order so that streams with
+     * B-frames can be sent as-is; audio is interleaved against the video
+     * DTS timeline (see SetAudioWindowMs()).
+     *
+     * In eager mode every packet payload is read into memory. In lazy mode
+     * only the sample index is built from the moov box; payloads are read
+     * from the file on demand, so startup time and RSS do not depend on
+     * the media size. Lazy mode falls back to eager for fragmented MP4.
+     *
+     * With useIndex, lazy mode first tries the sidecar index file and skips
+     * libavformat entirely when it is current; otherwise the index is built
+     * as usual and persisted in the background. Eager mode has to read
+     * every payload anyway and ignores the sidecar; see SetSharedStore()
+     * for sharing eager-mode packets between processes.
+     *
      * @param filePath path to MP4 file
+     * @param isLazy true to build only the sample index
+     * @param useIndex true to use a sidecar index file (lazy mode only)
      * @return true on success
      */
-    bool LoadFile(const std::string& filePath);
+    bool LoadFile(const std::string& filePath, bool isLazy = false, bool useIndex = false);
 
     /**
      * @brief Get total number of packets (audio + video)
      */
-    size_t GetPacketCount() const { return packets_.size(); }
+    size_t GetPacketCount() const { return store_.GetCount(); }
+
+    /**
+     * @brief Set how far audio is sent ahead of (positive) or behind the
+     *        video decode timeline; applied by the next LoadFile()
+     * @param windowMs audio packet with PTS p is sent with video DTS p - windowMs
+     */
+    void SetAudioWindowMs(int64_t windowMs) { audioWindowMs_ = windowMs; }
+
+    /**
+     * @brief Keep eager-mode packets in a shared-memory store (/dev/shm)
+     *        instead of a private arena; applied by the next LoadFile()
+     *
+     * The first process to load a file demuxes it and publishes the packets
+     * and index as one image; later processes map that image read-only, so
+     * host memory does not grow with the number of processes.
+     */
+    void SetSharedStore(bool isShared) { useSharedStore_ = isShared; }
+
+    /**
+     * @brief Get the send-schedule time of a packet (index must be in range)
+     *
+     * Packets are ordered by this time: video DTS, or audio PTS minus the
+     * audio window. It is non-decreasing over the packet index.
+     */
+    int64_t GetSendTimeMs(size_t index) const { return sendTimesMs_[index]; }
+
+    /**
+     * @brief Get index entry (timestamps, type, size) by packet index
+     * @return false if out of range
+     */
+    bool GetIndexEntry(size_t index, PacketIndexEntry& entry) const;
 
     /**
      * @brief Get packet by index
-     * @return pointer to packet, nullptr if out of range
+     *
+     * The returned packet is valid until the next call. In eager mode it
+     * points into the packet arena; in lazy mode the payload is read from
+     * the file into an internal buffer.
+     *
+     * @return pointer to packet, nullptr if out of range or on read error
      */
     const MediaPacket* GetPacket(size_t index) const;
 
+    /**
+     * @brief Get bytes held by in-memory payloads (0 in lazy mode)
+     */
+    size_t GetArenaBytes() const { return store_.GetArenaBytes(); }
+
+    /**
+     * @brief Get bytes held in memory: payload arena plus packet index
+     */
+    size_t GetResidentBytes() const;
+
     /**
      * @brief Get video stream metadata
      */
@@ -88,9 +156,49 @@ public:
     double GetFrameRate() const;
 
 private:
-    std::vector<MediaPacket> packets_;
+    bool LoadIndex(const std::string& filePath, int32_t videoStreamIndex,
+                   int32_t audioStreamIndex);
+    bool OpenLazyFile(const std::string& filePath);
+    bool ReadIndexSections(const IndexFile& index);
+    void AddIndexSections();
+    bool LoadIndexFile(const std::string& filePath, const std::string& indexPath,
+                       const IndexSourceKey& key);
+    void WriteIndexFile(const std::string& indexPath, const IndexSourceKey& key);
+    bool LoadSharedImage(const std::string& sharedPath, const IndexSourceKey& key);
+    bool PublishSharedImage(const std::string& sharedPath, const IndexSourceKey& key);
+    static void ClassifyFromSampleTable(const Mp4Sample& sample, int64_t maxPtsSoFar,
+                                        bool isIdr, PacketIndexEntry& entry);
+    const uint8_t* ReadProbe(uint64_t offset, size_t wanted, size_t& available);
+    bool ProbeSample(uint64_t offset, uint32_t size, FrameInfo& frame);
+    bool AppendEagerPacket(const AVPacket* pkt, const AVStream* stream, MediaType type);
+    void SortPacketsForSending();
+    bool ParseVideoExtradata(const uint8_t* data, size_t size);
+    bool ReadAt(uint64_t offset, uint8_t* data, size_t size) const;
+    bool ReadLazyPacket(const PacketIndexEntry& entry, std::vector<uint8_t>& out) const;
+    void ReadAhead(uint64_t offset) const;
+
+    PacketStore store_;
+    std::vector<int64_t> sendTimesMs_;      // per packet, aligned with store_
     VideoInfo videoInfo_;
     AudioInfo audioInfo_;
+    int64_t audioWindowMs_;
+    bool useSharedStore_;
+    IndexFile sharedImage_;                   // payloads and index when shared
+
+    // Lazy mode state
+    bool isLazy_;
+    int32_t fileFd_;
+    uint32_t nalLengthSize_;                  // AVCC length prefix size, 0 if Annex B
+    std::vector<uint8_t> parameterSets_;      // Annex B SPS/PPS(/VPS) from extradata
+    FrameClassifier classifier_;
+    std::vector<uint8_t> probeWindow_;        // sample header reads while indexing
+    uint64_t probeOffset_;
+    size_t probeWindowBytes_;
+    IndexFileWriter indexWriter_;
+    mutable MediaPacket scratchPacket_;
+    mutable std::vector<uint8_t> lazyPayload_;
+    mutable std::vector<uint8_t> readBuffer_;
+    mutable uint64_t readAheadEnd_;
 };
 
 }  // namespace server
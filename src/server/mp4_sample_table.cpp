@@ -0,0 +1,407 @@
+#include "mp4_sample_table.h"
+
+#include <cstdio>
+#include <fstream>
+
+namespace server {
+
+static const size_t BOX_HEADER_SIZE = 8;
+static const size_t LARGE_BOX_HEADER_SIZE = 16;
+static const size_t FULL_BOX_HEADER_SIZE = 4;  // version(1) + flags(3)
+
+static uint32_t MakeFourCC(char a, char b, char c, char d) {
+    return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) |
+           (static_cast<uint32_t>(c) << 8) | static_cast<uint32_t>(d);
+}
+
+static uint32_t ReadBE32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+static uint64_t ReadBE64(const uint8_t* p) {
+    return (static_cast<uint64_t>(ReadBE32(p)) << 32) | ReadBE32(p + 4);
+}
+
+/**
+ * @brief Locate a child box by type inside a container payload
+ * @return true if found; payload/payloadSize point past the box header
+ */
+static bool FindBox(const uint8_t* data, size_t size, uint32_t type,
+                    const uint8_t*& payload, size_t& payloadSize) {
+    size_t pos = 0;
+    while (pos + BOX_HEADER_SIZE <= size) {
+        uint64_t boxSize = ReadBE32(data + pos);
+        uint32_t boxType = ReadBE32(data + pos + 4);
+        size_t headerSize = BOX_HEADER_SIZE;
+
+        if (boxSize == 1) {
+            if (pos + LARGE_BOX_HEADER_SIZE > size) return false;
+            boxSize = ReadBE64(data + pos + 8);
+            headerSize = LARGE_BOX_HEADER_SIZE;
+        } else if (boxSize == 0) {
+            boxSize = size - pos;
+        }
+
+        if (boxSize < headerSize || boxSize > size - pos) {
+            return false;
+        }
+
+        if (boxType == type) {
+            payload = data + pos + headerSize;
+            payloadSize = static_cast<size_t>(boxSize) - headerSize;
+            return true;
+        }
+        pos += static_cast<size_t>(boxSize);
+    }
+    return false;
+}
+
+/**
+ * @brief Validate a full box with a 32-bit entry count followed by fixed-size entries
+ * @return entry count, or 0 if the box is truncated
+ */
+static uint32_t ReadEntryCount(const uint8_t* payload, size_t size, size_t entrySize) {
+    if (size < FULL_BOX_HEADER_SIZE + 4) return 0;
+    uint32_t count = ReadBE32(payload + FULL_BOX_HEADER_SIZE);
+    if (entrySize > 0 && count > (size - FULL_BOX_HEADER_SIZE - 4) / entrySize) {
+        return 0;
+    }
+    return count;
+}
+
+static bool ReadSampleSizes(const uint8_t* stbl, size_t size, std::vector<uint32_t>& sizes) {
+    const uint8_t* box = nullptr;
+    size_t boxSize = 0;
+
+    if (FindBox(stbl, size, MakeFourCC('s', 't', 's', 'z'), box, boxSize)) {
+        if (boxSize < FULL_BOX_HEADER_SIZE + 8) return false;
+        uint32_t constantSize = ReadBE32(box + 4);
+        uint32_t count = ReadBE32(box + 8);
+        if (constantSize != 0) {
+            sizes.assign(count, constantSize);
+            return true;
+        }
+        if (count > (boxSize - 12) / 4) return false;
+        sizes.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            sizes[i] = ReadBE32(box + 12 + i * 4);
+        }
+        return true;
+    }
+
+    if (FindBox(stbl, size, MakeFourCC('s', 't', 'z', '2'), box, boxSize)) {
+        // version/flags(4) + reserved(3) + field_size(1) + sample_count(4)
+        if (boxSize < 12) return false;
+        uint8_t fieldSize = box[7];
+        uint32_t count = ReadBE32(box + 8);
+        if (fieldSize != 4 && fieldSize != 8 && fieldSize != 16) return false;
+        if (count > (boxSize - 12) * 8 / fieldSize) return false;
+        sizes.resize(count);
+        const uint8_t* entries = box + 12;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (fieldSize == 16) {
+                sizes[i] = (static_cast<uint32_t>(entries[i * 2]) << 8) | entries[i * 2 + 1];
+            } else if (fieldSize == 8) {
+                sizes[i] = entries[i];
+            } else {
+                uint8_t packed = entries[i / 2];
+                sizes[i] = (i % 2 == 0) ? (packed >> 4) : (packed & 0x0F);
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static bool ReadChunkOffsets(const uint8_t* stbl, size_t size, std::vector<uint64_t>& offsets) {
+    const uint8_t* box = nullptr;
+    size_t boxSize = 0;
+
+    if (FindBox(stbl, size, MakeFourCC('s', 't', 'c', 'o'), box, boxSize)) {
+        uint32_t count = ReadEntryCount(box, boxSize, 4);
+        offsets.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            offsets[i] = ReadBE32(box + 8 + i * 4);
+        }
+        return count > 0;
+    }
+
+    if (FindBox(stbl, size, MakeFourCC('c', 'o', '6', '4'), box, boxSize)) {
+        uint32_t count = ReadEntryCount(box, boxSize, 8);
+        offsets.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            offsets[i] = ReadBE64(box + 8 + i * 8);
+        }
+        return count > 0;
+    }
+
+    return false;
+}
+
+bool Mp4SampleTable::BuildSamples(const uint8_t* stbl, size_t size, int64_t editShift,
+                                  Mp4Track& track) {
+    std::vector<uint32_t> sampleSizes;
+    std::vector<uint64_t> chunkOffsets;
+    if (!ReadSampleSizes(stbl, size, sampleSizes) || !ReadChunkOffsets(stbl, size, chunkOffsets)) {
+        return false;
+    }
+
+    const uint8_t* stsc = nullptr;
+    size_t stscSize = 0;
+    const uint8_t* stts = nullptr;
+    size_t sttsSize = 0;
+    if (!FindBox(stbl, size, MakeFourCC('s', 't', 's', 'c'), stsc, stscSize) ||
+        !FindBox(stbl, size, MakeFourCC('s', 't', 't', 's'), stts, sttsSize)) {
+        return false;
+    }
+
+    uint32_t stscCount = ReadEntryCount(stsc, stscSize, 12);
+    uint32_t sttsCount = ReadEntryCount(stts, sttsSize, 8);
+
+    const uint8_t* ctts = nullptr;
+    size_t cttsSize = 0;
+    uint32_t cttsCount = 0;
+    if (FindBox(stbl, size, MakeFourCC('c', 't', 't', 's'), ctts, cttsSize)) {
+        cttsCount = ReadEntryCount(ctts, cttsSize, 8);
+    }
+
+    const uint8_t* stss = nullptr;
+    size_t stssSize = 0;
+    bool hasStss = FindBox(stbl, size, MakeFourCC('s', 't', 's', 's'), stss, stssSize);
+    uint32_t stssCount = hasStss ? ReadEntryCount(stss, stssSize, 4) : 0;
+
+    size_t sampleCount = sampleSizes.size();
+    track.samples.resize(sampleCount);
+
+    // Offsets: walk chunks, using stsc runs to know samples per chunk
+    size_t sampleIndex = 0;
+    for (uint32_t run = 0; run < stscCount && sampleIndex < sampleCount; ++run) {
+        const uint8_t* entry = stsc + 8 + run * 12;
+        uint32_t firstChunk = ReadBE32(entry);
+        uint32_t samplesPerChunk = ReadBE32(entry + 4);
+        uint32_t lastChunk = (run + 1 < stscCount)
+            ? ReadBE32(entry + 12) - 1
+            : static_cast<uint32_t>(chunkOffsets.size());
+
+        for (uint32_t chunk = firstChunk; chunk <= lastChunk && chunk >= 1 &&
+             chunk <= chunkOffsets.size() && sampleIndex < sampleCount; ++chunk) {
+            uint64_t offset = chunkOffsets[chunk - 1];
+            for (uint32_t s = 0; s < samplesPerChunk && sampleIndex < sampleCount; ++s) {
+                track.samples[sampleIndex].offset = offset;
+                track.samples[sampleIndex].size = sampleSizes[sampleIndex];
+                offset += sampleSizes[sampleIndex];
+                sampleIndex++;
+            }
+        }
+    }
+    if (sampleIndex < sampleCount) {
+        std::fprintf(stderr, "[Mp4SampleTable] stsc covers %zu of %zu samples\n",
+                     sampleIndex, sampleCount);
+        track.samples.resize(sampleIndex);
+        sampleCount = sampleIndex;
+    }
+
+    // Decode timestamps from stts
+    sampleIndex = 0;
+    int64_t dts = 0;
+    for (uint32_t run = 0; run < sttsCount && sampleIndex < sampleCount; ++run) {
+        uint32_t count = ReadBE32(stts + 8 + run * 8);
+        uint32_t delta = ReadBE32(stts + 8 + run * 8 + 4);
+        for (uint32_t s = 0; s < count && sampleIndex < sampleCount; ++s) {
+            track.samples[sampleIndex].dts = dts - editShift;
+            track.samples[sampleIndex].pts = dts - editShift;
+            dts += delta;
+            sampleIndex++;
+        }
+    }
+    for (; sampleIndex < sampleCount; ++sampleIndex) {
+        track.samples[sampleIndex].dts = dts - editShift;
+        track.samples[sampleIndex].pts = dts - editShift;
+    }
+
+    // Composition offsets from ctts (treated as signed, as in version 1)
+    sampleIndex = 0;
+    for (uint32_t run = 0; run < cttsCount && sampleIndex < sampleCount; ++run) {
+        uint32_t count = ReadBE32(ctts + 8 + run * 8);
+        int32_t compositionOffset = static_cast<int32_t>(ReadBE32(ctts + 8 + run * 8 + 4));
+        for (uint32_t s = 0; s < count && sampleIndex < sampleCount; ++s) {
+            track.samples[sampleIndex].pts += compositionOffset;
+            sampleIndex++;
+        }
+    }
+
+    // Sync samples: every sample is sync when stss is absent
+    for (size_t i = 0; i < sampleCount; ++i) {
+        track.samples[i].isSync = !hasStss;
+        track.samples[i].dependencyFlags = 0;
+    }
+    for (uint32_t i = 0; i < stssCount; ++i) {
+        uint32_t sampleNumber = ReadBE32(stss + 8 + i * 4);
+        if (sampleNumber >= 1 && sampleNumber <= sampleCount) {
+            track.samples[sampleNumber - 1].isSync = true;
+        }
+    }
+
+    // Independent and disposable samples: one byte per sample, no entry count
+    const uint8_t* sdtp = nullptr;
+    size_t sdtpSize = 0;
+    if (FindBox(stbl, size, MakeFourCC('s', 'd', 't', 'p'), sdtp, sdtpSize) &&
+        sdtpSize >= FULL_BOX_HEADER_SIZE) {
+        size_t count = sdtpSize - FULL_BOX_HEADER_SIZE;
+        for (size_t i = 0; i < count && i < sampleCount; ++i) {
+            track.samples[i].dependencyFlags = sdtp[FULL_BOX_HEADER_SIZE + i];
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Media time of the first non-empty edit, used to shift timestamps
+ *        the same way libavformat applies the edit list
+ */
+static int64_t ReadEditShift(const uint8_t* trak, size_t size) {
+    const uint8_t* edts = nullptr;
+    size_t edtsSize = 0;
+    const uint8_t* elst = nullptr;
+    size_t elstSize = 0;
+    if (!FindBox(trak, size, MakeFourCC('e', 'd', 't', 's'), edts, edtsSize) ||
+        !FindBox(edts, edtsSize, MakeFourCC('e', 'l', 's', 't'), elst, elstSize) ||
+        elstSize < FULL_BOX_HEADER_SIZE + 4) {
+        return 0;
+    }
+
+    uint8_t version = elst[0];
+    size_t entrySize = (version == 1) ? 20 : 12;
+    uint32_t count = ReadEntryCount(elst, elstSize, entrySize);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t* entry = elst + 8 + i * entrySize;
+        int64_t mediaTime = (version == 1)
+            ? static_cast<int64_t>(ReadBE64(entry + 8))
+            : static_cast<int64_t>(static_cast<int32_t>(ReadBE32(entry + 4)));
+        if (mediaTime >= 0) {
+            return mediaTime;
+        }
+    }
+    return 0;
+}
+
+bool Mp4SampleTable::ParseTrak(const uint8_t* data, size_t size, Mp4Track& track) {
+    const uint8_t* mdia = nullptr;
+    size_t mdiaSize = 0;
+    const uint8_t* mdhd = nullptr;
+    size_t mdhdSize = 0;
+    const uint8_t* hdlr = nullptr;
+    size_t hdlrSize = 0;
+    const uint8_t* minf = nullptr;
+    size_t minfSize = 0;
+    const uint8_t* stbl = nullptr;
+    size_t stblSize = 0;
+
+    if (!FindBox(data, size, MakeFourCC('m', 'd', 'i', 'a'), mdia, mdiaSize) ||
+        !FindBox(mdia, mdiaSize, MakeFourCC('m', 'd', 'h', 'd'), mdhd, mdhdSize) ||
+        !FindBox(mdia, mdiaSize, MakeFourCC('h', 'd', 'l', 'r'), hdlr, hdlrSize) ||
+        !FindBox(mdia, mdiaSize, MakeFourCC('m', 'i', 'n', 'f'), minf, minfSize) ||
+        !FindBox(minf, minfSize, MakeFourCC('s', 't', 'b', 'l'), stbl, stblSize)) {
+        return false;
+    }
+
+    // mdhd: version 1 uses 64-bit creation/modification times
+    size_t timescaleOffset = (mdhd[0] == 1) ? 20 : 12;
+    if (mdhdSize < timescaleOffset + 4 || hdlrSize < 12) {
+        return false;
+    }
+    track.timescale = ReadBE32(mdhd + timescaleOffset);
+    track.handlerType = ReadBE32(hdlr + 8);
+    if (track.timescale == 0) {
+        return false;
+    }
+
+    return BuildSamples(stbl, stblSize, ReadEditShift(data, size), track);
+}
+
+bool Mp4SampleTable::ParseFile(const std::string& filePath, std::vector<Mp4Track>& tracks) {
+    tracks.clear();
+
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::fprintf(stderr, "Failed to open file: %s\n", filePath.c_str());
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+
+    // Walk top-level boxes, skipping mdat payloads without reading them
+    std::vector<uint8_t> moov;
+    uint64_t pos = 0;
+    while (pos + BOX_HEADER_SIZE <= fileSize) {
+        uint8_t header[LARGE_BOX_HEADER_SIZE];
+        file.seekg(static_cast<std::streamoff>(pos));
+        if (!file.read(reinterpret_cast<char*>(header), BOX_HEADER_SIZE)) break;
+
+        uint64_t boxSize = ReadBE32(header);
+        uint32_t boxType = ReadBE32(header + 4);
+        uint64_t headerSize = BOX_HEADER_SIZE;
+        if (boxSize == 1) {
+            if (!file.read(reinterpret_cast<char*>(header + BOX_HEADER_SIZE), 8)) break;
+            boxSize = ReadBE64(header + BOX_HEADER_SIZE);
+            headerSize = LARGE_BOX_HEADER_SIZE;
+        } else if (boxSize == 0) {
+            boxSize = fileSize - pos;
+        }
+        if (boxSize < headerSize || boxSize > fileSize - pos) break;
+
+        if (boxType == MakeFourCC('m', 'o', 'o', 'f')) {
+            std::fprintf(stderr, "[Mp4SampleTable] Fragmented MP4 not supported: %s\n",
+                         filePath.c_str());
+            return false;
+        }
+        if (boxType == MakeFourCC('m', 'o', 'o', 'v')) {
+            moov.resize(static_cast<size_t>(boxSize - headerSize));
+            if (!file.read(reinterpret_cast<char*>(moov.data()),
+                           static_cast<std::streamsize>(moov.size()))) {
+                return false;
+            }
+        }
+        pos += boxSize;
+    }
+
+    if (moov.empty()) {
+        std::fprintf(stderr, "[Mp4SampleTable] No moov box in: %s\n", filePath.c_str());
+        return false;
+    }
+
+    const uint8_t* mvex = nullptr;
+    size_t mvexSize = 0;
+    if (FindBox(moov.data(), moov.size(), MakeFourCC('m', 'v', 'e', 'x'), mvex, mvexSize)) {
+        std::fprintf(stderr, "[Mp4SampleTable] Fragmented MP4 not supported: %s\n",
+                     filePath.c_str());
+        return false;
+    }
+
+    // Iterate trak boxes in order
+    const uint32_t trakType = MakeFourCC('t', 'r', 'a', 'k');
+    const uint8_t* cursor = moov.data();
+    size_t remaining = moov.size();
+    const uint8_t* trak = nullptr;
+    size_t trakSize = 0;
+    while (FindBox(cursor, remaining, trakType, trak, trakSize)) {
+        Mp4Track track;
+        track.handlerType = 0;
+        track.timescale = 0;
+        if (!ParseTrak(trak, trakSize, track)) {
+            track.samples.clear();
+        }
+        tracks.push_back(std::move(track));
+
+        size_t consumed = static_cast<size_t>((trak + trakSize) - cursor);
+        cursor += consumed;
+        remaining -= consumed;
+    }
+
+    return !tracks.empty();
+}
+
+}  // namespace server
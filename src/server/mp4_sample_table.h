@@ -0,0 +1,58 @@
+#ifndef MP4_SAMPLE_TABLE_H
+#define MP4_SAMPLE_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace server {
+
+/**
+ * @brief One sample location/timing entry taken from an MP4 sample table
+ */
+struct Mp4Sample {
+    uint64_t offset;   // absolute file offset of sample payload
+    uint32_t size;     // payload size in bytes
+    int64_t dts;       // decode timestamp in track timescale
+    int64_t pts;       // presentation timestamp in track timescale
+    bool isSync;       // sync sample (keyframe)
+    uint8_t dependencyFlags;  // sdtp byte (is_leading, depends_on, is_depended_on,
+                              // has_redundancy), 0 if unknown
+};
+
+/**
+ * @brief Sample table of a single MP4 track (trak box)
+ */
+struct Mp4Track {
+    uint32_t handlerType;   // 'vide', 'soun', ...
+    uint32_t timescale;     // media timescale from mdhd
+    std::vector<Mp4Sample> samples;
+};
+
+/**
+ * @brief Minimal ISO-BMFF parser that builds per-track sample indexes
+ *        from the moov box (stts/ctts/stss/sdtp/stsz/stsc/stco/co64/elst)
+ *        without reading any sample payload.
+ *
+ * Tracks are returned in trak order, which matches libavformat stream order.
+ * Fragmented MP4 (moof/mvex) is not supported.
+ */
+class Mp4SampleTable {
+public:
+    /**
+     * @brief Parse sample tables of all tracks in an MP4 file
+     * @param filePath path to MP4 file
+     * @param tracks output tracks, in trak order
+     * @return true on success, false if the file has no usable moov box
+     */
+    static bool ParseFile(const std::string& filePath, std::vector<Mp4Track>& tracks);
+
+private:
+    static bool ParseTrak(const uint8_t* data, size_t size, Mp4Track& track);
+    static bool BuildSamples(const uint8_t* stbl, size_t size, int64_t editShift,
+                             Mp4Track& track);
+};
+
+}  // namespace server
+
+#endif  // MP4_SAMPLE_TABLE_H
@@ -4,46 +4,81 @@
 #include <fstream>
 
 #include "sps_parser.h"
+#include "start_code_scanner.h"
 
 namespace server {
 
-bool NalParser::LoadFile(const std::string& filePath, bool isH265) {
+// Sidecar index sections
+static const uint32_t SECTION_META = 1;
+static const uint32_t SECTION_NAL_UNITS = 2;
+static const uint32_t SECTION_ACCESS_UNITS = 3;
+
+/**
+ * @brief Stream-level values stored in the sidecar index
+ */
+struct RawIndexMeta {
+    double frameRate;
+};
+
+NalParser::NalParser()
+    : sourceData_(nullptr),
+      fileSize_(0),
+      isH265_(false),
+      frameRate_(25.0) {
+}
+
+bool NalParser::LoadFile(const std::string& filePath, bool isH265, bool useMmap,
+                         bool useIndex) {
     isH265_ = isH265;
     frameRate_ = 25.0;  // Default
-    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        std::fprintf(stderr, "Failed to open file: %s\n", filePath.c_str());
-        return false;
-    }
 
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    if (useMmap) {
+        if (!mappedFile_.Open(filePath)) {
+            return false;
+        }
+        sourceData_ = mappedFile_.GetData();
+        fileSize_ = mappedFile_.GetSize();
+    } else {
+        std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            std::fprintf(stderr, "Failed to open file: %s\n", filePath.c_str());
+            return false;
+        }
 
-    std::vector<uint8_t> buffer(static_cast<size_t>(size));
-    if (!file.read(reinterpret_cast<char*>(buffer.data()), size)) {
-        std::fprintf(stderr, "Failed to read file: %s\n", filePath.c_str());
-        return false;
-    }
+        std::streamsize size = file.tellg();
+        file.seekg(0, std::ios::beg);
 
-    fileSize_ = static_cast<size_t>(size);
-    ParseNalUnits(buffer);
-
-    // Parse frame rate from SPS
-    uint8_t spsType = isH265_ ? 33 : 7;
-    for (const auto& nal : nalUnits_) {
-        if (GetNalType(nal) == spsType) {
-            if (isH265_) {
-                frameRate_ = SpsParser::ParseH265Fps(nal.data);
-            } else {
-                frameRate_ = SpsParser::ParseH264Fps(nal.data);
-            }
-            break;
+        fileBuffer_.resize(static_cast<size_t>(size));
+        if (!file.read(reinterpret_cast<char*>(fileBuffer_.data()), size)) {
+            std::fprintf(stderr, "Failed to read file: %s\n", filePath.c_str());
+            return false;
         }
+        sourceData_ = fileBuffer_.data();
+        fileSize_ = static_cast<size_t>(size);
     }
 
-    GroupIntoAccessUnits();
+    IndexSourceKey key;
+    std::string indexPath = IndexFile::GetSidecarPath(filePath);
+    bool hasKey = useIndex && IndexFile::ReadSourceKey(filePath, key);
+    bool isIndexed = hasKey && LoadIndexFile(indexPath, key);
 
-    std::printf("Loaded video file: %s\n", filePath.c_str());
+    if (!isIndexed) {
+        ParseNalUnits(sourceData_, fileSize_);
+
+        // Timestamps need the frame rate, which is only known once the SPS was seen
+        double frameIntervalMs = 1000.0 / frameRate_;
+        for (size_t i = 0; i < accessUnits_.size(); ++i) {
+            accessUnits_[i].ptsMs = static_cast<int64_t>(i * frameIntervalMs);
+            accessUnits_[i].dtsMs = accessUnits_[i].ptsMs;
+        }
+
+        if (hasKey) {
+            WriteIndexFile(indexPath, key);
+        }
+    }
+
+    std::printf("Loaded video file: %s (%s%s)\n", filePath.c_str(), useMmap ? "mmap" : "read",
+                isIndexed ? ", indexed" : "");
     std::printf("NAL units count: %zu\n", nalUnits_.size());
     std::printf("Access units count: %zu\n", accessUnits_.size());
     std::printf("Detected frame rate: %.2f fps\n", frameRate_);
@@ -52,53 +87,125 @@ bool NalParser::LoadFile(const std::string& filePath, bool isH265) {
     // Log first few NAL sizes
     std::printf("\nFirst 5 NAL units:\n");
     for (size_t i = 0; i < 5 && i < nalUnits_.size(); ++i) {
-        std::printf("  NAL %zu: %zu bytes\n", i, nalUnits_[i].data.size());
+        std::printf("  NAL %zu: %u bytes\n", i, nalUnits_[i].size);
     }
 
     return true;
 }
 
-void NalParser::ParseNalUnits(const std::vector<uint8_t>& buffer) {
+bool NalParser::LoadIndexFile(const std::string& indexPath, const IndexSourceKey& key) {
+    IndexFile index;
+    if (!index.Open(indexPath, isH265_ ? IndexKind::RAW_H265 : IndexKind::RAW_H264, key)) {
+        return false;
+    }
+
+    const RawIndexMeta* meta = nullptr;
+    const NalUnit* nals = nullptr;
+    const AccessUnit* aus = nullptr;
+    size_t metaCount = 0;
+    size_t nalCount = 0;
+    size_t auCount = 0;
+    if (!index.GetSection(SECTION_META, meta, metaCount) || metaCount != 1 ||
+        !index.GetSection(SECTION_NAL_UNITS, nals, nalCount) ||
+        !index.GetSection(SECTION_ACCESS_UNITS, aus, auCount)) {
+        return false;
+    }
+
+    // Records are bulk-copied out of the mapping; no media bytes are touched
+    frameRate_ = meta->frameRate;
+    nalUnits_.assign(nals, nals + nalCount);
+    accessUnits_.assign(aus, aus + auCount);
+    return true;
+}
+
+void NalParser::WriteIndexFile(const std::string& indexPath, const IndexSourceKey& key) {
+    RawIndexMeta meta;
+    meta.frameRate = frameRate_;
+
+    indexWriter_.AddSection(SECTION_META, &meta, sizeof(meta), 1);
+    indexWriter_.AddSection(SECTION_NAL_UNITS, nalUnits_);
+    indexWriter_.AddSection(SECTION_ACCESS_UNITS, accessUnits_);
+    indexWriter_.WriteAsync(indexPath, isH265_ ? IndexKind::RAW_H265 : IndexKind::RAW_H264, key);
+}
+
+void NalParser::ParseFrameRate(const uint8_t* nal, size_t size) {
+    std::vector<uint8_t> sps(nal, nal + size);
+    frameRate_ = isH265_ ? SpsParser::ParseH265Fps(sps) : SpsParser::ParseH264Fps(sps);
+}
+
+void NalParser::ParseNalUnits(const uint8_t* data, size_t size) {
     nalUnits_.clear();
+    accessUnits_.clear();
+    classifier_.Reset(isH265_);
+
+    const uint8_t spsType = isH265_ ? 33 : 7;
+    bool hasFrameRate = false;
 
-    if (buffer.size() < 4) {
+    AccessUnit currentAU = {0, 0, 0, 0, 0, 0, VideoFrameType::SPS_PPS, false, 0};
+    FrameInfo currentFrame = FrameClassifier::BeginFrame();
+    bool auHasVcl = false;
+
+    // Each NAL runs from its start code (3 or 4 bytes) to the next one
+    size_t pos = StartCodeScanner::FindNext(data, size, 0);
+    if (pos == size) {
         return;
     }
+    size_t start = pos + 3 - StartCodeScanner::GetStartCodeLength(data, pos);
+
+    while (start < size) {
+        size_t next = StartCodeScanner::FindNext(data, size, pos + 3);
+        size_t end = (next == size) ? size : next + 3 - StartCodeScanner::GetStartCodeLength(data, next);
 
-    size_t start = 0;
-    bool firstNalFound = false;
-
-    for (size_t i = 0; i < buffer.size() - 3; ++i) {
-        // Check for 4-byte start code: 0x00 0x00 0x00 0x01
-        bool is4ByteStart = (buffer[i] == 0 && buffer[i + 1] == 0 &&
-                             buffer[i + 2] == 0 && buffer[i + 3] == 1);
-
-        // Check for 3-byte start code: 0x00 0x00 0x01
-        // Make sure it's not part of a 4-byte start code
-        bool is3ByteStart = !is4ByteStart && i > 0 &&
-                            (buffer[i] == 0 && buffer[i + 1] == 0 && buffer[i + 2] == 1);
-
-        if (is4ByteStart || is3ByteStart) {
-            if (firstNalFound) {
-                // Save the previous NAL unit
-                NalUnit nal;
-                nal.data.assign(buffer.begin() + start, buffer.begin() + i);
-                nalUnits_.push_back(std::move(nal));
-            }
-            start = i;
-            firstNalFound = true;
-
-            // Skip start code bytes to avoid re-detecting
-            i += is4ByteStart ? 3 : 2;
+        NalInfo info = classifier_.ParseNal(data + pos + 3, end - pos - 3);
+
+        NalUnit nal;
+        nal.offset = start;
+        nal.size = static_cast<uint32_t>(end - start);
+        nal.type = info.type;
+        nalUnits_.push_back(nal);
+
+        if (!hasFrameRate && info.type == spsType) {
+            ParseFrameRate(data + start, nal.size);
+            hasFrameRate = true;
+        }
+
+        // O(1) boundary decision: only "does the current AU have a slice yet" is kept
+        if (FrameClassifier::IsAuBoundary(info, auHasVcl)) {
+            AppendAccessUnit(currentAU, currentFrame);
+            currentFrame = FrameClassifier::BeginFrame();
+            auHasVcl = false;
         }
+
+        // NAL units are adjacent in the source, so an AU is one contiguous span
+        if (currentAU.nalCount == 0) {
+            currentAU.offset = nal.offset;
+            currentAU.size = 0;
+            currentAU.firstNal = static_cast<uint32_t>(nalUnits_.size() - 1);
+        }
+        currentAU.size += nal.size;
+        currentAU.nalCount++;
+        classifier_.AddNal(currentFrame, info);
+        auHasVcl = auHasVcl || info.isVcl;
+
+        pos = next;
+        start = end;
     }
 
-    // Add the last NAL unit
-    if (firstNalFound && start < buffer.size()) {
-        NalUnit nal;
-        nal.data.assign(buffer.begin() + start, buffer.end());
-        nalUnits_.push_back(std::move(nal));
+    AppendAccessUnit(currentAU, currentFrame);
+}
+
+void NalParser::AppendAccessUnit(AccessUnit& au, const FrameInfo& frame) {
+    if (au.nalCount == 0) {
+        return;
     }
+    au.frameType = frame.frameType;
+    au.temporalId = frame.temporalId;
+    // AUs without slices only carry parameter sets, which are always needed
+    bool hasVcl = (frame.frameType != VideoFrameType::SPS_PPS &&
+                   frame.frameType != VideoFrameType::VPS);
+    au.isReference = frame.isReference || !hasVcl;
+    accessUnits_.push_back(au);
+    au.nalCount = 0;
 }
 
 const NalUnit* NalParser::GetNalUnit(size_t index) const {
@@ -115,101 +222,10 @@ const AccessUnit* NalParser::GetAccessUnit(size_t index) const {
     return &accessUnits_[index];
 }
 
-uint8_t NalParser::GetNalType(const NalUnit& nal) const {
-    // Skip start code (3 or 4 bytes)
-    size_t offset = 0;
-    if (nal.data.size() >= 4 && nal.data[0] == 0 && nal.data[1] == 0) {
-        if (nal.data[2] == 0 && nal.data[3] == 1) {
-            offset = 4;
-        } else if (nal.data[2] == 1) {
-            offset = 3;
-        }
-    }
-
-    if (offset == 0 || offset >= nal.data.size()) {
-        return 0xFF;  // Invalid
-    }
-
-    if (isH265_) {
-        // H.265: NAL type is bits 1-6 of first byte after start code
-        return (nal.data[offset] >> 1) & 0x3F;
-    } else {
-        // H.264: NAL type is bits 0-4 of first byte after start code
-        return nal.data[offset] & 0x1F;
-    }
-}
-
-void NalParser::GroupIntoAccessUnits() {
-    accessUnits_.clear();
-
-    if (nalUnits_.empty()) {
-        return;
-    }
-
-    AccessUnit currentAU;
-
-    for (size_t i = 0; i < nalUnits_.size(); ++i) {
-        uint8_t nalType = GetNalType(nalUnits_[i]);
-
-        bool isNewAU = false;
-
-        if (isH265_) {
-            // H.265 NAL types:
-            // 35 = AUD (Access Unit Delimiter)
-            // 32 = VPS, 33 = SPS, 34 = PPS
-            // 0-31 = VCL NAL units
-            if (nalType == 35) {
-                // AUD always starts new AU
-                isNewAU = true;
-            } else if (nalType >= 0 && nalType <= 31) {
-                // VCL NAL: start new AU if current AU already has VCL NAL
-                // Simplified: assume each VCL starts new AU unless it's the first NAL
-                if (!currentAU.nalUnits.empty()) {
-                    // Check if current AU already has a VCL NAL
-                    for (const auto& nal : currentAU.nalUnits) {
-                        uint8_t type = GetNalType(nal);
-                        if (type >= 0 && type <= 31) {
-                            isNewAU = true;
-                            break;
-                        }
-                    }
-                }
-            }
-        } else {
-            // H.264 NAL types:
-            // 9 = AUD
-            // 7 = SPS, 8 = PPS
-            // 1 = non-IDR slice, 5 = IDR slice
-            if (nalType == 9) {
-                // AUD always starts new AU
-                isNewAU = true;
-            } else if (nalType == 1 || nalType == 5) {
-                // Slice NAL: start new AU if current AU already has a slice
-                // Simplified: assume each slice starts new AU unless it's the first NAL
-                if (!currentAU.nalUnits.empty()) {
-                    for (const auto& nal : currentAU.nalUnits) {
-                        uint8_t type = GetNalType(nal);
-                        if (type == 1 || type == 5) {
-                            isNewAU = true;
-                            break;
-                        }
-                    }
-                }
-            }
-        }
-
-        if (isNewAU && !currentAU.nalUnits.empty()) {
-            accessUnits_.push_back(std::move(currentAU));
-            currentAU.nalUnits.clear();
-        }
-
-        currentAU.nalUnits.push_back(nalUnits_[i]);
-    }
-
-    // Add the last AU
-    if (!currentAU.nalUnits.empty()) {
-        accessUnits_.push_back(std::move(currentAU));
-    }
+size_t NalParser::GetResidentBytes() const {
+    // A mapping counts in full: its pages stay resident while it is streamed
+    return fileSize_ + nalUnits_.capacity() * sizeof(NalUnit) +
+           accessUnits_.capacity() * sizeof(AccessUnit);
 }
 
 }  // namespace server
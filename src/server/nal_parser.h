@@ -5,34 +5,62 @@
 #include <string>
 #include <vector>
 
+#include "frame_classifier.h"
+#include "index_file.h"
+#include "mapped_file.h"
+
 namespace server {
 
 /**
- * @brief NAL unit with start code
+ * @brief NAL unit record (with start code) pointing into the source data
  */
 struct NalUnit {
-    std::vector<uint8_t> data;
+    uint64_t offset;   // offset of the start code in the source
+    uint32_t size;     // size including start code
+    uint8_t type;      // NAL unit type (H.264/H.265 aware), 0xFF if invalid
 };
 
 /**
- * @brief Access Unit (one video frame)
+ * @brief Access Unit (one video frame) index entry: a contiguous span of
+ *        NAL units plus its timing and classification
  */
 struct AccessUnit {
-    std::vector<NalUnit> nalUnits;
+    uint64_t offset;     // offset of the first NAL's start code
+    uint32_t size;       // total size of all NAL units
+    uint32_t firstNal;   // index of the first NAL unit
+    uint32_t nalCount;   // number of NAL units
+    int64_t ptsMs;       // presentation timestamp (decode order x frame interval)
+    int64_t dtsMs;       // decode timestamp
+    VideoFrameType frameType;
+    bool isReference;    // referenced by other pictures (or parameter sets only)
+    uint8_t temporalId;  // H.265 TemporalId / H.264 SVC temporal_id
 };
 
 /**
  * @brief H.264/H.265 NAL unit parser
+ *
+ * NAL units and Access Units are stored as (offset, size) records into a
+ * single source buffer: either the whole file read into memory, or a
+ * read-only mmap of the file. No per-NAL copies are made.
  */
 class NalParser {
 public:
+    NalParser();
+
+    NalParser(const NalParser&) = delete;
+    NalParser& operator=(const NalParser&) = delete;
+
     /**
      * @brief Load video file and parse NAL units
      * @param filePath path to video file
      * @param isH265 true for H.265/HEVC, false for H.264/AVC
+     * @param useMmap true to mmap the file instead of reading it into memory
+     * @param useIndex true to load the NAL/AU index from a sidecar index
+     *        file, rebuilding it in the background when missing or stale
      * @return true on success
      */
-    bool LoadFile(const std::string& filePath, bool isH265);
+    bool LoadFile(const std::string& filePath, bool isH265, bool useMmap = false,
+                  bool useIndex = false);
 
     /**
      * @brief Get number of NAL units
@@ -42,7 +70,7 @@ public:
     /**
      * @brief Get NAL unit by index
      * @param index NAL unit index
-     * @return pointer to NAL unit data, nullptr if out of range
+     * @return pointer to NAL unit record, nullptr if out of range
      */
     const NalUnit* GetNalUnit(size_t index) const;
 
@@ -58,38 +86,72 @@ public:
      */
     const AccessUnit* GetAccessUnit(size_t index) const;
 
+    /**
+     * @brief Get pointer to the bytes of a NAL unit or Access Unit span
+     * @param offset span offset (NalUnit::offset or AccessUnit::offset)
+     * @return pointer into the source data
+     */
+    const uint8_t* GetData(uint64_t offset) const { return sourceData_ + offset; }
+
     /**
      * @brief Get total file size
      */
     size_t GetFileSize() const { return fileSize_; }
 
+    /**
+     * @brief Get bytes held in memory: source data (copy or mapping) plus
+     *        NAL/AU records
+     */
+    size_t GetResidentBytes() const;
+
     /**
      * @brief Get detected frame rate
      * @return frame rate in fps, or 25.0 if not detected
      */
     double GetFrameRate() const { return frameRate_; }
 
+    /**
+     * @brief Check whether the loaded bitstream is H.265/HEVC
+     */
+    bool IsH265() const { return isH265_; }
+
 private:
     /**
-     * @brief Parse NAL units from buffer
-     * @param buffer raw video data
+     * @brief Single pass over the source: split NAL units, group them into
+     *        Access Units and classify each AU, parsing the frame rate from
+     *        the first SPS
+     * @param data raw video data
+     * @param size data size in bytes
+     */
+    void ParseNalUnits(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Close the current AU and append it to the index
+     */
+    void AppendAccessUnit(AccessUnit& au, const FrameInfo& frame);
+
+    /**
+     * @brief Restore NAL/AU records and frame rate from a current sidecar index
      */
-    void ParseNalUnits(const std::vector<uint8_t>& buffer);
+    bool LoadIndexFile(const std::string& indexPath, const IndexSourceKey& key);
 
     /**
-     * @brief Group NAL units into Access Units
+     * @brief Persist NAL/AU records and frame rate to a sidecar index
      */
-    void GroupIntoAccessUnits();
+    void WriteIndexFile(const std::string& indexPath, const IndexSourceKey& key);
 
     /**
-     * @brief Get NAL unit type (H.264/H.265 aware)
-     * @param nal NAL unit data
-     * @return NAL type
+     * @brief Parse frame rate from an SPS NAL unit (with start code)
      */
-    uint8_t GetNalType(const NalUnit& nal) const;
+    void ParseFrameRate(const uint8_t* nal, size_t size);
 
     std::vector<NalUnit> nalUnits_;
     std::vector<AccessUnit> accessUnits_;
+    std::vector<uint8_t> fileBuffer_;   // owned copy when not mmapped
+    MappedFile mappedFile_;
+    FrameClassifier classifier_;
+    IndexFileWriter indexWriter_;
+    const uint8_t* sourceData_;
     size_t fileSize_;
     bool isH265_;
     double frameRate_;
@@ -0,0 +1,198 @@
+#include "packet_store.h"
+
+#include <sys/mman.h>
+
+#include <cstdio>
+#include <cstring>
+
+namespace server {
+
+static const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+static const size_t SLAB_BYTES = 32 * HUGE_PAGE_BYTES;
+static const uint8_t FLAG_KEYFRAME = 0x01;
+static const uint8_t FLAG_REFERENCE = 0x02;
+
+PacketStore::PacketStore() {
+}
+
+PacketStore::~PacketStore() {
+    FreeSlabs();
+}
+
+void PacketStore::Reserve(size_t count) {
+    offsets_.reserve(count);
+    sizes_.reserve(count);
+    ptsMs_.reserve(count);
+    dtsMs_.reserve(count);
+    types_.reserve(count);
+    frameTypes_.reserve(count);
+    flags_.reserve(count);
+    temporalIds_.reserve(count);
+    payloads_.reserve(count);
+    payloadSizes_.reserve(count);
+}
+
+uint8_t* PacketStore::AllocatePayload(size_t size) {
+    if (slabs_.empty() || slabs_.back().capacity - slabs_.back().used < size) {
+        // Oversized packets get a slab of their own
+        size_t capacity = (size > SLAB_BYTES) ? size : SLAB_BYTES;
+        void* addr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            std::fprintf(stderr, "Failed to allocate %zu byte packet slab\n", capacity);
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(addr, capacity, MADV_HUGEPAGE);
+#endif
+        slabs_.push_back(Slab{static_cast<uint8_t*>(addr), capacity, 0});
+    }
+
+    Slab& slab = slabs_.back();
+    uint8_t* out = slab.data + slab.used;
+    slab.used += size;
+    return out;
+}
+
+bool PacketStore::Append(const PacketIndexEntry& entry, const uint8_t* payload,
+                         size_t payloadSize) {
+    const uint8_t* stored = nullptr;
+    if (payload != nullptr) {
+        uint8_t* dst = AllocatePayload(payloadSize);
+        if (dst == nullptr) {
+            return false;
+        }
+        std::memcpy(dst, payload, payloadSize);
+        stored = dst;
+    }
+
+    offsets_.push_back(entry.offset);
+    sizes_.push_back(entry.size);
+    ptsMs_.push_back(entry.ptsMs);
+    dtsMs_.push_back(entry.dtsMs);
+    types_.push_back(entry.type);
+    frameTypes_.push_back(entry.frameType);
+    flags_.push_back(static_cast<uint8_t>((entry.isKeyframe ? FLAG_KEYFRAME : 0) |
+                                          (entry.isReference ? FLAG_REFERENCE : 0)));
+    temporalIds_.push_back(entry.temporalId);
+    payloads_.push_back(stored);
+    payloadSizes_.push_back(static_cast<uint32_t>(payloadSize));
+    return true;
+}
+
+template <typename T>
+void PacketStore::PermuteColumn(std::vector<T>& column, const std::vector<size_t>& order) {
+    std::vector<T> sorted;
+    sorted.reserve(order.size());
+    for (size_t i : order) {
+        sorted.push_back(column[i]);
+    }
+    column.swap(sorted);
+}
+
+void PacketStore::Permute(const std::vector<size_t>& order) {
+    PermuteColumn(offsets_, order);
+    PermuteColumn(sizes_, order);
+    PermuteColumn(ptsMs_, order);
+    PermuteColumn(dtsMs_, order);
+    PermuteColumn(types_, order);
+    PermuteColumn(frameTypes_, order);
+    PermuteColumn(flags_, order);
+    PermuteColumn(temporalIds_, order);
+    PermuteColumn(payloads_, order);
+    PermuteColumn(payloadSizes_, order);
+}
+
+PacketIndexEntry PacketStore::GetEntry(size_t index) const {
+    PacketIndexEntry entry;
+    entry.offset = offsets_[index];
+    entry.size = sizes_[index];
+    entry.ptsMs = ptsMs_[index];
+    entry.dtsMs = dtsMs_[index];
+    entry.type = types_[index];
+    entry.isKeyframe = (flags_[index] & FLAG_KEYFRAME) != 0;
+    entry.frameType = frameTypes_[index];
+    entry.isReference = (flags_[index] & FLAG_REFERENCE) != 0;
+    entry.temporalId = temporalIds_[index];
+    return entry;
+}
+
+void PacketStore::AssignColumns(const uint64_t* offsets, const uint32_t* sizes,
+                                const int64_t* ptsMs, const int64_t* dtsMs,
+                                const MediaType* types, const VideoFrameType* frameTypes,
+                                const uint8_t* flags, const uint8_t* temporalIds,
+                                size_t count) {
+    Clear();
+    offsets_.assign(offsets, offsets + count);
+    sizes_.assign(sizes, sizes + count);
+    ptsMs_.assign(ptsMs, ptsMs + count);
+    dtsMs_.assign(dtsMs, dtsMs + count);
+    types_.assign(types, types + count);
+    frameTypes_.assign(frameTypes, frameTypes + count);
+    flags_.assign(flags, flags + count);
+    temporalIds_.assign(temporalIds, temporalIds + count);
+    payloads_.assign(count, nullptr);
+    payloadSizes_.assign(count, 0);
+}
+
+void PacketStore::AssignExternalPayloads(const uint8_t* base, const uint64_t* offsets,
+                                         const uint32_t* sizes) {
+    FreeSlabs();
+    for (size_t i = 0; i < payloads_.size(); ++i) {
+        payloads_[i] = base + offsets[i];
+        payloadSizes_[i] = sizes[i];
+    }
+}
+
+void PacketStore::Clear() {
+    offsets_.clear();
+    sizes_.clear();
+    ptsMs_.clear();
+    dtsMs_.clear();
+    types_.clear();
+    frameTypes_.clear();
+    flags_.clear();
+    temporalIds_.clear();
+    payloads_.clear();
+    payloadSizes_.clear();
+    FreeSlabs();
+}
+
+size_t PacketStore::GetArenaBytes() const {
+    // Untouched slab space is never faulted in; what was written is backed
+    // in whole huge pages at most
+    size_t total = 0;
+    for (const auto& slab : slabs_) {
+        total += (slab.used + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    }
+    return total;
+}
+
+size_t PacketStore::GetArenaReservedBytes() const {
+    size_t total = 0;
+    for (const auto& slab : slabs_) {
+        total += slab.capacity;
+    }
+    return total;
+}
+
+template <typename T>
+static size_t ColumnBytes(const std::vector<T>& column) {
+    return column.capacity() * sizeof(T);
+}
+
+size_t PacketStore::GetIndexBytes() const {
+    return ColumnBytes(offsets_) + ColumnBytes(sizes_) + ColumnBytes(ptsMs_) +
+           ColumnBytes(dtsMs_) + ColumnBytes(types_) + ColumnBytes(frameTypes_) +
+           ColumnBytes(flags_) + ColumnBytes(temporalIds_) + ColumnBytes(payloads_) +
+           ColumnBytes(payloadSizes_);
+}
+
+void PacketStore::FreeSlabs() {
+    for (const auto& slab : slabs_) {
+        munmap(slab.data, slab.capacity);
+    }
+    slabs_.clear();
+}
+
+}  // namespace server
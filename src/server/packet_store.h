@@ -0,0 +1,171 @@
+#ifndef PACKET_STORE_H
+#define PACKET_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame_protocol.h"
+
+namespace server {
+
+enum class MediaType : uint8_t {
+    VIDEO = 0,
+    AUDIO = 1
+};
+
+/**
+ * @brief Per-packet metadata (no payload), as passed in and out of the store
+ */
+struct PacketIndexEntry {
+    uint64_t offset;   // file offset of the sample payload (lazy mode)
+    uint32_t size;     // payload size in bytes as stored in the file
+    int64_t ptsMs;     // presentation timestamp in milliseconds
+    int64_t dtsMs;     // decode timestamp in milliseconds
+    MediaType type;
+    bool isKeyframe;
+    // Video classification, computed once at load time (audio: I_FRAME, reference)
+    VideoFrameType frameType;
+    bool isReference;
+    uint8_t temporalId;
+};
+
+/**
+ * @brief Packet metadata in dense per-field arrays plus payloads in an arena
+ *
+ * Each metadata field lives in its own array (structure of arrays), so a
+ * timestamp scan touches only the PTS column. Payloads are copied
+ * back-to-back into large slabs (huge-page backed where the kernel allows
+ * it) instead of one heap allocation per packet; a packet never spans two
+ * slabs. Payload pointers stay valid until Clear(), including across
+ * Permute().
+ */
+class PacketStore {
+public:
+    PacketStore();
+    ~PacketStore();
+
+    PacketStore(const PacketStore&) = delete;
+    PacketStore& operator=(const PacketStore&) = delete;
+
+    /**
+     * @brief Reserve metadata capacity for count packets
+     */
+    void Reserve(size_t count);
+
+    /**
+     * @brief Append a packet
+     * @param entry packet metadata
+     * @param payload payload bytes to copy into the arena, nullptr for
+     *        index-only packets (lazy mode)
+     * @param payloadSize payload size in bytes
+     * @return false if the arena could not grow
+     */
+    bool Append(const PacketIndexEntry& entry, const uint8_t* payload, size_t payloadSize);
+
+    /**
+     * @brief Reorder all metadata columns: new position i takes old order[i]
+     */
+    void Permute(const std::vector<size_t>& order);
+
+    /**
+     * @brief Release all packets and slabs
+     */
+    void Clear();
+
+    size_t GetCount() const { return ptsMs_.size(); }
+
+    int64_t GetPtsMs(size_t index) const { return ptsMs_[index]; }
+    int64_t GetDtsMs(size_t index) const { return dtsMs_[index]; }
+    MediaType GetType(size_t index) const { return types_[index]; }
+
+    /**
+     * @brief Assemble the metadata of one packet
+     */
+    PacketIndexEntry GetEntry(size_t index) const;
+
+    /**
+     * @brief Get payload stored in the arena
+     * @return pointer to payload, nullptr for index-only packets
+     */
+    const uint8_t* GetPayload(size_t index) const { return payloads_[index]; }
+    uint32_t GetPayloadSize(size_t index) const { return payloadSizes_[index]; }
+
+    /**
+     * @brief Get payload slab bytes in use, rounded up to whole huge pages
+     */
+    size_t GetArenaBytes() const;
+
+    /**
+     * @brief Get address space reserved for payload slabs
+     */
+    size_t GetArenaReservedBytes() const;
+
+    /**
+     * @brief Get bytes held by the per-packet metadata columns
+     */
+    size_t GetIndexBytes() const;
+
+    // Raw columns, for bulk persistence (sidecar index)
+    const std::vector<uint64_t>& GetOffsets() const { return offsets_; }
+    const std::vector<uint32_t>& GetSizes() const { return sizes_; }
+    const std::vector<int64_t>& GetPtsColumn() const { return ptsMs_; }
+    const std::vector<int64_t>& GetDtsColumn() const { return dtsMs_; }
+    const std::vector<MediaType>& GetTypes() const { return types_; }
+    const std::vector<VideoFrameType>& GetFrameTypes() const { return frameTypes_; }
+    const std::vector<uint8_t>& GetFlags() const { return flags_; }
+    const std::vector<uint8_t>& GetTemporalIds() const { return temporalIds_; }
+
+    /**
+     * @brief Replace the store with count index-only packets taken from raw columns
+     */
+    void AssignColumns(const uint64_t* offsets, const uint32_t* sizes, const int64_t* ptsMs,
+                       const int64_t* dtsMs, const MediaType* types,
+                       const VideoFrameType* frameTypes, const uint8_t* flags,
+                       const uint8_t* temporalIds, size_t count);
+
+    /**
+     * @brief Point every packet's payload at memory outside the arena
+     *
+     * Used for payloads in a shared read-only mapping; the caller keeps the
+     * mapping alive for as long as the store refers to it.
+     *
+     * @param base start of the payload area
+     * @param offsets per-packet payload offset from base (GetCount() entries)
+     * @param sizes per-packet payload size (GetCount() entries)
+     */
+    void AssignExternalPayloads(const uint8_t* base, const uint64_t* offsets,
+                                const uint32_t* sizes);
+
+private:
+    struct Slab {
+        uint8_t* data;
+        size_t capacity;
+        size_t used;
+    };
+
+    uint8_t* AllocatePayload(size_t size);
+    void FreeSlabs();
+
+    template <typename T>
+    static void PermuteColumn(std::vector<T>& column, const std::vector<size_t>& order);
+
+    // Metadata columns
+    std::vector<uint64_t> offsets_;
+    std::vector<uint32_t> sizes_;
+    std::vector<int64_t> ptsMs_;
+    std::vector<int64_t> dtsMs_;
+    std::vector<MediaType> types_;
+    std::vector<VideoFrameType> frameTypes_;
+    std::vector<uint8_t> flags_;        // FLAG_KEYFRAME | FLAG_REFERENCE
+    std::vector<uint8_t> temporalIds_;
+    std::vector<const uint8_t*> payloads_;
+    std::vector<uint32_t> payloadSizes_;
+
+    // Payload arena
+    std::vector<Slab> slabs_;
+};
+
+}  // namespace server
+
+#endif  // PACKET_STORE_H
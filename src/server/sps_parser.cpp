@@ -24,6 +24,26 @@ std::vector<uint8_t> SpsParser::RemoveEmulationPrevention(const std::vector<uint
 }
 
 double SpsParser::ParseH264Fps(const std::vector<uint8_t>& spsData) {
+    return ParseH264(spsData, nullptr);
+}
+
+double SpsParser::ParseH265Fps(const std::vector<uint8_t>& spsData) {
+    return ParseH265(spsData, nullptr);
+}
+
+bool SpsParser::ParseH264Picture(const std::vector<uint8_t>& spsData, SpsPictureInfo& info) {
+    info = SpsPictureInfo();
+    ParseH264(spsData, &info);
+    return info.width > 0 && info.height > 0;
+}
+
+bool SpsParser::ParseH265Picture(const std::vector<uint8_t>& spsData, SpsPictureInfo& info) {
+    info = SpsPictureInfo();
+    ParseH265(spsData, &info);
+    return info.width > 0 && info.height > 0;
+}
+
+double SpsParser::ParseH264(const std::vector<uint8_t>& spsData, SpsPictureInfo* info) {
     // Skip start code (3 or 4 bytes) and NAL header (1 byte)
     size_t offset = 0;
     if (spsData.size() >= 4 && spsData[0] == 0 && spsData[1] == 0) {
@@ -55,21 +75,24 @@ double SpsParser::ParseH264Fps(const std::vector<uint8_t>& spsData) {
         // profile_idc (8), constraint_setX_flag (8), level_idc (8)
         uint32_t profile_idc = reader.ReadBits(8);
         reader.SkipBits(8);  // constraints
-        reader.SkipBits(8);  // level_idc
+        uint32_t level_idc = reader.ReadBits(8);
 
         // seq_parameter_set_id
         reader.ReadUE();
 
         // High profile complexity: chroma_format_idc, bit_depth, etc.
+        uint32_t chroma_format_idc = 1;  // 4:2:0 unless signalled
+        uint32_t bit_depth_luma_minus8 = 0;
+        uint32_t bit_depth_chroma_minus8 = 0;
         if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
             profile_idc == 244 || profile_idc == 44 || profile_idc == 83 ||
             profile_idc == 86 || profile_idc == 118 || profile_idc == 128) {
-            uint32_t chroma_format_idc = reader.ReadUE();
+            chroma_format_idc = reader.ReadUE();
             if (chroma_format_idc == 3) {
                 reader.SkipBits(1);  // separate_colour_plane_flag
             }
-            reader.ReadUE();  // bit_depth_luma_minus8
-            reader.ReadUE();  // bit_depth_chroma_minus8
+            bit_depth_luma_minus8 = reader.ReadUE();
+            bit_depth_chroma_minus8 = reader.ReadUE();
             reader.SkipBits(1);  // qpprime_y_zero_transform_bypass_flag
 
             // seq_scaling_matrix_present_flag
@@ -116,8 +139,8 @@ double SpsParser::ParseH264Fps(const std::vector<uint8_t>& spsData) {
         reader.SkipBits(1);
 
         // pic_width_in_mbs_minus1, pic_height_in_map_units_minus1
-        reader.ReadUE();
-        reader.ReadUE();
+        uint32_t pic_width_in_mbs_minus1 = reader.ReadUE();
+        uint32_t pic_height_in_map_units_minus1 = reader.ReadUE();
 
         // frame_mbs_only_flag
         uint32_t frame_mbs_only_flag = reader.ReadBit();
@@ -129,11 +152,31 @@ double SpsParser::ParseH264Fps(const std::vector<uint8_t>& spsData) {
         reader.SkipBits(1);
 
         // frame_cropping_flag
+        uint32_t crop_left = 0;
+        uint32_t crop_right = 0;
+        uint32_t crop_top = 0;
+        uint32_t crop_bottom = 0;
         if (reader.ReadBit()) {
-            reader.ReadUE();  // frame_crop_left_offset
-            reader.ReadUE();  // frame_crop_right_offset
-            reader.ReadUE();  // frame_crop_top_offset
-            reader.ReadUE();  // frame_crop_bottom_offset
+            crop_left = reader.ReadUE();
+            crop_right = reader.ReadUE();
+            crop_top = reader.ReadUE();
+            crop_bottom = reader.ReadUE();
+        }
+
+        if (info != nullptr) {
+            // Crop units follow the chroma subsampling (ITU-T H.264 7.4.2.1.1)
+            uint32_t cropUnitX = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+            uint32_t cropUnitY = (chroma_format_idc == 1) ? 2 : 1;
+            cropUnitY *= 2 - frame_mbs_only_flag;
+            info->width = (pic_width_in_mbs_minus1 + 1) * 16 - cropUnitX * (crop_left + crop_right);
+            info->height = (pic_height_in_map_units_minus1 + 1) * 16 * (2 - frame_mbs_only_flag) -
+                           cropUnitY * (crop_top + crop_bottom);
+            info->chromaFormat = chroma_format_idc;
+            info->bitDepthLuma = bit_depth_luma_minus8 + 8;
+            info->bitDepthChroma = bit_depth_chroma_minus8 + 8;
+            info->profileIdc = profile_idc;
+            info->levelIdc = level_idc;
+            return 0.0;
         }
 
         // vui_parameters_present_flag
@@ -196,7 +239,7 @@ double SpsParser::ParseH264Fps(const std::vector<uint8_t>& spsData) {
     }
 }
 
-double SpsParser::ParseH265Fps(const std::vector<uint8_t>& spsData) {
+double SpsParser::ParseH265(const std::vector<uint8_t>& spsData, SpsPictureInfo* info) {
     // Skip start code (3 or 4 bytes) and NAL header (2 bytes for HEVC)
     size_t offset = 0;
     if (spsData.size() >= 4 && spsData[0] == 0 && spsData[1] == 0) {
@@ -236,14 +279,14 @@ double SpsParser::ParseH265Fps(const std::vector<uint8_t>& spsData) {
         // profile_tier_level
         reader.SkipBits(2);  // general_profile_space
         reader.SkipBits(1);  // general_tier_flag
-        reader.SkipBits(5);  // general_profile_idc
+        uint32_t general_profile_idc = reader.ReadBits(5);
         reader.SkipBits(32);  // general_profile_compatibility_flag[32]
         reader.SkipBits(1);  // general_progressive_source_flag
         reader.SkipBits(1);  // general_interlaced_source_flag
         reader.SkipBits(1);  // general_non_packed_constraint_flag
         reader.SkipBits(1);  // general_frame_only_constraint_flag
         reader.SkipBits(44);  // general_reserved_zero_44bits
-        reader.SkipBits(8);  // general_level_idc
+        uint32_t general_level_idc = reader.ReadBits(8);
 
         // sub_layer_profile_present_flag, sub_layer_level_present_flag
         std::vector<uint32_t> sub_layer_profile_present_flag;
@@ -279,20 +322,38 @@ double SpsParser::ParseH265Fps(const std::vector<uint8_t>& spsData) {
         }
 
         // pic_width_in_luma_samples, pic_height_in_luma_samples
-        reader.ReadUE();
-        reader.ReadUE();
+        uint32_t pic_width_in_luma_samples = reader.ReadUE();
+        uint32_t pic_height_in_luma_samples = reader.ReadUE();
 
         // conformance_window_flag
+        uint32_t conf_win_left = 0;
+        uint32_t conf_win_right = 0;
+        uint32_t conf_win_top = 0;
+        uint32_t conf_win_bottom = 0;
         if (reader.ReadBit()) {
-            reader.ReadUE();  // conf_win_left_offset
-            reader.ReadUE();  // conf_win_right_offset
-            reader.ReadUE();  // conf_win_top_offset
-            reader.ReadUE();  // conf_win_bottom_offset
+            conf_win_left = reader.ReadUE();
+            conf_win_right = reader.ReadUE();
+            conf_win_top = reader.ReadUE();
+            conf_win_bottom = reader.ReadUE();
         }
 
         // bit_depth_luma_minus8, bit_depth_chroma_minus8
-        reader.ReadUE();
-        reader.ReadUE();
+        uint32_t bit_depth_luma_minus8 = reader.ReadUE();
+        uint32_t bit_depth_chroma_minus8 = reader.ReadUE();
+
+        if (info != nullptr) {
+            // Window offsets are in chroma sample units (ITU-T H.265 7.4.3.2.1)
+            uint32_t subWidthC = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+            uint32_t subHeightC = (chroma_format_idc == 1) ? 2 : 1;
+            info->width = pic_width_in_luma_samples - subWidthC * (conf_win_left + conf_win_right);
+            info->height = pic_height_in_luma_samples - subHeightC * (conf_win_top + conf_win_bottom);
+            info->chromaFormat = chroma_format_idc;
+            info->bitDepthLuma = bit_depth_luma_minus8 + 8;
+            info->bitDepthChroma = bit_depth_chroma_minus8 + 8;
+            info->profileIdc = general_profile_idc;
+            info->levelIdc = general_level_idc;
+            return 0.0;
+        }
 
         // log2_max_pic_order_cnt_lsb_minus4
         reader.ReadUE();
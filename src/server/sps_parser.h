@@ -7,7 +7,21 @@
 namespace server {
 
 /**
- * @brief SPS parser for extracting frame rate from H.264/H.265 bitstreams
+ * @brief Picture format signalled in an SPS
+ */
+struct SpsPictureInfo {
+    uint32_t width;          // luma samples after cropping
+    uint32_t height;
+    uint32_t chromaFormat;   // chroma_format_idc (1 = 4:2:0)
+    uint32_t bitDepthLuma;
+    uint32_t bitDepthChroma;
+    uint32_t profileIdc;     // profile_idc / general_profile_idc
+    uint32_t levelIdc;       // level_idc / general_level_idc
+};
+
+/**
+ * @brief SPS parser for extracting frame rate and picture format from
+ *        H.264/H.265 bitstreams
  */
 class SpsParser {
 public:
@@ -25,7 +39,30 @@ public:
      */
     static double ParseH265Fps(const std::vector<uint8_t>& spsData);
 
+    /**
+     * @brief Parse picture size and format from H.264 SPS NAL unit
+     * @param spsData SPS NAL unit data (including start code)
+     * @param info receives the picture format
+     * @return true on success
+     */
+    static bool ParseH264Picture(const std::vector<uint8_t>& spsData, SpsPictureInfo& info);
+
+    /**
+     * @brief Parse picture size and format from H.265 SPS NAL unit
+     * @param spsData SPS NAL unit data (including start code)
+     * @param info receives the picture format
+     * @return true on success
+     */
+    static bool ParseH265Picture(const std::vector<uint8_t>& spsData, SpsPictureInfo& info);
+
 private:
+    /**
+     * @brief Parse an SPS; with info set, stop after the picture format
+     * @return frame rate in fps (0 when info is set)
+     */
+    static double ParseH264(const std::vector<uint8_t>& spsData, SpsPictureInfo* info);
+    static double ParseH265(const std::vector<uint8_t>& spsData, SpsPictureInfo* info);
+
     /**
      * @brief Remove emulation prevention bytes (0x03) from RBSP
      * @param data NAL unit data
@@ -0,0 +1,119 @@
+#include "start_code_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define START_CODE_SCANNER_X86 1
+#endif
+
+namespace server {
+
+static size_t FindNextScalar(const uint8_t* data, size_t size, size_t from) {
+    if (size < 3) {
+        return size;
+    }
+    for (size_t i = from; i + 2 < size; ++i) {
+        // data[i + 2] > 1 rules out a pattern starting at i, i + 1 and i + 2
+        if (data[i + 2] > 1) {
+            i += 2;
+            continue;
+        }
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            return i;
+        }
+    }
+    return size;
+}
+
+#ifdef START_CODE_SCANNER_X86
+
+static size_t FindNextSse2(const uint8_t* data, size_t size, size_t from) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    size_t i = from;
+
+    // Each block reads data[i .. i + 17]
+    for (; i + 18 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i isZeroA = _mm_cmpeq_epi8(a, zero);
+        if (_mm_movemask_epi8(isZeroA) == 0) {
+            continue;  // no zero-byte candidate in this block
+        }
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2));
+        __m128i match = _mm_and_si128(_mm_and_si128(isZeroA, _mm_cmpeq_epi8(b, zero)),
+                                      _mm_cmpeq_epi8(c, one));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(match));
+        if (mask != 0) {
+            return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+    }
+    return FindNextScalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+static size_t FindNextAvx2(const uint8_t* data, size_t size, size_t from) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    size_t i = from;
+
+    // Each block reads data[i .. i + 33]
+    for (; i + 34 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i isZeroA = _mm256_cmpeq_epi8(a, zero);
+        if (_mm256_movemask_epi8(isZeroA) == 0) {
+            continue;  // no zero-byte candidate in this block
+        }
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 2));
+        __m256i match = _mm256_and_si256(_mm256_and_si256(isZeroA, _mm256_cmpeq_epi8(b, zero)),
+                                         _mm256_cmpeq_epi8(c, one));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+        if (mask != 0) {
+            return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+    }
+    return FindNextSse2(data, size, i);
+}
+
+#endif  // START_CODE_SCANNER_X86
+
+ScanImpl StartCodeScanner::GetBestImpl() {
+#ifdef START_CODE_SCANNER_X86
+    static const ScanImpl best = __builtin_cpu_supports("avx2") ? ScanImpl::AVX2 : ScanImpl::SSE2;
+    return best;
+#else
+    return ScanImpl::SCALAR;
+#endif
+}
+
+const char* StartCodeScanner::GetImplName(ScanImpl impl) {
+    switch (impl) {
+        case ScanImpl::AVX2: return "avx2";
+        case ScanImpl::SSE2: return "sse2";
+        default:             return "scalar";
+    }
+}
+
+size_t StartCodeScanner::FindNextWith(ScanImpl impl, const uint8_t* data, size_t size,
+                                      size_t from) {
+    if (from >= size) {
+        return size;
+    }
+#ifdef START_CODE_SCANNER_X86
+    if (impl == ScanImpl::AVX2 && GetBestImpl() == ScanImpl::AVX2) {
+        return FindNextAvx2(data, size, from);
+    }
+    if (impl != ScanImpl::SCALAR) {
+        return FindNextSse2(data, size, from);
+    }
+#else
+    (void)impl;
+#endif
+    return FindNextScalar(data, size, from);
+}
+
+size_t StartCodeScanner::FindNext(const uint8_t* data, size_t size, size_t from) {
+    return FindNextWith(GetBestImpl(), data, size, from);
+}
+
+}  // namespace server
@@ -0,0 +1,68 @@
+#ifndef START_CODE_SCANNER_H
+#define START_CODE_SCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace server {
+
+/**
+ * @brief Scanner implementation selector
+ */
+enum class ScanImpl : uint8_t {
+    SCALAR = 0,
+    SSE2   = 1,
+    AVX2   = 2
+};
+
+/**
+ * @brief Annex B start code (00 00 01 / 00 00 00 01) scanner
+ *
+ * Searches blocks of 16 (SSE2) or 32 (AVX2) bytes for zero-byte candidates
+ * and only then checks the full 00 00 01 pattern, with a scalar fallback on
+ * other architectures. The best implementation is selected once at runtime.
+ *
+ * Callers that scan a byte stream in chunks (e.g. pipe ingest) must keep the
+ * last 3 bytes of a chunk so that start codes spanning two chunks are found.
+ */
+class StartCodeScanner {
+public:
+    /**
+     * @brief Find the next 00 00 01 pattern
+     * @param data buffer
+     * @param size buffer size in bytes
+     * @param from position to start searching at
+     * @return position of the first 00 of the pattern, or size if none
+     */
+    static size_t FindNext(const uint8_t* data, size_t size, size_t from);
+
+    /**
+     * @brief Same as FindNext, using an explicit implementation
+     *        (falls back to scalar if the CPU does not support it)
+     */
+    static size_t FindNextWith(ScanImpl impl, const uint8_t* data, size_t size, size_t from);
+
+    /**
+     * @brief Get start code length for a pattern found by FindNext
+     * @param data buffer
+     * @param pos position returned by FindNext
+     * @return 4 if the pattern is preceded by a zero byte, else 3
+     */
+    static uint32_t GetStartCodeLength(const uint8_t* data, size_t pos) {
+        return (pos > 0 && data[pos - 1] == 0) ? 4 : 3;
+    }
+
+    /**
+     * @brief Get the fastest implementation supported by this CPU
+     */
+    static ScanImpl GetBestImpl();
+
+    /**
+     * @brief Get human readable implementation name
+     */
+    static const char* GetImplName(ScanImpl impl);
+};
+
+}  // namespace server
+
+#endif  // START_CODE_SCANNER_H
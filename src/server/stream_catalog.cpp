@@ -0,0 +1,223 @@
+#include "stream_catalog.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace server {
+
+static const char* STREAM_PATH_PREFIX = "/stream/";
+
+static const char* const MEDIA_EXTENSIONS[] = {
+    ".mp4", ".h264", ".264", ".h265", ".265", ".hevc"
+};
+
+static bool HasMediaExtension(const std::string& fileName, size_t& stemLength) {
+    for (const char* ext : MEDIA_EXTENSIONS) {
+        std::string suffix(ext);
+        if (fileName.size() > suffix.size() &&
+            std::equal(suffix.rbegin(), suffix.rend(), fileName.rbegin())) {
+            stemLength = fileName.size() - suffix.size();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Split "<base>_<digits>[p]" into base and label; false if the stem has no label
+static bool SplitRenditionStem(const std::string& stem, std::string& base, std::string& label) {
+    size_t sep = stem.rfind('_');
+    if (sep == std::string::npos || sep == 0 || sep + 1 == stem.size()) {
+        return false;
+    }
+    std::string suffix = stem.substr(sep + 1);
+    if (suffix.back() == 'p') {
+        suffix.pop_back();
+    }
+    if (suffix.empty() || suffix.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    base = stem.substr(0, sep);
+    label = suffix;
+    return true;
+}
+
+StreamCatalog::StreamCatalog() {
+}
+
+bool StreamCatalog::AddSource(const std::string& name, const std::string& path,
+                              const SourceLoadOptions& options, const std::string& label) {
+    if (name.empty() || name.find('/') != std::string::npos) {
+        std::fprintf(stderr, "Invalid source name: '%s'\n", name.c_str());
+        return false;
+    }
+    if (sourcesByName_.count(name) != 0) {
+        std::fprintf(stderr, "Duplicate source name: '%s'\n", name.c_str());
+        return false;
+    }
+
+    if (access(path.c_str(), R_OK) != 0) {
+        std::fprintf(stderr, "Cannot read source '%s': %s\n", name.c_str(), path.c_str());
+        return false;
+    }
+
+    std::unique_ptr<MediaSource> source(new MediaSource(name, path, options, label));
+
+    sourcesByName_[name] = source.get();
+    sources_.push_back(std::move(source));
+    return true;
+}
+
+bool StreamCatalog::AddRendition(const std::string& name, const std::string& label,
+                                 const std::string& path) {
+    MediaSource* source = Find(name);
+    if (source == nullptr || source->IsLoaded()) {
+        return false;
+    }
+    if (access(path.c_str(), R_OK) != 0) {
+        std::fprintf(stderr, "Cannot read rendition '%s': %s\n", name.c_str(), path.c_str());
+        return false;
+    }
+    source->AddRendition(label, path);
+    return true;
+}
+
+bool StreamCatalog::LoadDirectory(const std::string& dir, const SourceLoadOptions& options) {
+    DIR* dirp = opendir(dir.c_str());
+    if (dirp == nullptr) {
+        std::fprintf(stderr, "Cannot open catalog directory: %s\n", dir.c_str());
+        return false;
+    }
+
+    std::vector<std::string> fileNames;
+    while (struct dirent* ent = readdir(dirp)) {
+        fileNames.push_back(ent->d_name);
+    }
+    closedir(dirp);
+
+    // Sorted so that the default source does not depend on readdir order
+    std::sort(fileNames.begin(), fileNames.end());
+
+    std::vector<std::string> stems;
+    std::vector<std::string> paths;
+    std::unordered_map<std::string, size_t> renditionCounts;
+    for (const auto& fileName : fileNames) {
+        size_t stemLength = 0;
+        if (fileName[0] == '.' || !HasMediaExtension(fileName, stemLength)) {
+            continue;
+        }
+
+        std::string path = dir + "/" + fileName;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        std::string stem = fileName.substr(0, stemLength);
+        std::string base;
+        std::string label;
+        if (SplitRenditionStem(stem, base, label)) {
+            renditionCounts[base]++;
+        }
+        stems.push_back(stem);
+        paths.push_back(path);
+    }
+
+    size_t added = 0;
+    for (size_t i = 0; i < stems.size(); ++i) {
+        std::string base;
+        std::string label;
+        bool isRendition = SplitRenditionStem(stems[i], base, label) &&
+                           renditionCounts[base] > 1;
+        if (!isRendition) {
+            added += AddSource(stems[i], paths[i], options) ? 1 : 0;
+        } else if (Find(base) == nullptr) {
+            added += AddSource(base, paths[i], options, label) ? 1 : 0;
+        } else {
+            AddRendition(base, label, paths[i]);
+        }
+    }
+
+    std::printf("Catalog %s: %zu sources\n", dir.c_str(), added);
+    return added > 0;
+}
+
+bool StreamCatalog::LoadConfig(const std::string& configPath, const SourceLoadOptions& options) {
+    std::ifstream file(configPath);
+    if (!file.is_open()) {
+        std::fprintf(stderr, "Cannot open catalog config: %s\n", configPath.c_str());
+        return false;
+    }
+
+    size_t added = 0;
+    std::string line;
+    int32_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream fields(line);
+        std::string name;
+        std::string path;
+        std::string codec;
+        if (!(fields >> name) || name[0] == '#') {
+            continue;
+        }
+        if (!(fields >> path)) {
+            std::fprintf(stderr, "%s:%d: missing path for source '%s'\n",
+                         configPath.c_str(), lineNumber, name.c_str());
+            continue;
+        }
+
+        SourceLoadOptions entryOptions = options;
+        if (fields >> codec) {
+            entryOptions.isH265 = (codec == "h265" || codec == "hevc");
+        }
+
+        // Label from the file stem: cam1_1080.mp4 -> "1080"
+        size_t nameStart = path.find_last_of('/');
+        std::string stem = path.substr((nameStart == std::string::npos) ? 0 : nameStart + 1);
+        stem = stem.substr(0, stem.find('.'));
+        std::string base;
+        std::string label;
+        if (!SplitRenditionStem(stem, base, label)) {
+            label = stem;
+        }
+
+        if (Find(name) != nullptr) {
+            AddRendition(name, label, path);
+        } else if (AddSource(name, path, entryOptions, label)) {
+            added++;
+        }
+    }
+
+    std::printf("Catalog %s: %zu sources\n", configPath.c_str(), added);
+    return added > 0;
+}
+
+MediaSource* StreamCatalog::Find(const std::string& name) const {
+    auto it = sourcesByName_.find(name);
+    return (it != sourcesByName_.end()) ? it->second : nullptr;
+}
+
+MediaSource* StreamCatalog::Resolve(const std::string& path) const {
+    if (path.empty() || path == "/") {
+        return sources_.empty() ? nullptr : sources_.front().get();
+    }
+
+    std::string prefix(STREAM_PATH_PREFIX);
+    if (path.compare(0, prefix.size(), prefix) != 0) {
+        return nullptr;
+    }
+
+    std::string name = path.substr(prefix.size());
+    if (!name.empty() && name.back() == '/') {
+        name.pop_back();
+    }
+    return Find(name);
+}
+
+}  // namespace server
@@ -0,0 +1,100 @@
+#ifndef STREAM_CATALOG_H
+#define STREAM_CATALOG_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "media_source.h"
+
+namespace server {
+
+/**
+ * @brief Named set of media sources served by one process
+ *
+ * Clients select a source with the WebSocket request path /stream/<name>;
+ * a bare "/" selects the default (first added) source. Sources are only
+ * registered here; MediaCache loads them on first subscribe.
+ *
+ * Files named <name>_<label>.<ext> with a numeric label (cam1_1080.mp4,
+ * cam1_540.mp4) become renditions of one source <name> when at least two
+ * of them are present.
+ */
+class StreamCatalog {
+public:
+    StreamCatalog();
+
+    StreamCatalog(const StreamCatalog&) = delete;
+    StreamCatalog& operator=(const StreamCatalog&) = delete;
+
+    /**
+     * @brief Register one media file under the given name
+     * @param name source name (must be unique)
+     * @param path media file path (must be readable)
+     * @param options load options
+     * @param label label of the first rendition
+     * @return true on success
+     */
+    bool AddSource(const std::string& name, const std::string& path,
+                   const SourceLoadOptions& options, const std::string& label = "");
+
+    /**
+     * @brief Register another rendition of an existing source
+     * @param name source name
+     * @param label rendition label
+     * @param path media file path (must be readable)
+     * @return true on success
+     */
+    bool AddRendition(const std::string& name, const std::string& label,
+                      const std::string& path);
+
+    /**
+     * @brief Add every media file in a directory, named by file stem
+     * @param dir directory path
+     * @param options load options
+     * @return true if at least one source was added
+     */
+    bool LoadDirectory(const std::string& dir, const SourceLoadOptions& options);
+
+    /**
+     * @brief Add sources from a config file with one "<name> <path> [h264|h265]"
+     *        entry per line; repeating a name adds a rendition to that source.
+     *        Blank lines and lines starting with '#' are ignored
+     * @param configPath config file path
+     * @param options load options (codec may be overridden per entry)
+     * @return true if at least one source was added
+     */
+    bool LoadConfig(const std::string& configPath, const SourceLoadOptions& options);
+
+    /**
+     * @brief Find a source by name
+     * @return source, nullptr if not found
+     */
+    MediaSource* Find(const std::string& name) const;
+
+    /**
+     * @brief Resolve a WebSocket request path to a source
+     * @param path request path ("/" or "/stream/<name>")
+     * @return source, nullptr if the path does not name a known source
+     */
+    MediaSource* Resolve(const std::string& path) const;
+
+    /**
+     * @brief Get source count
+     */
+    size_t GetSourceCount() const { return sources_.size(); }
+
+    /**
+     * @brief Get all sources in the order they were added
+     */
+    const std::vector<std::unique_ptr<MediaSource>>& GetSources() const { return sources_; }
+
+private:
+    std::vector<std::unique_ptr<MediaSource>> sources_;
+    std::unordered_map<std::string, MediaSource*> sourcesByName_;
+};
+
+}  // namespace server
+
+#endif  // STREAM_CATALOG_H
@@ -3,7 +3,9 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -19,8 +21,9 @@ static const int32_t RECV_BUFFER_SIZE = 65536;
 TcpServer::TcpServer()
     : serverFd_(-1),
       epollFd_(-1),
-      timerFd_(-1),
       isRunning_(false) {
+    serverTag_.fd = -1;
+    timerTag_.fd = -1;
 }
 
 TcpServer::~TcpServer() {
@@ -82,7 +85,7 @@ bool TcpServer::Start(uint16_t port) {
 
     struct epoll_event ev;
     ev.events = EPOLLIN;
-    ev.data.fd = serverFd_;
+    ev.data.ptr = &serverTag_;
     if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, serverFd_, &ev) < 0) {
         std::fprintf(stderr, "Failed to add server to epoll: %s\n", std::strerror(errno));
         close(epollFd_);
@@ -110,10 +113,9 @@ void TcpServer::Stop() {
 }
 
 void TcpServer::RegisterTimer(int32_t timerFd) {
-    timerFd_ = timerFd;
     struct epoll_event ev;
     ev.events = EPOLLIN;
-    ev.data.fd = timerFd;
+    ev.data.ptr = &timerTag_;
     if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd, &ev) < 0) {
         std::fprintf(stderr, "Failed to add timer to epoll: %s\n", std::strerror(errno));
     }
@@ -139,20 +141,21 @@ void TcpServer::ProcessEvents(int32_t timeoutMs) {
     }
 
     for (int32_t i = 0; i < nfds; ++i) {
-        int32_t fd = events[i].data.fd;
+        TcpClient* client = static_cast<TcpClient*>(events[i].data.ptr);
 
-        if (fd == serverFd_) {
+        if (client == &serverTag_) {
             AcceptConnection();
-        } else if (fd == timerFd_) {
+        } else if (client == &timerTag_) {
             if (timerCallback_) {
                 timerCallback_();
             }
-        } else {
-            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
-                RemoveClient(fd);
-            } else if (events[i].events & EPOLLIN) {
-                HandleClientData(fd);
-            }
+        } else if (client->fd < 0) {
+            // Closed by an earlier event of this batch
+            continue;
+        } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            RemoveClient(client);
+        } else if (events[i].events & EPOLLIN) {
+            HandleClientData(client);
         }
     }
 }
@@ -177,59 +180,62 @@ void TcpServer::AcceptConnection() {
             continue;
         }
 
-        struct epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;
-        ev.data.fd = clientFd;
-        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, clientFd, &ev) < 0) {
-            std::fprintf(stderr, "Failed to add client to epoll: %s\n", std::strerror(errno));
+        char ipStr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &clientAddr.sin_addr, ipStr, sizeof(ipStr));
+        TcpClient* client = callbacks_.onAccept ? callbacks_.onAccept(clientFd, ipStr) : nullptr;
+        if (client == nullptr) {
             close(clientFd);
             continue;
         }
 
-        char ipStr[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &clientAddr.sin_addr, ipStr, sizeof(ipStr));
-        std::string clientIp(ipStr);
-        clientIps_[clientFd] = clientIp;
-
-        if (callbacks_.onConnect) {
-            callbacks_.onConnect(clientFd, clientIp);
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = client;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, clientFd, &ev) < 0) {
+            std::fprintf(stderr, "Failed to add client to epoll: %s\n", std::strerror(errno));
+            RemoveClient(client);
         }
     }
 }
 
-void TcpServer::HandleClientData(int32_t fd) {
+void TcpServer::HandleClientData(TcpClient* client) {
     uint8_t buffer[RECV_BUFFER_SIZE];
 
-    while (true) {
-        ssize_t bytesRead = recv(fd, buffer, sizeof(buffer), 0);
+    // The data callback may close the client
+    while (client->fd >= 0) {
+        ssize_t bytesRead = recv(client->fd, buffer, sizeof(buffer), 0);
 
         if (bytesRead < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 break;
             }
-            RemoveClient(fd);
+            RemoveClient(client);
             return;
         }
 
         if (bytesRead == 0) {
-            RemoveClient(fd);
+            RemoveClient(client);
             return;
         }
 
         if (callbacks_.onData) {
-            callbacks_.onData(fd, buffer, static_cast<size_t>(bytesRead));
+            callbacks_.onData(client, buffer, static_cast<size_t>(bytesRead));
         }
     }
 }
 
-void TcpServer::RemoveClient(int32_t fd) {
+void TcpServer::RemoveClient(TcpClient* client) {
+    int32_t fd = client->fd;
+    if (fd < 0) {
+        return;
+    }
     epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
 
     if (callbacks_.onDisconnect) {
-        callbacks_.onDisconnect(fd);
+        callbacks_.onDisconnect(client);
     }
 
-    clientIps_.erase(fd);
+    client->fd = -1;
     close(fd);
 }
 
@@ -250,8 +256,27 @@ int32_t TcpServer::SendData(int32_t fd, const uint8_t* data, size_t len) {
     return static_cast<int32_t>(totalSent);
 }
 
-void TcpServer::CloseConnection(int32_t fd) {
-    RemoveClient(fd);
+size_t TcpServer::GetSendQueueBytes(int32_t fd) {
+    int pending = 0;
+    if (ioctl(fd, TIOCOUTQ, &pending) < 0 || pending < 0) {
+        return 0;
+    }
+    return static_cast<size_t>(pending);
+}
+
+bool TcpServer::GetPathInfo(int32_t fd, uint32_t& mssBytes, uint32_t& cwndSegments) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return false;
+    }
+    mssBytes = info.tcpi_snd_mss;
+    cwndSegments = info.tcpi_snd_cwnd;
+    return true;
+}
+
+void TcpServer::CloseConnection(TcpClient* client) {
+    RemoveClient(client);
 }
 
 }  // namespace server
@@ -5,17 +5,34 @@
 #include <functional>
 #include <memory>
 #include <string>
-#include <unordered_map>
 
 namespace server {
 
+/**
+ * @brief Socket state of one client
+ *
+ * The epoll registration points straight at this object, so events need
+ * no lookup by fd. Layers above extend it (TlsConnection, Connection) and
+ * the owner allocates the most derived object in onAccept.
+ */
+struct TcpClient {
+    int32_t fd;         // -1 once closed; the object outlives the event batch
+    std::string ip;
+};
+
 /**
  * @brief TCP connection event callbacks
+ *
+ * Every client returned by onAccept gets exactly one onDisconnect. The
+ * owner must not free it before ProcessEvents() returns: later events of
+ * the same batch may still point at it.
  */
 struct TcpCallbacks {
-    std::function<void(int32_t fd, const std::string& ip)> onConnect;
-    std::function<void(int32_t fd)> onDisconnect;
-    std::function<void(int32_t fd, const uint8_t* data, size_t len)> onData;
+    // Create the client object (fd and ip set) for an accepted socket;
+    // nullptr rejects it
+    std::function<TcpClient*(int32_t fd, const std::string& ip)> onAccept;
+    std::function<void(TcpClient* client)> onDisconnect;
+    std::function<void(TcpClient* client, const uint8_t* data, size_t len)> onData;
 };
 
 /**
@@ -57,10 +74,26 @@ public:
     int32_t SendData(int32_t fd, const uint8_t* data, size_t len);
 
     /**
-     * @brief Close a client connection
+     * @brief Get bytes written to a client socket but not yet acknowledged
      * @param fd client file descriptor
+     * @return queued bytes, 0 on error
+     */
+    static size_t GetSendQueueBytes(int32_t fd);
+
+    /**
+     * @brief Get the send MSS and congestion window of a client socket
+     * @param fd client file descriptor
+     * @param mssBytes receives the send MSS in bytes
+     * @param cwndSegments receives the congestion window in segments
+     * @return false if TCP_INFO is not available
+     */
+    static bool GetPathInfo(int32_t fd, uint32_t& mssBytes, uint32_t& cwndSegments);
+
+    /**
+     * @brief Close a client connection; closing it again is a no-op
+     * @param client client returned by onAccept
      */
-    void CloseConnection(int32_t fd);
+    void CloseConnection(TcpClient* client);
 
     /**
      * @brief Register a timer fd to epoll
@@ -90,17 +123,19 @@ public:
 
 private:
     void AcceptConnection();
-    void HandleClientData(int32_t fd);
-    void RemoveClient(int32_t fd);
+    void HandleClientData(TcpClient* client);
+    void RemoveClient(TcpClient* client);
     bool SetNonBlocking(int32_t fd);
 
     int32_t serverFd_;
     int32_t epollFd_;
-    int32_t timerFd_;
     bool isRunning_;
     TcpCallbacks callbacks_;
     std::function<void()> timerCallback_;
-    std::unordered_map<int32_t, std::string> clientIps_;
+    // Registration tags of the listening socket and the timer; clients
+    // are tagged with their TcpClient
+    TcpClient serverTag_;
+    TcpClient timerTag_;
 };
 
 }  // namespace server
@@ -0,0 +1,223 @@
+#include "thumbnail_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "frame_protocol.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+namespace server {
+
+// MJPEG quantizer scale, 2 (best) .. 31; thumbnails are viewed small
+static const int32_t JPEG_QSCALE = 6;
+
+ThumbnailCache::ThumbnailCache()
+    : isRunning_(false),
+      maxWidth_(0) {
+    decoders_[0] = nullptr;
+    decoders_[1] = nullptr;
+}
+
+ThumbnailCache::~ThumbnailCache() {
+    Stop();
+}
+
+bool ThumbnailCache::Start(size_t sourceCount, uint32_t maxWidth) {
+    if (isRunning_ || maxWidth < 2) {
+        return false;
+    }
+    maxWidth_ = maxWidth;
+    isPending_.assign(sourceCount, false);
+    thumbnails_.assign(sourceCount, nullptr);
+    isRunning_ = true;
+    thread_ = std::thread(&ThumbnailCache::Run, this);
+    std::printf("Thumbnails: %zu source(s), up to %u px wide\n", sourceCount, maxWidth);
+    return true;
+}
+
+void ThumbnailCache::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!isRunning_) {
+            return;
+        }
+        isRunning_ = false;
+        jobs_.clear();
+    }
+    wake_.notify_one();
+    thread_.join();
+
+    for (AVCodecContext*& decoder : decoders_) {
+        avcodec_free_context(&decoder);
+    }
+}
+
+void ThumbnailCache::Submit(size_t index, bool isH265, std::vector<uint8_t> keyframe,
+                            uint16_t picId) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!isRunning_ || index >= thumbnails_.size()) {
+            return;
+        }
+        Job job = {index, isH265, picId, std::move(keyframe)};
+        auto it = std::find_if(jobs_.begin(), jobs_.end(),
+                               [index](const Job& queued) { return queued.index == index; });
+        if (it != jobs_.end()) {
+            *it = std::move(job);
+        } else {
+            jobs_.push_back(std::move(job));
+        }
+        isPending_[index] = true;
+    }
+    wake_.notify_one();
+}
+
+std::shared_ptr<const Thumbnail> ThumbnailCache::Get(size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (index < thumbnails_.size()) ? thumbnails_[index] : nullptr;
+}
+
+bool ThumbnailCache::IsPending(size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index < isPending_.size() && isPending_[index];
+}
+
+void ThumbnailCache::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this]() { return !isRunning_ || !jobs_.empty(); });
+        if (!isRunning_) {
+            return;
+        }
+        Job job = std::move(jobs_.front());
+        jobs_.pop_front();
+
+        // Decoding and encoding run unlocked; the event loop only waits
+        // for the swap of the finished message
+        lock.unlock();
+        std::vector<uint8_t> jpeg;
+        bool isMade = MakeJpeg(job, jpeg);
+        std::shared_ptr<Thumbnail> thumbnail;
+        if (isMade) {
+            thumbnail = std::make_shared<Thumbnail>();
+            thumbnail->message = FrameProtocol::EncodeImageFrame(
+                ImageFormat::JPEG, ImagePurpose::THUMBNAIL, job.picId, jpeg.data(), jpeg.size(), 0);
+        } else {
+            std::fprintf(stderr, "Thumbnail of source %zu failed\n", job.index);
+        }
+        lock.lock();
+
+        if (isMade) {
+            const auto& previous = thumbnails_[job.index];
+            thumbnail->generation = previous ? previous->generation + 1 : 1;
+            thumbnails_[job.index] = thumbnail;
+        }
+        // A newer keyframe of the same source may have been queued meanwhile
+        isPending_[job.index] = std::any_of(
+            jobs_.begin(), jobs_.end(), [&job](const Job& queued) { return queued.index == job.index; });
+    }
+}
+
+// Decode a single keyframe; draining makes the decoder output it at once
+static bool DecodeKeyframe(AVCodecContext* decoder, const std::vector<uint8_t>& keyframe,
+                           AVFrame* frame) {
+    AVPacket* pkt = av_packet_alloc();
+    if (pkt == nullptr || av_new_packet(pkt, static_cast<int>(keyframe.size())) < 0) {
+        av_packet_free(&pkt);
+        return false;
+    }
+    std::memcpy(pkt->data, keyframe.data(), keyframe.size());
+    pkt->flags = AV_PKT_FLAG_KEY;
+
+    bool isDecoded = avcodec_send_packet(decoder, pkt) >= 0 &&
+                     avcodec_send_packet(decoder, nullptr) >= 0 &&
+                     avcodec_receive_frame(decoder, frame) >= 0;
+    // Leave draining mode for the next keyframe
+    avcodec_flush_buffers(decoder);
+    av_packet_free(&pkt);
+    return isDecoded;
+}
+
+// Scale a decoded picture to width x height (full-range YUV 4:2:0, as MJPEG
+// expects) and encode it as one JPEG
+static bool EncodeJpeg(const AVFrame* picture, int32_t width, int32_t height,
+                       std::vector<uint8_t>& jpeg) {
+    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    AVCodecContext* encoder = (codec != nullptr) ? avcodec_alloc_context3(codec) : nullptr;
+    AVFrame* scaled = av_frame_alloc();
+    AVPacket* pkt = av_packet_alloc();
+    SwsContext* sws = sws_getContext(picture->width, picture->height,
+                                     static_cast<AVPixelFormat>(picture->format),
+                                     width, height, AV_PIX_FMT_YUVJ420P,
+                                     SWS_BILINEAR, nullptr, nullptr, nullptr);
+    bool isEncoded = false;
+
+    if (encoder != nullptr && scaled != nullptr && pkt != nullptr && sws != nullptr) {
+        encoder->width = width;
+        encoder->height = height;
+        encoder->pix_fmt = AV_PIX_FMT_YUVJ420P;
+        encoder->time_base = AVRational{1, 25};
+        encoder->flags |= AV_CODEC_FLAG_QSCALE;
+        encoder->global_quality = FF_QP2LAMBDA * JPEG_QSCALE;
+
+        scaled->format = AV_PIX_FMT_YUVJ420P;
+        scaled->width = width;
+        scaled->height = height;
+        scaled->quality = encoder->global_quality;
+
+        isEncoded = avcodec_open2(encoder, codec, nullptr) >= 0 &&
+                    av_frame_get_buffer(scaled, 0) >= 0 &&
+                    sws_scale(sws, picture->data, picture->linesize, 0, picture->height,
+                              scaled->data, scaled->linesize) == height &&
+                    avcodec_send_frame(encoder, scaled) >= 0 &&
+                    avcodec_receive_packet(encoder, pkt) >= 0;
+        if (isEncoded) {
+            jpeg.assign(pkt->data, pkt->data + pkt->size);
+        }
+    }
+
+    sws_freeContext(sws);
+    av_packet_free(&pkt);
+    av_frame_free(&scaled);
+    avcodec_free_context(&encoder);
+    return isEncoded;
+}
+
+bool ThumbnailCache::MakeJpeg(const Job& job, std::vector<uint8_t>& jpeg) {
+    AVCodecContext*& decoder = decoders_[job.isH265 ? 1 : 0];
+    if (decoder == nullptr) {
+        const AVCodec* codec = avcodec_find_decoder(job.isH265 ? AV_CODEC_ID_HEVC
+                                                               : AV_CODEC_ID_H264);
+        decoder = (codec != nullptr) ? avcodec_alloc_context3(codec) : nullptr;
+        if (decoder == nullptr) {
+            return false;
+        }
+        // One worker serves every source; frame threads would only add delay
+        decoder->thread_count = 1;
+        if (avcodec_open2(decoder, codec, nullptr) < 0) {
+            avcodec_free_context(&decoder);
+            return false;
+        }
+    }
+
+    AVFrame* picture = av_frame_alloc();
+    bool isMade = false;
+    if (picture != nullptr && DecodeKeyframe(decoder, job.keyframe, picture) &&
+        picture->width > 0 && picture->height > 0) {
+        // Even dimensions for 4:2:0, aspect ratio kept
+        int32_t width = std::min(static_cast<int32_t>(maxWidth_), picture->width) & ~1;
+        int32_t height = std::max(2, static_cast<int32_t>(
+            static_cast<int64_t>(picture->height) * width / picture->width) & ~1);
+        isMade = EncodeJpeg(picture, width, height, jpeg);
+    }
+    av_frame_free(&picture);
+    return isMade;
+}
+
+}  // namespace server
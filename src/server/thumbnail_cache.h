@@ -0,0 +1,100 @@
+#ifndef THUMBNAIL_CACHE_H
+#define THUMBNAIL_CACHE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct AVCodecContext;
+
+namespace server {
+
+/**
+ * @brief Latest still of one source, ready to send
+ */
+struct Thumbnail {
+    std::vector<uint8_t> message;   // IMAGE protocol message holding the JPEG
+    uint32_t generation;            // increases with every refresh of the source
+};
+
+/**
+ * @brief Per-source JPEG thumbnails made on a background thread
+ *
+ * The event loop copies a keyframe of each source and submits it; the
+ * worker decodes it with libavcodec, scales it down and encodes it with the
+ * MJPEG encoder. The result is cached as a complete IMAGE message that
+ * every overview subscriber is sent unchanged, so thumbnail CPU grows with
+ * the number of sources, not with viewers.
+ */
+class ThumbnailCache {
+public:
+    ThumbnailCache();
+    ~ThumbnailCache();
+
+    ThumbnailCache(const ThumbnailCache&) = delete;
+    ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+    /**
+     * @brief Start the worker thread
+     * @param sourceCount number of sources; thumbnails are indexed 0..n-1
+     * @param maxWidth thumbnail width limit; smaller pictures keep their size
+     * @return true on success
+     */
+    bool Start(size_t sourceCount, uint32_t maxWidth);
+
+    /**
+     * @brief Stop the worker thread and drop pending keyframes
+     */
+    void Stop();
+
+    /**
+     * @brief Queue a keyframe for thumbnailing; replaces a keyframe of the
+     *        same source that is still waiting
+     * @param index source index
+     * @param isH265 codec of the keyframe
+     * @param keyframe Annex-B keyframe with its parameter sets
+     * @param picId picture ID written to the IMAGE message
+     */
+    void Submit(size_t index, bool isH265, std::vector<uint8_t> keyframe, uint16_t picId);
+
+    /**
+     * @brief Get the latest thumbnail of a source (thread-safe)
+     * @return thumbnail, nullptr until the first one is ready
+     */
+    std::shared_ptr<const Thumbnail> Get(size_t index) const;
+
+    /**
+     * @brief Check whether a keyframe of the source is queued or being made
+     */
+    bool IsPending(size_t index) const;
+
+private:
+    struct Job {
+        size_t index;
+        bool isH265;
+        uint16_t picId;
+        std::vector<uint8_t> keyframe;
+    };
+
+    void Run();
+    bool MakeJpeg(const Job& job, std::vector<uint8_t>& jpeg);
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread thread_;
+    bool isRunning_;
+    uint32_t maxWidth_;
+    std::deque<Job> jobs_;
+    std::vector<bool> isPending_;
+    std::vector<std::shared_ptr<const Thumbnail>> thumbnails_;
+    // Worker thread only: decoders are reused across jobs (0 = H.264, 1 = H.265)
+    AVCodecContext* decoders_[2];
+};
+
+}  // namespace server
+
+#endif  // THUMBNAIL_CACHE_H
@@ -23,15 +23,17 @@ bool TlsServer::Start(uint16_t port, const std::string& certPath, const std::str
         return false;
     }
 
+    // Clients are TlsConnections created by OnTcpAccept, so the downcasts
+    // below are safe
     TcpCallbacks tcpCallbacks;
-    tcpCallbacks.onConnect = [this](int32_t fd, const std::string& ip) {
-        OnTcpConnect(fd, ip);
+    tcpCallbacks.onAccept = [this](int32_t fd, const std::string& ip) {
+        return OnTcpAccept(fd, ip);
     };
-    tcpCallbacks.onDisconnect = [this](int32_t fd) {
-        OnTcpDisconnect(fd);
+    tcpCallbacks.onDisconnect = [this](TcpClient* client) {
+        OnTcpDisconnect(static_cast<TlsConnection*>(client));
     };
-    tcpCallbacks.onData = [this](int32_t fd, const uint8_t* data, size_t len) {
-        OnTcpData(fd, data, len);
+    tcpCallbacks.onData = [this](TcpClient* client, const uint8_t* data, size_t len) {
+        OnTcpData(static_cast<TlsConnection*>(client), data, len);
     };
 
     tcpServer_.SetCallbacks(tcpCallbacks);
@@ -40,11 +42,7 @@ bool TlsServer::Start(uint16_t port, const std::string& certPath, const std::str
 }
 
 void TlsServer::Stop() {
-    for (auto& pair : tlsConnections_) {
-        mbedtls_ssl_close_notify(&pair.second.ssl);
-        mbedtls_ssl_free(&pair.second.ssl);
-    }
-    tlsConnections_.clear();
+    // Clients are owned by the caller, which closes them before stopping
     tcpServer_.Stop();
 }
 
@@ -56,7 +54,7 @@ void TlsServer::RegisterTimer(int32_t timerFd) {
     tcpServer_.RegisterTimer(timerFd);
 }
 
-void TlsServer::SetCallbacks(const TcpCallbacks& callbacks) {
+void TlsServer::SetCallbacks(const TlsCallbacks& callbacks) {
     userCallbacks_ = callbacks;
 }
 
@@ -68,43 +66,47 @@ bool TlsServer::IsRunning() const {
     return tcpServer_.IsRunning();
 }
 
-void TlsServer::OnTcpConnect(int32_t fd, const std::string& ip) {
-    if (!StartTlsHandshake(fd)) {
-        tcpServer_.CloseConnection(fd);
-        return;
+TcpClient* TlsServer::OnTcpAccept(int32_t fd, const std::string& ip) {
+    TlsConnection* conn = userCallbacks_.onAccept ? userCallbacks_.onAccept(fd, ip) : nullptr;
+    if (conn == nullptr) {
+        return nullptr;
+    }
+    if (!StartTlsHandshake(conn)) {
+        // Not registered with epoll yet: hand it back to the owner here
+        if (userCallbacks_.onDisconnect) {
+            userCallbacks_.onDisconnect(conn);
+        }
+        conn->fd = -1;
+        return nullptr;
     }
+    return conn;
 }
 
-void TlsServer::OnTcpDisconnect(int32_t fd) {
-    bool wasConnected = false;
-    auto it = tlsConnections_.find(fd);
-    if (it != tlsConnections_.end()) {
-        wasConnected = it->second.handshakeComplete;
-    }
-    RemoveTlsConnection(fd);
-    if (wasConnected && userCallbacks_.onDisconnect) {
-        userCallbacks_.onDisconnect(fd);
+void TlsServer::OnTcpDisconnect(TlsConnection* conn) {
+    FreeTls(conn);
+    if (userCallbacks_.onDisconnect) {
+        userCallbacks_.onDisconnect(conn);
     }
 }
 
-void TlsServer::OnTcpData(int32_t fd, const uint8_t* data, size_t len) {
-    auto it = tlsConnections_.find(fd);
-    if (it == tlsConnections_.end()) {
+void TlsServer::OnTcpData(TlsConnection* conn, const uint8_t* data, size_t len) {
+    if (!conn->hasSsl) {
         return;
     }
 
     // Append raw TCP data to the TLS connection's receive buffer
-    it->second.recvBuf.insert(it->second.recvBuf.end(), data, data + len);
+    conn->recvBuf.insert(conn->recvBuf.end(), data, data + len);
 
-    if (!it->second.handshakeComplete) {
-        ContinueTlsHandshake(fd);
+    if (!conn->handshakeComplete) {
+        ContinueTlsHandshake(conn);
         return;
     }
 
-    // Read decrypted data from mbedtls
+    // Read decrypted data from mbedtls; the data callback may close the
+    // connection
     uint8_t buffer[65536];
-    while (true) {
-        int ret = mbedtls_ssl_read(&it->second.ssl, buffer, sizeof(buffer));
+    while (conn->hasSsl) {
+        int ret = mbedtls_ssl_read(&conn->ssl, buffer, sizeof(buffer));
         if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
             break;
         }
@@ -114,48 +116,39 @@ void TlsServer::OnTcpData(int32_t fd, const uint8_t* data, size_t len) {
                 mbedtls_strerror(ret, errBuf, sizeof(errBuf));
                 std::fprintf(stderr, "mbedtls_ssl_read failed: %s\n", errBuf);
             }
-            tcpServer_.CloseConnection(fd);
+            tcpServer_.CloseConnection(conn);
             return;
         }
 
         if (userCallbacks_.onData) {
-            userCallbacks_.onData(fd, buffer, static_cast<size_t>(ret));
+            userCallbacks_.onData(conn, buffer, static_cast<size_t>(ret));
         }
     }
 }
 
-bool TlsServer::StartTlsHandshake(int32_t fd) {
-    TlsConnection tlsConn;
-    mbedtls_ssl_init(&tlsConn.ssl);
-    tlsConn.handshakeComplete = false;
-    tlsConn.fd = fd;
-    tlsConn.recvBufOffset = 0;
+bool TlsServer::StartTlsHandshake(TlsConnection* conn) {
+    mbedtls_ssl_init(&conn->ssl);
+    conn->handshakeComplete = false;
+    conn->recvBuf.clear();
+    conn->recvBufOffset = 0;
 
-    int ret = mbedtls_ssl_setup(&tlsConn.ssl, tlsContext_.GetConfig());
+    int ret = mbedtls_ssl_setup(&conn->ssl, tlsContext_.GetConfig());
     if (ret != 0) {
         char errBuf[256];
         mbedtls_strerror(ret, errBuf, sizeof(errBuf));
         std::fprintf(stderr, "mbedtls_ssl_setup failed: %s\n", errBuf);
-        mbedtls_ssl_free(&tlsConn.ssl);
+        mbedtls_ssl_free(&conn->ssl);
         return false;
     }
 
-    tlsConnections_[fd] = std::move(tlsConn);
-
-    // Set BIO after inserting into map, so the pointer is stable
-    auto it = tlsConnections_.find(fd);
-    mbedtls_ssl_set_bio(&it->second.ssl, &it->second, SslSend, SslRecv, nullptr);
-
+    // The connection object does not move, so it can be the BIO context
+    mbedtls_ssl_set_bio(&conn->ssl, conn, SslSend, SslRecv, nullptr);
+    conn->hasSsl = true;
     return true;
 }
 
-void TlsServer::ContinueTlsHandshake(int32_t fd) {
-    auto it = tlsConnections_.find(fd);
-    if (it == tlsConnections_.end()) {
-        return;
-    }
-
-    int ret = mbedtls_ssl_handshake(&it->second.ssl);
+void TlsServer::ContinueTlsHandshake(TlsConnection* conn) {
+    int ret = mbedtls_ssl_handshake(&conn->ssl);
     if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
         return;
     }
@@ -164,27 +157,26 @@ void TlsServer::ContinueTlsHandshake(int32_t fd) {
         char errBuf[256];
         mbedtls_strerror(ret, errBuf, sizeof(errBuf));
         std::fprintf(stderr, "TLS handshake failed: %s\n", errBuf);
-        tcpServer_.CloseConnection(fd);
+        tcpServer_.CloseConnection(conn);
         return;
     }
 
-    it->second.handshakeComplete = true;
-    std::printf("TLS handshake completed for fd %d\n", fd);
+    conn->handshakeComplete = true;
+    std::printf("TLS handshake completed for fd %d\n", conn->fd);
 
     if (userCallbacks_.onConnect) {
-        userCallbacks_.onConnect(fd, "");
+        userCallbacks_.onConnect(conn);
     }
 }
 
-int32_t TlsServer::SendData(int32_t fd, const uint8_t* data, size_t len) {
-    auto it = tlsConnections_.find(fd);
-    if (it == tlsConnections_.end() || !it->second.handshakeComplete) {
+int32_t TlsServer::SendData(TlsConnection* conn, const uint8_t* data, size_t len) {
+    if (!conn->hasSsl || !conn->handshakeComplete) {
         return -1;
     }
 
     size_t totalSent = 0;
     while (totalSent < len) {
-        int ret = mbedtls_ssl_write(&it->second.ssl, data + totalSent, len - totalSent);
+        int ret = mbedtls_ssl_write(&conn->ssl, data + totalSent, len - totalSent);
         if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
             continue;
         }
@@ -200,17 +192,24 @@ int32_t TlsServer::SendData(int32_t fd, const uint8_t* data, size_t len) {
     return static_cast<int32_t>(totalSent);
 }
 
-void TlsServer::CloseConnection(int32_t fd) {
-    RemoveTlsConnection(fd);
-    tcpServer_.CloseConnection(fd);
+size_t TlsServer::GetMaxRecordPayload(const TlsConnection* conn) const {
+    if (!conn->hasSsl || !conn->handshakeComplete) {
+        return 0;
+    }
+    int ret = mbedtls_ssl_get_max_out_record_payload(&conn->ssl);
+    return (ret > 0) ? static_cast<size_t>(ret) : 0;
+}
+
+void TlsServer::CloseConnection(TlsConnection* conn) {
+    tcpServer_.CloseConnection(conn);
 }
 
-void TlsServer::RemoveTlsConnection(int32_t fd) {
-    auto it = tlsConnections_.find(fd);
-    if (it != tlsConnections_.end()) {
-        mbedtls_ssl_close_notify(&it->second.ssl);
-        mbedtls_ssl_free(&it->second.ssl);
-        tlsConnections_.erase(it);
+void TlsServer::FreeTls(TlsConnection* conn) {
+    if (conn->hasSsl) {
+        mbedtls_ssl_close_notify(&conn->ssl);
+        mbedtls_ssl_free(&conn->ssl);
+        conn->hasSsl = false;
+        conn->handshakeComplete = false;
     }
 }
 
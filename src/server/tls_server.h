@@ -4,9 +4,8 @@
 #include <mbedtls/ssl.h>
 
 #include <cstdint>
-#include <memory>
+#include <functional>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #include "tcp_server.h"
@@ -14,14 +13,32 @@
 
 namespace server {
 
-struct TlsConnection {
+/**
+ * @brief TLS state of one client, on top of its socket state
+ */
+struct TlsConnection : TcpClient {
     mbedtls_ssl_context ssl;
     bool handshakeComplete;
-    int32_t fd;
-    std::vector<uint8_t> recvBuf;
+    bool hasSsl;                    // ssl set up and not freed yet
+    std::vector<uint8_t> recvBuf;   // ciphertext not yet read by mbedtls
     size_t recvBufOffset;
 };
 
+/**
+ * @brief TLS connection event callbacks; the client lifetime rules of
+ *        TcpCallbacks apply
+ */
+struct TlsCallbacks {
+    // Create the client object (fd and ip set) for an accepted socket;
+    // nullptr rejects it
+    std::function<TlsConnection*(int32_t fd, const std::string& ip)> onAccept;
+    // TLS handshake completed
+    std::function<void(TlsConnection* conn)> onConnect;
+    std::function<void(TlsConnection* conn)> onDisconnect;
+    // Decrypted application data
+    std::function<void(TlsConnection* conn, const uint8_t* data, size_t len)> onData;
+};
+
 class TlsServer {
 public:
     TlsServer();
@@ -36,26 +53,35 @@ public:
 
     void ProcessEvents(int32_t timeoutMs);
 
-    int32_t SendData(int32_t fd, const uint8_t* data, size_t len);
+    int32_t SendData(TlsConnection* conn, const uint8_t* data, size_t len);
+
+    size_t GetSendQueueBytes(int32_t fd) const { return TcpServer::GetSendQueueBytes(fd); }
+
+    bool GetPathInfo(int32_t fd, uint32_t& mssBytes, uint32_t& cwndSegments) const {
+        return TcpServer::GetPathInfo(fd, mssBytes, cwndSegments);
+    }
+
+    // Largest plaintext one TLS record carries on this connection, 0 if unknown
+    size_t GetMaxRecordPayload(const TlsConnection* conn) const;
 
-    void CloseConnection(int32_t fd);
+    void CloseConnection(TlsConnection* conn);
 
     void RegisterTimer(int32_t timerFd);
 
-    void SetCallbacks(const TcpCallbacks& callbacks);
+    void SetCallbacks(const TlsCallbacks& callbacks);
 
     void SetTimerCallback(std::function<void()> callback);
 
     bool IsRunning() const;
 
 private:
-    void OnTcpConnect(int32_t fd, const std::string& ip);
-    void OnTcpDisconnect(int32_t fd);
-    void OnTcpData(int32_t fd, const uint8_t* data, size_t len);
+    TcpClient* OnTcpAccept(int32_t fd, const std::string& ip);
+    void OnTcpDisconnect(TlsConnection* conn);
+    void OnTcpData(TlsConnection* conn, const uint8_t* data, size_t len);
 
-    bool StartTlsHandshake(int32_t fd);
-    void ContinueTlsHandshake(int32_t fd);
-    void RemoveTlsConnection(int32_t fd);
+    bool StartTlsHandshake(TlsConnection* conn);
+    void ContinueTlsHandshake(TlsConnection* conn);
+    void FreeTls(TlsConnection* conn);
 
     // mbedtls I/O callbacks: send directly to socket, recv from buffer
     static int SslSend(void* ctx, const unsigned char* buf, size_t len);
@@ -63,8 +89,7 @@ private:
 
     TcpServer tcpServer_;
     TlsContext tlsContext_;
-    std::unordered_map<int32_t, TlsConnection> tlsConnections_;
-    TcpCallbacks userCallbacks_;
+    TlsCallbacks userCallbacks_;
 };
 
 }  // namespace server
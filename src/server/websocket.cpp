@@ -3,6 +3,7 @@
 #include <mbedtls/base64.h>
 #include <mbedtls/sha1.h>
 
+#include <cstdio>
 #include <cstring>
 
 namespace server {
@@ -80,6 +81,31 @@ bool WebSocket::HandleHandshake(const std::string& request, std::string& respons
     return true;
 }
 
+std::string WebSocket::GetRequestPath(const std::string& request) {
+    // Request line: GET <path>[?query] HTTP/1.1
+    size_t start = request.find(' ');
+    if (start == std::string::npos) {
+        return "";
+    }
+    ++start;
+
+    size_t end = request.find_first_of(" ?\r\n", start);
+    if (end == std::string::npos || end == start) {
+        return "";
+    }
+    return request.substr(start, end - start);
+}
+
+std::string WebSocket::CreateHttpErrorResponse(uint16_t status, const std::string& reason) {
+    char statusLine[64];
+    std::snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %u ", status);
+
+    return std::string(statusLine) + reason + "\r\n"
+           "Content-Length: 0\r\n"
+           "Connection: close\r\n"
+           "\r\n";
+}
+
 bool WebSocket::ParseFrame(const uint8_t* data, size_t len, WsFrame& frame, size_t& consumed) {
     if (len < 2) {
         return false;
@@ -52,6 +52,21 @@ public:
      */
     static bool HandleHandshake(const std::string& request, std::string& response);
 
+    /**
+     * @brief Extract the request target path from an HTTP request line
+     * @param request HTTP request string
+     * @return path without query string, empty if the request line is malformed
+     */
+    static std::string GetRequestPath(const std::string& request);
+
+    /**
+     * @brief Build a plain HTTP error response used to refuse an upgrade
+     * @param status HTTP status code
+     * @param reason status reason phrase
+     * @return response string
+     */
+    static std::string CreateHttpErrorResponse(uint16_t status, const std::string& reason);
+
     /**
      * @brief Parse WebSocket frame from raw data
      * @param data raw data
@@ -25,6 +25,7 @@ static AVPacket* g_video_packet = NULL;
 static const AVCodec* g_video_codec = NULL;
 static AVCodecParserContext* g_video_parser = NULL;
 static int g_video_initialized = 0;
+static int g_video_slice_input = 0;  // packets are whole NAL units, not whole frames
 
 // ===========================
 // Audio global state
@@ -92,6 +93,7 @@ static void cleanup_video_decoder(void) {
         g_video_parser = NULL;
     }
     g_video_codec = NULL;
+    g_video_slice_input = 0;
 }
 
 // ===========================
@@ -150,18 +152,18 @@ int decoder_init_video(CodecType codec_type) {
     return 0;
 }
 
-DecodeStatus decoder_send_video_packet(const uint8_t* data, int size, int64_t pts) {
+DecodeStatus decoder_send_video_packet(const uint8_t* data, int size, int64_t pts, int64_t dts) {
     if (!g_video_initialized || !g_video_ctx || !g_video_packet) {
         fprintf(stderr, "[decoder] Decoder not initialized\n");
         return DECODE_ERROR;
     }
 
-    if (!g_video_parser) {
-        // Fallback: send raw packet directly
+    if (!g_video_parser || g_video_slice_input) {
+        // Slice input, or fallback: send raw packet directly
         g_video_packet->data = (uint8_t*)data;
         g_video_packet->size = size;
         g_video_packet->pts = pts;
-        g_video_packet->dts = pts;
+        g_video_packet->dts = dts;
 
         int ret = avcodec_send_packet(g_video_ctx, g_video_packet);
         av_packet_unref(g_video_packet);
@@ -196,7 +198,7 @@ DecodeStatus decoder_send_video_packet(const uint8_t* data, int size, int64_t pt
             input_data,
             input_size,
             pts,
-            pts,
+            dts,
             0
         );
 
@@ -214,7 +216,7 @@ DecodeStatus decoder_send_video_packet(const uint8_t* data, int size, int64_t pt
             g_video_packet->data = out_data;
             g_video_packet->size = out_size;
             g_video_packet->pts = pts;
-            g_video_packet->dts = pts;
+            g_video_packet->dts = dts;
 
             int ret = avcodec_send_packet(g_video_ctx, g_video_packet);
             av_packet_unref(g_video_packet);
@@ -235,6 +237,22 @@ DecodeStatus decoder_send_video_packet(const uint8_t* data, int size, int64_t pt
     return has_packet ? DECODE_OK : DECODE_NEED_MORE_DATA;
 }
 
+int decoder_enable_slice_input(void) {
+    if (!g_video_initialized || !g_video_ctx) {
+        fprintf(stderr, "[decoder] Decoder not initialized\n");
+        return -1;
+    }
+    // Only the H.264 decoder finishes a picture from chunked input on its own
+    if (g_video_ctx->codec_id != AV_CODEC_ID_H264) {
+        return -2;
+    }
+
+    // Read by the H.264 decoder per packet, so it can be set after open
+    g_video_ctx->flags2 |= AV_CODEC_FLAG2_CHUNKS;
+    g_video_slice_input = 1;
+    return 0;
+}
+
 DecodeStatus decoder_receive_video_frame(VideoFrameInfo* frame_info) {
     if (!g_video_initialized || !g_video_ctx || !g_video_frame || !frame_info) {
         fprintf(stderr, "[decoder] Invalid parameters or decoder not initialized\n");
@@ -77,9 +77,18 @@ int decoder_init_video(CodecType codec_type);
  * @param data Encoded data pointer
  * @param size Data length
  * @param pts Presentation timestamp
+ * @param dts Decode timestamp (equal to pts for streams without B-frames)
  * @return DecodeStatus
  */
-DecodeStatus decoder_send_video_packet(const uint8_t* data, int size, int64_t pts);
+DecodeStatus decoder_send_video_packet(const uint8_t* data, int size, int64_t pts, int64_t dts);
+
+/**
+ * Accept packets holding whole NAL units of a frame instead of whole
+ * frames (H.264 only): each is decoded as it arrives and the picture is
+ * output once its last slice is in. Call after decoder_init_video.
+ * @return 0 on success, negative value if not supported
+ */
+int decoder_enable_slice_input(void);
 
 /**
  * Receive decoded video frame
@@ -14,15 +14,55 @@
 /* flags bit definitions */
 #define FLAG_FRAGMENT    0x01
 #define FLAG_HAS_COMMON  0x08
+#define FLAG_NAL_ALIGNED 0x10
 
 /* common_flags bit definitions */
-#define COMMON_ABS_TIME  0x01
+#define COMMON_ABS_TIME    0x01
+#define COMMON_WATERMARK   0x02
+#define COMMON_SEQ_NUMBER  0x04
+#define COMMON_DTS_OFFSET  0x08
+
+/* Protocol version 2 (compact headers) */
+#define COMPACT_VERSION           2
+#define COMPACT_BASE_HEADER_SIZE  3   /* version|msg_type, flags, stream_id */
+#define COMPACT_FRAGMENT          0x01
+#define COMPACT_ABSOLUTE          0x02
+#define COMPACT_DTS_OFFSET        0x04
+#define COMPACT_NAL_ALIGNED       0x08
+#define MSG_TYPE_SLOTS            8   /* timeline state indexed by msg_type */
+
+#define MSG_TYPE_AUDIO        0x02
+#define MSG_TYPE_AUDIO_BATCH  0x06
+
+/* Header fields of one message, from either protocol version */
+typedef struct {
+    uint8_t  msg_type;
+    uint8_t  flags;            /* version 1 flags; FLAG_FRAGMENT set for both */
+    int64_t  timestamp;
+    uint16_t frame_id;
+    uint16_t frag_index;
+    uint16_t total_frags;
+    int64_t  abs_time;
+    int32_t  dts_offset;
+    uint32_t seq_number;
+    uint8_t  video_codec;
+    uint8_t  video_frame_type;
+    uint16_t video_resolution;
+    uint8_t  audio_codec;
+    uint8_t  audio_sample_rate;
+    uint8_t  audio_channels;
+    const uint8_t* payload;
+    uint32_t payload_length;
+} MessageHeader;
 
 /* Fragment reassembly entry */
 typedef struct {
     uint16_t frame_id;
     uint16_t total_fragments;
     uint16_t received_count;
+    uint16_t contiguous_count; /* fragments 0..n-1 all received */
+    uint16_t aligned_count;    /* fragments 0..n-1 end on a NAL unit boundary */
+    uint16_t returned_count;   /* fragments 0..n-1 already returned as slices */
     uint32_t total_payload_size;
 
     /* Per-fragment storage */
@@ -37,6 +77,8 @@ typedef struct {
     uint16_t video_resolution;
     int64_t  timestamp;
     int64_t  abs_time;
+    int32_t  dts_offset;
+    uint32_t seq_number;
     uint8_t  audio_codec;
     uint8_t  audio_sample_rate;
     uint8_t  audio_channels;
@@ -49,6 +91,27 @@ static FragmentEntry* g_fragments = NULL;
 static int g_max_entries = 16;
 static int g_initialized = 0;
 
+/* Version 2 timeline: timestamps are deltas from the previous message of
+ * the same msg_type, valid once an absolute timestamp has been seen */
+static int64_t g_last_timestamp[MSG_TYPE_SLOTS];
+static int64_t g_abs_time_offset[MSG_TYPE_SLOTS];  /* abs_time - timestamp */
+static uint8_t g_timeline_valid[MSG_TYPE_SLOTS];
+static int g_sequenced = 0;  /* absolute messages carry a seq_number */
+
+/* AUDIO_BATCH being returned frame by frame by frame_protocol_next */
+typedef struct {
+    uint8_t* data;             /* owned copy of the batch payload */
+    uint32_t size;
+    uint32_t offset;           /* start of the next frame */
+    int64_t  timestamp;        /* timestamp of the previous frame */
+    int64_t  abs_time_offset;  /* abs_time - timestamp */
+    uint8_t  audio_codec;
+    uint8_t  audio_sample_rate;
+    uint8_t  audio_channels;
+} AudioBatchState;
+
+static AudioBatchState g_batch;
+
 /* Big-endian read helpers */
 static uint16_t read_be16(const uint8_t* p) {
     return (uint16_t)((p[0] << 8) | p[1]);
@@ -67,6 +130,26 @@ static int64_t read_be64(const uint8_t* p) {
     return (int64_t)val;
 }
 
+/* LEB128 varint; returns bytes read, 0 if truncated or too long */
+static int read_varint(const uint8_t* p, const uint8_t* end, uint64_t* out) {
+    uint64_t val = 0;
+    for (int i = 0; i < 10 && p + i < end; ++i) {
+        val |= (uint64_t)(p[i] & 0x7F) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *out = val;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static int read_signed_varint(const uint8_t* p, const uint8_t* end, int64_t* out) {
+    uint64_t zigzag = 0;
+    int n = read_varint(p, end, &zigzag);
+    *out = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    return n;
+}
+
 static void free_fragment_entry(FragmentEntry* entry) {
     if (entry->fragment_data != NULL) {
         for (uint16_t i = 0; i < entry->total_fragments; ++i) {
@@ -128,9 +211,11 @@ static FragmentEntry* alloc_fragment_entry(uint16_t frame_id,
     return entry;
 }
 
-static uint8_t* reassemble_fragments(FragmentEntry* entry, uint32_t* out_size) {
+/* Concatenate fragments [first, last) */
+static uint8_t* reassemble_fragments(FragmentEntry* entry, uint16_t first, uint16_t last,
+                                     uint32_t* out_size) {
     uint32_t total = 0;
-    for (uint16_t i = 0; i < entry->total_fragments; ++i) {
+    for (uint16_t i = first; i < last; ++i) {
         total += entry->fragment_sizes[i];
     }
 
@@ -141,7 +226,7 @@ static uint8_t* reassemble_fragments(FragmentEntry* entry, uint32_t* out_size) {
     }
 
     uint32_t offset = 0;
-    for (uint16_t i = 0; i < entry->total_fragments; ++i) {
+    for (uint16_t i = first; i < last; ++i) {
         memcpy(buf + offset, entry->fragment_data[i], entry->fragment_sizes[i]);
         offset += entry->fragment_sizes[i];
     }
@@ -157,6 +242,8 @@ static void parse_ext_headers(const uint8_t* ext_data, uint8_t ext_length,
                               uint16_t* out_frag_index,
                               uint16_t* out_total_frags,
                               int64_t* out_abs_time,
+                              uint32_t* out_seq_number,
+                              int32_t* out_dts_offset,
                               uint8_t* out_video_codec,
                               uint8_t* out_video_frame_type,
                               uint16_t* out_video_resolution,
@@ -186,6 +273,21 @@ static void parse_ext_headers(const uint8_t* ext_data, uint8_t ext_length,
             field_offset += 8;
         }
 
+        /* Fields are laid out in bit order; skip the ones not used here */
+        if (common_flags & COMMON_WATERMARK) {
+            field_offset += 4;
+        }
+        if ((common_flags & COMMON_SEQ_NUMBER) &&
+            field_offset + 4 <= common_length && offset + field_offset + 4 <= ext_length) {
+            *out_seq_number = read_be32(ext_data + offset + field_offset);
+            field_offset += 4;
+        }
+        if ((common_flags & COMMON_DTS_OFFSET) &&
+            field_offset + 4 <= common_length && offset + field_offset + 4 <= ext_length) {
+            *out_dts_offset = (int32_t)read_be32(ext_data + offset + field_offset);
+            field_offset += 4;
+        }
+
         /* Skip rest of common ext by common_length */
         offset += common_length;
     }
@@ -196,7 +298,8 @@ static void parse_ext_headers(const uint8_t* ext_data, uint8_t ext_length,
         *out_video_codec = ext_data[offset];
         *out_video_frame_type = ext_data[offset + 1];
         *out_video_resolution = read_be16(ext_data + offset + 2);
-    } else if (msg_type == 0x02 && offset + 4 <= ext_length) {
+    } else if ((msg_type == MSG_TYPE_AUDIO || msg_type == MSG_TYPE_AUDIO_BATCH) &&
+               offset + 4 <= ext_length) {
         /* Audio ext header: codec(1) + sample_rate(1) + channels(1) + reserved(1) */
         *out_audio_codec = ext_data[offset];
         *out_audio_sample_rate = ext_data[offset + 1];
@@ -214,16 +317,98 @@ int frame_protocol_init(void) {
         return -1;
     }
 
+    frame_protocol_reset_timeline();
     g_initialized = 1;
     return 0;
 }
 
-FrameParseStatus frame_protocol_parse(const uint8_t* data, int size,
-                                      ParsedFrame* result) {
-    if (result == NULL || data == NULL) {
+void frame_protocol_reset_timeline(void) {
+    memset(g_timeline_valid, 0, sizeof(g_timeline_valid));
+}
+
+void frame_protocol_set_sequenced(int enabled) {
+    g_sequenced = enabled;
+}
+
+static void clear_audio_batch(void) {
+    if (g_batch.data != NULL) {
+        free(g_batch.data);
+    }
+    memset(&g_batch, 0, sizeof(g_batch));
+}
+
+/* Take ownership of a batch payload and return its first frame */
+static FrameParseStatus begin_audio_batch(uint8_t* data, uint32_t size, int64_t timestamp,
+                                          int64_t abs_time, uint8_t audio_codec,
+                                          uint8_t audio_sample_rate, uint8_t audio_channels,
+                                          ParsedFrame* result) {
+    clear_audio_batch();
+    g_batch.data = data;
+    g_batch.size = size;
+    g_batch.timestamp = timestamp;
+    g_batch.abs_time_offset = abs_time - timestamp;
+    g_batch.audio_codec = audio_codec;
+    g_batch.audio_sample_rate = audio_sample_rate;
+    g_batch.audio_channels = audio_channels;
+    return frame_protocol_next(result);
+}
+
+FrameParseStatus frame_protocol_next(ParsedFrame* result) {
+    if (result == NULL || g_batch.data == NULL) {
         return FRAME_ERROR;
     }
 
+    const uint8_t* p = g_batch.data + g_batch.offset;
+    const uint8_t* end = g_batch.data + g_batch.size;
+    uint64_t delta = 0;
+    uint64_t frame_size = 0;
+    int n = 0;
+
+    if ((n = read_varint(p, end, &delta)) == 0) {
+        clear_audio_batch();
+        return FRAME_ERROR;
+    }
+    p += n;
+    if ((n = read_varint(p, end, &frame_size)) == 0 || frame_size > (uint64_t)(end - p - n)) {
+        clear_audio_batch();
+        return FRAME_ERROR;
+    }
+    p += n;
+
+    if (result->payload != NULL) {
+        free(result->payload);
+        result->payload = NULL;
+    }
+
+    g_batch.timestamp += (int64_t)delta;
+    memset(result, 0, sizeof(ParsedFrame));
+    result->msg_type = MSG_TYPE_AUDIO;
+    result->timestamp = g_batch.timestamp;
+    result->dts = g_batch.timestamp;
+    result->abs_time = g_batch.timestamp + g_batch.abs_time_offset;
+    result->audio_codec = g_batch.audio_codec;
+    result->audio_sample_rate = g_batch.audio_sample_rate;
+    result->audio_channels = g_batch.audio_channels;
+    result->payload_size = (uint32_t)frame_size;
+
+    if (frame_size > 0) {
+        result->payload = (uint8_t*)malloc((size_t)frame_size);
+        if (result->payload == NULL) {
+            clear_audio_batch();
+            return FRAME_ERROR;
+        }
+        memcpy(result->payload, p, (size_t)frame_size);
+    }
+
+    g_batch.offset = (uint32_t)(p + frame_size - g_batch.data);
+    if (g_batch.offset >= g_batch.size) {
+        clear_audio_batch();
+        return FRAME_COMPLETE;
+    }
+    return FRAME_BATCH_MORE;
+}
+
+static FrameParseStatus parse_header(const uint8_t* data, int size, MessageHeader* h) {
     /* Need at least fixed header */
     if (size < FIXED_HEADER_SIZE) {
         return FRAME_ERROR;
@@ -241,136 +426,285 @@ FrameParseStatus frame_protocol_parse(const uint8_t* data, int size,
         return FRAME_SKIP;
     }
 
-    uint8_t msg_type = data[3];
-    uint8_t flags = data[4];
-    int64_t timestamp = read_be64(data + 5);
+    h->msg_type = data[3];
+    h->flags = data[4];
+    h->timestamp = read_be64(data + 5);
     uint8_t ext_length = data[13];
-    uint32_t payload_length = read_be32(data + 14);
-    /* reserved at data[18..19] */
+    h->payload_length = read_be32(data + 14);
+    /* stream_id at data[18] is routed by the client, reserved at data[19] */
 
     /* Validate total size */
-    if (size < FIXED_HEADER_SIZE + ext_length + (int)payload_length) {
+    if (size < FIXED_HEADER_SIZE + ext_length + (int)h->payload_length) {
         return FRAME_ERROR;
     }
 
-    const uint8_t* ext_data = data + FIXED_HEADER_SIZE;
-    const uint8_t* payload_data = data + FIXED_HEADER_SIZE + ext_length;
+    h->payload = data + FIXED_HEADER_SIZE + ext_length;
 
     /* Parse extension headers */
-    uint16_t frame_id = 0;
-    uint16_t frag_index = 0;
-    uint16_t total_frags = 0;
-    int64_t abs_time = 0;
-    uint8_t video_codec = 0;
-    uint8_t video_frame_type = 0;
-    uint16_t video_resolution = 0;
-    uint8_t audio_codec = 0;
-    uint8_t audio_sample_rate = 0;
-    uint8_t audio_channels = 0;
-
-    parse_ext_headers(ext_data, ext_length, flags, msg_type,
-                      &frame_id, &frag_index, &total_frags,
-                      &abs_time, &video_codec, &video_frame_type,
-                      &video_resolution,
-                      &audio_codec, &audio_sample_rate, &audio_channels);
+    parse_ext_headers(data + FIXED_HEADER_SIZE, ext_length, h->flags, h->msg_type,
+                      &h->frame_id, &h->frag_index, &h->total_frags,
+                      &h->abs_time, &h->seq_number, &h->dts_offset,
+                      &h->video_codec, &h->video_frame_type,
+                      &h->video_resolution,
+                      &h->audio_codec, &h->audio_sample_rate, &h->audio_channels);
+    return FRAME_COMPLETE;
+}
+
+/* Version 2: codec parameters come from the media-offer, the payload runs
+ * to the end of the message */
+static FrameParseStatus parse_compact_header(const uint8_t* data, int size, MessageHeader* h) {
+    if (size < COMPACT_BASE_HEADER_SIZE) {
+        return FRAME_ERROR;
+    }
+
+    const uint8_t* p = data + COMPACT_BASE_HEADER_SIZE;
+    const uint8_t* end = data + size;
+    uint8_t flags = data[1];
+    uint64_t value = 0;
+    int n = 0;
+
+    h->msg_type = data[0] & 0x0F;
+    /* stream_id at data[2] is routed by the client */
+
+    if (flags & COMPACT_FRAGMENT) {
+        if (end - p < 2) {
+            return FRAME_ERROR;
+        }
+        h->flags |= FLAG_FRAGMENT;
+        if (flags & COMPACT_NAL_ALIGNED) {
+            h->flags |= FLAG_NAL_ALIGNED;
+        }
+        h->frame_id = read_be16(p);
+        p += 2;
+        if ((n = read_varint(p, end, &value)) == 0) {
+            return FRAME_ERROR;
+        }
+        h->frag_index = (uint16_t)value;
+        p += n;
+        if ((n = read_varint(p, end, &value)) == 0) {
+            return FRAME_ERROR;
+        }
+        h->total_frags = (uint16_t)value;
+        p += n;
+    }
+
+    /* Timing fields are in the first (or only) fragment */
+    if (!(flags & COMPACT_FRAGMENT) || h->frag_index == 0) {
+        int slot = h->msg_type % MSG_TYPE_SLOTS;
+        int64_t timestamp = 0;
+        if ((n = read_signed_varint(p, end, &timestamp)) == 0) {
+            return FRAME_ERROR;
+        }
+        p += n;
+
+        if (flags & COMPACT_ABSOLUTE) {
+            if ((n = read_varint(p, end, &value)) == 0) {
+                return FRAME_ERROR;
+            }
+            p += n;
+            g_abs_time_offset[slot] = (int64_t)value - timestamp;
+            g_timeline_valid[slot] = 1;
+            if (g_sequenced) {
+                if ((n = read_varint(p, end, &value)) == 0) {
+                    return FRAME_ERROR;
+                }
+                p += n;
+                h->seq_number = (uint32_t)value;
+            }
+        } else if (g_timeline_valid[slot]) {
+            timestamp += g_last_timestamp[slot];
+        } else {
+            /* Input was dropped: wait for the next absolute timestamp */
+            return FRAME_SKIP;
+        }
+        g_last_timestamp[slot] = timestamp;
+        h->timestamp = timestamp;
+        h->abs_time = timestamp + g_abs_time_offset[slot];
+
+        if (flags & COMPACT_DTS_OFFSET) {
+            int64_t dts_offset = 0;
+            if ((n = read_signed_varint(p, end, &dts_offset)) == 0) {
+                return FRAME_ERROR;
+            }
+            p += n;
+            h->dts_offset = (int32_t)dts_offset;
+        }
+        h->video_frame_type = flags >> 4;
+    }
+
+    h->payload = p;
+    h->payload_length = (uint32_t)(end - p);
+    return FRAME_COMPLETE;
+}
+
+/* Fill result from the first fragment's metadata, taking ownership of payload */
+static void fill_fragment_result(const FragmentEntry* entry, uint8_t* payload,
+                                 uint32_t payload_size, ParsedFrame* result) {
+    if (result->payload != NULL) {
+        free(result->payload);
+    }
+
+    result->msg_type = entry->msg_type;
+    result->timestamp = entry->timestamp;
+    result->dts = entry->timestamp - entry->dts_offset;
+    result->abs_time = entry->abs_time;
+    result->seq_number = entry->seq_number;
+    result->video_codec = entry->video_codec;
+    result->video_frame_type = entry->video_frame_type;
+    result->video_resolution = entry->video_resolution;
+    result->audio_codec = entry->audio_codec;
+    result->audio_sample_rate = entry->audio_sample_rate;
+    result->audio_channels = entry->audio_channels;
+    result->payload = payload;
+    result->payload_size = payload_size;
+}
+
+FrameParseStatus frame_protocol_parse(const uint8_t* data, int size,
+                                      ParsedFrame* result) {
+    if (result == NULL || data == NULL || size < 1) {
+        return FRAME_ERROR;
+    }
+
+    MessageHeader header;
+    memset(&header, 0, sizeof(header));
+    FrameParseStatus status = ((data[0] >> 4) == COMPACT_VERSION)
+        ? parse_compact_header(data, size, &header)
+        : parse_header(data, size, &header);
+    if (status != FRAME_COMPLETE) {
+        return status;
+    }
+
+    /* Batched audio frames are returned one at a time */
+    if (header.msg_type == MSG_TYPE_AUDIO_BATCH && !(header.flags & FLAG_FRAGMENT)) {
+        uint8_t* batch = (uint8_t*)malloc(header.payload_length > 0 ? header.payload_length : 1);
+        if (batch == NULL) {
+            return FRAME_ERROR;
+        }
+        memcpy(batch, header.payload, header.payload_length);
+        return begin_audio_batch(batch, header.payload_length, header.timestamp, header.abs_time,
+                                 header.audio_codec, header.audio_sample_rate,
+                                 header.audio_channels, result);
+    }
 
     /* Non-fragmented frame */
-    if (!(flags & FLAG_FRAGMENT)) {
+    if (!(header.flags & FLAG_FRAGMENT)) {
         /* Free previous payload if any */
         if (result->payload != NULL) {
             free(result->payload);
             result->payload = NULL;
         }
 
-        result->msg_type = msg_type;
-        result->timestamp = timestamp;
-        result->abs_time = abs_time;
-        result->video_codec = video_codec;
-        result->video_frame_type = video_frame_type;
-        result->video_resolution = video_resolution;
-        result->audio_codec = audio_codec;
-        result->audio_sample_rate = audio_sample_rate;
-        result->audio_channels = audio_channels;
-        result->payload_size = payload_length;
-
-        if (payload_length > 0) {
-            result->payload = (uint8_t*)malloc(payload_length);
+        result->msg_type = header.msg_type;
+        result->timestamp = header.timestamp;
+        result->dts = header.timestamp - header.dts_offset;
+        result->abs_time = header.abs_time;
+        result->seq_number = header.seq_number;
+        result->video_codec = header.video_codec;
+        result->video_frame_type = header.video_frame_type;
+        result->video_resolution = header.video_resolution;
+        result->audio_codec = header.audio_codec;
+        result->audio_sample_rate = header.audio_sample_rate;
+        result->audio_channels = header.audio_channels;
+        result->payload_size = header.payload_length;
+
+        if (header.payload_length > 0) {
+            result->payload = (uint8_t*)malloc(header.payload_length);
             if (result->payload == NULL) {
                 return FRAME_ERROR;
             }
-            memcpy(result->payload, payload_data, payload_length);
+            memcpy(result->payload, header.payload, header.payload_length);
         }
 
         return FRAME_COMPLETE;
     }
 
     /* Fragmented frame */
-    if (total_frags == 0 || total_frags > MAX_FRAGMENTS) {
+    if (header.total_frags == 0 || header.total_frags > MAX_FRAGMENTS) {
         return FRAME_ERROR;
     }
 
-    FragmentEntry* entry = find_fragment_entry(frame_id);
+    FragmentEntry* entry = find_fragment_entry(header.frame_id);
 
     if (entry == NULL) {
-        entry = alloc_fragment_entry(frame_id, total_frags);
+        entry = alloc_fragment_entry(header.frame_id, header.total_frags);
         if (entry == NULL || entry->fragment_data == NULL) {
             return FRAME_ERROR;
         }
     }
 
     /* Store first fragment metadata */
-    if (frag_index == 0) {
-        entry->msg_type = msg_type;
-        entry->timestamp = timestamp;
-        entry->abs_time = abs_time;
-        entry->video_codec = video_codec;
-        entry->video_frame_type = video_frame_type;
-        entry->video_resolution = video_resolution;
-        entry->audio_codec = audio_codec;
-        entry->audio_sample_rate = audio_sample_rate;
-        entry->audio_channels = audio_channels;
+    if (header.frag_index == 0) {
+        entry->msg_type = header.msg_type;
+        entry->timestamp = header.timestamp;
+        entry->abs_time = header.abs_time;
+        entry->seq_number = header.seq_number;
+        entry->dts_offset = header.dts_offset;
+        entry->video_codec = header.video_codec;
+        entry->video_frame_type = header.video_frame_type;
+        entry->video_resolution = header.video_resolution;
+        entry->audio_codec = header.audio_codec;
+        entry->audio_sample_rate = header.audio_sample_rate;
+        entry->audio_channels = header.audio_channels;
     }
 
     /* Store this fragment's payload */
-    if (frag_index < entry->total_fragments && !entry->fragment_present[frag_index]) {
-        entry->fragment_data[frag_index] = (uint8_t*)malloc(payload_length);
-        if (entry->fragment_data[frag_index] == NULL) {
+    if (header.frag_index < entry->total_fragments && !entry->fragment_present[header.frag_index]) {
+        entry->fragment_data[header.frag_index] = (uint8_t*)malloc(header.payload_length);
+        if (entry->fragment_data[header.frag_index] == NULL) {
             return FRAME_ERROR;
         }
-        memcpy(entry->fragment_data[frag_index], payload_data, payload_length);
-        entry->fragment_sizes[frag_index] = payload_length;
-        entry->fragment_present[frag_index] = 1;
+        memcpy(entry->fragment_data[header.frag_index], header.payload, header.payload_length);
+        entry->fragment_sizes[header.frag_index] = header.payload_length;
+        entry->fragment_present[header.frag_index] = 1;
         entry->received_count++;
+
+        while (entry->contiguous_count < entry->total_fragments &&
+               entry->fragment_present[entry->contiguous_count]) {
+            entry->contiguous_count++;
+        }
+        if ((header.flags & FLAG_NAL_ALIGNED) && header.frag_index < entry->contiguous_count &&
+            header.frag_index >= entry->aligned_count) {
+            entry->aligned_count = header.frag_index + 1;
+        }
+    }
+
+    /* Return whole NAL units received so far, so the caller can decode
+     * slices before the last fragment arrives */
+    if (entry->received_count < entry->total_fragments &&
+        entry->aligned_count > entry->returned_count) {
+        uint32_t slice_size = 0;
+        uint8_t* slice = reassemble_fragments(entry, entry->returned_count,
+                                              entry->aligned_count, &slice_size);
+        if (slice == NULL) {
+            free_fragment_entry(entry);
+            return FRAME_ERROR;
+        }
+        entry->returned_count = entry->aligned_count;
+        fill_fragment_result(entry, slice, slice_size, result);
+        return FRAME_SLICE;
     }
 
     /* Check if all fragments received */
     if (entry->received_count >= entry->total_fragments) {
-        /* Reassemble */
+        /* Reassemble what was not returned as slices */
         uint32_t reassembled_size = 0;
-        uint8_t* reassembled = reassemble_fragments(entry, &reassembled_size);
+        uint8_t* reassembled = reassemble_fragments(entry, entry->returned_count,
+                                                    entry->total_fragments, &reassembled_size);
 
         if (reassembled == NULL) {
             free_fragment_entry(entry);
             return FRAME_ERROR;
         }
 
-        /* Free previous payload if any */
-        if (result->payload != NULL) {
-            free(result->payload);
+        if (entry->msg_type == MSG_TYPE_AUDIO_BATCH) {
+            FrameParseStatus batch_status = begin_audio_batch(
+                reassembled, reassembled_size, entry->timestamp, entry->abs_time,
+                entry->audio_codec, entry->audio_sample_rate, entry->audio_channels, result);
+            free_fragment_entry(entry);
+            return batch_status;
         }
 
-        result->msg_type = entry->msg_type;
-        result->timestamp = entry->timestamp;
-        result->abs_time = entry->abs_time;
-        result->video_codec = entry->video_codec;
-        result->video_frame_type = entry->video_frame_type;
-        result->video_resolution = entry->video_resolution;
-        result->audio_codec = entry->audio_codec;
-        result->audio_sample_rate = entry->audio_sample_rate;
-        result->audio_channels = entry->audio_channels;
-        result->payload = reassembled;
-        result->payload_size = reassembled_size;
-
+        fill_fragment_result(entry, reassembled, reassembled_size, result);
         free_fragment_entry(entry);
         return FRAME_COMPLETE;
     }
@@ -388,6 +722,7 @@ void frame_protocol_destroy(void) {
         free(g_fragments);
         g_fragments = NULL;
     }
+    clear_audio_batch();
     g_initialized = 0;
 }
 
@@ -11,7 +11,9 @@ typedef enum {
     FRAME_COMPLETE          = 0,
     FRAME_FRAGMENT_PENDING  = 1,
     FRAME_ERROR             = -1,
-    FRAME_SKIP              = 2
+    FRAME_SKIP              = 2,
+    FRAME_BATCH_MORE        = 3,  /* frame complete, more frames of a batch follow */
+    FRAME_SLICE             = 4   /* leading NAL units of a fragmented frame */
 } FrameParseStatus;
 
 typedef struct {
@@ -27,6 +29,8 @@ typedef struct {
     uint8_t  audio_codec;       /* AudioCodec: 1=G711A, 2=G711U, 3=G726, 4=AAC */
     uint8_t  audio_sample_rate; /* SampleRateCode: 0=8000, 1=16000, 2=44100, 3=48000 */
     uint8_t  audio_channels;    /* 1=mono, 2=stereo */
+    int64_t  dts;               /* decode timestamp: timestamp - dts_offset (= timestamp if absent) */
+    uint32_t seq_number;        /* latency probe sequence number, 0 if none */
 } ParsedFrame;
 
 /**
@@ -36,10 +40,15 @@ typedef struct {
 int frame_protocol_init(void);
 
 /**
- * Parse a single protocol frame.
+ * Parse a single protocol frame, in protocol version 1 or 2 (compact
+ * headers; told apart by the high nibble of the first byte).
  * For fragmented frames, returns FRAME_FRAGMENT_PENDING until all fragments
  * are received, then returns FRAME_COMPLETE with reassembled payload.
  *
+ * Fragments marked NAL-aligned are returned as they arrive in order: each
+ * FRAME_SLICE result holds the next whole NAL units of the frame, and the
+ * FRAME_COMPLETE result holds only the rest not returned as slices.
+ *
  * @param data    raw protocol frame data
  * @param size    data length
  * @param result  output parsed frame info
@@ -48,6 +57,31 @@ int frame_protocol_init(void);
 FrameParseStatus frame_protocol_parse(const uint8_t* data, int size,
                                       ParsedFrame* result);
 
+/**
+ * Get the next audio frame of an AUDIO_BATCH message. frame_protocol_parse
+ * returns the first frame of a batch with FRAME_BATCH_MORE when more
+ * follow; call this until it returns FRAME_COMPLETE for the last one.
+ * Batched frames are returned as AUDIO (msg_type 0x02) frames.
+ *
+ * @param result  output parsed frame info
+ * @return FRAME_BATCH_MORE, FRAME_COMPLETE, or FRAME_ERROR if no batch is
+ *         pending or it is malformed
+ */
+FrameParseStatus frame_protocol_next(ParsedFrame* result);
+
+/**
+ * Forget the version 2 timestamp state after the caller dropped input;
+ * messages with delta timestamps are skipped until the next absolute one
+ */
+void frame_protocol_reset_timeline(void);
+
+/**
+ * Expect a seq_number after abs_time in version 2 absolute messages; set
+ * when the media-answer asked for latency probes (version 1 messages
+ * describe it in the common ext header)
+ */
+void frame_protocol_set_sequenced(int enabled);
+
 /**
  * Destroy parser and free all internal buffers
  */
@@ -1,8 +1,9 @@
 import { DecoderWrapper } from '../js/decoder/DecoderWrapper.js';
 import { FrameParseStatus } from '../js/decoder/types.js';
-import type { AudioDecoderConfig, WorkerRequest, WorkerResponse } from '../js/decoder/types.js';
+import type { AudioDecoderConfig, ParsedFrameInfo, WorkerRequest, WorkerResponse } from '../js/decoder/types.js';
 
 let decoder: DecoderWrapper | null = null;
+let videoPassthrough = false;
 let statsInterval: number | null = null;
 
 self.onmessage = async (event: MessageEvent<WorkerRequest>) => {
@@ -26,6 +27,12 @@ self.onmessage = async (event: MessageEvent<WorkerRequest>) => {
                 await handleFlush();
                 break;
 
+            case 'resetTimeline':
+                if (decoder) {
+                    decoder.resetProtocolTimeline();
+                }
+                break;
+
             case 'destroy':
                 await handleDestroy();
                 break;
@@ -45,7 +52,8 @@ async function handleInit(config: any): Promise<void> {
 
     decoder = new DecoderWrapper();
     await decoder.init(config);
-    decoder.initProtocol();
+    videoPassthrough = config.videoPassthrough === true;
+    decoder.initProtocol(config.latencyProbes === true);
 
     const response: WorkerResponse = { type: 'ready' };
     self.postMessage(response);
@@ -73,16 +81,23 @@ async function handleInitAudio(config: AudioDecoderConfig): Promise<void> {
     self.postMessage(response);
 }
 
-async function handleDecode(data: Uint8Array, _pts?: number): Promise<void> {
+// receivedAt: local UTC ms the message arrived on the main thread
+async function handleDecode(data: Uint8Array, receivedAt: number = Date.now()): Promise<void> {
     if (!decoder) {
         throw new Error('Decoder not initialized');
     }
 
-    const parsed = decoder.parseFrame(data);
+    let parsed = decoder.parseFrame(data);
     if (!parsed) {
         return;
     }
 
+    // An audio batch yields its frames one at a time
+    while (parsed.status === FrameParseStatus.BATCH_MORE) {
+        await handleParsedFrame(parsed, receivedAt);
+        parsed = decoder.nextFrame();
+    }
+
     if (parsed.status === FrameParseStatus.FRAGMENT_PENDING) {
         return;
     }
@@ -91,9 +106,29 @@ async function handleDecode(data: Uint8Array, _pts?: number): Promise<void> {
         return;
     }
 
-    if (parsed.msgType === 0x01) {
-        // Video frame
-        const frame = await decoder.decode(parsed.payload, parsed.timestamp);
+    await handleParsedFrame(parsed, receivedAt);
+}
+
+async function handleParsedFrame(parsed: ParsedFrameInfo, receivedAt: number): Promise<void> {
+    if (!decoder) {
+        throw new Error('Decoder not initialized');
+    }
+
+    if (parsed.msgType === 0x01 && videoPassthrough) {
+        // fMP4 segment: the main thread appends it to MSE
+        const response: WorkerResponse = {
+            type: 'segment',
+            data: parsed.payload,
+            frameType: parsed.frameType,
+        };
+
+        self.postMessage(response, [parsed.payload.buffer]);
+        postLatencySample(parsed, receivedAt, 0);
+    } else if (parsed.msgType === 0x01) {
+        // Video frame, or its leading slices (output once the last one is in)
+        // Video arrives in decode order; the decoder reorders by PTS
+        const frame = await decoder.decode(parsed.payload, parsed.timestamp, parsed.dts);
+        postLatencySample(parsed, receivedAt, Date.now());
 
         if (frame) {
             const transferableBuffers = [frame.yData.buffer, frame.uData.buffer, frame.vData.buffer];
@@ -120,6 +155,18 @@ async function handleDecode(data: Uint8Array, _pts?: number): Promise<void> {
     }
 }
 
+// A latency probe is timed once its last fragment is in and decoded
+function postLatencySample(parsed: ParsedFrameInfo, receivedAt: number, decodedAt: number): void {
+    if (parsed.seqNumber === 0 || parsed.status === FrameParseStatus.SLICE) {
+        return;
+    }
+    const response: WorkerResponse = {
+        type: 'latency',
+        sample: { seqNumber: parsed.seqNumber, receivedAt, decodedAt },
+    };
+    self.postMessage(response);
+}
+
 async function handleFlush(): Promise<void> {
     if (!decoder) {
         throw new Error('Decoder not initialized');